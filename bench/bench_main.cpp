@@ -0,0 +1,368 @@
+/*
+ * Microbenchmarks for the bridge data path, built against the simulated serial
+ * and SPP APIs in sim/. Each case prints one JSON object per line:
+ *
+ *   bench          which path: command_loop, spp_rx, spp_write, spp_loopback
+ *                  or gap_inquiry
+ *   transport      the SPP transport built in, CB or VFS (see SPPTransport)
+ *   mix, len       payload mix and line/packet/name length
+ *   ops, bytes     lines, packets, writes or inquiry results processed and
+ *                  their total size
+ *   ns_per_byte    host CPU time, including the stand-ins
+ *   sim_us_per_op  device time per operation on the simulated clock. This
+ *                  is where delays, blocking reads and link pacing show up.
+ *   sim_Bps        bytes per simulated second, 0 if the path takes no
+ *                  simulated time
+ *   allocs_per_op, alloc_bytes_per_op  heap use per operation
+ *
+ * Host times are only comparable between runs on the same machine. The
+ * simulated times and allocation counts are deterministic, so they can be
+ * compared between firmware versions with tools/bench_compare.py, and so can
+ * a run of each transport.
+ *
+ * All of these paths are meant to be heap free once running. --no-alloc turns
+ * any allocation inside a measured loop into an abort, so that a debugger shows
+ * where it came from. command_loop only has a stand-in PING; the simulator's
+ * --no-alloc does the same for the bridge's own commands.
+ *
+ *   program [--bytes N] [--filter TEXT] [--no-alloc]
+ */
+#include <Arduino.h>
+#include <SimRuntime.h>
+#include <SimAlloc.h>
+#include <SimBluetooth.h>
+#include <CommandHandler.h>
+#include <BTSPP.h>
+#include <BTGAP.h>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+static const uint8_t peerAddress[6] = {0x10, 0x20, 0x30, 0x40, 0x50, 0x60};
+
+static size_t caseBytes = 64 * 1024;
+static std::string filter;
+static const char *transport = "CB";
+static bool noAlloc = false;
+
+class Measurement {
+public:
+    Measurement(const char *_bench, const char *_mix, int _len) : bench(_bench), mix(_mix), len(_len) {
+        allocStart = sim::allocations();
+        simStart = sim::now();
+        hostStart = std::chrono::steady_clock::now();
+        if (noAlloc) {
+            guard.emplace(bench);
+        }
+    }
+
+    void report(uint64_t ops, uint64_t bytes) {
+        guard.reset();
+        auto hostEnd = std::chrono::steady_clock::now();
+        uint64_t simUs = sim::now() - simStart;
+        sim::AllocCounters allocEnd = sim::allocations();
+        double hostNs = std::chrono::duration<double, std::nano>(hostEnd - hostStart).count();
+
+        if (ops == 0 || bytes == 0) {
+            ops = bytes = 1;
+        }
+        printf("{\"bench\":\"%s\",\"transport\":\"%s\",\"mix\":\"%s\",\"len\":%d,\"ops\":%llu,\"bytes\":%llu,"
+               "\"ns_per_byte\":%.2f,\"sim_us_per_op\":%.2f,\"sim_Bps\":%llu,"
+               "\"allocs_per_op\":%.3f,\"alloc_bytes_per_op\":%.1f}\n",
+               bench, transport, mix, len, (unsigned long long)ops, (unsigned long long)bytes,
+               hostNs / bytes, (double)simUs / ops,
+               (unsigned long long)(simUs ? bytes * 1000000ULL / simUs : 0),
+               (double)(allocEnd.count - allocStart.count) / ops,
+               (double)(allocEnd.bytes - allocStart.bytes) / ops);
+        fflush(stdout);
+    }
+
+private:
+    const char *bench;
+    const char *mix;
+    int len;
+    sim::AllocCounters allocStart;
+    uint64_t simStart;
+    std::chrono::steady_clock::time_point hostStart;
+    std::optional<sim::AllocAssert> guard;
+};
+
+static bool selected(const std::string &name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+// One line of exactly len bytes before the \r\n
+static std::string makeLine(bool command, int len, int seq) {
+    std::string line = command ? "AT+PING=" : "#";
+    line += std::to_string(seq);
+    line.resize(len, command ? '0' : 'x');
+
+    return line;
+}
+
+/*
+ * UART to SPP: CommandHandler::loop over a batch of lines that is already in the
+ * RX buffer. "data" lines go to the send callback, "command" lines are parsed
+ * and dispatched, "mixed" has one command in every ten lines.
+ */
+static void benchCommandLoop() {
+    static const char *mixes[] = {"data", "command", "mixed"};
+    static const int lens[] = {8, 16, 32, 48};
+    static const int BATCH = 32;
+
+    for (const char *mix : mixes) {
+        for (int len : lens) {
+            if (!selected(std::string("command_loop/") + mix)) {
+                continue;
+            }
+
+            CommandHandler handler(Serial1);
+            uint64_t sent = 0;
+            handler.setMode(CommandHandler::PASSTHROUGH);
+            handler.setSendCallback([&sent](uint8_t *data, int len) { sent += len; return true; });
+            handler.setCommandCallback("PING", [](const char *cmd, const char *arg) { return true; });
+
+            std::string batch;
+            for (int i = 0; i < BATCH; i++) {
+                bool command = strcmp(mix, "command") == 0 || (strcmp(mix, "mixed") == 0 && i % 10 == 0);
+                batch += makeLine(command, len, i);
+                batch += "\r\n";
+            }
+
+            uint64_t lines = 0;
+            uint64_t bytes = 0;
+            Measurement measurement("command_loop", mix, len);
+            while (bytes < caseBytes) {
+                Serial1.simInject((const uint8_t*)batch.data(), batch.size());
+                while (Serial1.available() > 0) {
+                    handler.loop();
+                }
+                Serial1.simTakeOutput();
+                lines += BATCH;
+                bytes += batch.size();
+            }
+            measurement.report(lines, bytes);
+        }
+    }
+}
+
+static bool connect(BTSPP &spp, BTGAP &gap) {
+    if (!spp.init() || !sim::waitUntil([&spp] { return spp.inited(); }, 1000000) || !gap.init()) {
+        return false;
+    }
+
+    spp.startConnection((uint8_t*)peerAddress);
+
+    return sim::waitUntil([&spp] { return spp.connectionDone(); }, 5000000);
+}
+
+/*
+ * SPP to UART: one ESP_SPP_DATA_IND_EVT into recvQueue, then BTSPP::read of the
+ * same amount, as the server loop does.
+ */
+static void benchSppRx(BTSPP &spp) {
+    static const int lens[] = {16, 64, 256, 990};
+    uint8_t in[1024];
+    uint8_t out[1024];
+
+    if (!selected("spp_rx/burst")) {
+        return;
+    }
+
+    for (int len : lens) {
+        for (int i = 0; i < len; i++) {
+            in[i] = 'a' + i % 26;
+        }
+
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        Measurement measurement("spp_rx", "burst", len);
+        while (bytes < caseBytes) {
+            sim::peerDeliverNow(in, len);
+            int n = spp.read(out, len);
+            if (n != len || memcmp(in, out, len) != 0) {
+                fprintf(stderr, "spp_rx: read %d of %d bytes\n", n, len);
+                sim::exit(1);
+            }
+            packets++;
+            bytes += len;
+        }
+        measurement.report(packets, bytes);
+    }
+}
+
+/*
+ * BTSPP::write until the peer has everything. "clear" has room for the whole
+ * write, "congested" shrinks the link's buffer so that writes are split and
+ * BTSPP has to send the remainder from the write and congestion events.
+ */
+static void benchSppWrite(BTSPP &spp) {
+    static const char *mixes[] = {"clear", "congested"};
+    static const int lens[] = {16, 64, 128, MAX_STRING_LENGTH - 1};
+    uint8_t buf[MAX_STRING_LENGTH];
+    uint64_t received = 0;
+
+    sim::setPeerReceiver([&received](const uint8_t *data, size_t len, uint64_t timeUs) { received += len; });
+
+    for (const char *mix : mixes) {
+        if (!selected(std::string("spp_write/") + mix)) {
+            continue;
+        }
+        sim::bluetooth().txBufferBytes = strcmp(mix, "congested") == 0 ? 48 : 2048;
+
+        for (int len : lens) {
+            for (int i = 0; i < len; i++) {
+                buf[i] = 'A' + i % 26;
+            }
+
+            uint64_t writes = 0;
+            uint64_t bytes = 0;
+            received = 0;
+            Measurement measurement("spp_write", mix, len);
+            while (bytes < caseBytes) {
+                if (!spp.write(buf, len) || spp.isError()) {
+                    fprintf(stderr, "spp_write: %s\n", spp.getErrMessage());
+                    sim::exit(1);
+                }
+                writes++;
+                bytes += len;
+                if (!sim::waitUntil([&received, bytes] { return received >= bytes; }, 10000000)) {
+                    fprintf(stderr, "spp_write: stalled after %llu of %llu bytes\n",
+                            (unsigned long long)received, (unsigned long long)bytes);
+                    sim::exit(1);
+                }
+            }
+            measurement.report(writes, bytes);
+        }
+    }
+
+    sim::setPeerReceiver(nullptr);
+}
+
+/*
+ * SPP to SPP: AT+LOOPBACK reflecting one ESP_SPP_DATA_IND_EVT at a time until
+ * the peer has it back. Turning it on is measured too: what it reflects from
+ * comes with the transport, so it doesn't allocate either.
+ */
+static void benchSppLoopback(BTSPP &spp) {
+    static const int lens[] = {16, 64, 256, 990};
+    uint8_t in[1024];
+    uint64_t received = 0;
+
+    if (!selected("spp_loopback/reflect")) {
+        return;
+    }
+    sim::setPeerReceiver([&received](const uint8_t *data, size_t len, uint64_t timeUs) { received += len; });
+
+    for (int len : lens) {
+        for (int i = 0; i < len; i++) {
+            in[i] = 'a' + i % 26;
+        }
+
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        received = 0;
+        Measurement measurement("spp_loopback", "reflect", len);
+        if (!spp.setLoopback(true)) {
+            fprintf(stderr, "spp_loopback: %s\n", spp.getErrMessage());
+            sim::exit(1);
+        }
+        while (bytes < caseBytes) {
+            sim::peerDeliverNow(in, len);
+            packets++;
+            bytes += len;
+            if (!sim::waitUntil([&received, bytes] { return received >= bytes; }, 10000000)) {
+                fprintf(stderr, "spp_loopback: stalled after %llu of %llu bytes\n",
+                        (unsigned long long)received, (unsigned long long)bytes);
+                sim::exit(1);
+            }
+        }
+        spp.setLoopback(false);
+        measurement.report(packets, bytes);
+    }
+
+    sim::setPeerReceiver(nullptr);
+}
+
+/*
+ * ESP_BT_GAP_DISC_RES_EVT into BTGAP's peers table, then BTGAP::getAddress of
+ * the name, as connecting by name does. Twice as many devices answer as the
+ * table holds, so it keeps wrapping. "bdname" has the name as a property of
+ * its own, "eir" in the EIR data.
+ */
+static void benchGapInquiry(BTGAP &gap) {
+    static const char *mixes[] = {"bdname", "eir"};
+    static const int lens[] = {8, 32};
+    static const int devices = 2 * BTGAP_MAX_PEERS;
+    static char names[devices][ESP_BT_GAP_MAX_BDNAME_LEN + 1];
+    uint8_t address[ESP_BD_ADDR_LEN] = {0x20, 0x30, 0x40, 0x50, 0x60, 0x00};
+
+    for (const char *mix : mixes) {
+        if (!selected(std::string("gap_inquiry/") + mix)) {
+            continue;
+        }
+
+        for (int len : lens) {
+            for (int i = 0; i < devices; i++) {
+                int n = snprintf(names[i], sizeof(names[i]), "%02d:", i);
+                memset(&names[i][n], 'a' + i % 26, len - n);
+                names[i][len] = 0;
+            }
+
+            uint64_t results = 0;
+            uint64_t bytes = 0;
+            Measurement measurement("gap_inquiry", mix, len);
+            while (bytes < caseBytes) {
+                int device = results % devices;
+                address[5] = device;
+                sim::inquiryResultNow(names[device], address, strcmp(mix, "eir") == 0);
+                uint8_t *found = gap.getAddress(names[device]);
+                if (found == nullptr || memcmp(found, address, ESP_BD_ADDR_LEN) != 0) {
+                    fprintf(stderr, "gap_inquiry: %s not found\n", names[device]);
+                    sim::exit(1);
+                }
+                results++;
+                bytes += len;
+            }
+            measurement.report(results, bytes);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    sim::init();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bytes" && i + 1 < argc) {
+            caseBytes = atol(argv[++i]);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--no-alloc") {
+            noAlloc = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--bytes N] [--filter TEXT] [--no-alloc]\n", argv[0]);
+            sim::exit(1);
+        }
+    }
+
+    Serial1.setRxBufferSize(4096);
+    Serial1.begin(921600);
+    benchCommandLoop();
+
+    static BTSPP spp("benchbridge", 1024);
+    static BTGAP gap;
+    transport = spp.transportName();
+    sim::setPeer("Time Flies", peerAddress);
+    if (!connect(spp, gap)) {
+        fprintf(stderr, "Could not connect to the simulated peer\n");
+        sim::exit(1);
+    }
+    benchSppRx(spp);
+    benchSppWrite(spp);
+    benchSppLoopback(spp);
+    benchGapInquiry(gap);
+
+    sim::exit(0);
+}
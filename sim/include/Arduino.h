@@ -0,0 +1,57 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <esp_err.h>
+#include <esp32-hal-log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <Print.h>
+#include <WString.h>
+#include <HardwareSerial.h>
+
+// newlib has it, glibc only from 2.38
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+static inline size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+
+    return len;
+}
+#endif
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+
+// Reading the clock costs a microsecond of simulated CPU time, so that polling
+// loops make progress.
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+// Host side: drive an input pin (pins with a pull-up read HIGH until driven)
+void simSetPin(uint8_t pin, int value);
+int simGetPin(uint8_t pin);
+
+#endif
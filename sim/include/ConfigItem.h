@@ -0,0 +1,39 @@
+#ifndef SIM_CONFIG_ITEM_H
+#define SIM_CONFIG_ITEM_H
+
+#include <Arduino.h>
+
+/*
+ * The parts of ESPConfig's config items that ConfigCommitter uses. put()
+ * copies the value into the EEPROM's RAM image, which EEPROMConfig::commit()
+ * writes to flash, as on the device.
+ */
+class BaseConfigItem {
+public:
+    BaseConfigItem(const char *name, int maxSize) : name(name), maxSize(maxSize) {}
+    virtual ~BaseConfigItem() {}
+
+    virtual String toString(const char **excludes = 0) const = 0;
+    virtual void put() const;
+
+    const char *name;
+    int maxSize;
+};
+
+template <class T>
+class ConfigItem : public BaseConfigItem {
+public:
+    ConfigItem(const char *name, int maxSize, const T &value) : BaseConfigItem(name, maxSize), value(value) {}
+
+    T value;
+};
+
+class StringConfigItem : public ConfigItem<String> {
+public:
+    StringConfigItem(const char *name, int maxSize, const char *value) : ConfigItem(name, maxSize, String(value)) {}
+
+    String toString(const char **excludes = 0) const override { return value; }
+    StringConfigItem &operator=(const char *val) { value = String(val); return *this; }
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef SIM_EEPROM_CONFIG_H
+#define SIM_EEPROM_CONFIG_H
+
+#include <ConfigItem.h>
+
+// The EEPROM's size, all of which a commit erases and writes
+#define SIM_EEPROM_SIZE 4096
+
+/*
+ * ESPConfig's EEPROM-backed store, without the item tree. A commit burns the
+ * simulated flash time of writing the whole EEPROM.
+ */
+class EEPROMConfig {
+public:
+    void commit();
+
+    // Host side: commits so far, and an item's value as of the last one
+    int commits();
+    String committed(const char *name);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SIM_FS_H
+#define SIM_FS_H
+
+#include <Stream.h>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class FileImpl;
+typedef std::shared_ptr<FileImpl> FileImplPtr;
+
+// Subset of the Arduino fs::File that the bridge uses
+class File : public Stream {
+public:
+    File(FileImplPtr p = FileImplPtr()) : impl(p) {}
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int peek() override;
+    void flush() override;
+    size_t read(uint8_t *buf, size_t size);
+    bool seek(uint32_t pos, SeekMode mode);
+    bool seek(uint32_t pos) { return seek(pos, SeekSet); }
+    size_t position() const;
+    size_t size() const;
+    void close();
+    operator bool() const;
+    const char *path() const;
+    const char *name() const;
+    bool isDirectory();
+    File openNextFile(const char *mode = FILE_READ);
+    void rewindDirectory();
+
+private:
+    FileImplPtr impl;
+};
+
+class FS {
+public:
+    File open(const char *path, const char *mode = FILE_READ, const bool create = false);
+    File open(const std::string &path, const char *mode = FILE_READ, const bool create = false) {
+        return open(path.c_str(), mode, create);
+    }
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool mkdir(const char *path);
+    bool rmdir(const char *path);
+};
+
+}
+
+using fs::FS;
+using fs::File;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef SIM_HARDWARE_SERIAL_H
+#define SIM_HARDWARE_SERIAL_H
+
+#include <Stream.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define SERIAL_8N1 0x800001c
+
+/*
+ * Simulated UART. Output drains at the configured baud rate through a FIFO of
+ * the same size as the ESP32's, so write() and flush() block for as long as
+ * they would on the device. The host end injects input with simReceive(), which
+ * arrives at line rate, or simInject(), which is there at once, and collects
+ * output that has been transmitted with simTakeOutput().
+ */
+class HardwareSerial : public Stream {
+    // Fixed size, so that the RX path doesn't allocate as it runs
+    class ByteRing {
+    public:
+        void setCapacity(size_t capacity) {
+            std::vector<uint8_t> data(capacity);
+            size_t n = 0;
+            while (n < capacity && !empty()) {
+                data[n++] = front();
+                pop_front();
+            }
+            buf.swap(data);
+            head = 0;
+            count = n;
+        }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        uint8_t front() const { return buf[head]; }
+        void pop_front() { head = (head + 1) % buf.size(); count--; }
+        void push_back(uint8_t c) { buf[(head + count++) % buf.size()] = c; }
+
+    private:
+        std::vector<uint8_t> buf;
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+public:
+    HardwareSerial(int uartNum);
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+    void end() {}
+    void setDebugOutput(bool enable) {}
+    size_t setRxBufferSize(size_t size);
+    size_t setTxBufferSize(size_t size);
+
+    int available() override;
+    int peek() override;
+    int read() override;
+    size_t read(uint8_t *buffer, size_t size);
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int availableForWrite() override;
+    void flush() override;
+
+    // Host side. Returns the time (us) at which the last byte will have arrived.
+    uint64_t simReceive(const uint8_t *data, size_t len);
+    uint64_t simReceive(const std::string &data) { return simReceive((const uint8_t*)data.data(), data.size()); }
+    // Host side. Puts data straight into the RX buffer, as if it arrived in no time.
+    size_t simInject(const uint8_t *data, size_t len);
+    std::string simTakeOutput();
+    uint64_t simRxOverflows() { return rxOverflows; }
+
+private:
+    int uartNum;
+    unsigned long baud = 115200;
+    size_t rxBufferSize = 256;
+    size_t txBufferSize = 0;        // Arduino default: only the hardware FIFO
+    ByteRing rxBuffer;
+    uint64_t rxNextNs = 0;          // When the last byte injected by the host will have arrived
+    uint64_t rxOverflows = 0;
+    uint64_t txFreeNs = 0;          // When everything written so far will have left the FIFO
+    std::deque<std::pair<uint64_t, uint8_t>> txLine;  // Bytes on the wire and when they arrive
+
+    uint64_t byteNs() { return 10000000000ULL / baud; }
+    size_t txQueued();
+    size_t txCapacity() { return 128 + txBufferSize; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+#endif
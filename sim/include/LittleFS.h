@@ -0,0 +1,23 @@
+#ifndef SIM_LITTLEFS_H
+#define SIM_LITTLEFS_H
+
+#include <FS.h>
+
+namespace fs {
+
+// Kept in memory, so it starts empty on every run unless simulated restarts keep it
+class LittleFSFS : public FS {
+public:
+    bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10,
+               const char *partitionLabel = "spiffs");
+    void end();
+    bool format();
+    size_t totalBytes();
+    size_t usedBytes();
+};
+
+}
+
+extern fs::LittleFSFS LittleFS;
+
+#endif
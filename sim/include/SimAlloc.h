@@ -0,0 +1,43 @@
+#ifndef SIM_ALLOC_H
+#define SIM_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Counts heap allocations made through operator new (std::string,
+ * std::function, containers) and Print::printf's fallback buffer, so the
+ * simulator and benchmarks can report allocations per operation.
+ */
+namespace sim {
+
+typedef struct {
+    uint64_t count;
+    uint64_t bytes;
+} AllocCounters;
+
+AllocCounters allocations();
+
+// For allocations that don't go through operator new
+void countAllocation(size_t size);
+
+// Allocations made by the stand-ins themselves (event queue, copies of data in
+// flight on the simulated link) aren't counted while one of these is in scope
+class AllocPause {
+public:
+    AllocPause();
+    ~AllocPause();
+};
+
+// A counted allocation while one of these is in scope is a bug in a path that
+// should be heap free: it names the scope and aborts, so a debugger or core
+// dump shows where it came from
+class AllocAssert {
+public:
+    AllocAssert(const char *what);
+    ~AllocAssert();
+};
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef SIM_BLUETOOTH_H
+#define SIM_BLUETOOTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+
+/*
+ * The simulated controller, Bluedroid GAP/SPP stack and the remote SPP device.
+ * Timings and link capacity are configurable so that the same scenario can be
+ * run against a fast, a slow or a congested link.
+ */
+namespace sim {
+
+typedef struct {
+    // Stack bring-up, as blocking time in the calling task
+    uint64_t controllerStartUs = 120000;
+    uint64_t bluedroidInitUs = 30000;
+    uint64_t bluedroidEnableUs = 60000;
+    uint64_t sppInitUs = 5000;      // esp_spp_init until ESP_SPP_INIT_EVT
+
+    // Connection set-up
+    uint64_t inquiryResultUs = 600000;  // Start of inquiry until the peer answers
+    uint64_t inquiryUs = 4000000;       // Start of inquiry until it stops
+    uint64_t sdpUs = 180000;
+    uint64_t pinReqUs = 60000;          // esp_spp_connect until the PIN request
+    uint64_t authUs = 40000;            // PIN reply until authentication completes
+    uint64_t openUs = 50000;            // Authentication until ESP_SPP_OPEN_EVT
+    uint64_t closeUs = 20000;
+    uint64_t pageTimeoutUs = 5120000;   // Service discovery on a device that doesn't answer
+
+    // Data
+    uint64_t latencyUs = 6000;          // One way, per packet
+    uint32_t bytesPerSec = 160000;      // Each direction
+    uint32_t txBufferBytes = 2048;      // Written but unsent bytes before the link reports congestion
+    uint32_t mtu = 990;                 // Largest ESP_SPP_DATA_IND_EVT
+    uint64_t writeEvtUs = 150;          // esp_spp_write until ESP_SPP_WRITE_EVT
+    uint32_t failWriteEvery = 0;        // Every nth esp_spp_write is lost, with a failed ESP_SPP_WRITE_EVT
+
+    // Link quality. A write is sent again until it gets through whole, so
+    // with bit errors large writes cost more air time per byte than small ones.
+    uint32_t bitErrorPpm = 0;
+    uint64_t writeOverheadUs = 0;       // Air time per write besides the data: headers, slots, acknowledgement
+    int8_t rssiDelta = 0;               // What ESP_BT_GAP_READ_RSSI_DELTA_EVT reports, 0 in the golden range
+
+    // Power. With esp_bt_gap_set_qos above ESP_BT_GAP_TPOLL_DFT, data from the
+    // peer waits for the next poll to start, counting from the last thing the
+    // device sent. At the default the latency above covers it.
+    uint64_t lmpUs = 3750;              // An LMP exchange, e.g. until ESP_BT_GAP_QOS_CMPL_EVT
+} BluetoothConfig;
+
+typedef enum {
+    PEER_SINK,      // Swallow everything
+    PEER_ECHO,      // Send everything straight back
+} PeerMode;
+
+typedef struct {
+    uint64_t bytesToPeer;
+    uint64_t bytesFromPeer;
+    uint64_t writes;
+    uint64_t partialWrites;     // Writes that only took part of the data
+    uint64_t congestions;
+} LinkCounters;
+
+BluetoothConfig &bluetooth();
+
+// There is one remote device. addr is in esp_bd_addr_t byte order.
+void setPeer(const char *name, const uint8_t addr[6], const char *pin = "1234");
+void setPeerMode(PeerMode mode);
+
+// Data from the peer to the device under test, paced by the link
+void peerSend(const uint8_t *data, size_t len);
+
+// Data from the peer delivered as one ESP_SPP_DATA_IND_EVT right now, without
+// link pacing. For benchmarks of the receive path.
+void peerDeliverNow(const uint8_t *data, size_t len);
+
+// One ESP_BT_GAP_DISC_RES_EVT right now from a device other than the peer,
+// with its name as a BDNAME property or in EIR data. For benchmarks of
+// the inquiry path.
+void inquiryResultNow(const char *name, const uint8_t addr[6], bool eir);
+
+// Called as data arrives at the peer, with the arrival time
+void setPeerReceiver(std::function<void(const uint8_t *data, size_t len, uint64_t timeUs)> receiver);
+
+// Whether the link is up, as the peer sees it
+bool peerConnected();
+
+// The remote end drops the link
+void peerDisconnect();
+
+// Out of range, the peer drops the link and doesn't answer inquiries or pages
+void setPeerInRange(bool inRange);
+
+const LinkCounters &linkCounters();
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef SIM_FLASH_H
+#define SIM_FLASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+ * The simulated LittleFS partition, and the two OTA app partitions. File data
+ * and images are kept in memory; reads and writes burn simulated CPU time in
+ * the calling task, as flash access does on the device, where the cache is off
+ * while the flash is busy.
+ */
+namespace sim {
+
+typedef struct {
+    size_t partitionBytes = 1441792;    // spiffs partition in default.csv
+    uint32_t readBytesPerSec = 2000000;
+    uint32_t writeBytesPerSec = 100000;
+    bool failMount = false;             // LittleFS.begin() fails, as with a missing partition
+    bool pendingVerify = false;         // The running app was just updated and isn't confirmed yet
+} FlashConfig;
+
+FlashConfig &flash();
+
+// What esp_ota_write() wrote to app partition 0 or 1, and which one boots next
+const std::vector<uint8_t> &otaImage(int slot);
+int otaBootSlot();
+
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SIM_RUNTIME_H
+#define SIM_RUNTIME_H
+
+#include <stdint.h>
+#include <functional>
+
+/*
+ * Virtual-time scheduler behind the simulated FreeRTOS, Arduino and Bluetooth
+ * APIs. Tasks are real threads, but only one of them runs at a time and they
+ * hand over in a fixed round-robin order. Time only moves when every task is
+ * blocked, or when a task burns simulated CPU time, so a run with the same
+ * inputs always produces the same timings.
+ *
+ * Stack events (Bluetooth callbacks, UART bytes, the simulated peer) are
+ * scheduled on the same clock and run in the context of whichever task
+ * advanced time past them, as the Bluetooth task would on the real thing.
+ */
+namespace sim {
+
+typedef void *TaskRef;
+
+// Register the calling thread as the first task. Must be called before anything else.
+void init();
+
+// Virtual time in microseconds
+uint64_t now();
+
+// Burn CPU time. Lets other tasks run once the current time slice is used up.
+void consume(uint64_t us);
+
+// Let another runnable task have the CPU
+void yield();
+
+// Block until ready() returns true or timeoutUs passes. UINT64_MAX waits for ever.
+bool waitUntil(std::function<bool()> ready, uint64_t timeoutUs);
+
+// Block for a while
+void sleep(uint64_t us);
+
+// Run fn at now() + delayUs
+void schedule(uint64_t delayUs, std::function<void()> fn);
+
+TaskRef spawn(const char *name, std::function<void()> fn);
+TaskRef currentTask();
+void endTask(TaskRef task);     // A task may end itself, in which case this doesn't return
+int taskCount();
+
+// True while a scheduled event is running
+bool inEvent();
+
+// Flush stdio and terminate the process, leaving blocked task threads behind
+[[noreturn]] void exit(int status);
+
+}
+
+#endif
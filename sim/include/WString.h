@@ -0,0 +1,20 @@
+#ifndef SIM_WSTRING_H
+#define SIM_WSTRING_H
+
+#include <string>
+
+// Arduino's String, as much of it as the bridge and its config items use
+class String {
+public:
+    String(const char *s = "") : s(s ? s : "") {}
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool operator==(const String &other) const { return s == other.s; }
+    bool operator!=(const String &other) const { return s != other.s; }
+
+private:
+    std::string s;
+};
+
+#endif
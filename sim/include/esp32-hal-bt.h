@@ -0,0 +1,16 @@
+#ifndef SIM_ESP32_HAL_BT_H
+#define SIM_ESP32_HAL_BT_H
+
+typedef enum {
+    BT_MODE_IDLE,
+    BT_MODE_BLE,
+    BT_MODE_CLASSIC_BT,
+    BT_MODE_BTDM
+} bt_mode;
+
+bool btStarted();
+bool btStart();
+bool btStartMode(bt_mode mode);
+bool btStop();
+
+#endif
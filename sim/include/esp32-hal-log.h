@@ -0,0 +1,12 @@
+#ifndef SIM_ESP32_HAL_LOG_H
+#define SIM_ESP32_HAL_LOG_H
+
+#include <esp_log.h>
+
+#define log_e(format, ...) esp_log_write(ESP_LOG_ERROR, "ARDUINO", format, ##__VA_ARGS__)
+#define log_w(format, ...) esp_log_write(ESP_LOG_WARN, "ARDUINO", format, ##__VA_ARGS__)
+#define log_i(format, ...) esp_log_write(ESP_LOG_INFO, "ARDUINO", format, ##__VA_ARGS__)
+#define log_d(format, ...) esp_log_write(ESP_LOG_DEBUG, "ARDUINO", format, ##__VA_ARGS__)
+#define log_v(format, ...) esp_log_write(ESP_LOG_VERBOSE, "ARDUINO", format, ##__VA_ARGS__)
+
+#endif
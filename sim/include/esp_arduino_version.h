@@ -0,0 +1,8 @@
+#ifndef SIM_ESP_ARDUINO_VERSION_H
+#define SIM_ESP_ARDUINO_VERSION_H
+
+#define ESP_ARDUINO_VERSION_MAJOR 3
+#define ESP_ARDUINO_VERSION_MINOR 0
+#define ESP_ARDUINO_VERSION_PATCH 0
+
+#endif
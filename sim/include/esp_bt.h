@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_BT_H
+#define SIM_ESP_BT_H
+
+#include <esp_err.h>
+#include <esp_bt_defs.h>
+
+esp_err_t esp_bt_controller_disable();
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SIM_ESP_BT_DEFS_H
+#define SIM_ESP_BT_DEFS_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#define ESP_BD_ADDR_LEN 6
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL,
+    ESP_BT_STATUS_NOT_READY,
+    ESP_BT_STATUS_NOMEM,
+    ESP_BT_STATUS_BUSY,
+    ESP_BT_STATUS_DONE,
+    ESP_BT_STATUS_UNSUPPORTED,
+    ESP_BT_STATUS_PARM_INVALID,
+    ESP_BT_STATUS_UNHANDLED,
+    ESP_BT_STATUS_AUTH_FAILURE,
+    ESP_BT_STATUS_RMT_DEV_DOWN,
+    ESP_BT_STATUS_AUTH_REJECTED,
+} esp_bt_status_t;
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SIM_ESP_BT_DEVICE_H
+#define SIM_ESP_BT_DEVICE_H
+
+#include <esp_err.h>
+#include <esp_bt_defs.h>
+
+const uint8_t *esp_bt_dev_get_address();
+esp_err_t esp_bt_dev_set_device_name(const char *name);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef SIM_ESP_IDF_VERSION_H
+#define SIM_ESP_IDF_VERSION_H
+
+// The simulator follows the ESP-IDF 5 / Arduino 3 APIs
+#define ESP_IDF_VERSION_MAJOR 5
+#define ESP_IDF_VERSION_MINOR 1
+#define ESP_IDF_VERSION_PATCH 0
+
+#endif
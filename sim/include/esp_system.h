@@ -0,0 +1,12 @@
+#ifndef SIM_ESP_SYSTEM_H
+#define SIM_ESP_SYSTEM_H
+
+#include <stdint.h>
+#include <esp_err.h>
+
+uint32_t esp_get_free_heap_size();
+uint32_t esp_get_minimum_free_heap_size();
+void esp_restart();
+uint32_t esp_random();
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SIM_FREERTOS_H
+#define SIM_FREERTOS_H
+
+/*
+ * Stand-in for the ESP-IDF FreeRTOS API on top of the simulator scheduler.
+ * Priorities and core affinity are accepted but ignored: tasks share one
+ * simulated CPU in round-robin order. Critical sections are no-ops because
+ * only one task ever runs at a time.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+typedef struct SimQueue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL pdFALSE
+#define errQUEUE_EMPTY pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(((uint64_t)(ticks) * 1000) / configTICK_RATE_HZ))
+
+#define tskIDLE_PRIORITY 0
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY 0x7fffffff
+
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define taskENTER_CRITICAL(mux) ((void)(mux))
+#define taskEXIT_CRITICAL(mux) ((void)(mux))
+#define spinlock_initialize(mux) ((void)(mux))
+
+BaseType_t xPortGetCoreID();
+
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#endif
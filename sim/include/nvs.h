@@ -0,0 +1,6 @@
+#ifndef SIM_NVS_H
+#define SIM_NVS_H
+
+#include <esp_err.h>
+
+#endif
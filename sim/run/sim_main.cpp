@@ -0,0 +1,1189 @@
+/*
+ * Runs the unmodified bridge against the simulated stack and a loopback peer,
+ * drives it over the simulated UART like a host would, and prints the results
+ * as key=value lines. Everything runs on simulated time, so the numbers are
+ * the same on every run and every machine.
+ *
+ *   program [--lines N] [--len L] [--rx-lines N] [--rx-mode M] [--baud B]
+ *       [--latency-us U] [--rate BYTES_PER_SEC] [--txbuf BYTES]
+ *       [--bench SIZE,SECONDS,WINDOW] [--loopback BYTES] [--spool LINES]
+ *       [--compress LINES] [--reliable LINES] [--lanes LINES] [--file BYTES]
+ *       [--ota BYTES] [--marginal BYTES] [--bond] [--idle] [--config] [--no-alloc]
+ *       [--verbose]
+ *
+ * --rx-mode is the AT+SENDRX mode for the peer to host test, 1 to 5. With 3
+ *   the lines end in \n, with 4 and 5 the frames are checked and timed.
+ * --bench also runs AT+BENCH against a peer that echoes everything back.
+ * --loopback puts the bridge in AT+LOOPBACK mode and has the peer send BYTES.
+ * --spool takes the peer out of range, sends LINES lines from the host, and
+ *   brings the peer back to check that they all arrive, in order. Then again
+ *   with the flash full part way through, to check only whole lines arrive.
+ * --compress turns on AT+COMPRESS against a peer that runs the codec as well,
+ *   and sends LINES lines of telemetry each way.
+ * --reliable turns on AT+RELIABLE against a peer that runs it as well, and
+ *   sends LINES lines each way while every 5th write fails and, half way,
+ *   the peer goes out of range for a while.
+ * --lanes streams LINES lines of bulk data over a link slower than the UART,
+ *   with every 10th line flagged for the urgent lane, and compares how long
+ *   each kind took to reach the peer.
+ * --file sends a file of BYTES from LittleFS with AT+SENDFILE, then has the
+ *   peer send it back with AT+RECVFILE and compares.
+ * --ota has the peer send a firmware image of BYTES for AT+OTA, once intact
+ *   and once with a bad CRC, and checks what ended up in the app partition.
+ *   The firmware it runs starts out on probation, as after an update.
+ * --marginal sends a file of BYTES with AT+SENDFILE over a link at the edge
+ *   of its range, where every write costs a slot's overhead and bit errors
+ *   make long ones go again, once with AT+TUNE off and once with it on.
+ * --bond gives the peer a PIN of its own and reconnects three times: paired
+ *   with the PIN set for it by AT+PIN, with the link key that left, and, with
+ *   the bond removed, paired again by answering the PIN request.
+ * --idle has a line go each way after a pause, with AT+IDLE off, with the
+ *   poll slowed down and with the link dropped, and compares how long each
+ *   took to arrive.
+ * --config persists the names set by AT+NAME and AT+RNAME with the
+ *   ConfigCommitter, as the firmware does, and checks that a burst of changes
+ *   is one commit, that changes undone before it are none, and that changes
+ *   that never stop are committed anyway.
+ * --no-alloc runs the bridge's own commands, each under sim::AllocAssert, so
+ *   that any heap use while the radio and UART stages handle one, or send
+ *   its response, aborts and names the command.
+ */
+#include <Arduino.h>
+#include <SimRuntime.h>
+#include <SimBluetooth.h>
+#include <SimFlash.h>
+#include <SimAlloc.h>
+#include <BTSPPServer.h>
+#include <BridgeStats.h>
+#include <LinkCodec.h>
+#include <ReliableLink.h>
+#include <LittleFS.h>
+#include <ConfigCommitter.h>
+#include <EEPROMConfig.h>
+#include <esp_rom_crc.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define RXD 17
+#define TXD 16
+
+static const uint8_t peerAddress[6] = {0x10, 0x20, 0x30, 0x40, 0x50, 0x60};
+static bool verbose = false;
+
+class Host {
+public:
+    Host(HardwareSerial &_serial) : serial(_serial) {}
+
+    uint64_t send(const std::string &line) {
+        return serial.simReceive(line + "\r\n");
+    }
+
+    // Next line from the bridge without the line ending, or false on timeout
+    bool readLine(std::string &line, uint64_t timeoutUs) {
+        uint64_t deadline = sim::now() + timeoutUs;
+        while (true) {
+            pending += serial.simTakeOutput();
+            size_t eol = pending.find('\n');
+            if (eol != std::string::npos) {
+                line = pending.substr(0, eol);
+                pending.erase(0, eol + 1);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (verbose) {
+                    printf("# < %s\n", line.c_str());
+                }
+                return true;
+            }
+            if (sim::now() >= deadline) {
+                return false;
+            }
+            sim::sleep(500);
+        }
+    }
+
+    // Unsolicited result codes seen by command(), see AT+URC
+    std::vector<std::string> urcs;
+
+    // Send a command and collect its response lines up to OK, false on FAILED or timeout.
+    // Unsolicited result codes go to urcs instead.
+    bool command(const std::string &cmd, std::vector<std::string> *response = nullptr, uint64_t timeoutUs = 2000000) {
+        std::string line;
+
+        if (verbose) {
+            printf("# > %s\n", cmd.c_str());
+        }
+        send(cmd);
+        while (readLine(line, timeoutUs)) {
+            if (line == "OK") {
+                return true;
+            }
+            if (line.compare(0, 6, "FAILED") == 0) {
+                return false;
+            }
+            if (line[0] == '+') {
+                urcs.push_back(line);
+                continue;
+            }
+            if (response) {
+                response->push_back(line);
+            }
+        }
+
+        return false;
+    }
+
+    std::string takeRaw() {
+        std::string out = pending + serial.simTakeOutput();
+        pending.clear();
+        return out;
+    }
+
+private:
+    HardwareSerial &serial;
+    std::string pending;
+};
+
+static uint64_t percentile(std::vector<uint64_t> values, int pct) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = (values.size() * pct + 99) / 100;
+    return values[index > 0 ? index - 1 : 0];
+}
+
+static int intArg(int &i, int argc, char **argv) {
+    if (i + 1 >= argc) {
+        fprintf(stderr, "%s needs a value\n", argv[i]);
+        sim::exit(1);
+    }
+    return atoi(argv[++i]);
+}
+
+int main(int argc, char **argv) {
+    int lines = 200;
+    int lineLen = 40;
+    int rxLines = 100;
+    int rxMode = 1;
+    int baud = 38400;
+    std::string benchArgs;
+    int loopbackBytes = 0;
+    int spoolLines = 0;
+    int compressLines = 0;
+    int reliableLines = 0;
+    int laneLines = 0;
+    int fileBytes = 0;
+    int otaBytes = 0;
+    int marginalBytes = 0;
+    bool bond = false;
+    bool idle = false;
+    bool config = false;
+    bool noAlloc = false;
+
+    sim::init();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--lines") {
+            lines = intArg(i, argc, argv);
+        } else if (arg == "--len") {
+            lineLen = intArg(i, argc, argv);
+        } else if (arg == "--rx-lines") {
+            rxLines = intArg(i, argc, argv);
+        } else if (arg == "--rx-mode") {
+            rxMode = intArg(i, argc, argv);
+        } else if (arg == "--baud") {
+            baud = intArg(i, argc, argv);
+        } else if (arg == "--latency-us") {
+            sim::bluetooth().latencyUs = intArg(i, argc, argv);
+        } else if (arg == "--rate") {
+            sim::bluetooth().bytesPerSec = intArg(i, argc, argv);
+        } else if (arg == "--txbuf") {
+            sim::bluetooth().txBufferBytes = intArg(i, argc, argv);
+        } else if (arg == "--bench" && i + 1 < argc) {
+            benchArgs = argv[++i];
+        } else if (arg == "--loopback") {
+            loopbackBytes = intArg(i, argc, argv);
+        } else if (arg == "--spool") {
+            spoolLines = intArg(i, argc, argv);
+        } else if (arg == "--compress") {
+            compressLines = intArg(i, argc, argv);
+        } else if (arg == "--reliable") {
+            reliableLines = intArg(i, argc, argv);
+        } else if (arg == "--lanes") {
+            laneLines = intArg(i, argc, argv);
+        } else if (arg == "--file") {
+            fileBytes = intArg(i, argc, argv);
+        } else if (arg == "--ota") {
+            otaBytes = intArg(i, argc, argv);
+            sim::flash().pendingVerify = true;
+        } else if (arg == "--marginal") {
+            marginalBytes = intArg(i, argc, argv);
+        } else if (arg == "--bond") {
+            bond = true;
+        } else if (arg == "--idle") {
+            idle = true;
+        } else if (arg == "--config") {
+            config = true;
+        } else if (arg == "--no-alloc") {
+            noAlloc = true;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            sim::exit(1);
+        }
+    }
+    if (lineLen < 8) {
+        lineLen = 8;
+    }
+
+    sim::setPeer("Time Flies", peerAddress);
+
+    static BTSPPServer server("simbridge", Serial1);
+    server.setClientName("Time Flies");
+    server.start(baud, SERIAL_8N1, RXD, TXD);
+    sim::spawn("BT SPP task", [] {
+        while (true) {
+            server.loop();
+        }
+    });
+    sim::spawn("UART task", [] {
+        while (true) {
+            server.uartLoop();
+        }
+    });
+
+    Host host(Serial1);
+    std::vector<std::string> response;
+
+    // Connect, searching for the peer by name
+    uint64_t connectStart = sim::now();
+    host.command("AT+CONNECT");
+    uint64_t deadline = sim::now() + 30000000;
+    while (sim::now() < deadline) {
+        response.clear();
+        host.command("AT+STATE", &response);
+        if (!response.empty() && response[0] == "4") {
+            break;
+        }
+        sim::sleep(20000);
+    }
+    if (response.empty() || response[0] != "4") {
+        printf("connected=0\n");
+        sim::exit(1);
+    }
+    printf("connected=1\n");
+    printf("connect_ms=%llu\n", (unsigned long long)(sim::now() - connectStart) / 1000);
+
+    // Host to peer: fixed length lines, each tagged with its sequence number
+    std::vector<uint64_t> sentAt(lines, 0);
+    std::vector<uint64_t> latencies;
+    std::string peerStream;
+    uint64_t lastArrival = 0;
+    sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+        peerStream.append((const char*)data, len);
+        while (peerStream.size() >= (size_t)lineLen) {
+            int seq = atoi(peerStream.c_str() + 1);
+            if (peerStream[0] == '#' && seq >= 0 && seq < lines) {
+                latencies.push_back(timeUs - sentAt[seq]);
+            }
+            peerStream.erase(0, lineLen);
+            lastArrival = timeUs;
+        }
+    });
+
+    uint64_t txStart = sim::now();
+    for (int seq = 0; seq < lines; seq++) {
+        char header[16];
+        snprintf(header, sizeof(header), "#%06d:", seq);
+        std::string line(header);
+        line.resize(lineLen, 'a' + seq % 26);
+        sentAt[seq] = host.send(line);
+    }
+    // Wait for the UART to deliver everything plus time for the link to drain
+    sim::sleep(sentAt[lines - 1] - sim::now() + 2000000);
+
+    uint64_t txTime = (lastArrival > txStart ? lastArrival : sim::now()) - txStart;
+    printf("tx_lines_sent=%d\n", lines);
+    printf("tx_lines_delivered=%zu\n", latencies.size());
+    printf("tx_uart_overflows=%llu\n", (unsigned long long)Serial1.simRxOverflows());
+    printf("tx_goodput_Bps=%llu\n", (unsigned long long)(latencies.size() * lineLen * 1000000ULL / (txTime ? txTime : 1)));
+    printf("tx_latency_p50_us=%llu\n", (unsigned long long)percentile(latencies, 50));
+    printf("tx_latency_p99_us=%llu\n", (unsigned long long)percentile(latencies, 99));
+    printf("tx_latency_max_us=%llu\n", (unsigned long long)percentile(latencies, 100));
+
+    // Peer to host
+    host.takeRaw();
+    if (rxMode < 4) {
+        host.command("AT+SENDRX=" + std::to_string(rxMode));
+    } else {
+        host.send("AT+SENDRX=" + std::to_string(rxMode));     // Its OK comes in a text frame
+    }
+    std::string payload;
+    for (int seq = 0; seq < rxLines; seq++) {
+        char header[16];
+        snprintf(header, sizeof(header), "#%06d:", seq);
+        std::string line(header);
+        line.resize(lineLen, 'A' + seq % 26);
+        if (rxMode == 3) {
+            line.back() = '\n';
+        }
+        payload += line;
+    }
+    uint64_t rxStart = sim::now();
+    sim::peerSend((const uint8_t*)payload.data(), payload.size());
+
+    std::string received;
+    std::string framed;
+    int frames = 0;
+    int blocks = 0;         // Frames without the rest of their block to come
+    int textFrames = 0;
+    std::string text;       // Command responses and URCs, from text frames
+    bool stateAsked = false;
+    bool framesOk = true;
+    uint32_t firstArrivalUs = 0;
+    uint32_t frameDelayMaxUs = 0;
+    uint64_t rxLast = rxStart;
+    deadline = sim::now() + 60000000;
+    // Until the data, and the response to AT+STATE=NAME if it was asked, are all in
+    while (sim::now() < deadline && (received.size() < payload.size() || (stateAsked && text.find("\r\nOK\r\n") == std::string::npos)) && framesOk) {
+        sim::sleep(1000);
+        std::string out = host.takeRaw();
+        if (rxMode < 4) {
+            for (char c : out) {
+                if (rxMode != 1 || (c != '\r' && c != '\n')) {
+                    received += c;
+                    rxLast = sim::now();
+                }
+            }
+            continue;
+        }
+
+        // <length: 2> <arrived at, us: 4> <data>, or the same in COBS then 00.
+        // Bit 15 of the length is set if the block goes on in the next frame,
+        // bit 14 for text. A command half way through has its response in them.
+        if (!stateAsked && !received.empty()) {
+            host.send("AT+STATE=NAME");
+            stateAsked = true;
+        }
+        framed += out;
+        while (true) {
+            std::string frame;
+            size_t length = framed.size() >= 2 ? ((uint8_t)framed[0] | (uint8_t)framed[1] << 8) & 0x3fff : 0;
+            if (rxMode == 4 && framed.size() >= 6 && framed.size() >= 6 + length) {
+                frame = framed.substr(0, 6 + length);
+                framed.erase(0, frame.size());
+            } else if (rxMode == 5 && framed.find('\0') != std::string::npos) {
+                size_t end = framed.find('\0');
+                for (size_t i = 0; i < end; ) {
+                    uint8_t code = framed[i++];
+                    frame.append(framed, i, std::min<size_t>(code - 1, end - i));
+                    i += code - 1;
+                    if (code < 0xff && i < end) {
+                        frame += '\0';
+                    }
+                }
+                framed.erase(0, end + 1);
+            } else {
+                break;
+            }
+            int flags = frame.size() >= 6 ? (uint8_t)frame[1] & 0xc0 : 0;
+            length = frame.size() >= 6 ? ((uint8_t)frame[0] | (uint8_t)frame[1] << 8) & 0x3fff : 0;
+            if (length == 0 || frame.size() != 6 + length || flags == 0xc0) {
+                framesOk = false;
+                break;
+            }
+            if (flags & 0x40) {
+                textFrames++;
+                text += frame.substr(6);
+                continue;
+            }
+            uint32_t arrivedUs = (uint8_t)frame[2] | (uint8_t)frame[3] << 8 | (uint8_t)frame[4] << 16 | (uint32_t)(uint8_t)frame[5] << 24;
+            firstArrivalUs = frames++ == 0 ? arrivedUs : firstArrivalUs;
+            blocks += (flags & 0x80) ? 0 : 1;
+            frameDelayMaxUs = std::max(frameDelayMaxUs, (uint32_t)sim::now() - arrivedUs);
+            received += frame.substr(6);
+            rxLast = sim::now();
+        }
+    }
+    uint64_t rxTime = rxLast - rxStart;
+    printf("rx_bytes_sent=%zu\n", payload.size());
+    printf("rx_bytes_delivered=%zu\n", received.size());
+    printf("rx_intact=%d\n", payload.compare(0, received.size(), received) == 0 ? 1 : 0);
+    printf("rx_goodput_Bps=%llu\n", (unsigned long long)(received.size() * 1000000ULL / (rxTime ? rxTime : 1)));
+    if (rxMode >= 4) {
+        // How long the first block took over the link, and the most any frame took from there to the host
+        printf("rx_frames=%d\n", frames);
+        printf("rx_blocks=%d\n", blocks);
+        printf("rx_frames_ok=%d\n", framesOk && framed.empty() ? 1 : 0);
+        // The OK of AT+SENDRX, then AT+STATE=NAME's response
+        printf("rx_text_frames=%d\n", textFrames);
+        printf("rx_text_ok=%d\n", text == "OK\r\nCONNECTED\r\nOK\r\n" ? 1 : 0);
+        printf("rx_first_arrival_us=%llu\n", (unsigned long long)(frames > 0 ? firstArrivalUs - (uint32_t)rxStart : 0));
+        printf("rx_frame_delay_max_us=%u\n", frameDelayMaxUs);
+    }
+    host.command("AT+SENDRX=0");
+
+    if (!benchArgs.empty()) {
+        int seconds = 10;
+        sscanf(benchArgs.c_str(), "%*d,%d", &seconds);
+        sim::setPeerMode(sim::PEER_ECHO);
+        sim::setPeerReceiver(nullptr);
+        response.clear();
+        bool ok = host.command("AT+BENCH=" + benchArgs, &response, (seconds + 10) * 1000000ULL);
+        printf("bench.OK=%d\n", ok ? 1 : 0);
+        for (const std::string &line : response) {
+            printf("bench.%s\n", line.c_str());
+        }
+        sim::setPeerMode(sim::PEER_SINK);
+    }
+
+    if (loopbackBytes > 0) {
+        std::string sentBack;
+        uint64_t lastUs = 0;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            sentBack.append((const char*)data, len);
+            lastUs = timeUs;
+        });
+        printf("loopback.OK=%d\n", host.command("AT+LOOPBACK=1") ? 1 : 0);
+
+        std::string payload;
+        for (int i = 0; i < loopbackBytes; i++) {
+            payload += (char)('0' + i % 64);
+        }
+        uint64_t startUs = sim::now();
+        sim::peerSend((const uint8_t*)payload.data(), payload.size());
+        sim::waitUntil([&] { return sentBack.size() >= payload.size(); }, 60000000);
+
+        printf("loopback.bytes=%zu\n", sentBack.size());
+        printf("loopback.intact=%d\n", sentBack == payload ? 1 : 0);
+        printf("loopback.Bps=%llu\n", (unsigned long long)(lastUs > startUs ? sentBack.size() * 1000000ULL / (lastUs - startUs) : 0));
+        response.clear();
+        host.command("AT+LOOPBACK", &response);
+        for (const std::string &line : response) {
+            if (line.compare(0, 8, "DROPPED=") == 0) {
+                printf("loopback.%s\n", line.c_str());
+            }
+        }
+        host.command("AT+LOOPBACK=0");
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (spoolLines > 0) {
+        std::string arrived;
+        uint64_t lastUs = 0;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            arrived.append((const char*)data, len);
+            lastUs = timeUs;
+        });
+
+        host.command("AT+URC=STATE,1");
+        host.command("AT+URC=DROP,1");
+        sim::setPeerInRange(false);
+        deadline = sim::now() + 5000000;
+        do {
+            sim::sleep(20000);
+            response.clear();
+            host.command("AT+STATE", &response);
+        } while (sim::now() < deadline && !response.empty() && response[0] == "4");
+
+        std::string expected;
+        for (int seq = 0; seq < spoolLines; seq++) {
+            char header[16];
+            snprintf(header, sizeof(header), "$%06d:", seq);
+            std::string line(header);
+            line.resize(lineLen, 'a' + seq % 26);
+            expected += line;
+            uint64_t sentUs = host.send(line);
+            sim::sleep(sentUs > sim::now() ? sentUs - sim::now() : 0);
+        }
+        sim::sleep(100000);
+
+        response.clear();
+        host.command("AT+SPOOL", &response);
+        for (const std::string &line : response) {
+            printf("spool.%s\n", line.c_str());
+        }
+
+        uint64_t backUs = sim::now();
+        sim::setPeerInRange(true);
+        sim::waitUntil([&] { return arrived.size() >= expected.size(); }, 60000000);
+
+        printf("spool.lines=%d\n", spoolLines);
+        printf("spool.delivered_bytes=%zu\n", arrived.size());
+        printf("spool.intact=%d\n", arrived == expected ? 1 : 0);
+        printf("spool.replay_ms=%llu\n", (unsigned long long)(lastUs > backUs ? (lastUs - backUs) / 1000 : 0));
+        host.command("AT+URC=STATE,0");
+        host.command("AT+URC=DROP,0");
+        for (const std::string &urc : host.urcs) {
+            printf("spool.urc=%s\n", urc.c_str());
+        }
+
+        // Again with the flash filling up half way through a record, and room
+        // again half way through the lines. What made it comes back as whole
+        // lines in order, and the rest counts as dropped.
+        sim::setPeerInRange(false);
+        sim::waitUntil([&] {
+            response.clear();
+            host.command("AT+STATE", &response);
+            return response.empty() || response[0] != "4";
+        }, 5000000);
+        size_t partitionBytes = sim::flash().partitionBytes;
+        sim::flash().partitionBytes = LittleFS.usedBytes() + 10 * (lineLen + 1) + lineLen / 2;
+        uint32_t droppedBefore = BridgeStats::get(BridgeStats::SPOOL_DROPPED_BYTES);
+        arrived.clear();
+        expected.clear();
+        for (int seq = 0; seq < spoolLines; seq++) {
+            char header[16];
+            snprintf(header, sizeof(header), "%%%06d:", seq);
+            std::string line(header);
+            line.resize(lineLen, 'A' + seq % 26);
+            expected += line;
+            uint64_t sentUs = host.send(line);
+            sim::sleep(sentUs > sim::now() ? sentUs - sim::now() : 0);
+            if (seq == spoolLines / 2) {
+                sim::flash().partitionBytes = partitionBytes;
+            }
+        }
+        sim::sleep(100000);
+        uint32_t dropped = BridgeStats::get(BridgeStats::SPOOL_DROPPED_BYTES) - droppedBefore;
+        sim::setPeerInRange(true);
+        sim::waitUntil([&] { return arrived.size() + dropped >= expected.size(); }, 60000000);
+        sim::sleep(500000);
+        response.clear();
+        host.command("AT+SPOOL", &response);
+        bool whole = arrived.size() + dropped == expected.size();
+        size_t next = 0;
+        for (size_t at = 0; whole && at < arrived.size(); at += lineLen) {
+            next = expected.find(arrived.substr(at, lineLen), next);
+            whole = next != std::string::npos && next % lineLen == 0;
+        }
+        printf("spool.full.delivered_bytes=%zu\n", arrived.size());
+        printf("spool.full.dropped_bytes=%u\n", dropped);
+        printf("spool.full.intact=%d\n", whole ? 1 : 0);
+        for (const std::string &line : response) {
+            if (line.compare(0, 12, "FLASH_BYTES=") == 0) {
+                printf("spool.full.%s\n", line.c_str());
+            }
+        }
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (compressLines > 0) {
+        // The peer is another bridge. Its codec counts into the same stats.
+        static LinkCodec peerCodec;
+        std::string arrived;
+        uint64_t linkBytes = 0;
+        auto peerControl = [] {
+            const uint8_t *control;
+            int len = peerCodec.control(&control);
+            if (len > 0) {
+                sim::peerSend(control, len);
+                peerCodec.controlSent();
+            }
+        };
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            uint8_t out[256];
+            size_t used = 0;
+            linkBytes += len;
+            while (used < len) {
+                used += peerCodec.receive(&data[used], len - used);
+                int n;
+                while ((n = peerCodec.read(out, sizeof(out))) > 0) {
+                    arrived.append((const char*)out, n);
+                }
+            }
+            peerControl();
+        });
+        peerCodec.setEnabled(true);
+        peerCodec.linkUp();
+        peerControl();
+        printf("compress.OK=%d\n", host.command("AT+COMPRESS=1") ? 1 : 0);
+        sim::sleep(200000);
+        response.clear();
+        host.command("AT+COMPRESS", &response);
+        for (const std::string &line : response) {
+            printf("compress.%s\n", line.c_str());
+        }
+
+        std::vector<std::string> telemetry;
+        for (int seq = 0; seq < compressLines; seq++) {
+            char line[64];
+            snprintf(line, sizeof(line), "seq=%d,temp=%d.%d,hum=%d,press=1013.%d,vbat=3.%02d",
+                     seq, 20 + seq % 3, seq % 10, 40 + seq % 5, seq % 4, 70 + seq % 7);
+            telemetry.push_back(line);
+        }
+
+        std::string expected;
+        uint64_t linkBefore = linkBytes;
+        for (const std::string &line : telemetry) {
+            expected += line;
+            uint64_t sentUs = host.send(line);
+            sim::sleep(sentUs > sim::now() ? sentUs - sim::now() : 0);
+        }
+        sim::waitUntil([&] { return arrived.size() >= expected.size(); }, 10000000);
+        printf("compress.tx_bytes=%zu\n", expected.size());
+        printf("compress.tx_link_bytes=%llu\n", (unsigned long long)(linkBytes - linkBefore));
+        printf("compress.tx_intact=%d\n", arrived == expected ? 1 : 0);
+
+        // And back, a line per write as the peer's host would send them
+        host.takeRaw();
+        host.command("AT+SENDRX=2");
+        std::string received;
+        uint8_t frame[MAX_STRING_LENGTH];
+        for (const std::string &line : telemetry) {
+            int len = peerCodec.encode((const uint8_t*)line.data(), line.size(), frame);
+            sim::peerSend(frame, len);
+            peerCodec.commit();
+        }
+        sim::waitUntil([&] {
+            received += host.takeRaw();
+            return received.size() >= expected.size();
+        }, 10000000);
+        printf("compress.rx_bytes=%zu\n", received.size());
+        printf("compress.rx_intact=%d\n", received == expected ? 1 : 0);
+
+        // Off again with the link up. The peer frames until it has the STOP,
+        // then both ends go back to plain.
+        host.command("AT+COMPRESS=0");
+        sim::sleep(200000);
+        host.takeRaw();
+        received.clear();
+        arrived.clear();
+        for (const std::string &line : telemetry) {
+            if (peerCodec.txFramed()) {
+                int len = peerCodec.encode((const uint8_t*)line.data(), line.size(), frame);
+                sim::peerSend(frame, len);
+                peerCodec.commit();
+            } else {
+                sim::peerSend((const uint8_t*)line.data(), line.size());
+            }
+            sim::sleep(line.size() * 10000000ULL / baud);     // Plain, as fast as the UART takes it
+        }
+        sim::waitUntil([&] {
+            received += host.takeRaw();
+            return received.size() >= expected.size();
+        }, 10000000);
+        printf("compress.stopped_rx_intact=%d\n", received == expected ? 1 : 0);
+        host.command("AT+SENDRX=0");
+        for (const std::string &line : telemetry) {
+            uint64_t sentUs = host.send(line);
+            sim::sleep(sentUs > sim::now() ? sentUs - sim::now() : 0);
+        }
+        sim::waitUntil([&] { return arrived.size() >= expected.size(); }, 10000000);
+        printf("compress.stopped_tx_intact=%d\n", arrived == expected ? 1 : 0);
+        response.clear();
+        host.command("AT+COMPRESS", &response);
+        for (const std::string &line : response) {
+            printf("compress.stopped.%s\n", line.c_str());
+        }
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (reliableLines > 0) {
+        // The peer is another bridge, which loses every 5th packet it sends
+        static ReliableLink peerLink;
+        static int peerPackets = 0;
+        std::string arrived;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            uint8_t out[256];
+            int n;
+            peerLink.receive(data, len);
+            while ((n = peerLink.read(out, sizeof(out))) > 0) {
+                arrived.append((const char*)out, n);
+            }
+        });
+        peerLink.setEnabled(true);
+        sim::spawn("Peer", [] {
+            bool up = false;
+            while (true) {
+                if (sim::peerConnected() != up) {
+                    up = !up;
+                    up ? peerLink.linkUp() : peerLink.linkDown();
+                }
+                const uint8_t *packet;
+                int len = peerLink.next(&packet);
+                if (len == 0) {
+                    sim::sleep(2000);
+                    continue;
+                }
+                if (packet[1] != 'D' || ++peerPackets % 5 != 0) {
+                    sim::peerSend(packet, len);
+                }
+                peerLink.sent();
+            }
+        });
+        sim::bluetooth().failWriteEvery = 5;
+        printf("reliable.OK=%d\n", host.command("AT+RELIABLE=1") ? 1 : 0);
+        host.takeRaw();
+        host.command("AT+SENDRX=2");
+
+        std::string expected;
+        std::vector<std::string> fromPeer;
+        for (int seq = 0; seq < reliableLines; seq++) {
+            char header[16];
+            snprintf(header, sizeof(header), "#%06d:", seq);
+            std::string line(header);
+            line.resize(lineLen, 'a' + seq % 26);
+            expected += line;
+            fromPeer.push_back(line);
+        }
+
+        // Both ways at once, with the link lost half way
+        std::string received;
+        uint64_t startUs = sim::now();
+        size_t toPeer = 0;
+        for (int seq = 0; seq < reliableLines; seq++) {
+            if (seq == reliableLines / 2) {
+                sim::setPeerInRange(false);
+                sim::sleep(300000);
+                sim::setPeerInRange(true);
+            }
+            uint64_t sentUs = host.send(fromPeer[seq]);
+            sim::sleep(sentUs > sim::now() ? sentUs - sim::now() : 0);
+            while (toPeer < fromPeer.size() && peerLink.queue((const uint8_t*)fromPeer[toPeer].data(), fromPeer[toPeer].size())) {
+                toPeer++;
+            }
+            received += host.takeRaw();
+        }
+        sim::waitUntil([&] {
+            while (toPeer < fromPeer.size() && peerLink.queue((const uint8_t*)fromPeer[toPeer].data(), fromPeer[toPeer].size())) {
+                toPeer++;
+            }
+            received += host.takeRaw();
+            return arrived.size() >= expected.size() && received.size() >= expected.size();
+        }, 120000000);
+
+        printf("reliable.ms=%llu\n", (unsigned long long)((sim::now() - startUs) / 1000));
+        printf("reliable.tx_bytes=%zu\n", arrived.size());
+        printf("reliable.tx_intact=%d\n", arrived == expected ? 1 : 0);
+        printf("reliable.rx_bytes=%zu\n", received.size());
+        printf("reliable.rx_intact=%d\n", received == expected ? 1 : 0);
+        response.clear();
+        host.command("AT+RELIABLE", &response);
+        for (const std::string &line : response) {
+            printf("reliable.%s\n", line.c_str());
+        }
+        sim::bluetooth().failWriteEvery = 0;
+        host.command("AT+SENDRX=0");
+        host.command("AT+RELIABLE=0");
+        peerLink.setEnabled(false);
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (laneLines > 0) {
+        // Lines are all the same length, so the peer can tell them apart
+        std::string arrived;
+        size_t parsed = 0;
+        std::vector<uint64_t> sentAt(laneLines);
+        std::vector<uint64_t> arrivedAt(laneLines);
+        uint64_t bulkMaxUs = 0;
+        uint64_t urgentMaxUs = 0;
+        int bulkLines = 0;
+        int urgentLines = 0;
+        bool inOrder = true;
+        int lastBulk = -1;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            arrived.append((const char*)data, len);
+            while (arrived.size() - parsed >= (size_t)lineLen) {
+                int seq = atoi(&arrived[parsed + 1]);
+                if (seq >= 0 && seq < laneLines) {
+                    arrivedAt[seq] = timeUs;
+                    if (arrived[parsed] == 'U') {
+                        urgentLines++;
+                    } else {
+                        inOrder &= seq > lastBulk;
+                        lastBulk = seq;
+                        bulkLines++;
+                    }
+                }
+                parsed += lineLen;
+            }
+        });
+
+        uint32_t rate = sim::bluetooth().bytesPerSec;
+        sim::bluetooth().bytesPerSec = baud / 10 * 3 / 4;
+        printf("lanes.OK=%d\n", host.command("AT+LANE=0,21") ? 1 : 0);
+        for (int seq = 0; seq < laneLines; seq++) {
+            char header[16];
+            bool isUrgent = seq % 10 == 9;
+            snprintf(header, sizeof(header), "%c%06d:", isUrgent ? 'U' : 'B', seq);
+            std::string line(header);
+            line.resize(lineLen, 'a' + seq % 26);
+            if (isUrgent) {
+                line.insert(0, "!");    // The flag, which the bridge takes off
+            }
+            sentAt[seq] = host.send(line);
+            sim::sleep(sentAt[seq] > sim::now() ? sentAt[seq] - sim::now() : 0);
+        }
+        sim::waitUntil([&] { return bulkLines + urgentLines >= laneLines; }, 120000000);
+
+        for (int seq = 0; seq < laneLines; seq++) {
+            uint64_t waitUs = arrivedAt[seq] > sentAt[seq] ? arrivedAt[seq] - sentAt[seq] : 0;
+            uint64_t &worst = seq % 10 == 9 ? urgentMaxUs : bulkMaxUs;
+            worst = waitUs > worst ? waitUs : worst;
+        }
+        printf("lanes.bulk_lines=%d\n", bulkLines);
+        printf("lanes.urgent_lines=%d\n", urgentLines);
+        printf("lanes.bulk_in_order=%d\n", inOrder ? 1 : 0);
+        printf("lanes.bulk_max_ms=%llu\n", (unsigned long long)(bulkMaxUs / 1000));
+        printf("lanes.urgent_max_ms=%llu\n", (unsigned long long)(urgentMaxUs / 1000));
+        host.command("AT+LANE=0");
+        sim::bluetooth().bytesPerSec = rate;
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (fileBytes > 0) {
+        std::string content;
+        for (int i = 0; i < fileBytes; i++) {
+            content += (char)((i * 7919) >> 5);
+        }
+        File out = LittleFS.open("/log.bin", FILE_WRITE);
+        out.write((const uint8_t*)content.data(), content.size());
+        out.close();
+
+        // The peer checks the header and CRC itself
+        std::string arrived;
+        uint64_t lastUs = 0;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            arrived.append((const char*)data, len);
+            lastUs = timeUs;
+        });
+        host.command("AT+URC=FILE,1");
+        uint64_t startUs = sim::now();
+        printf("file.send_OK=%d\n", host.command("AT+SENDFILE=/log.bin") ? 1 : 0);
+        sim::waitUntil([&] { return arrived.size() >= content.size() + 12; }, 120000000);
+        sim::sleep(100000);
+        uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)content.data(), content.size());
+        bool intact = arrived.size() == content.size() + 12 &&
+            arrived.compare(0, 4, std::string("\x00\xc5" "FT", 4)) == 0 &&
+            arrived.compare(8, content.size(), content) == 0 &&
+            memcmp(&arrived[8 + content.size()], &crc, 4) == 0;
+        printf("file.send_intact=%d\n", intact ? 1 : 0);
+        printf("file.send_Bps=%llu\n", (unsigned long long)(lastUs > startUs ? content.size() * 1000000ULL / (lastUs - startUs) : 0));
+        response.clear();
+        host.command("AT+SENDFILE", &response);
+        for (const std::string &line : response) {
+            printf("file.send.%s\n", line.c_str());
+        }
+
+        // And back, as the peer's bridge would send it
+        printf("file.recv_OK=%d\n", host.command("AT+RECVFILE=/back.bin") ? 1 : 0);
+#ifdef SPP_TRANSPORT_VFS
+        sim::peerSend((const uint8_t*)arrived.data(), arrived.size());
+#else
+        // The callback transport can't hold the peer back, so it keeps below
+        // what the flash takes, as AT+RELIABLE's window would make it
+        for (size_t offset = 0; offset < arrived.size(); offset += 1024) {
+            sim::peerSend((const uint8_t*)&arrived[offset], std::min((size_t)1024, arrived.size() - offset));
+            sim::sleep(1024 * 1000000ULL / (sim::flash().writeBytesPerSec * 3 / 4));
+        }
+#endif
+        deadline = sim::now() + 120000000;
+        do {
+            sim::sleep(100000);
+            response.clear();
+            host.command("AT+RECVFILE", &response);
+        } while (sim::now() < deadline && !response.empty() && response[0] == "STATE=RECEIVING");
+        for (const std::string &line : response) {
+            printf("file.recv.%s\n", line.c_str());
+        }
+        std::string back;
+        File in = LittleFS.open("/back.bin", FILE_READ);
+        while (in && in.available() > 0) {
+            uint8_t buf[256];
+            size_t n = in.read(buf, sizeof(buf));
+            back.append((const char*)buf, n);
+        }
+        in.close();
+        printf("file.recv_intact=%d\n", back == content ? 1 : 0);
+        for (const std::string &urc : host.urcs) {
+            printf("file.urc=%s\n", urc.c_str());
+        }
+        host.command("AT+URC=FILE,0");
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (otaBytes > 0) {
+        std::string image(1, (char)0xe9);     // What esp_ota_write() takes for an app image
+        for (int i = 1; i < otaBytes; i++) {
+            image += (char)((i * 40503) >> 7);
+        }
+        uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)image.data(), image.size());
+        uint32_t size = image.size();
+        std::string framed("\x00\xc5" "FT", 4);
+        framed.append((const char*)&size, 4);
+        framed += image;
+
+        host.urcs.clear();
+        host.command("AT+URC=OTA,1");
+        for (int pass = 0; pass < 2; pass++) {
+            // The second time with a CRC that doesn't match
+            uint32_t sentCrc = pass == 0 ? crc : ~crc;
+            std::string sent = framed + std::string((const char*)&sentCrc, 4);
+            const char *name = pass == 0 ? "ota" : "ota.bad_crc";
+
+            printf("%s.start_OK=%d\n", name, host.command("AT+OTA=START") ? 1 : 0);
+#ifdef SPP_TRANSPORT_VFS
+            sim::peerSend((const uint8_t*)sent.data(), sent.size());
+#else
+            // As for --file, kept below what the flash takes
+            for (size_t offset = 0; offset < sent.size(); offset += 1024) {
+                sim::peerSend((const uint8_t*)&sent[offset], std::min((size_t)1024, sent.size() - offset));
+                sim::sleep(1024 * 1000000ULL / (sim::flash().writeBytesPerSec * 3 / 4));
+            }
+#endif
+            deadline = sim::now() + 120000000;
+            do {
+                sim::sleep(100000);
+                response.clear();
+                host.command("AT+OTA", &response);
+            } while (sim::now() < deadline && !response.empty() &&
+                (response[0] == "STATE=RECEIVING" || response[0] == "STATE=FINISHING"));
+            for (const std::string &line : response) {
+                printf("%s.%s\n", name, line.c_str());
+            }
+            const std::vector<uint8_t> &written = sim::otaImage(1);
+            printf("%s.image_intact=%d\n", name,
+                written.size() == image.size() && memcmp(written.data(), image.data(), image.size()) == 0 ? 1 : 0);
+            printf("%s.boot_slot=%d\n", name, sim::otaBootSlot());
+        }
+        for (const std::string &urc : host.urcs) {
+            printf("ota.urc=%s\n", urc.c_str());
+        }
+        host.command("AT+URC=OTA,0");
+    }
+
+    if (marginalBytes > 0) {
+        std::string content;
+        for (int i = 0; i < marginalBytes; i++) {
+            content += (char)((i * 2654435761u) >> 13);
+        }
+        File out = LittleFS.open("/marginal.bin", FILE_WRITE);
+        out.write((const uint8_t*)content.data(), content.size());
+        out.close();
+
+        sim::BluetoothConfig before = sim::bluetooth();
+        sim::bluetooth().rssiDelta = -12;
+        sim::bluetooth().bitErrorPpm = 1000;
+        sim::bluetooth().writeOverheadUs = 625;
+
+        size_t arrived = 0;
+        uint64_t lastUs = 0;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            arrived += len;
+            lastUs = timeUs;
+        });
+        for (int tuned = 0; tuned < 2; tuned++) {
+            const char *name = tuned ? "marginal.tuned" : "marginal.untuned";
+            host.command(tuned ? "AT+TUNE=1" : "AT+TUNE=0");
+            arrived = 0;
+            uint64_t startUs = sim::now();
+            printf("%s.send_OK=%d\n", name, host.command("AT+SENDFILE=/marginal.bin") ? 1 : 0);
+            sim::waitUntil([&] { return arrived >= content.size() + 12; }, 300000000);
+            sim::sleep(100000);
+            printf("%s.arrived=%d\n", name, arrived == content.size() + 12 ? 1 : 0);
+            printf("%s.Bps=%llu\n", name, (unsigned long long)(lastUs > startUs ? content.size() * 1000000ULL / (lastUs - startUs) : 0));
+            response.clear();
+            host.command("AT+TUNE", &response);
+            for (const std::string &line : response) {
+                printf("%s.%s\n", name, line.c_str());
+            }
+        }
+        sim::setPeerReceiver(nullptr);
+        sim::bluetooth() = before;
+    }
+
+    if (bond) {
+        auto reconnect = [&](const char *name) {
+            host.command("AT+DISCONNECT");
+            sim::sleep(500000);
+            uint64_t startUs = sim::now();
+            host.command("AT+CONNECT");
+            uint64_t until = sim::now() + 30000000;
+            do {
+                sim::sleep(5000);
+                response.clear();
+                host.command("AT+STATE", &response);
+            } while (sim::now() < until && (response.empty() || response[0] != "4"));
+            printf("%s.connected=%d\n", name, !response.empty() && response[0] == "4" ? 1 : 0);
+            printf("%s.connect_ms=%llu\n", name, (unsigned long long)(sim::now() - startUs) / 1000);
+        };
+
+        sim::setPeer("Time Flies", peerAddress, "2468");
+        printf("bond.clear_OK=%d\n", host.command("AT+BOND=CLEAR") ? 1 : 0);
+        printf("bond.pin_OK=%d\n", host.command("AT+PIN=10:20:30:40:50:60,2468") ? 1 : 0);
+        reconnect("bond.fixed_pin");
+        reconnect("bond.link_key");
+        response.clear();
+        host.command("AT+BOND", &response);
+        for (const std::string &line : response) {
+            printf("bond.%s\n", line.c_str());
+        }
+
+        printf("bond.remove_OK=%d\n", host.command("AT+BOND=REMOVE,10:20:30:40:50:60") ? 1 : 0);
+        host.command("AT+PIN=10:20:30:40:50:60,");
+        host.command("AT+PIN=2468");
+        reconnect("bond.pin_request");
+        response.clear();
+        host.command("AT+PIN", &response);
+        for (const std::string &line : response) {
+            printf("bond.pins.%s\n", line.c_str());
+        }
+        printf("bond.bad_pin_OK=%d\n", host.command("AT+PIN=12;34") ? 1 : 0);
+        host.command("AT+PIN=1234");
+        sim::setPeer("Time Flies", peerAddress);
+
+        response.clear();
+        host.command("AT+CONNSTATS", &response);
+        for (const std::string &line : response) {
+            if (line.compare(0, 4, "AUTH") == 0) {
+                printf("bond.connstats.%s\n", line.c_str());
+            }
+        }
+    }
+
+    if (idle) {
+        std::string arrived;
+        uint64_t arrivedUs = 0;
+        sim::setPeerReceiver([&](const uint8_t *data, size_t len, uint64_t timeUs) {
+            arrived.append((const char*)data, len);
+            arrivedUs = timeUs;
+        });
+        host.command("AT+SENDRX=2");
+
+        const struct {
+            const char *name;
+            const char *setting;
+            bool fromPeer;      // Not while the link is down
+        } cases[] = {
+            {"idle.active", "AT+IDLE=0,0", true},
+            {"idle.slow_poll", "AT+IDLE=1000,0", true},
+            {"idle.disconnect", "AT+IDLE=0,1000", false},
+        };
+        for (const auto &c : cases) {
+            host.command(c.setting);
+            if (c.fromPeer) {
+                sim::sleep(1200000);
+                host.takeRaw();
+                std::string out;
+                uint64_t startUs = sim::now();
+                uint64_t until = startUs + 5000000;
+                sim::peerSend((const uint8_t*)"ping\r\n", 6);
+                while (sim::now() < until && out.find('\n') == std::string::npos) {
+                    sim::sleep(500);
+                    out += host.takeRaw();
+                }
+                printf("%s.from_peer_us=%llu\n", c.name, (unsigned long long)(sim::now() - startUs));
+            }
+
+            sim::sleep(1200000);
+            response.clear();
+            host.command("AT+STATE=NAME", &response);
+            printf("%s.state=%s\n", c.name, response.empty() ? "" : response[0].c_str());
+            arrived.clear();
+            uint64_t sentUs = host.send("pong");
+            sim::waitUntil([&] { return arrived == "pong"; }, 5000000);
+            printf("%s.to_peer_us=%llu\n", c.name, (unsigned long long)(arrived == "pong" ? arrivedUs - sentUs : 0));
+            sim::sleep(100000);
+
+            response.clear();
+            host.command("AT+IDLE", &response);
+            for (const std::string &line : response) {
+                if (line.compare(0, 4, "WAKE") == 0 || line.compare(0, 9, "RECONNECT") == 0 || line.compare(0, 4, "MODE") == 0) {
+                    printf("%s.%s\n", c.name, line.c_str());
+                }
+            }
+        }
+        host.command("AT+IDLE=0,0");
+        host.command("AT+SENDRX=0");
+        sim::setPeerReceiver(nullptr);
+    }
+
+    if (config) {
+        static EEPROMConfig eeprom;
+        static StringConfigItem serverName("server_name", MAX_NAME_LEN, "simbridge");
+        static StringConfigItem clientName("client_name", MAX_NAME_LEN, "Time Flies");
+        static ConfigCommitter committer(eeprom);
+        committer.track(serverName);
+        committer.track(clientName);
+        server.setServerNameCallback([](const char *name) { committer.set(serverName, name); });
+        server.setClientNameCallback([](const char *name) { committer.set(clientName, name); });
+        xTaskCreate(ConfigCommitter::taskFn, "Commit EEPROM task", 4096, &committer, 1, nullptr);
+
+        // Well inside the quiet time of each other, so written once
+        for (int i = 1; i <= 5; i++) {
+            host.command("AT+NAME=bridge" + std::to_string(i));
+            sim::sleep(200000);
+        }
+        host.command("AT+RNAME=Time Flies 2");
+        sim::sleep(3000000);
+        printf("config.burst_commits=%d\n", eeprom.commits());
+        printf("config.server_name=%s\n", eeprom.committed("server_name").c_str());
+        printf("config.client_name=%s\n", eeprom.committed("client_name").c_str());
+
+        // Changed and changed back before the commit, so nothing to write
+        host.command("AT+NAME=elsewhere");
+        host.command("AT+NAME=bridge5");
+        sim::sleep(3000000);
+        printf("config.unchanged_commits=%d\n", eeprom.commits() - 1);
+
+        // A change every 500ms never leaves the quiet time, so only the
+        // upper bound commits them: every 5 quiet times of 2s
+        int before = eeprom.commits();
+        uint64_t firstUs = sim::now();
+        uint64_t firstCommitUs = 0;
+        for (int seq = 0; sim::now() - firstUs < 25000000; seq++) {
+            host.command("AT+NAME=steady" + std::to_string(seq));
+            sim::sleep(500000);
+            firstCommitUs = firstCommitUs == 0 && eeprom.commits() > before ? sim::now() : firstCommitUs;
+        }
+        printf("config.steady_commits=%d\n", eeprom.commits() - before);
+        printf("config.steady_first_commit_ms=%llu\n", (unsigned long long)(firstCommitUs ? (firstCommitUs - firstUs) / 1000 : 0));
+        host.command("AT+NAME=bridge5");
+        host.command("AT+RNAME=Time Flies");
+    }
+
+    if (noAlloc) {
+        // Queries and settings that leave things as they were, the link up.
+        // Only the bridge runs while the guard is there: the host side just
+        // hands over the line and waits.
+        static const char *commands[] = {
+            "AT+STATE", "AT+STATE=NAME", "AT+STATS", "AT+STATS=BIN", "AT+CONNSTATS", "AT+TRACE", "AT+BOOT",
+            "AT+LOOPBACK", "AT+SPOOL", "AT+URC", "AT+URC=STATE,1", "AT+URC=STATE,0", "AT+RXFLOW",
+            "AT+COMPRESS", "AT+RELIABLE", "AT+LANE", "AT+SENDFILE", "AT+RECVFILE", "AT+OTA",
+            "AT+TUNE", "AT+BOND", "AT+PIN", "AT+PIN=10:20:30:40:50:60,2468", "AT+PIN=10:20:30:40:50:60,",
+            "AT+IDLE", "AT+SENDRX=2", "AT+SENDRX=0", "AT+RNAME=Time Flies", "AT+NAME=simbridge"
+        };
+        int ok = 0;
+        for (const char *command : commands) {
+            std::string line = std::string(command) + "\r\n";
+            host.takeRaw();
+            {
+                sim::AllocAssert guard(command);
+                Serial1.simReceive(line);
+                sim::sleep(3000000);        // For AT+TRACE to get through the UART
+            }
+            std::string out = host.takeRaw();
+            ok += out.size() >= 4 && out.compare(out.size() - 4, 4, "OK\r\n") == 0 ? 1 : 0;
+        }
+        printf("no_alloc.commands=%zu\n", sizeof(commands) / sizeof(commands[0]));
+        printf("no_alloc.ok=%d\n", ok);
+    }
+
+    const sim::LinkCounters &link = sim::linkCounters();
+    printf("link_writes=%llu\n", (unsigned long long)link.writes);
+    printf("link_partial_writes=%llu\n", (unsigned long long)link.partialWrites);
+    printf("link_congestions=%llu\n", (unsigned long long)link.congestions);
+
+    response.clear();
+    host.command("AT+STATS", &response);
+    for (const std::string &line : response) {
+        printf("stats.%s\n", line.c_str());
+    }
+
+    sim::exit(0);
+}
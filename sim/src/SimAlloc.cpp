@@ -0,0 +1,99 @@
+#include <SimAlloc.h>
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace sim {
+
+namespace {
+
+std::atomic<uint64_t> allocCount{0};
+std::atomic<uint64_t> allocBytes{0};
+std::atomic<int> pauseDepth{0};
+std::atomic<const char*> asserting{nullptr};
+
+void *allocate(size_t size) {
+    countAllocation(size);
+    void *p = malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+}
+
+AllocCounters allocations() {
+    AllocCounters counters;
+    counters.count = allocCount.load(std::memory_order_relaxed);
+    counters.bytes = allocBytes.load(std::memory_order_relaxed);
+
+    return counters;
+}
+
+AllocPause::AllocPause() {
+    pauseDepth.fetch_add(1, std::memory_order_relaxed);
+}
+
+AllocPause::~AllocPause() {
+    pauseDepth.fetch_sub(1, std::memory_order_relaxed);
+}
+
+AllocAssert::AllocAssert(const char *what) {
+    asserting.store(what, std::memory_order_relaxed);
+}
+
+AllocAssert::~AllocAssert() {
+    asserting.store(nullptr, std::memory_order_relaxed);
+}
+
+void countAllocation(size_t size) {
+    if (pauseDepth.load(std::memory_order_relaxed) > 0) {
+        return;
+    }
+    const char *what = asserting.load(std::memory_order_relaxed);
+    if (what != nullptr) {
+        fprintf(stderr, "%s: unexpected %zu byte allocation\n", what, size);
+        abort();
+    }
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+}
+
+void *operator new(size_t size) {
+    return sim::allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return sim::allocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+    sim::countAllocation(size);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept {
+    sim::countAllocation(size);
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
@@ -0,0 +1,385 @@
+#include <Arduino.h>
+#include <SimRuntime.h>
+#include <SimAlloc.h>
+#include <nvs_flash.h>
+#include <esp_rom_crc.h>
+#include <esp_ota_ops.h>
+#include <stdarg.h>
+#include <map>
+#include <string>
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+
+    return n;
+}
+
+size_t Print::printf(const char *format, ...) {
+    // Same as the Arduino core: format on the stack, fall back to the heap
+    char loc_buf[64];
+    char *temp = loc_buf;
+    va_list arg;
+    va_list copy;
+
+    va_start(arg, format);
+    va_copy(copy, arg);
+    int len = vsnprintf(temp, sizeof(loc_buf), format, copy);
+    va_end(copy);
+    if (len < 0) {
+        va_end(arg);
+        return 0;
+    }
+    if (len >= (int)sizeof(loc_buf)) {
+        temp = (char*)malloc(len + 1);
+        sim::countAllocation(len + 1);
+        if (temp == NULL) {
+            va_end(arg);
+            return 0;
+        }
+        len = vsnprintf(temp, len + 1, format, arg);
+    }
+    va_end(arg);
+    len = write((uint8_t*)temp, len);
+    if (temp != loc_buf) {
+        free(temp);
+    }
+
+    return len;
+}
+
+static size_t printNumber(Print &out, unsigned long long n, int base, bool negative) {
+    char buf[8 * sizeof(n) + 2];
+    char *str = &buf[sizeof(buf) - 1];
+
+    *str = '\0';
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        int digit = n % base;
+        n /= base;
+        *--str = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while (n);
+    if (negative) {
+        *--str = '-';
+    }
+
+    return out.write(str);
+}
+
+size_t Print::print(long n, int base) {
+    return print((long long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    return printNumber(*this, n, base, false);
+}
+
+size_t Print::print(long long n, int base) {
+    if (base == 10 && n < 0) {
+        return printNumber(*this, -(unsigned long long)n, base, true);
+    }
+
+    return printNumber(*this, (unsigned long long)n, base, false);
+}
+
+size_t Print::print(unsigned long long n, int base) {
+    return printNumber(*this, n, base, false);
+}
+
+size_t Print::print(double n, int digits) {
+    return printf("%.*f", digits, n);
+}
+
+HardwareSerial::HardwareSerial(int _uartNum) : uartNum(_uartNum) {
+    rxBuffer.setCapacity(rxBufferSize);
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin) {
+    this->baud = baud;
+}
+
+size_t HardwareSerial::setRxBufferSize(size_t size) {
+    rxBufferSize = size;
+    rxBuffer.setCapacity(size);
+
+    return size;
+}
+
+size_t HardwareSerial::setTxBufferSize(size_t size) {
+    txBufferSize = size;
+
+    return size;
+}
+
+int HardwareSerial::available() {
+    sim::consume(1);
+
+    return rxBuffer.size();
+}
+
+int HardwareSerial::peek() {
+    return rxBuffer.empty() ? -1 : rxBuffer.front();
+}
+
+int HardwareSerial::read() {
+    if (rxBuffer.empty()) {
+        return -1;
+    }
+
+    int c = rxBuffer.front();
+    rxBuffer.pop_front();
+
+    return c;
+}
+
+size_t HardwareSerial::read(uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && !rxBuffer.empty()) {
+        buffer[n++] = rxBuffer.front();
+        rxBuffer.pop_front();
+    }
+
+    return n;
+}
+
+size_t HardwareSerial::txQueued() {
+    uint64_t nowNs = sim::now() * 1000;
+
+    if (txFreeNs <= nowNs) {
+        return 0;
+    }
+
+    return (txFreeNs - nowNs + byteNs() - 1) / byteNs();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    sim::AllocPause pause;     // The bytes on the simulated wire
+
+    for (size_t i = 0; i < size; i++) {
+        // The driver blocks until there is room in the FIFO
+        while (txQueued() >= txCapacity()) {
+            sim::sleep((byteNs() + 999) / 1000);
+        }
+
+        uint64_t nowNs = sim::now() * 1000;
+        txFreeNs = (txFreeNs > nowNs ? txFreeNs : nowNs) + byteNs();
+        txLine.push_back(std::make_pair(txFreeNs, buffer[i]));
+    }
+
+    return size;
+}
+
+int HardwareSerial::availableForWrite() {
+    return txCapacity() - txQueued();
+}
+
+void HardwareSerial::flush() {
+    uint64_t nowNs = sim::now() * 1000;
+
+    if (txFreeNs > nowNs) {
+        sim::sleep((txFreeNs - nowNs + 999) / 1000);
+    }
+}
+
+uint64_t HardwareSerial::simReceive(const uint8_t *data, size_t len) {
+    uint64_t nowNs = sim::now() * 1000;
+
+    if (rxNextNs < nowNs) {
+        rxNextNs = nowNs;
+    }
+    for (size_t i = 0; i < len; i++) {
+        rxNextNs += byteNs();
+        uint8_t c = data[i];
+        sim::schedule((rxNextNs + 999) / 1000 - sim::now(), [this, c] {
+            if (rxBuffer.size() < rxBufferSize) {
+                rxBuffer.push_back(c);
+            } else {
+                rxOverflows++;
+            }
+        });
+    }
+
+    return (rxNextNs + 999) / 1000;
+}
+
+size_t HardwareSerial::simInject(const uint8_t *data, size_t len) {
+    size_t n = 0;
+    while (n < len && rxBuffer.size() < rxBufferSize) {
+        rxBuffer.push_back(data[n++]);
+    }
+    rxOverflows += len - n;
+
+    return n;
+}
+
+std::string HardwareSerial::simTakeOutput() {
+    sim::AllocPause pause;
+    std::string out;
+    uint64_t nowNs = sim::now() * 1000;
+
+    while (!txLine.empty() && txLine.front().first <= nowNs) {
+        out += (char)txLine.front().second;
+        txLine.pop_front();
+    }
+
+    return out;
+}
+
+unsigned long millis() {
+    sim::consume(1);
+
+    return sim::now() / 1000;
+}
+
+unsigned long micros() {
+    sim::consume(1);
+
+    return sim::now();
+}
+
+void delay(uint32_t ms) {
+    sim::sleep((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+    sim::consume(us);   // Busy waits on the real thing
+}
+
+static std::map<uint8_t, int> pinModes;
+static std::map<uint8_t, int> pinLevels;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    pinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    pinLevels[pin] = value;
+}
+
+int digitalRead(uint8_t pin) {
+    auto level = pinLevels.find(pin);
+    if (level != pinLevels.end()) {
+        return level->second;
+    }
+
+    return pinModes[pin] == INPUT_PULLUP ? HIGH : LOW;
+}
+
+void simSetPin(uint8_t pin, int value) {
+    pinLevels[pin] = value;
+}
+
+int simGetPin(uint8_t pin) {
+    return digitalRead(pin);
+}
+
+int64_t esp_timer_get_time() {
+    return sim::now();
+}
+
+uint32_t esp_get_free_heap_size() {
+    return 200000;
+}
+
+uint32_t esp_get_minimum_free_heap_size() {
+    return 180000;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+uint32_t esp_random() {
+    // Repeatable from run to run, which is all the simulation needs
+    static uint32_t state = 0x2545f491;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+void esp_restart() {
+    fprintf(stderr, "sim: esp_restart()\n");
+    sim::exit(0);
+}
+
+esp_err_t nvs_flash_init() {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase() {
+    return ESP_OK;
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_OTA_PARTITION_CONFLICT: return "ESP_ERR_OTA_PARTITION_CONFLICT";
+    case ESP_ERR_OTA_VALIDATE_FAILED: return "ESP_ERR_OTA_VALIDATE_FAILED";
+    case ESP_ERR_OTA_ROLLBACK_INVALID_STATE: return "ESP_ERR_OTA_ROLLBACK_INVALID_STATE";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+static std::map<std::string, esp_log_level_t> logLevels;
+
+static esp_log_level_t defaultLogLevel() {
+    static int level = -1;
+    if (level < 0) {
+        const char *env = getenv("SIM_LOG_LEVEL");
+        level = env ? atoi(env) : ESP_LOG_WARN;
+    }
+
+    return (esp_log_level_t)level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    logLevels[tag] = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    auto tagLevel = logLevels.find(tag);
+    esp_log_level_t limit = tagLevel == logLevels.end() ? defaultLogLevel() : tagLevel->second;
+
+    if (level <= limit) {
+        static const char letters[] = "NEWIDV";
+        va_list arg;
+
+        fprintf(stderr, "%c (%llu) %s: ", letters[level], (unsigned long long)sim::now() / 1000, tag);
+        va_start(arg, format);
+        vfprintf(stderr, format, arg);
+        va_end(arg);
+        fputc('\n', stderr);
+    }
+}
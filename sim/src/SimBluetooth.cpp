@@ -0,0 +1,814 @@
+#include <SimBluetooth.h>
+#include <SimRuntime.h>
+#include <SimAlloc.h>
+#include <esp_bt.h>
+#include <esp_bt_main.h>
+#include <esp_bt_device.h>
+#include <esp_gap_bt_api.h>
+#include <esp_spp_api.h>
+#include <esp32-hal-bt.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include <deque>
+#include <vector>
+
+namespace sim {
+
+namespace {
+
+const uint32_t PEER_HANDLE = 0x81;
+const int PEER_FD = 1000;               // What ESP_SPP_OPEN_EVT hands out in VFS mode
+const size_t VFS_RX_BYTES = 4096;       // Held for read() before the peer is held back
+
+BluetoothConfig config;
+LinkCounters counters;
+
+struct {
+    std::string name;
+    esp_bd_addr_t addr = {0};
+    std::string pin;
+    PeerMode mode = PEER_SINK;
+    bool bonded = false;
+    bool inRange = true;
+    std::function<void(const uint8_t*, size_t, uint64_t)> receiver;
+} peer;
+
+bool controllerStarted = false;
+bool bluedroidEnabled = false;
+bool sppInited = false;
+esp_spp_cb_t sppCallback = nullptr;
+esp_bt_gap_cb_t gapCallback = nullptr;
+
+esp_bt_pin_type_t pinType = ESP_BT_PIN_TYPE_VARIABLE;
+std::string fixedPin;
+bool waitingForPin = false;
+bool connected = false;
+uint64_t connection = 0;        // Bumped on every open/close, so stale events can be dropped
+
+uint32_t writeCalls = 0;
+uint32_t inflight = 0;          // Bytes accepted by esp_spp_write but not yet sent
+bool congested = false;
+uint64_t txFreeNs = 0;          // When the device to peer direction is next idle
+uint64_t rxFreeNs = 0;          // When the peer to device direction is next idle
+uint32_t tPoll = ESP_BT_GAP_TPOLL_DFT;
+uint64_t pollRefNs = 0;         // When the device last sent something, which polls the peer
+
+// ESP_SPP_MODE_VFS: received data waits here for read(). Past VFS_RX_BYTES it
+// stays pending, as RFCOMM would stop giving the peer credits.
+bool vfsMode = false;
+std::deque<uint8_t> vfsRx;
+std::deque<std::vector<uint8_t>> vfsPending;
+
+uint64_t nsToDelayUs(uint64_t ns) {
+    uint64_t us = (ns + 999) / 1000;
+
+    return us > now() ? us - now() : 0;
+}
+
+uint64_t transmitNs(size_t len) {
+    return (uint64_t)len * 1000000000ULL / config.bytesPerSec;
+}
+
+// Device to peer, including the tries lost to bit errors
+uint64_t airNs(size_t len) {
+    double ns = transmitNs(len) + config.writeOverheadUs * 1000.0;
+
+    if (config.bitErrorPpm > 0) {
+        ns /= pow(1.0 - config.bitErrorPpm / 1000000.0, 8.0 * len);
+    }
+
+    return (uint64_t)ns;
+}
+
+// When the peer may start sending data it has at atNs
+uint64_t pollNs(uint64_t atNs) {
+    uint64_t intervalNs = tPoll * 625000ULL;
+
+    if (tPoll <= ESP_BT_GAP_TPOLL_DFT || atNs <= pollRefNs) {
+        return atNs;    // Polled often enough, or while the device is sending
+    }
+
+    return pollRefNs + (atNs - pollRefNs + intervalNs - 1) / intervalNs * intervalNs;
+}
+
+bool isPeer(const uint8_t *addr) {
+    return !peer.name.empty() && memcmp(addr, peer.addr, ESP_BD_ADDR_LEN) == 0;
+}
+
+void sppEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t &param) {
+    if (sppCallback) {
+        sppCallback(event, &param);
+    }
+}
+
+void gapEvent(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t &param) {
+    if (gapCallback) {
+        gapCallback(event, &param);
+    }
+}
+
+void open(uint64_t delayUs) {
+    uint64_t attempt = connection;
+
+    schedule(delayUs, [attempt] {
+        if (attempt != connection) {
+            return;
+        }
+        connected = true;
+        connection++;
+        inflight = 0;
+        congested = false;
+        tPoll = ESP_BT_GAP_TPOLL_DFT;
+        vfsRx.clear();
+        vfsPending.clear();
+
+        esp_spp_cb_param_t param = {};
+        param.open.status = ESP_SPP_SUCCESS;
+        param.open.handle = PEER_HANDLE;
+        param.open.fd = vfsMode ? PEER_FD : -1;
+        memcpy(param.open.rem_bda, peer.addr, ESP_BD_ADDR_LEN);
+        sppEvent(ESP_SPP_OPEN_EVT, param);
+    });
+}
+
+void authComplete(uint64_t delayUs, bool success) {
+    schedule(delayUs, [success] {
+        esp_bt_gap_cb_param_t gap = {};
+        memcpy(gap.auth_cmpl.bda, peer.addr, ESP_BD_ADDR_LEN);
+        gap.auth_cmpl.stat = success ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_AUTH_FAILURE;
+        strncpy((char*)gap.auth_cmpl.device_name, peer.name.c_str(), ESP_BT_GAP_MAX_BDNAME_LEN);
+        gapEvent(ESP_BT_GAP_AUTH_CMPL_EVT, gap);
+
+        if (success) {
+            peer.bonded = true;
+            open(config.openUs);
+        } else {
+            esp_spp_cb_param_t param = {};
+            param.open.status = ESP_SPP_FAILURE;
+            sppEvent(ESP_SPP_OPEN_EVT, param);
+        }
+    });
+}
+
+void close(uint64_t delayUs, bool byRemote) {
+    schedule(delayUs, [byRemote] {
+        if (!connected) {
+            return;
+        }
+        connected = false;
+        connection++;
+
+        esp_spp_cb_param_t param = {};
+        param.close.status = ESP_SPP_SUCCESS;
+        param.close.handle = PEER_HANDLE;
+        param.close.async = byRemote;
+        sppEvent(ESP_SPP_CLOSE_EVT, param);
+
+        esp_bt_gap_cb_param_t gap = {};
+        memcpy(gap.acl_disconn_cmpl_stat.bda, peer.addr, ESP_BD_ADDR_LEN);
+        gapEvent(ESP_BT_GAP_ACL_DISCONN_CMPL_STAT_EVT, gap);
+    });
+}
+
+void vfsFill() {
+    while (!vfsPending.empty() && vfsRx.size() + vfsPending.front().size() <= VFS_RX_BYTES) {
+        vfsRx.insert(vfsRx.end(), vfsPending.front().begin(), vfsPending.front().end());
+        vfsPending.pop_front();
+    }
+}
+
+// Data that has arrived from the peer, to the callback or the VFS buffer
+void received(const uint8_t *data, size_t len) {
+    AllocPause pause;
+
+    counters.bytesFromPeer += len;
+    if (vfsMode) {
+        vfsPending.emplace_back(data, data + len);
+        vfsFill();
+        return;
+    }
+
+    esp_spp_cb_param_t param = {};
+    param.data_ind.status = ESP_SPP_SUCCESS;
+    param.data_ind.handle = PEER_HANDLE;
+    param.data_ind.len = len;
+    param.data_ind.data = (uint8_t*)data;
+    sppEvent(ESP_SPP_DATA_IND_EVT, param);
+}
+
+// Deliver data to the peer in MTU sized packets at the given time
+void deliverToPeer(std::vector<uint8_t> data, uint64_t atNs) {
+    AllocPause pause;
+    uint64_t current = connection;
+
+    schedule(nsToDelayUs(atNs), [data, current] {
+        if (current != connection) {
+            return;     // Lost with the link
+        }
+        counters.bytesToPeer += data.size();
+        if (peer.receiver) {
+            peer.receiver(data.data(), data.size(), now());
+        }
+        if (peer.mode == PEER_ECHO) {
+            peerSend(data.data(), data.size());
+        }
+    });
+}
+
+}
+
+BluetoothConfig &bluetooth() {
+    return config;
+}
+
+void setPeer(const char *name, const uint8_t addr[6], const char *pin) {
+    peer.name = name;
+    memcpy(peer.addr, addr, ESP_BD_ADDR_LEN);
+    peer.pin = pin;
+}
+
+void setPeerMode(PeerMode mode) {
+    peer.mode = mode;
+}
+
+void setPeerReceiver(std::function<void(const uint8_t *data, size_t len, uint64_t timeUs)> receiver) {
+    peer.receiver = receiver;
+}
+
+const LinkCounters &linkCounters() {
+    return counters;
+}
+
+void peerSend(const uint8_t *data, size_t len) {
+    AllocPause pause;
+    uint64_t current = connection;
+    uint64_t nowNs = now() * 1000;
+
+    if (!connected) {
+        return;
+    }
+
+    // Once it has been polled, the device keeps polling while it sends
+    rxFreeNs = pollNs(rxFreeNs > nowNs ? rxFreeNs : nowNs);
+    for (size_t offset = 0; offset < len; offset += config.mtu) {
+        size_t chunk = len - offset < config.mtu ? len - offset : config.mtu;
+        std::vector<uint8_t> packet(data + offset, data + offset + chunk);
+
+        rxFreeNs = (rxFreeNs > nowNs ? rxFreeNs : nowNs) + transmitNs(chunk);
+        schedule(nsToDelayUs(rxFreeNs + config.latencyUs * 1000), [packet, current] {
+            if (current != connection) {
+                return;
+            }
+            received(packet.data(), packet.size());
+        });
+    }
+}
+
+void peerDeliverNow(const uint8_t *data, size_t len) {
+    if (!connected) {
+        return;
+    }
+    received(data, len);
+}
+
+void inquiryResultNow(const char *name, const uint8_t addr[6], bool eir) {
+    uint8_t data[ESP_BT_GAP_EIR_DATA_LEN] = {0};
+    uint8_t len = strlen(name);
+    esp_bt_gap_dev_prop_t prop;
+
+    if (eir) {
+        // <length> <type> <name>, as a device puts it in its EIR
+        data[0] = len + 1;
+        data[1] = ESP_BT_EIR_TYPE_CMPL_LOCAL_NAME;
+        memcpy(&data[2], name, len);
+        prop.type = ESP_BT_GAP_DEV_PROP_EIR;
+        prop.len = len + 2;
+        prop.val = data;
+    } else {
+        prop.type = ESP_BT_GAP_DEV_PROP_BDNAME;
+        prop.len = len;
+        prop.val = (void*)name;
+    }
+
+    esp_bt_gap_cb_param_t param = {};
+    memcpy(param.disc_res.bda, addr, ESP_BD_ADDR_LEN);
+    param.disc_res.num_prop = 1;
+    param.disc_res.prop = &prop;
+    gapEvent(ESP_BT_GAP_DISC_RES_EVT, param);
+}
+
+bool peerConnected() {
+    return connected;
+}
+
+void peerDisconnect() {
+    close(0, true);
+}
+
+void setPeerInRange(bool inRange) {
+    peer.inRange = inRange;
+    if (!inRange) {
+        close(0, true);
+    }
+}
+
+}
+
+using namespace sim;
+
+bool btStarted() {
+    return controllerStarted;
+}
+
+bool btStart() {
+    return btStartMode(BT_MODE_BTDM);
+}
+
+bool btStartMode(bt_mode mode) {
+    if (!controllerStarted) {
+        sleep(config.controllerStartUs);
+        controllerStarted = true;
+    }
+
+    return true;
+}
+
+bool btStop() {
+    controllerStarted = false;
+
+    return true;
+}
+
+esp_err_t esp_bt_controller_disable() {
+    controllerStarted = false;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init() {
+    if (!controllerStarted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sleep(config.bluedroidInitUs);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable() {
+    if (!controllerStarted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sleep(config.bluedroidEnableUs);
+    bluedroidEnabled = true;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_disable() {
+    bluedroidEnabled = false;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_deinit() {
+    return ESP_OK;
+}
+
+const uint8_t *esp_bt_dev_get_address() {
+    static const esp_bd_addr_t self = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+
+    return self;
+}
+
+esp_err_t esp_bt_dev_set_device_name(const char *name) {
+    return bluedroidEnabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_bt_gap_set_device_name(const char *name) {
+    return bluedroidEnabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_bt_gap_register_callback(esp_bt_gap_cb_t callback) {
+    gapCallback = callback;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode, esp_bt_discovery_mode_t d_mode) {
+    return bluedroidEnabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_bt_gap_start_discovery(esp_bt_inq_mode_t mode, uint8_t inq_len, uint8_t num_rsps) {
+    if (!bluedroidEnabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    schedule(0, [] {
+        esp_bt_gap_cb_param_t param = {};
+        param.disc_st_chg.state = ESP_BT_GAP_DISCOVERY_STARTED;
+        gapEvent(ESP_BT_GAP_DISC_STATE_CHANGED_EVT, param);
+    });
+
+    if (!peer.name.empty() && peer.inRange) {
+        schedule(config.inquiryResultUs, [] {
+            std::string name = peer.name;
+            esp_bt_gap_dev_prop_t prop;
+            prop.type = ESP_BT_GAP_DEV_PROP_BDNAME;
+            prop.len = name.size();
+            prop.val = (void*)name.data();
+
+            esp_bt_gap_cb_param_t param = {};
+            memcpy(param.disc_res.bda, peer.addr, ESP_BD_ADDR_LEN);
+            param.disc_res.num_prop = 1;
+            param.disc_res.prop = &prop;
+            gapEvent(ESP_BT_GAP_DISC_RES_EVT, param);
+        });
+    }
+
+    schedule(config.inquiryUs, [] {
+        esp_bt_gap_cb_param_t param = {};
+        param.disc_st_chg.state = ESP_BT_GAP_DISCOVERY_STOPPED;
+        gapEvent(ESP_BT_GAP_DISC_STATE_CHANGED_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_cancel_discovery() {
+    return ESP_OK;
+}
+
+uint8_t *esp_bt_gap_resolve_eir_data(uint8_t *eir, uint8_t type, uint8_t *length) {
+    uint8_t *p = eir;
+
+    while (p && p < eir + ESP_BT_GAP_EIR_DATA_LEN && p[0] != 0) {
+        if (p[1] == type) {
+            if (length) {
+                *length = p[0] - 1;
+            }
+            return p + 2;
+        }
+        p += p[0] + 1;
+    }
+
+    if (length) {
+        *length = 0;
+    }
+
+    return nullptr;
+}
+
+esp_err_t esp_bt_gap_set_pin(esp_bt_pin_type_t pin_type, uint8_t pin_code_len, esp_bt_pin_code_t pin_code) {
+    pinType = pin_type;
+    fixedPin.assign((const char*)pin_code, pin_type == ESP_BT_PIN_TYPE_FIXED ? pin_code_len : 0);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_pin_reply(esp_bd_addr_t bd_addr, bool accept, uint8_t pin_code_len, esp_bt_pin_code_t pin_code) {
+    if (waitingForPin && isPeer(bd_addr)) {
+        waitingForPin = false;
+        authComplete(config.authUs, accept && peer.pin == std::string((const char*)pin_code, pin_code_len));
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_read_rssi_delta(esp_bd_addr_t remote_addr) {
+    if (!connected || !isPeer(remote_addr)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    schedule(config.writeEvtUs, [] {
+        esp_bt_gap_cb_param_t param = {};
+        memcpy(param.read_rssi_delta.bda, peer.addr, ESP_BD_ADDR_LEN);
+        param.read_rssi_delta.stat = ESP_BT_STATUS_SUCCESS;
+        param.read_rssi_delta.rssi_delta = config.rssiDelta;
+        gapEvent(ESP_BT_GAP_READ_RSSI_DELTA_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_qos(esp_bd_addr_t remote_bda, uint32_t t_poll) {
+    if (!connected || !isPeer(remote_bda)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (t_poll < ESP_BT_GAP_TPOLL_MIN || t_poll > ESP_BT_GAP_TPOLL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The request itself polls the peer, so it doesn't wait for the interval
+    uint64_t current = connection;
+    schedule(config.lmpUs, [t_poll, current] {
+        if (current != connection) {
+            return;
+        }
+        tPoll = t_poll;
+        pollRefNs = now() * 1000;
+
+        esp_bt_gap_cb_param_t param = {};
+        param.qos_cmpl.stat = ESP_BT_STATUS_SUCCESS;
+        memcpy(param.qos_cmpl.bda, peer.addr, ESP_BD_ADDR_LEN);
+        param.qos_cmpl.t_poll = t_poll;
+        gapEvent(ESP_BT_GAP_QOS_CMPL_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+int esp_bt_gap_get_bond_device_num() {
+    return peer.bonded ? 1 : 0;
+}
+
+esp_err_t esp_bt_gap_get_bond_device_list(int *dev_num, esp_bd_addr_t *dev_list) {
+    if (*dev_num > 0 && peer.bonded) {
+        memcpy(dev_list[0], peer.addr, ESP_BD_ADDR_LEN);
+        *dev_num = 1;
+    } else {
+        *dev_num = 0;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_remove_bond_device(esp_bd_addr_t bd_addr) {
+    if (isPeer(bd_addr)) {
+        peer.bonded = false;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_register_callback(esp_spp_cb_t callback) {
+    sppCallback = callback;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_init(esp_spp_mode_t mode) {
+    esp_spp_cfg_t cfg = {};
+    cfg.mode = mode;
+
+    return esp_spp_enhanced_init(&cfg);
+}
+
+esp_err_t esp_spp_enhanced_init(const esp_spp_cfg_t *cfg) {
+    if (!bluedroidEnabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    vfsMode = cfg->mode == ESP_SPP_MODE_VFS;
+
+    schedule(config.sppInitUs, [] {
+        sppInited = true;
+
+        esp_spp_cb_param_t param = {};
+        param.init.status = ESP_SPP_SUCCESS;
+        sppEvent(ESP_SPP_INIT_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_deinit() {
+    schedule(0, [] {
+        sppInited = false;
+
+        esp_spp_cb_param_t param = {};
+        param.uninit.status = ESP_SPP_SUCCESS;
+        sppEvent(ESP_SPP_UNINIT_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_start_discovery(esp_bd_addr_t bd_addr) {
+    if (!sppInited) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bool found = isPeer(bd_addr) && peer.inRange;
+    schedule(found ? config.sdpUs : config.pageTimeoutUs, [found] {
+        esp_spp_cb_param_t param = {};
+        if (found) {
+            param.disc_comp.status = ESP_SPP_SUCCESS;
+            param.disc_comp.scn_num = 1;
+            param.disc_comp.scn[0] = 1;
+            param.disc_comp.service_name[0] = "SPP";
+        } else {
+            param.disc_comp.status = ESP_SPP_FAILURE;
+        }
+        sppEvent(ESP_SPP_DISCOVERY_COMP_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_connect(esp_spp_sec_t sec_mask, esp_spp_role_t role, uint8_t remote_scn, esp_bd_addr_t peer_bd_addr) {
+    if (!sppInited) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    schedule(0, [] {
+        esp_spp_cb_param_t param = {};
+        param.cl_init.status = ESP_SPP_SUCCESS;
+        param.cl_init.handle = PEER_HANDLE;
+        sppEvent(ESP_SPP_CL_INIT_EVT, param);
+    });
+
+    if (!isPeer(peer_bd_addr)) {
+        schedule(config.pinReqUs, [] {
+            esp_spp_cb_param_t param = {};
+            param.open.status = ESP_SPP_FAILURE;
+            sppEvent(ESP_SPP_OPEN_EVT, param);
+        });
+    } else if (!(sec_mask & ESP_SPP_SEC_AUTHENTICATE)) {
+        open(config.openUs);
+    } else if (peer.bonded) {
+        // The stored link key is used, no PIN exchange
+        authComplete(config.authUs, true);
+    } else if (pinType == ESP_BT_PIN_TYPE_FIXED) {
+        authComplete(config.pinReqUs + config.authUs, fixedPin == peer.pin);
+    } else {
+        schedule(config.pinReqUs, [] {
+            waitingForPin = true;
+
+            esp_bt_gap_cb_param_t param = {};
+            memcpy(param.pin_req.bda, peer.addr, ESP_BD_ADDR_LEN);
+            param.pin_req.min_16_digit = false;
+            gapEvent(ESP_BT_GAP_PIN_REQ_EVT, param);
+        });
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_disconnect(uint32_t handle) {
+    if (!connected || handle != PEER_HANDLE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    close(config.closeUs, false);
+
+    return ESP_OK;
+}
+
+namespace sim {
+
+namespace {
+
+// As much of the data as the link's buffer has room for
+uint32_t linkWrite(const uint8_t *p_data, uint32_t len) {
+    uint32_t room = inflight < config.txBufferBytes ? config.txBufferBytes - inflight : 0;
+    uint32_t accepted = len < room ? len : room;
+    uint64_t current = connection;
+
+    counters.writes++;
+    if (accepted < len) {
+        counters.partialWrites++;
+    }
+
+    if (accepted > 0) {
+        uint64_t nowNs = now() * 1000;
+        std::vector<uint8_t> data(p_data, p_data + accepted);
+
+        inflight += accepted;
+        txFreeNs = (txFreeNs > nowNs ? txFreeNs : nowNs) + airNs(accepted);
+        pollRefNs = txFreeNs;
+
+        // Sent: the space comes back, and congestion clears at half full
+        schedule(nsToDelayUs(txFreeNs), [accepted, current] {
+            if (current != connection) {
+                return;
+            }
+            inflight -= accepted;
+            if (congested && inflight <= config.txBufferBytes / 2) {
+                congested = false;
+                if (vfsMode) {
+                    return;     // write() just starts taking data again
+                }
+
+                esp_spp_cb_param_t param = {};
+                param.cong.status = ESP_SPP_SUCCESS;
+                param.cong.handle = PEER_HANDLE;
+                param.cong.cong = false;
+                sppEvent(ESP_SPP_CONG_EVT, param);
+            }
+        });
+
+        deliverToPeer(data, txFreeNs + config.latencyUs * 1000);
+    }
+
+    bool cong = inflight >= config.txBufferBytes;
+    if (cong && !congested) {
+        congested = true;
+        counters.congestions++;
+    }
+
+    return accepted;
+}
+
+}
+
+}
+
+esp_err_t esp_spp_write(uint32_t handle, int len, uint8_t *p_data) {
+    AllocPause pause;
+
+    if (!connected || handle != PEER_HANDLE || vfsMode) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bool fail = config.failWriteEvery > 0 && ++writeCalls % config.failWriteEvery == 0;
+    uint32_t accepted = fail ? 0 : linkWrite(p_data, len);
+    uint64_t current = connection;
+
+    schedule(config.writeEvtUs, [fail, accepted, current] {
+        if (current != connection) {
+            return;
+        }
+
+        // Congestion as it is now, so that it can't contradict an ESP_SPP_CONG_EVT sent meanwhile
+        esp_spp_cb_param_t param = {};
+        param.write.status = fail ? ESP_SPP_FAILURE : ESP_SPP_SUCCESS;
+        param.write.handle = PEER_HANDLE;
+        param.write.len = accepted;
+        param.write.cong = congested;
+        sppEvent(ESP_SPP_WRITE_EVT, param);
+    });
+
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_vfs_register() {
+    return vfsMode ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+/*
+ * The connection's file descriptor in VFS mode. These stand in for the C
+ * library's read, write and select; any other descriptor goes straight to
+ * the kernel. read and write don't block, as in the real VFS driver.
+ */
+extern "C" {
+
+ssize_t read(int fd, void *buf, size_t count) {
+    if (fd != PEER_FD) {
+        return syscall(SYS_read, fd, buf, count);
+    }
+    if (!connected) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    AllocPause pause;
+    size_t n = count < vfsRx.size() ? count : vfsRx.size();
+    std::copy(vfsRx.begin(), vfsRx.begin() + n, (uint8_t*)buf);
+    vfsRx.erase(vfsRx.begin(), vfsRx.begin() + n);
+    vfsFill();
+
+    return n;
+}
+
+ssize_t __read_chk(int fd, void *buf, size_t count, size_t bufLen) {
+    return read(fd, buf, count < bufLen ? count : bufLen);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    if (fd != PEER_FD) {
+        return syscall(SYS_write, fd, buf, count);
+    }
+    if (!connected) {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    AllocPause pause;
+    uint32_t accepted = linkWrite((const uint8_t*)buf, count);
+    if (accepted == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return accepted;
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if (nfds != PEER_FD + 1 || readfds == nullptr || !FD_ISSET(PEER_FD, readfds) || writefds || exceptfds) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    uint64_t timeoutUs = timeout ? timeout->tv_sec * 1000000ULL + timeout->tv_usec : UINT64_MAX;
+    if (sim::waitUntil([] { return !connected || !vfsRx.empty(); }, timeoutUs)) {
+        return 1;   // Readable, or read will report the link as gone
+    }
+    FD_ZERO(readfds);
+
+    return 0;
+}
+
+}
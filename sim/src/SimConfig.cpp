@@ -0,0 +1,35 @@
+#include <EEPROMConfig.h>
+#include <SimFlash.h>
+#include <SimRuntime.h>
+#include <map>
+#include <string>
+
+namespace {
+
+std::map<std::string, String> image;        // The EEPROM's RAM image
+std::map<std::string, String> stored;       // As of the last commit
+int commitCount = 0;
+
+}
+
+void BaseConfigItem::put() const {
+    image[name] = toString();
+}
+
+void EEPROMConfig::commit() {
+    if (sim::flash().writeBytesPerSec > 0) {
+        sim::consume((uint64_t)SIM_EEPROM_SIZE * 1000000 / sim::flash().writeBytesPerSec);
+    }
+    stored = image;
+    commitCount++;
+}
+
+int EEPROMConfig::commits() {
+    return commitCount;
+}
+
+String EEPROMConfig::committed(const char *name) {
+    auto it = stored.find(name);
+
+    return it == stored.end() ? String() : it->second;
+}
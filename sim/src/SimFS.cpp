@@ -0,0 +1,329 @@
+#include <LittleFS.h>
+#include <SimFlash.h>
+#include <SimRuntime.h>
+#include <SimAlloc.h>
+#include <map>
+#include <vector>
+
+fs::LittleFSFS LittleFS;
+
+namespace sim {
+
+namespace {
+
+FlashConfig config;
+
+struct Node {
+    bool dir = false;
+    std::shared_ptr<std::vector<uint8_t>> data;
+};
+
+std::map<std::string, Node> nodes = {{"/", Node{true, nullptr}}};
+bool mounted = false;
+
+std::string normalize(const char *path) {
+    std::string p = path && path[0] == '/' ? path : std::string("/") + (path ? path : "");
+    while (p.size() > 1 && p.back() == '/') {
+        p.pop_back();
+    }
+    return p;
+}
+
+std::string parentOf(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+size_t used() {
+    size_t total = 0;
+    for (auto &node : nodes) {
+        total += node.second.dir ? 0 : node.second.data->size();
+    }
+    return total;
+}
+
+void cost(size_t bytes, uint32_t bytesPerSec) {
+    if (bytes > 0 && bytesPerSec > 0) {
+        consume(((uint64_t)bytes * 1000000 + bytesPerSec - 1) / bytesPerSec);
+    }
+}
+
+}
+
+FlashConfig &flash() {
+    return config;
+}
+
+}
+
+using namespace sim;
+
+namespace fs {
+
+class FileImpl {
+public:
+    std::string path;
+    bool dir = false;
+    std::shared_ptr<std::vector<uint8_t>> data;
+    size_t pos = 0;
+    bool canRead = false;
+    bool canWrite = false;
+    bool append = false;
+    bool open = true;
+    std::vector<std::string> children;
+    size_t nextChild = 0;
+};
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    if (!*this || !impl->canWrite || impl->dir) {
+        return 0;
+    }
+    AllocPause pause;
+    if (used() + size > config.partitionBytes) {
+        size = config.partitionBytes > used() ? config.partitionBytes - used() : 0;     // Full
+    }
+    std::vector<uint8_t> &data = *impl->data;
+    if (impl->append) {
+        impl->pos = data.size();
+    }
+    if (size == 0) {
+        return 0;
+    }
+    if (impl->pos + size > data.size()) {
+        data.resize(impl->pos + size);
+    }
+    memcpy(&data[impl->pos], buf, size);
+    impl->pos += size;
+    cost(size, config.writeBytesPerSec);
+
+    return size;
+}
+
+int File::available() {
+    return *this && !impl->dir && impl->canRead ? impl->data->size() - impl->pos : 0;
+}
+
+int File::read() {
+    uint8_t c;
+
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek() {
+    return available() > 0 ? (*impl->data)[impl->pos] : -1;
+}
+
+void File::flush() {
+}
+
+size_t File::read(uint8_t *buf, size_t size) {
+    size_t n = available();
+
+    n = n < size ? n : size;
+    if (n > 0) {
+        memcpy(buf, &(*impl->data)[impl->pos], n);
+        impl->pos += n;
+        cost(n, config.readBytesPerSec);
+    }
+
+    return n;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    if (!*this || impl->dir) {
+        return false;
+    }
+    size_t base = mode == SeekSet ? 0 : mode == SeekCur ? impl->pos : impl->data->size();
+    if (base + pos > impl->data->size()) {
+        return false;
+    }
+    impl->pos = base + pos;
+
+    return true;
+}
+
+size_t File::position() const {
+    return *this ? impl->pos : 0;
+}
+
+size_t File::size() const {
+    return *this && !impl->dir ? impl->data->size() : 0;
+}
+
+void File::close() {
+    if (impl) {
+        impl->open = false;
+        impl.reset();
+    }
+}
+
+File::operator bool() const {
+    return impl && impl->open;
+}
+
+const char *File::path() const {
+    return *this ? impl->path.c_str() : nullptr;
+}
+
+const char *File::name() const {
+    if (!*this) {
+        return nullptr;
+    }
+    return impl->path.c_str() + impl->path.rfind('/') + 1;
+}
+
+bool File::isDirectory() {
+    return *this && impl->dir;
+}
+
+File File::openNextFile(const char *mode) {
+    if (!isDirectory() || impl->nextChild >= impl->children.size()) {
+        return File();
+    }
+
+    return LittleFS.open(impl->children[impl->nextChild++].c_str(), mode);
+}
+
+void File::rewindDirectory() {
+    if (isDirectory()) {
+        impl->nextChild = 0;
+    }
+}
+
+File FS::open(const char *path, const char *mode, const bool create) {
+    AllocPause pause;
+    std::string p = normalize(path);
+    auto it = nodes.find(p);
+    bool plus = strchr(mode, '+') != nullptr;
+
+    if (!mounted) {
+        return File();
+    }
+    if (it == nodes.end()) {
+        if (mode[0] == 'r') {
+            return File();
+        }
+        if (nodes.count(parentOf(p)) == 0) {
+            if (!create) {
+                return File();
+            }
+            mkdir(parentOf(p).c_str());
+        }
+        Node node;
+        node.data = std::make_shared<std::vector<uint8_t>>();
+        it = nodes.emplace(p, node).first;
+    }
+
+    auto impl = std::make_shared<FileImpl>();
+    impl->path = p;
+    impl->dir = it->second.dir;
+    impl->data = it->second.data;
+    if (impl->dir) {
+        for (auto &node : nodes) {
+            if (node.first != p && parentOf(node.first) == p) {
+                impl->children.push_back(node.first);
+            }
+        }
+        return File(impl);
+    }
+    impl->canRead = mode[0] == 'r' || plus;
+    impl->canWrite = mode[0] != 'r' || plus;
+    impl->append = mode[0] == 'a';
+    if (mode[0] == 'w') {
+        impl->data->clear();
+    }
+
+    return File(impl);
+}
+
+bool FS::exists(const char *path) {
+    return mounted && nodes.count(normalize(path)) > 0;
+}
+
+bool FS::remove(const char *path) {
+    auto it = nodes.find(normalize(path));
+    if (!mounted || it == nodes.end() || it->second.dir) {
+        return false;
+    }
+    nodes.erase(it);
+
+    return true;
+}
+
+bool FS::rename(const char *from, const char *to) {
+    AllocPause pause;
+    auto it = nodes.find(normalize(from));
+    if (!mounted || it == nodes.end() || it->second.dir || nodes.count(parentOf(normalize(to))) == 0) {
+        return false;
+    }
+    Node node = it->second;
+    nodes.erase(it);
+    nodes[normalize(to)] = node;
+
+    return true;
+}
+
+bool FS::mkdir(const char *path) {
+    AllocPause pause;
+    std::string p = normalize(path);
+    if (!mounted) {
+        return false;
+    }
+    if (nodes.count(p)) {
+        return nodes[p].dir;
+    }
+    if (nodes.count(parentOf(p)) == 0 && !mkdir(parentOf(p).c_str())) {
+        return false;
+    }
+    nodes[p] = Node{true, nullptr};
+
+    return true;
+}
+
+bool FS::rmdir(const char *path) {
+    std::string p = normalize(path);
+    auto it = nodes.find(p);
+    if (!mounted || p == "/" || it == nodes.end() || !it->second.dir) {
+        return false;
+    }
+    for (auto &node : nodes) {
+        if (node.first != p && parentOf(node.first) == p) {
+            return false;
+        }
+    }
+    nodes.erase(it);
+
+    return true;
+}
+
+bool LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel) {
+    mounted = !config.failMount;
+
+    return mounted;
+}
+
+void LittleFSFS::end() {
+    mounted = false;
+}
+
+bool LittleFSFS::format() {
+    AllocPause pause;
+    nodes.clear();
+    nodes["/"] = Node{true, nullptr};
+
+    return true;
+}
+
+size_t LittleFSFS::totalBytes() {
+    return config.partitionBytes;
+}
+
+size_t LittleFSFS::usedBytes() {
+    return used();
+}
+
+}
@@ -0,0 +1,219 @@
+#include <freertos/FreeRTOS.h>
+#include <SimRuntime.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+// Storage is allocated up front, as FreeRTOS does, so sends and receives don't allocate
+struct SimQueue {
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t count;          // Items waiting, or the count of a semaphore
+    UBaseType_t head;
+    std::vector<uint8_t> data;
+
+    bool empty() { return count == 0; }
+    bool full() { return count >= length; }
+    UBaseType_t waiting() { return count; }
+    uint8_t *slot(UBaseType_t index) { return &data[((head + index) % length) * itemSize]; }
+};
+
+static std::unordered_map<TaskHandle_t, uint32_t> notifications;
+
+static uint64_t ticksToUs(TickType_t ticks) {
+    return ticks == portMAX_DELAY ? UINT64_MAX : (uint64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+BaseType_t xPortGetCoreID() {
+    return 0;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    sim::TaskRef task = sim::spawn(name, [fn, arg] { fn(arg); });
+    if (handle) {
+        *handle = task;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(fn, name, stackDepth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    sim::endTask(task ? task : sim::currentTask());
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (ticks == 0) {
+        sim::yield();
+    } else {
+        sim::sleep(ticksToUs(ticks));
+    }
+}
+
+TickType_t xTaskGetTickCount() {
+    return sim::now() / (portTICK_PERIOD_MS * 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return sim::currentTask();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 4096;    // Stack use isn't simulated
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+}
+
+void taskYIELD() {
+    sim::yield();
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    notifications[task]++;
+
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    TaskHandle_t self = sim::currentTask();
+
+    sim::waitUntil([self] { return notifications[self] > 0; }, ticksToUs(ticks));
+
+    uint32_t value = notifications[self];
+    if (value > 0) {
+        notifications[self] = clearOnExit ? 0 : value - 1;
+    }
+
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    SimQueue *queue = new SimQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->count = 0;
+    queue->head = 0;
+    queue->data.resize((size_t)length * itemSize);
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void *item, TickType_t ticks, bool front) {
+    if (!sim::waitUntil([queue] { return !queue->full(); }, ticksToUs(ticks))) {
+        return errQUEUE_FULL;
+    }
+
+    if (queue->itemSize == 0) {
+        queue->count++;
+    } else if (front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        queue->count++;
+        memcpy(queue->slot(0), item, queue->itemSize);
+    } else {
+        memcpy(queue->slot(queue->count), item, queue->itemSize);
+        queue->count++;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    return queueSend(queue, item, ticks, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    return queueSend(queue, item, 0, false);
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void *item, TickType_t ticks, bool remove) {
+    if (!sim::waitUntil([queue] { return !queue->empty(); }, ticksToUs(ticks))) {
+        return errQUEUE_EMPTY;
+    }
+
+    if (queue->itemSize != 0) {
+        memcpy(item, queue->slot(0), queue->itemSize);
+    }
+    if (remove) {
+        if (queue->itemSize != 0) {
+            queue->head = (queue->head + 1) % queue->length;
+        }
+        queue->count--;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    return queueReceive(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+    return queueReceive(queue, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    return queue->waiting();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    return queue->length - queue->waiting();
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    queue->head = 0;
+    queue->count = 0;
+
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    SemaphoreHandle_t semaphore = xQueueCreate(1, 0);
+    semaphore->count = 1;
+
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    SemaphoreHandle_t semaphore = xQueueCreate(maxCount, 0);
+    semaphore->count = initialCount;
+
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    vQueueDelete(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    return queueReceive(semaphore, nullptr, ticks, true);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return queueSend(semaphore, nullptr, 0, false);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken) {
+    return queueSend(semaphore, nullptr, 0, false);
+}
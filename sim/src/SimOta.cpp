@@ -0,0 +1,161 @@
+#include <esp_ota_ops.h>
+#include <SimFlash.h>
+#include <SimRuntime.h>
+
+namespace sim {
+
+namespace {
+
+// app0 and app1 in default.csv
+const esp_partition_t partitions[2] = {
+    {0x10000, 0x140000, "app0"},
+    {0x150000, 0x140000, "app1"}
+};
+
+std::vector<uint8_t> images[2];
+esp_ota_img_states_t states[2] = {ESP_OTA_IMG_VALID, ESP_OTA_IMG_UNDEFINED};
+int bootSlot = 0;
+bool stateKnown = false;
+
+int slotOf(const esp_partition_t *partition) {
+    return partition == &partitions[1] ? 1 : partition == &partitions[0] ? 0 : -1;
+}
+
+struct Open {
+    int slot = -1;
+    size_t expected = 0;
+} open;
+esp_ota_handle_t nextHandle = 1;
+esp_ota_handle_t openHandle = 0;
+
+void checkState() {
+    if (!stateKnown) {
+        states[0] = flash().pendingVerify ? ESP_OTA_IMG_PENDING_VERIFY : ESP_OTA_IMG_VALID;
+        stateKnown = true;
+    }
+}
+
+}
+
+const std::vector<uint8_t> &otaImage(int slot) {
+    return images[slot];
+}
+
+int otaBootSlot() {
+    return bootSlot;
+}
+
+}
+
+using namespace sim;
+
+const esp_partition_t *esp_ota_get_running_partition() {
+    return &partitions[0];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition() {
+    return &partitions[bootSlot];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    return &partitions[1];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle) {
+    int slot = slotOf(partition);
+    if (slot < 0) {
+        return ESP_ERR_INVALID_ARG;
+    } else if (slot == 0) {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    } else if (image_size != OTA_SIZE_UNKNOWN && image_size != OTA_WITH_SEQUENTIAL_WRITES && image_size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    images[slot].clear();
+    states[slot] = ESP_OTA_IMG_UNDEFINED;
+    open.slot = slot;
+    openHandle = *out_handle = nextHandle++;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size) {
+    if (handle != openHandle || open.slot < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::vector<uint8_t> &image = images[open.slot];
+    if (image.size() + size > partitions[open.slot].size) {
+        return ESP_ERR_INVALID_SIZE;
+    } else if (image.empty() && size > 0 && ((const uint8_t*)data)[0] != 0xe9) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;     // Not an app image
+    }
+
+    // Erasing a sector ahead and programming it, at the LittleFS write rate
+    if (flash().writeBytesPerSec > 0) {
+        consume(((uint64_t)size * 1000000 + flash().writeBytesPerSec - 1) / flash().writeBytesPerSec);
+    }
+    image.insert(image.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+    if (handle != openHandle || open.slot < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    int slot = open.slot;
+    open.slot = -1;
+    openHandle = 0;
+
+    // The real one checks the header, segments and appended SHA-256
+    if (images[slot].size() < 24 || images[slot][0] != 0xe9) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    states[slot] = ESP_OTA_IMG_NEW;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle) {
+    if (handle != openHandle || open.slot < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    images[open.slot].clear();
+    open.slot = -1;
+    openHandle = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    int slot = slotOf(partition);
+    if (slot < 0) {
+        return ESP_ERR_INVALID_ARG;
+    } else if (slot != 0 && states[slot] != ESP_OTA_IMG_NEW) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    bootSlot = slot;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state) {
+    int slot = slotOf(partition);
+    if (slot < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    checkState();
+    if (states[slot] == ESP_OTA_IMG_UNDEFINED) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *ota_state = states[slot];
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback() {
+    checkState();
+    states[0] = ESP_OTA_IMG_VALID;
+
+    return ESP_OK;
+}
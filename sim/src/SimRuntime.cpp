@@ -0,0 +1,246 @@
+#include <SimRuntime.h>
+#include <SimAlloc.h>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace sim {
+
+namespace {
+
+// A task gets the CPU for this long before it has to let others run
+const uint64_t SLICE_US = 1000;
+
+struct Task {
+    std::string name;
+    std::condition_variable cv;
+    std::function<bool()> ready;
+    uint64_t deadline = UINT64_MAX;
+    bool blocked = false;
+    bool finished = false;
+};
+
+struct Event {
+    uint64_t time;
+    uint64_t seq;
+    std::function<void()> fn;
+};
+
+struct EventOrder {
+    bool operator()(const Event &a, const Event &b) const {
+        return a.time > b.time || (a.time == b.time && a.seq > b.seq);
+    }
+};
+
+std::mutex mtx;
+std::vector<Task*> tasks;
+Task *running = nullptr;
+uint64_t clock = 0;
+uint64_t sliceStart = 0;
+uint64_t eventSeq = 0;
+int eventDepth = 0;
+std::priority_queue<Event, std::vector<Event>, EventOrder> events;
+
+thread_local Task *self = nullptr;
+
+bool runnable(Task *t) {
+    if (t->finished) {
+        return false;
+    }
+
+    return !t->blocked || t->deadline <= clock || (t->ready && t->ready());
+}
+
+void runDueEvents() {
+    while (!events.empty() && events.top().time <= clock) {
+        std::function<void()> fn = std::move(const_cast<Event&>(events.top()).fn);
+        events.pop();
+        eventDepth++;
+        fn();
+        eventDepth--;
+    }
+}
+
+void switchTo(Task *next) {
+    if (next != self) {
+        std::unique_lock<std::mutex> lock(mtx);
+        running = next;
+        next->cv.notify_one();
+        self->cv.wait(lock, [] { return running == self; });
+    }
+    sliceStart = clock;
+}
+
+// Give the CPU to the next runnable task in round-robin order, with the caller
+// last. If nothing can run, move time on to the next event or timeout.
+void reschedule() {
+    while (true) {
+        size_t n = tasks.size();
+        size_t me = 0;
+        while (tasks[me] != self) {
+            me++;
+        }
+
+        for (size_t k = 1; k <= n; k++) {
+            Task *t = tasks[(me + k) % n];
+            if (runnable(t)) {
+                switchTo(t);
+                return;
+            }
+        }
+
+        uint64_t next = events.empty() ? UINT64_MAX : events.top().time;
+        for (Task *t : tasks) {
+            if (!t->finished && t->blocked && t->deadline < next) {
+                next = t->deadline;
+            }
+        }
+
+        if (next == UINT64_MAX) {
+            fprintf(stderr, "sim: deadlock - every task is blocked for ever\n");
+            exit(2);
+        }
+
+        if (next > clock) {
+            clock = next;
+        }
+        runDueEvents();
+    }
+}
+
+}
+
+void init() {
+    Task *t = new Task();
+    t->name = "main";
+    tasks.push_back(t);
+    running = t;
+    self = t;
+}
+
+uint64_t now() {
+    return clock;
+}
+
+bool inEvent() {
+    return eventDepth > 0;
+}
+
+void consume(uint64_t us) {
+    clock += us;
+    if (eventDepth == 0) {
+        runDueEvents();
+        if (clock - sliceStart >= SLICE_US) {
+            yield();
+        }
+    }
+}
+
+void yield() {
+    if (eventDepth == 0) {
+        reschedule();
+    }
+}
+
+bool waitUntil(std::function<bool()> ready, uint64_t timeoutUs) {
+    if (ready()) {
+        return true;
+    }
+
+    if (timeoutUs == 0) {
+        return false;
+    }
+
+    if (eventDepth > 0) {
+        fprintf(stderr, "sim: blocking call from a stack callback\n");
+        abort();
+    }
+
+    bool result;
+
+    self->blocked = true;
+    self->ready = ready;
+    self->deadline = timeoutUs == UINT64_MAX ? UINT64_MAX : clock + timeoutUs;
+    while (true) {
+        reschedule();
+        if (ready()) {
+            result = true;
+            break;
+        }
+        if (clock >= self->deadline) {
+            result = false;
+            break;
+        }
+    }
+    self->blocked = false;
+    self->ready = nullptr;
+    self->deadline = UINT64_MAX;
+
+    return result;
+}
+
+void sleep(uint64_t us) {
+    waitUntil([] { return false; }, us);
+}
+
+void schedule(uint64_t delayUs, std::function<void()> fn) {
+    AllocPause pause;
+    events.push(Event{clock + delayUs, eventSeq++, std::move(fn)});
+}
+
+TaskRef spawn(const char *name, std::function<void()> fn) {
+    Task *t = new Task();
+    t->name = name;
+    tasks.push_back(t);
+
+    std::thread([t, fn] {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            t->cv.wait(lock, [t] { return running == t; });
+        }
+        self = t;
+        sliceStart = clock;
+        fn();
+        endTask(t);
+    }).detach();
+
+    return t;
+}
+
+TaskRef currentTask() {
+    return self;
+}
+
+void endTask(TaskRef task) {
+    Task *t = (Task*)task;
+
+    t->finished = true;
+    if (t == self) {
+        reschedule();   // Never picks us again
+    }
+}
+
+int taskCount() {
+    int count = 0;
+    for (Task *t : tasks) {
+        if (!t->finished) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void exit(int status) {
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+}
@@ -2,6 +2,9 @@
 #include <string.h>
 #include <esp_bt.h>
 #include <esp32-hal-log.h>
+#include <Trace.h>
+#include <ConnStats.h>
+#include <BridgeStats.h>
 
 #define BT_GAP_TAG "BT_GAP"
 
@@ -13,12 +16,12 @@ bool BTGAP::init() {
         self = this;
         done = false;
         err = 0;
-        peers.clear();
+        peerCount = nextPeer = 0;
         err = ESP_OK;
 
         if ((err = esp_bt_gap_register_callback(btGapCallbackC)) != ESP_OK) {
-            errMsg = "Failed to register GAP callback: ";
-            errMsg += esp_err_to_name(err);
+            errMsg = "Failed to register GAP callback";
+            ESP_LOGE(BT_GAP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
             return false;
         }
     }
@@ -32,14 +35,222 @@ bool BTGAP::setName(const char *name) {
 #else
     if ((err = esp_bt_dev_set_device_name()) != ESP_OK) {
 #endif
-        errMsg = "Failed to set device name: ";
-        errMsg += esp_err_to_name(err);
+        errMsg = "Failed to set device name";
+        ESP_LOGE(BT_GAP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
         return false;
     }
 
     return true;
 }
 
+bool BTGAP::readRssi(const uint8_t *address) {
+    rssi.store(INT_MIN, std::memory_order_relaxed);     // Not to be mistaken for the answer
+    if ((err = esp_bt_gap_read_rssi_delta((uint8_t*)address)) != ESP_OK) {
+        errMsg = esp_err_to_name(err);
+        return false;
+    }
+
+    return true;
+}
+
+bool BTGAP::rssiDelta(int &delta) {
+    int value = rssi.load(std::memory_order_relaxed);
+
+    if (value == INT_MIN) {
+        return false;
+    }
+    delta = value;
+
+    return true;
+}
+
+bool BTGAP::setPollInterval(const uint8_t *address, uint32_t slots) {
+    if ((err = esp_bt_gap_set_qos((uint8_t*)address, slots)) != ESP_OK) {
+        errMsg = esp_err_to_name(err);
+        return false;
+    }
+
+    return true;
+}
+
+int BTGAP::getBonds(esp_bd_addr_t *addresses, int max) {
+    int n = max;
+
+    if ((err = esp_bt_gap_get_bond_device_list(&n, addresses)) != ESP_OK) {
+        errMsg = esp_err_to_name(err);
+        return 0;
+    }
+
+    return n;
+}
+
+bool BTGAP::isBonded(const uint8_t *address) {
+    esp_bd_addr_t bonds[BTGAP_MAX_PEERS];
+    int n = getBonds(bonds, BTGAP_MAX_PEERS);
+
+    for (int i = 0; i < n; i++) {
+        if (memcmp(bonds[i], address, ESP_BD_ADDR_LEN) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool BTGAP::removeBond(const uint8_t *address) {
+    if ((err = esp_bt_gap_remove_bond_device((uint8_t*)address)) != ESP_OK) {
+        errMsg = esp_err_to_name(err);
+        return false;
+    }
+
+    return true;
+}
+
+BTPinEntry *BTGAP::findPin(const uint8_t *address) {
+    for (int i = 0; i < pinCount; i++) {
+        if (memcmp(pins[i].address, address, ESP_BD_ADDR_LEN) == 0) {
+            return &pins[i];
+        }
+    }
+
+    return 0;
+}
+
+bool BTGAP::setPin(const uint8_t *address, const char *pin) {
+    size_t len = strlen(pin);
+    bool ok = true;
+
+    if (len > ESP_BT_PIN_CODE_LEN || (address == 0 && len == 0) || strpbrk(pin, ";=")) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&pinMux);
+    BTPinEntry *entry = address ? findPin(address) : 0;
+    if (address == 0) {
+        strcpy(defaultPin, pin);
+    } else if (len == 0) {
+        if (entry) {
+            *entry = pins[--pinCount];
+        }
+    } else if (entry == 0 && pinCount == BTGAP_MAX_PINS) {
+        ok = false;
+    } else {
+        if (entry == 0) {
+            entry = &pins[pinCount++];
+            memcpy(entry->address, address, ESP_BD_ADDR_LEN);
+        }
+        strcpy(entry->pin, pin);
+    }
+    portEXIT_CRITICAL(&pinMux);
+
+    return ok;
+}
+
+void BTGAP::pinFor(const uint8_t *address, char *pin) {
+    portENTER_CRITICAL(&pinMux);
+    BTPinEntry *entry = findPin(address);
+    strcpy(pin, entry ? entry->pin : defaultPin);
+    portEXIT_CRITICAL(&pinMux);
+}
+
+void BTGAP::pinsToString(char *out, int len) {
+    char address[BTGAP_ADDRESS_LEN + 1];
+    int n;
+
+    portENTER_CRITICAL(&pinMux);
+    n = snprintf(out, len, "*=%s", defaultPin);
+    for (int i = 0; i < pinCount && n < len; i++) {
+        n += snprintf(&out[n], len - n, ";%s=%s", formatAddress(pins[i].address, address), pins[i].pin);
+    }
+    portEXIT_CRITICAL(&pinMux);
+}
+
+void BTGAP::pinsFromString(const char *text) {
+    // Whatever doesn't parse is left out
+    while (*text) {
+        const char *end = strchr(text, ';');
+        const char *equals = strchr(text, '=');
+        int len = end ? end - text : strlen(text);
+        char entry[BTGAP_ADDRESS_LEN + ESP_BT_PIN_CODE_LEN + 2];
+        esp_bd_addr_t address;
+
+        if (equals && equals - text < len && len < (int)sizeof(entry)) {
+            memcpy(entry, text, len);
+            entry[len] = 0;
+            entry[equals - text] = 0;
+            const char *pin = &entry[equals - text + 1];
+            if (strcmp(entry, "*") == 0) {
+                setPin(0, pin);
+            } else if (parseAddress(entry, address)) {
+                setPin(address, pin);
+            }
+        }
+        text += end ? len + 1 : len;
+    }
+}
+
+void BTGAP::reportPins(Print &out) {
+    BTPinEntry entries[BTGAP_MAX_PINS];
+    char pin[ESP_BT_PIN_CODE_LEN + 1];
+    char address[BTGAP_ADDRESS_LEN + 1];
+    int n;
+
+    portENTER_CRITICAL(&pinMux);
+    memcpy(entries, pins, sizeof(entries));
+    n = pinCount;
+    strcpy(pin, defaultPin);
+    portEXIT_CRITICAL(&pinMux);
+
+    out.printf("DEFAULT=%s\r\n", pin);
+    for (int i = 0; i < n; i++) {
+        out.printf("%s=%s\r\n", formatAddress(entries[i].address, address), entries[i].pin);
+    }
+}
+
+void BTGAP::prepareAuth(const uint8_t *address) {
+    esp_bt_pin_code_t code = {0};
+    char pin[ESP_BT_PIN_CODE_LEN + 1] = "";
+
+    bool bonded = isBonded(address);
+    pairing.store(!bonded);
+    portENTER_CRITICAL(&pinMux);
+    BTPinEntry *entry = bonded ? 0 : findPin(address);
+    if (entry) {
+        strcpy(pin, entry->pin);
+    }
+    portEXIT_CRITICAL(&pinMux);
+
+    if (pin[0] != 0) {
+        memcpy(code, pin, strlen(pin));
+        esp_bt_gap_set_pin(ESP_BT_PIN_TYPE_FIXED, strlen(pin), code);
+    } else {
+        // Answered in ESP_BT_GAP_PIN_REQ_EVT, if it comes to that
+        esp_bt_gap_set_pin(ESP_BT_PIN_TYPE_VARIABLE, 0, code);
+    }
+}
+
+bool BTGAP::parseAddress(const char *text, esp_bd_addr_t address) {
+    unsigned int bytes[ESP_BD_ADDR_LEN];
+    int end = 0;
+
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%n", &bytes[0], &bytes[1], &bytes[2],
+            &bytes[3], &bytes[4], &bytes[5], &end) != ESP_BD_ADDR_LEN || text[end] != 0) {
+        return false;
+    }
+    for (int i = 0; i < ESP_BD_ADDR_LEN; i++) {
+        address[i] = bytes[i];
+    }
+
+    return true;
+}
+
+char *BTGAP::formatAddress(const uint8_t *address, char *text) {
+    sprintf(text, "%02x:%02x:%02x:%02x:%02x:%02x",
+            address[0], address[1], address[2], address[3], address[4], address[5]);
+
+    return text;
+}
+
 bool BTGAP::startInquiry() {
     ESP_LOGD(BT_GAP_TAG, "Starting inquiry");
     done = false;
@@ -61,11 +272,34 @@ bool BTGAP::inquiryDone() {
 }
 
 uint8_t* BTGAP::getAddress(const char* name) {
-    if (peers.find(name) != peers.end()) {
-        return peers[name].address;
-    } else {
-        return 0;
+    BTPeerInfo *peer = findPeer(name);
+
+    return peer ? peer->address : 0;
+}
+
+BTPeerInfo *BTGAP::findPeer(const char *name) {
+    for (int i = 0; i < peerCount; i++) {
+        if (strcmp(peers[i].name, name) == 0) {
+            return &peers[i];
+        }
+    }
+
+    return 0;
+}
+
+void BTGAP::addPeer(const char *name, const uint8_t *address) {
+    BTPeerInfo *peer = findPeer(name);
+
+    if (peer == 0) {
+        peer = &peers[nextPeer];
+        nextPeer = (nextPeer + 1) % BTGAP_MAX_PEERS;
+        if (peerCount < BTGAP_MAX_PEERS) {
+            peerCount++;
+        }
+        strncpy(peer->name, name, sizeof(peer->name) - 1);
     }
+    memcpy(peer->address, address, ESP_BD_ADDR_LEN);
+    ESP_LOGD(BT_GAP_TAG, "name='%s'", name);
 }
 
 void BTGAP::btGapCallback(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param) {
@@ -75,30 +309,25 @@ void BTGAP::btGapCallback(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *pa
 
     switch(event) {
     case ESP_BT_GAP_DISC_RES_EVT:
+        Trace::record(Trace::GAP_DISC_RES, param->disc_res.num_prop);
         // ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_DISC_RES_EVT");
         /* Find the target peer device name in the EIR data */
         for (int i = 0; i < param->disc_res.num_prop; i++) {
-            BTPeerInfo peer;
             // ESP_LOGD(BT_GAP_TAG, "type=%d", param->disc_res.prop[i].type);
             if (param->disc_res.prop[i].type == ESP_BT_GAP_DEV_PROP_BDNAME) {           
                 peer_bdname_len = param->disc_res.prop[i].len;
                 memcpy(peer_bdname, param->disc_res.prop[i].val, peer_bdname_len);
                 peer_bdname[peer_bdname_len] = 0;
-                peer.name = peer_bdname;
-                memcpy(peer.address, param->disc_res.bda, ESP_BD_ADDR_LEN);
-                peers[peer.name] = peer;
-                ESP_LOGD(BT_GAP_TAG, "name='%s'", peer.name.c_str());
+                addPeer(peer_bdname, param->disc_res.bda);
             }
             if (param->disc_res.prop[i].type == ESP_BT_GAP_DEV_PROP_EIR
                 && getNameFromEIR(param->disc_res.prop[i].val, peer_bdname, &peer_bdname_len)) {
-                memcpy(peer.address, param->disc_res.bda, ESP_BD_ADDR_LEN);
-                peer.name = peer_bdname;
-                peers[peer.name] = peer;
-                ESP_LOGD(BT_GAP_TAG, "name='%s'", peer.name.c_str());
+                addPeer(peer_bdname, param->disc_res.bda);
            }
         }
         break;
     case ESP_BT_GAP_DISC_STATE_CHANGED_EVT:
+        Trace::record(Trace::GAP_DISC_STATE, param->disc_st_chg.state);
         ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_DISC_STATE_CHANGED_EVT state:%d", param->disc_st_chg.state);
         done = param->disc_st_chg.state == ESP_BT_GAP_DISCOVERY_STOPPED;
         break;
@@ -109,41 +338,65 @@ void BTGAP::btGapCallback(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *pa
         ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_RMT_SRVC_REC_EVT");
         break;
     case ESP_BT_GAP_AUTH_CMPL_EVT:{
+        Trace::record(Trace::GAP_AUTH_CMPL, param->auth_cmpl.stat);
         if (param->auth_cmpl.stat == ESP_BT_STATUS_SUCCESS) {
             ESP_LOGD(BT_GAP_TAG, "authentication success: %s", param->auth_cmpl.device_name);
+            ConnStats::end(ConnStats::AUTH);
+            BridgeStats::add(pairing.exchange(false) ? BridgeStats::PAIRINGS : BridgeStats::BONDED_AUTHS);
         } else {
             ESP_LOGE(BT_GAP_TAG, "authentication failed, status:%d", param->auth_cmpl.stat);
+            ConnStats::fail(ConnStats::AUTH);
         }
         break;
     }
     case ESP_BT_GAP_PIN_REQ_EVT:{
+        Trace::record(Trace::GAP_PIN_REQ, param->pin_req.min_16_digit);
         ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_PIN_REQ_EVT min_16_digit:%d", param->pin_req.min_16_digit);
-        if (param->pin_req.min_16_digit) {
+        char pin[ESP_BT_PIN_CODE_LEN + 1];
+        esp_bt_pin_code_t pin_code = {0};
+        pinFor(param->pin_req.bda, pin);
+        if (param->pin_req.min_16_digit && strlen(pin) < ESP_BT_PIN_CODE_LEN) {
             ESP_LOGD(BT_GAP_TAG, "Input pin code: 0000 0000 0000 0000");
-            esp_bt_pin_code_t pin_code = {0};
-            esp_bt_gap_pin_reply(param->pin_req.bda, true, 16, pin_code);
+            esp_bt_gap_pin_reply(param->pin_req.bda, true, ESP_BT_PIN_CODE_LEN, pin_code);
         } else {
-            ESP_LOGD(BT_GAP_TAG, "Input pin code: 1234");
-            esp_bt_pin_code_t pin_code;
-            pin_code[0] = '1';
-            pin_code[1] = '2';
-            pin_code[2] = '3';
-            pin_code[3] = '4';
-            esp_bt_gap_pin_reply(param->pin_req.bda, true, 4, pin_code);
+            ESP_LOGD(BT_GAP_TAG, "Input pin code: %s", pin);
+            memcpy(pin_code, pin, strlen(pin));
+            esp_bt_gap_pin_reply(param->pin_req.bda, true, strlen(pin), pin_code);
         }
         break;
     }
 
+    case ESP_BT_GAP_READ_RSSI_DELTA_EVT:
+        if (param->read_rssi_delta.stat == ESP_BT_STATUS_SUCCESS) {
+            rssi.store(param->read_rssi_delta.rssi_delta, std::memory_order_relaxed);
+        }
+        break;
+
     case ESP_BT_GAP_MODE_CHG_EVT:
+        Trace::record(Trace::GAP_MODE_CHG, param->mode_chg.mode);
         ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_MODE_CHG_EVT mode:%d", param->mode_chg.mode);
+        pmMode.store(param->mode_chg.mode, std::memory_order_relaxed);
+        break;
+
+    case ESP_BT_GAP_QOS_CMPL_EVT:
+        Trace::record(Trace::GAP_QOS_CMPL, param->qos_cmpl.stat, param->qos_cmpl.t_poll);
+        ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_QOS_CMPL_EVT status:%d t_poll:%u", param->qos_cmpl.stat, param->qos_cmpl.t_poll);
+        if (param->qos_cmpl.stat == ESP_BT_STATUS_SUCCESS) {
+            tPoll.store(param->qos_cmpl.t_poll, std::memory_order_relaxed);
+        }
         break;
 
     case ESP_BT_GAP_ACL_CONN_CMPL_STAT_EVT:
+        Trace::record(Trace::GAP_ACL_CONN);
         ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_ACL_CONN_CMPL_STAT_EVT");
         break;
 
     case ESP_BT_GAP_ACL_DISCONN_CMPL_STAT_EVT:
+        Trace::record(Trace::GAP_ACL_DISCONN);
         ESP_LOGD(BT_GAP_TAG, "ESP_BT_GAP_ACL_DISCONN_CMPL_STAT_EVT");
+        // The next link starts out with the defaults
+        tPoll.store(ESP_BT_GAP_TPOLL_DFT, std::memory_order_relaxed);
+        pmMode.store(ESP_BT_PM_MD_ACTIVE, std::memory_order_relaxed);
         break;
 
     default:
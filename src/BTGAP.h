@@ -1,15 +1,35 @@
 #ifndef BT_GAP_H
 #define BT_GAP_H
+#include <Arduino.h>
 #include <esp_bt_defs.h>
 #include <esp_gap_bt_api.h>
 #include <esp_spp_api.h>
-#include <string>
-#include <unordered_map>
+#include <atomic>
+#include <limits.h>
+
+#ifndef BTGAP_MAX_PEERS
+#define BTGAP_MAX_PEERS 16
+#endif
+#ifndef BTGAP_MAX_PINS
+#define BTGAP_MAX_PINS 8
+#endif
+#ifndef BTGAP_DEFAULT_PIN
+#define BTGAP_DEFAULT_PIN "1234"
+#endif
+#define BTGAP_ADDRESS_LEN 17    // aa:bb:cc:dd:ee:ff
+// What pinsToString() may need, with the terminator
+#define BTGAP_PINS_STRING_LEN (ESP_BT_PIN_CODE_LEN + 3 + BTGAP_MAX_PINS * (BTGAP_ADDRESS_LEN + ESP_BT_PIN_CODE_LEN + 2))
 
 class BTPeerInfo {
 public:
     esp_bd_addr_t address = {0};
-    std::string name;
+    char name[ESP_BT_GAP_MAX_BDNAME_LEN + 1] = {0};
+};
+
+class BTPinEntry {
+public:
+    esp_bd_addr_t address = {0};
+    char pin[ESP_BT_PIN_CODE_LEN + 1] = {0};
 };
 
 class BTGAP {
@@ -19,11 +39,56 @@ public:
     bool inquiryDone();
     uint8_t*  getAddress(const char* name);
     bool setName(const char* name);
+    // Asks the controller for the link's RSSI, in dB from the golden receive
+    // power range. The answer comes later, through rssiDelta().
+    bool readRssi(const uint8_t *address);
+    // False until there has been an answer to the last readRssi()
+    bool rssiDelta(int &delta);
+
+    // As the master, poll the peer at least every slots * 0.625 ms while
+    // neither side has anything to send. ESP_BT_GAP_TPOLL_DFT is the stack's
+    // own. A peer with data to send waits for the next poll, and a radio that
+    // polls less often is off more of the time.
+    bool setPollInterval(const uint8_t *address, uint32_t slots);
+    // The interval last confirmed by the controller
+    uint32_t pollInterval() { return tPoll.load(std::memory_order_relaxed); }
+    // As last reported by the stack, whose power manager puts an idle link in
+    // sniff mode by itself and takes it out again when there is data
+    esp_bt_pm_mode_t powerMode() { return pmMode.load(std::memory_order_relaxed); }
+
+    // Peers the stack has a link key for. It keeps them in NVS itself, and
+    // authenticates them with it, without pairing again.
+    int getBonds(esp_bd_addr_t *addresses, int max);
+    bool isBonded(const uint8_t *address);
+    bool removeBond(const uint8_t *address);
+
+    // PINs for legacy pairing, for one peer or, with a null address, for any
+    // other. An empty PIN forgets a peer's. False if it is longer than 16
+    // characters, has a ';' or '=' in it, or there is no room for another peer.
+    bool setPin(const uint8_t *address, const char *pin);
+    // <address>=<pin> entries separated by ';', * for the default one
+    void pinsToString(char *out, int len);
+    void pinsFromString(const char *pins);
+    // NAME=value lines, as AT+STATS does
+    void reportPins(Print &out);
+    // Before connecting to a peer. One with a PIN of its own that isn't
+    // bonded yet gets it as the fixed PIN, which the stack answers with
+    // without asking.
+    void prepareAuth(const uint8_t *address);
+
+    // aa:bb:cc:dd:ee:ff
+    static bool parseAddress(const char *text, esp_bd_addr_t address);
+    static char *formatAddress(const uint8_t *address, char *text);
+
     bool isError() { return err != ESP_OK; }
-    const std::string& getErrMessage() { return errMsg; }
+    const char *getErrMessage() { return errMsg; }
 
 private:
     bool getNameFromEIR(void *eir, char *nameOut, uint8_t *lenOut);
+    BTPeerInfo *findPeer(const char *name);
+    BTPinEntry *findPin(const uint8_t *address);
+    void pinFor(const uint8_t *address, char *pin);
+    void addPeer(const char *name, const uint8_t *address);
 
     void btGapCallback(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param);
 
@@ -38,8 +103,22 @@ private:
     uint8_t inqLen = 10;    // Run for 10 * 1.28 secs
     uint8_t inqNumResp = 0; // Handle any number of responses
 
-    std::string errMsg;
-    std::unordered_map<std::string, BTPeerInfo> peers;
+    const char *errMsg = "";
+    std::atomic<int> rssi{INT_MIN};     // INT_MIN until it has been read
+    std::atomic<uint32_t> tPoll{ESP_BT_GAP_TPOLL_DFT};
+    std::atomic<esp_bt_pm_mode_t> pmMode{ESP_BT_PM_MD_ACTIVE};
+    // Names seen in the last inquiry. When it fills up, the oldest entries
+    // are overwritten.
+    BTPeerInfo peers[BTGAP_MAX_PEERS];
+    int peerCount = 0;
+    int nextPeer = 0;
+
+    // Read from the GAP callback, so only changed under pinMux
+    BTPinEntry pins[BTGAP_MAX_PINS];
+    int pinCount = 0;
+    char defaultPin[ESP_BT_PIN_CODE_LEN + 1] = BTGAP_DEFAULT_PIN;
+    portMUX_TYPE pinMux = portMUX_INITIALIZER_UNLOCKED;
+    std::atomic<bool> pairing{false};   // The peer being connected to had no link key
 };
 
 #endif
\ No newline at end of file
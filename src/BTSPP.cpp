@@ -1,4 +1,13 @@
 #include <BTSPP.h>
+#include <BootProfiler.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <ConnStats.h>
+#ifdef SPP_TRANSPORT_VFS
+#include <SPPVfsTransport.h>
+#else
+#include <SPPCallbackTransport.h>
+#endif
 #include <esp_arduino_version.h>
 #include <esp_bt.h>
 #include <esp_bt_main.h>
@@ -12,6 +21,11 @@ BTSPP *BTSPP::self = 0;
 
 BTSPP::BTSPP(const std::string& name, int recvBufSize) : recvQueue(xQueueCreate(recvBufSize, sizeof(uint8_t))) {
     this->name = name;
+#ifdef SPP_TRANSPORT_VFS
+    transport = new SPPVfsTransport(recvQueue, err, errMsg);
+#else
+    transport = new SPPCallbackTransport(recvQueue, err, errMsg);
+#endif
 }
 
 bool myBtStart(){
@@ -40,18 +54,22 @@ bool BTSPP::init() {
             return false;
         }
 #endif
+        BootProfiler::mark(BootProfiler::CONTROLLER_STARTED);
+
         if ((err = esp_bluedroid_init()) != ESP_OK) {
-            errMsg = "Bluedroid initialization failed: ";
-            errMsg += esp_err_to_name(err);
+            errMsg = "Bluedroid initialization failed";
+            ESP_LOGE(BT_SPP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
             return false;
         }
+        BootProfiler::mark(BootProfiler::BLUEDROID_INITED);
 
         if ((err = esp_bluedroid_enable()) != ESP_OK) {
-            errMsg = "Failed to enable bluedroid: ";
-            errMsg += esp_err_to_name(err);
+            errMsg = "Failed to enable bluedroid";
+            ESP_LOGE(BT_SPP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
             return false;
         }
 
+        BootProfiler::mark(BootProfiler::BLUEDROID_ENABLED);
         ESP_LOGD(BT_SPP_TAG, "Enabled bluedroid");
 
 #if ESP_IDF_VERSION_MAJOR >= 5
@@ -59,19 +77,19 @@ bool BTSPP::init() {
 #else
         if ((err = esp_bt_dev_set_device_name(name.c_str())) != ESP_OK) {
 #endif
-            errMsg = "Failed to set device name: ";
-            errMsg += esp_err_to_name(err);
+            errMsg = "Failed to set device name";
+            ESP_LOGE(BT_SPP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
             return false;
         }
 
         if ((err = esp_spp_register_callback(btSPPCallbackC)) != ESP_OK) {
-            errMsg = "Failed to register callback: ";
-            errMsg += esp_err_to_name(err);
+            errMsg = "Failed to register callback";
+            ESP_LOGE(BT_SPP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
             return false;
         }
 #if ESP_ARDUINO_VERSION_MAJOR >= 3
         esp_spp_cfg_t bt_spp_cfg = {
-            .mode = ESP_SPP_MODE_CB,
+            .mode = transport->mode(),
             .enable_l2cap_ertm = true,
         };
 
@@ -80,13 +98,13 @@ bool BTSPP::init() {
             return false;
         }
 #else
-        if ((err = esp_spp_init(ESP_SPP_MODE_CB)) != ESP_OK) {
-            errMsg = "Failed to init SPP: ";
-            errMsg += esp_err_to_name(err);
+        if ((err = esp_spp_init(transport->mode())) != ESP_OK) {
+            errMsg = "Failed to init SPP";
+            ESP_LOGE(BT_SPP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
             return false;
         }
 #endif
-        ESP_LOGD(BT_SPP_TAG, "Inited SPP");
+        ESP_LOGD(BT_SPP_TAG, "Inited SPP, %s transport", transport->name());
     }
 
     ESP_LOGD(BT_SPP_TAG, "SPP init returning true");
@@ -107,13 +125,7 @@ static char *bda2str(uint8_t * bda, char *str, size_t size)
 
 void BTSPP::startConnection(uint8_t *address) {
     connectDone = false;
-    /*
-    * Set default parameters for Legacy Pairing
-    * Use variable pin, input pin code when pairing
-    */
-    esp_bt_pin_type_t pin_type = ESP_BT_PIN_TYPE_VARIABLE;
-    esp_bt_pin_code_t pin_code;
-    esp_bt_gap_set_pin(pin_type, 0, pin_code);
+    // How a PIN request is answered is up to BTGAP::prepareAuth()
 
     memcpy(this->address, address, ESP_BD_ADDR_LEN);
     char bda_str [18];
@@ -123,7 +135,9 @@ void BTSPP::startConnection(uint8_t *address) {
     bda2str(address, bda_str, sizeof(bda_str));
     ESP_LOGD(BT_SPP_TAG, "Connecting to %s", bda_str);
 
+    ConnStats::start(ConnStats::SDP);
     if ((err = esp_spp_start_discovery(address)) != ESP_OK) {
+        ConnStats::fail(ConnStats::SDP);
         errMsg = esp_err_to_name(err);
         return;
     }
@@ -141,60 +155,79 @@ bool BTSPP::write(const std::string& msg) {
 }
 
 bool BTSPP::write(uint8_t *pBuf, int len) {
-    if (len > 0) {
-        if (writeDone) {
-            if (len < MAX_STRING_LENGTH) {
-                ESP_LOGD(BT_SPP_TAG, "Writing %.*s to %d", len, pBuf, peerHandle);
-                memcpy(writeBuf, pBuf, len);
-                bufPtr = writeBuf;
-                if ((err = esp_spp_write(peerHandle, len, pBuf)) != ESP_OK) {
-                    errMsg = esp_err_to_name(err);
-                } else {
-                    writeDone = false;
-                }
-            } else {
-                err = -1;
-                errMsg = "data is too long";
-            }
-
-            return true;
-        } else {
-            err = -1;
-            errMsg = "Still writing previous data";
-
-            return false;
-        }
-    } else {
-        return true;
-    }
+    return transport->write(pBuf, len);
 }
 
-int BTSPP::read(uint8_t *pBuf, int maxBytes) {
+int BTSPP::read(uint8_t *pBuf, int maxBytes, TickType_t wait) {
     int index = 0;
 
-    while (index < maxBytes && xQueueReceive(recvQueue, &pBuf[index], 50) == pdTRUE) {
+    while (index < maxBytes) {
+        if (xQueueReceive(recvQueue, &pBuf[index], 0) == pdTRUE) {
+            index++;
+            continue;
+        }
+        // The queue is empty, so the overflow pool is next in line
+        int n = transport->readOverflow(&pBuf[index], maxBytes - index);
+        if (n > 0) {
+            index += n;
+            continue;
+        }
+        if (wait == 0 || xQueueReceive(recvQueue, &pBuf[index], wait) != pdTRUE) {
+            break;
+        }
         index++;
     }
+    if (index > 0) {
+        // Not there if the block is still being queued, so the last time stays
+        uint32_t arrivedUs;
+        if (transport->arrival(readBytes, arrivedUs) > 0) {
+            lastArrivalUs = arrivedUs;
+        }
+        readBytes += index;
+        transport->checkWatermarks();
+    }
 
     return index;
 }
 
+int BTSPP::readBlock(uint8_t *pBuf, int maxBytes, bool &more) {
+    int left = blockLeft();
+    int n = read(pBuf, left > 0 && left < maxBytes ? left : maxBytes, 0);
+
+    more = left > n;
+
+    return n;
+}
+
+int BTSPP::blockLeft() {
+    uint32_t arrivedUs;
+
+    return transport->arrival(readBytes, arrivedUs);
+}
+
 void BTSPP::btSPPCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
     uint8_t i = 0;
     char bda_str[18] = {0};
 
     switch (event) {
     case ESP_SPP_INIT_EVT:
+        Trace::record(Trace::SPP_INIT, param->init.status);
         if (param->init.status == ESP_SPP_SUCCESS) {
             ESP_LOGD(BT_SPP_TAG, "ESP_SPP_INIT_EVT");
-            initDone=true;
+            BootProfiler::mark(BootProfiler::SPP_INITED);
+            initDone = transport->inited();
         } else {
             ESP_LOGE(BT_SPP_TAG, "ESP_SPP_INIT_EVT status:%d", param->init.status);
         }
         break;
 
     case ESP_SPP_DISCOVERY_COMP_EVT:
+        Trace::record(Trace::SPP_DISCOVERY_COMP, param->disc_comp.status, param->disc_comp.scn_num);
         if (param->disc_comp.status == ESP_SPP_SUCCESS) {
+            BootProfiler::mark(BootProfiler::SDP_DONE);
+            ConnStats::end(ConnStats::SDP);
+            ConnStats::start(ConnStats::AUTH);
+            ConnStats::start(ConnStats::RFCOMM_OPEN);
             ESP_LOGD(BT_SPP_TAG, "ESP_SPP_DISCOVERY_COMP_EVT scn_num:%d", param->disc_comp.scn_num);
             for (i = 0; i < param->disc_comp.scn_num; i++) {
                 ESP_LOGD(BT_SPP_TAG, "-- [%d] scn:%d service_name:%s", i, param->disc_comp.scn[i],
@@ -205,86 +238,44 @@ void BTSPP::btSPPCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
         } else {
             err = param->disc_comp.status;
             errMsg = "Service discovery failed";
+            ConnStats::fail(ConnStats::SDP);
             ESP_LOGE(BT_SPP_TAG, "ESP_SPP_DISCOVERY_COMP_EVT status=%d", param->disc_comp.status);
         }
         break;
     case ESP_SPP_OPEN_EVT:
+        Trace::record(Trace::SPP_OPEN, param->open.status, param->open.handle);
         if (param->open.status == ESP_SPP_SUCCESS) {
             ESP_LOGD(BT_SPP_TAG, "ESP_SPP_OPEN_EVT handle:%d", param->open.handle);
+            ConnStats::end(ConnStats::RFCOMM_OPEN);
+            ConnStats::end(ConnStats::AUTH);   // If the stack didn't report it, it is done by now
             connectDone = true;
             peerHandle = param->open.handle;
+            transport->opened(peerHandle, param->open.fd);
         } else {
             ESP_LOGE(BT_SPP_TAG, "ESP_SPP_OPEN_EVT status:%d", param->open.status);
+            ConnStats::fail(ConnStats::RFCOMM_OPEN);
         }
         break;
     case ESP_SPP_CLOSE_EVT:
+        Trace::record(Trace::SPP_CLOSE, param->close.status, param->close.async);
         ESP_LOGD(BT_SPP_TAG, "ESP_SPP_CLOSE_EVT status:%d handle:%d close_by_remote:%d", param->close.status,
                  param->close.handle, param->close.async);
         connectDone = false;
         peerHandle = 0;
+        transport->closed();
+        BridgeStats::add(BridgeStats::DISCONNECTS);
         break;
     case ESP_SPP_START_EVT:
         ESP_LOGD(BT_SPP_TAG, "ESP_SPP_START_EVT");
         break;
     case ESP_SPP_CL_INIT_EVT:
+        Trace::record(Trace::SPP_CL_INIT, param->cl_init.status, param->cl_init.handle);
         if (param->cl_init.status == ESP_SPP_SUCCESS) {
             ESP_LOGD(BT_SPP_TAG, "ESP_SPP_CL_INIT_EVT handle:%d sec_id:%d", param->cl_init.handle, param->cl_init.sec_id);
         } else {
             ESP_LOGE(BT_SPP_TAG, "ESP_SPP_CL_INIT_EVT status:%d", param->cl_init.status);
         }
         break;
-    case ESP_SPP_DATA_IND_EVT:
-        ESP_LOGD(BT_SPP_TAG, "ESP_SPP_DATA_IND_EVT");
-        if (param->data_ind.status == ESP_SPP_SUCCESS) {
-            for (int i = 0; i < param->data_ind.len; i++) {
-                if (xQueueSend(recvQueue, &param->data_ind.data[i], 0) != pdTRUE) {
-                    ESP_LOGE(BT_SPP_TAG, "Receive buffer is full");
-                }
-            }
-        }
-        
-        break;
-    case ESP_SPP_WRITE_EVT:
-        if (param->write.status == ESP_SPP_SUCCESS) {
-            if (bufPtr[param->write.len] == 0) {
-                writeDone = true;
-                ESP_LOGD(BT_SPP_TAG, "Wrote all data, len=%d", param->write.len);
-            } else {
-                ESP_LOGD(BT_SPP_TAG, "Wrote %d bytes, cong=%d", param->write.len, param->write.cong);
-                /*
-                 * Means the previous data packet only sent partially due to lower layer congestion, resend the
-                 * remainning data.
-                 */
-                bufPtr += param->write.len;
-                if (!param->write.cong) {
-                    /* The lower layer is not congested, you can send the next data packet now. */
-                    if (*bufPtr == 0) {
-                        writeDone = true;
-                        ESP_LOGD(BT_SPP_TAG, "All data was really sent");
-                        return;   // All sent anyway
-                    }
-                    ESP_LOGD(BT_SPP_TAG, "Attempting to write remainder");
-                    esp_spp_write(peerHandle, strlen(bufPtr), (uint8_t*)bufPtr);
-                }
-            }
-        } else {
-            /* Means the prevous data packet is not sent at all, need to send the whole data packet again. */
-            err = param->write.status;
-            errMsg = "Write failed";
-            ESP_LOGE(BT_SPP_TAG, "ESP_SPP_WRITE_EVT status:%d", param->write.status);
-        }
-        break;
-    case ESP_SPP_CONG_EVT:
-        ESP_LOGD(BT_SPP_TAG, "ESP_SPP_CONG_EVT cong:%d", param->cong.cong);
-        if (param->cong.cong == 0) {
-            /* Send the previous (partial) data packet or the next data packet. */
-            if (*bufPtr == 0) {
-                writeDone = true;
-                return;
-            }
-            esp_spp_write(peerHandle, strlen(bufPtr), (uint8_t*)bufPtr);
-        }
-        break;
     case ESP_SPP_SRV_OPEN_EVT:
         ESP_LOGD(BT_SPP_TAG, "ESP_SPP_SRV_OPEN_EVT");
         break;
@@ -294,6 +285,8 @@ void BTSPP::btSPPCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
         initDone = false;
         break;
     default:
+        // Data, write completion and congestion
+        transport->event(event, param);
         break;
     }
 }
@@ -5,8 +5,7 @@
 #include <esp_gap_bt_api.h>
 #include <esp_spp_api.h>
 #include <string>
-
-#define MAX_STRING_LENGTH 200
+#include <SPPTransport.h>
 
 class BTSPP {
 public:
@@ -17,12 +16,39 @@ public:
     void startConnection(uint8_t *address);
     void endConnection();
     bool connectionDone() { return connectDone; }
+    const uint8_t *peerAddress() { return address; }
     bool write(const std::string& msg);
     bool write(uint8_t *pBuf, int len);
-    int  read(uint8_t *pBuf, int maxBytes);
+    int  read(uint8_t *pBuf, int maxBytes, TickType_t wait = 50);   // wait is per byte
+    // The same without waiting, and no further than the end of the block the
+    // first byte is from, as it arrived. more: the block goes on past maxBytes.
+    int  readBlock(uint8_t *pBuf, int maxBytes, bool &more);
+    // What is left of that block, 0 if there is none
+    int  blockLeft();
+    // When the first byte the last read got arrived, in esp_timer_get_time()
+    // microseconds. See SPPTransport.
+    uint32_t arrivalUs() { return lastArrivalUs; }
+    // Until write() would take more data, or wait runs out
+    bool waitWritable(TickType_t wait) { return transport->waitWritable(wait); }
+
+    // Reflect everything received straight back to the peer from the Bluetooth
+    // task. While it is on, write() refuses data and read() gets nothing.
+    bool setLoopback(bool on) { return transport->setLoopback(on); }
+    bool loopback() { return transport->loopback(); }
+
+    // "CB" or "VFS", see SPPTransport
+    const char *transportName() { return transport->name(); }
+
+    // Receive flow control, see SPPTransport
+    bool setRxWatermarks(int highPercent, int lowPercent) { return transport->setRxWatermarks(highPercent, lowPercent); }
+    int rxHighWater() { return transport->rxHighWater(); }
+    int rxLowWater() { return transport->rxLowWater(); }
+    size_t rxBuffered() { return transport->rxBuffered(); }
+    size_t rxCapacity() { return transport->rxCapacity(); }
+    bool rxThrottled() { return transport->rxThrottled(); }
 
     bool isError() { return err != ESP_OK; }
-    const std::string& getErrMessage() { return errMsg; }
+    const char *getErrMessage() { return errMsg; }
 
 private:
     void btSPPCallback(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
@@ -39,14 +65,14 @@ private:
     bool initDone = false;
     bool connectDone = false;
     uint32_t peerHandle = 0;
-    char writeBuf[MAX_STRING_LENGTH];
-    char *bufPtr;
-    bool writeDone = true;
 
     QueueHandle_t recvQueue;
+    SPPTransport *transport;
+    uint32_t readBytes = 0;         // In all, to find blocks by
+    uint32_t lastArrivalUs = 0;
 
     esp_err_t err;
-    std::string errMsg;
+    const char *errMsg = "";
 };
 
 #endif
\ No newline at end of file
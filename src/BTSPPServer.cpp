@@ -7,46 +7,157 @@
 #include "BTSPP.h"
 #include "BTGAP.h"
 #include "CommandHandler.h"
-#include <ConfigItem.h>
-#include <EEPROMConfig.h>
 #include <BTSPPServer.h>
+#include <BootProfiler.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <ConnStats.h>
+#include <LinkBench.h>
+#include <esp_system.h>
 
 #define SPP_SERVER_TAG "SPP_SERVER"
 
-std::unordered_map<BTSPPServer::State, std::string> BTSPPServer::state2string = {
-	{NOT_INITIALIZED, "NOT_INITIALIZED"},
-    {NOT_CONNECTED, "NOT_CONNECTED"},
-	{SEARCHING, "SEARCHING"},
-	{CONNECTED, "CONNECTED"},
-	{SEARCHING, "SEARCHING"},
-	{DISCONNECTING, "DISCONNECTING"}
+const char *BTSPPServer::stateNames[] = {
+	"NOT_INITIALIZED",
+	"NOT_CONNECTED",
+	"SEARCHING",
+	"CONNECTING",
+	"CONNECTED",
+	"DISCONNECTING"
 };
 
-#define MAX_NAME_LEN 63
-#define RECV_BUF_SIZE 50
+#define RECV_BUF_SIZE 256
+#define RECV_QUEUE_SIZE 1024	// Holds a full AT+BENCH window of echoes
+#define UART_CHUNK_SIZE 128
+#define SEND_WAIT_MS 100
+#define NOTIFIER_QUEUE_SIZE 256
+#define RX_FRAME_HEADER 6		// <length: 2> <arrived at, us: 4>
+#define RX_FRAME_MORE 0x8000	// In the length: the rest of the block is in the next frame
+#define RX_FRAME_TEXT 0x4000	// In the length: a command response or URC, not data
+#define RX_FRAME_LENGTH 0x3fff
+// The header, a code byte per 254 bytes of a whole block and header, and the 00
+#define RX_COBS_OVERHEAD (RX_FRAME_HEADER + 1 + (RX_FRAME_HEADER + SPP_MAX_BLOCK) / 254 + 1)
+
+// Rings between the UART and radio stages. Both can be set with build flags.
+#ifndef FROM_HOST_RING_SIZE
+#define FROM_HOST_RING_SIZE 1024
+#endif
+#ifndef TO_HOST_RING_SIZE
+#define TO_HOST_RING_SIZE 2048
+#endif
+// The UART driver's own TX buffer, on top of the hardware FIFO
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 512
+#endif
+
+// Store and forward while the link is down. Both can be set with build flags,
+// and the flash limit with AT+SPOOL as well. 0 keeps it to RAM.
+#ifndef SPOOL_RAM_SIZE
+#define SPOOL_RAM_SIZE 4096
+#endif
+#ifndef SPOOL_FLASH_LIMIT
+#define SPOOL_FLASH_LIMIT (64 * 1024)
+#endif
+
+// The urgent lane, see AT+LANE. RAM only.
+#ifndef URGENT_QUEUE_SIZE
+#define URGENT_QUEUE_SIZE 512
+#endif
+#define URGENT_HEADER 5
 
 BTSPPServer::BTSPPServer(const std::string& name, HardwareSerial &_serial) :
+    fromHost(FROM_HOST_RING_SIZE),
+    toHost(TO_HOST_RING_SIZE),
+    host(fromHost, toHost),
+    btSPP(name, RECV_QUEUE_SIZE),
+    commandHandler(host),
+    spool(SPOOL_RAM_SIZE, SPOOL_FLASH_LIMIT),
+    notifier(NOTIFIER_QUEUE_SIZE),
+    urgent(URGENT_QUEUE_SIZE),
+    tuner(RELIABLE_WINDOW),
     serial(_serial),
-    commandHandler(_serial),
-    btSPP(name, RECV_BUF_SIZE),
-    serverName(name),
-    clientName("A client"),
     clientAddressCallback([](long address) { ESP_LOGI(SPP_SERVER_TAG, "client address=0x%6.6x", address); }),
     serverNameCallback([](const char *name) { ESP_LOGI(SPP_SERVER_TAG, "server name=%s", name); }),
-    clientNameCallback([](const char *name) { ESP_LOGI(SPP_SERVER_TAG, "client name=%s", name); })
+    clientNameCallback([](const char *name) { ESP_LOGI(SPP_SERVER_TAG, "client name=%s", name); }),
+    pinsCallback([](const char *pins) { ESP_LOGI(SPP_SERVER_TAG, "pins=%s", pins); })
 {
+    setServerName(name.c_str());
+    setClientName("A client");
+    // Command responses and URCs, while AT+SENDRX=4 or 5, stamped with when they went
+    host.setFramer([this](const uint8_t *text, size_t len) { writeFrame(text, len, micros(), RX_FRAME_TEXT); });
+}
+
+void BTSPPServer::setState(State state) {
+	Trace::record(Trace::SERVER_STATE, state, connectionStatus);
+
+	switch (connectionStatus) {
+	case SEARCHING:
+		ConnStats::end(ConnStats::INQUIRY);
+		break;
+	case CONNECTING:
+		if (state == CONNECTED) {
+			ConnStats::end(ConnStats::CONNECT);
+		} else {
+			ConnStats::fail(ConnStats::CONNECT);
+		}
+		break;
+	case DISCONNECTING:
+		ConnStats::end(ConnStats::DISCONNECT);
+		break;
+	default:
+		break;
+	}
+
+	switch (state) {
+	case SEARCHING:
+		ConnStats::start(ConnStats::INQUIRY);
+		break;
+	case CONNECTING:
+		ConnStats::start(ConnStats::CONNECT);
+		break;
+	case DISCONNECTING:
+		ConnStats::start(ConnStats::DISCONNECT);
+		break;
+	default:
+		break;
+	}
+
+	if (state == CONNECTED && connectionStatus != CONNECTED) {
+		codec.linkUp();
+		reliable.linkUp();
+		tuner.linkUp();
+		idle.linkUp();
+	} else if (state != CONNECTED && connectionStatus == CONNECTED) {
+		codec.linkDown();
+		reliable.linkDown();
+		idle.linkDown();
+		if (!reliable.enabled()) {
+			transfer.fail("Link lost");	// With AT+RELIABLE it picks up again once the link is back
+			ota.fail("Link lost");
+		}
+		linkInLen = 0;
+	}
+
+	if (state != connectionStatus) {
+		notifier.post(Notifier::STATE, "+STATE:%s", stateNames[state]);
+	}
+	connectionStatus = state;
 }
 
 void BTSPPServer::initSPP() {
 	if (!btSPP.inited()) {
 		if (btSPP.init()) {
 			if (btGAP.init()) {
-				connectionStatus = NOT_CONNECTED;
+				BootProfiler::mark(BootProfiler::GAP_INITED);
+				OtaUpdate::confirm();	// New firmware that gets this far can be updated again
+				setState(NOT_CONNECTED);
 			} else {
-				ESP_LOGE(SPP_SERVER_TAG, "GAP initialization failed: %s", btGAP.getErrMessage().c_str());
+				ESP_LOGE(SPP_SERVER_TAG, "GAP initialization failed: %s", btGAP.getErrMessage());
+				notifier.post(Notifier::ERROR, "+ERROR:INIT");
 			}
 		} else {
-			ESP_LOGE(SPP_SERVER_TAG, "BT initialization failed: %s", btSPP.getErrMessage().c_str());
+			ESP_LOGE(SPP_SERVER_TAG, "BT initialization failed: %s", btSPP.getErrMessage());
+			notifier.post(Notifier::ERROR, "+ERROR:INIT");
 		}
 	}
 }
@@ -54,7 +165,8 @@ void BTSPPServer::initSPP() {
 void BTSPPServer::initiateConnection() {
 	if (clientAddress != 0ULL) {
 		ESP_LOGI(SPP_SERVER_TAG, "Connecting to client");
-		connectionStatus = CONNECTING;
+		BootProfiler::mark(BootProfiler::CONNECT_STARTED);
+		setState(CONNECTING);
 		uint64_t uAddress = clientAddress;
 		esp_bd_addr_t address = {0};
 		address[0] = uAddress & 0xff;
@@ -64,13 +176,15 @@ void BTSPPServer::initiateConnection() {
 		address[4] = (uAddress >> 32) & 0xff;
 		address[5] = (uAddress >> 40) & 0xff;
 		
+		btGAP.prepareAuth(address);
 		btSPP.startConnection(address);
 	} else {
-		connectionStatus = SEARCHING;
+		setState(SEARCHING);
 		ESP_LOGI(SPP_SERVER_TAG, "Searching for client");
 		if (!btGAP.startInquiry()) {
 			ESP_LOGE(SPP_SERVER_TAG, "Error starting inqury: %s", btGAP.getErrMessage());
-			connectionStatus = NOT_CONNECTED;
+			notifier.post(Notifier::ERROR, "+ERROR:INQUIRY");
+			setState(NOT_CONNECTED);
 		}
 	}
 }
@@ -87,6 +201,14 @@ void BTSPPServer::setClientNameCallback(std::function<void(const char* name)> ca
     clientNameCallback = callback;
 }
 
+void BTSPPServer::setPinsCallback(std::function<void(const char* pins)> callback) {
+    pinsCallback = callback;
+}
+
+void BTSPPServer::setPins(const char *pins) {
+    btGAP.pinsFromString(pins);
+}
+
 void BTSPPServer::setCommandPin(uint8_t pin) {
     commandPin = pin;
 }
@@ -95,23 +217,77 @@ void BTSPPServer::setConnectedPin(uint8_t pin) {
     connectedPin = pin;
 }
 
+void BTSPPServer::setConfigured(bool configured) {
+    this->configured.store(configured, std::memory_order_release);
+}
+
 void BTSPPServer::setClientAddress(unsigned long address) {
     clientAddress = address;
 }
 
 void BTSPPServer::setServerName(const char *name) {
-    serverName = name;
+    strlcpy(serverName, name, sizeof(serverName));
 }
 
 void BTSPPServer::setClientName(const char *name) {
-    clientName = name;
+    strlcpy(clientName, name, sizeof(clientName));
+}
+
+void BTSPPServer::uartLoop() {
+	uint8_t buf[UART_CHUNK_SIZE];
+	bool busy = false;
+
+	// Host to radio stage. Whatever doesn't fit waits in the UART driver.
+	size_t len = serial.available();
+	if (len > 0 && fromHost.space() > 0) {
+		len = len < sizeof(buf) ? len : sizeof(buf);
+		len = len < fromHost.space() ? len : fromHost.space();
+		len = serial.read(buf, len);
+		fromHost.write(buf, len);
+		if (radioTask != nullptr) {
+			xTaskNotifyGive(radioTask);
+		}
+		busy = true;
+	}
+
+	// Radio stage to host, no more than the UART can take without blocking
+	const uint8_t *data;
+	size_t pending = toHost.peek(&data);
+	int room = serial.availableForWrite();
+	if (pending > 0 && room > 0) {
+		pending = pending < (size_t)room ? pending : room;
+		serial.write(data, pending);
+		toHost.consume(pending);
+		busy = true;
+	}
+
+	if (!busy) {
+		vTaskDelay(1);
+	}
 }
 
 void BTSPPServer::loop() {
-    static unsigned long lastReadMs = 0;
-    static uint8_t recvBuf[RECV_BUF_SIZE];
+    static uint8_t recvBuf[SPP_MAX_BLOCK];     // RECV_BUF_SIZE at a time, but a whole block for a frame
+    bool busy = false;
+
+    if (radioTask == nullptr) {
+        radioTask = xTaskGetCurrentTaskHandle();
+    }
+
+    if (connectionStatus == NOT_INITIALIZED) {
+        initSPP();	// Will move to NOT_CONNECTED if it succeeds
+    }
 
-    unsigned long now = millis();
+    if (!configured.load(std::memory_order_acquire)) {
+        delay(1);
+        return;
+    }
+
+    if (!nameApplied && connectionStatus != NOT_INITIALIZED) {
+        // The stack may have come up before the stored name was loaded
+        btGAP.setName(serverName);
+        nameApplied = true;
+    }
 
     if (digitalRead(commandPin) == HIGH) {
         commandHandler.setMode(CommandHandler::COMMAND);
@@ -119,18 +295,130 @@ void BTSPPServer::loop() {
         commandHandler.setMode(CommandHandler::PASSTHROUGH);
     }
 
-    commandHandler.loop();
+    if (host.available() > 0) {
+        commandHandler.loop();
+        host.flush();           // Not all errors end with one
+        busy = true;
+    }
 
-    if (millis() - lastReadMs > 1000) {
-        lastReadMs = now;
-        int len = 0;
-        if ((len = btSPP.read(recvBuf, sizeof(recvBuf))) > 0) {
-            if (sendRx) {
-                serial.printf("%.*s\r\n", len, recvBuf);
-                serial.flush();
-            }
-            ESP_LOGI(SPP_SERVER_TAG, "Received message: %.*s", len, recvBuf);
+    if (restartDue && toHost.size() == 0) {
+        delay(100);     // For the UART to send what the UART stage already took
+        esp_restart();
+    }
+
+    // Only take what the UART stage has room for, and leave the rest queued.
+    // A slow host so holds up the client instead of the radio stage.
+    int room = RECV_BUF_SIZE;
+    if (rxLineLen > 0 && rxMode != RX_WHOLE_LINES) {
+        room = 0;               // What is left of the last line goes first
+    } else if (rxMode == RX_LINES) {
+        room = host.availableForWrite() - 2;
+    } else if (rxMode == RX_RAW) {
+        room = host.availableForWrite();
+    } else if (rxMode == RX_WHOLE_LINES) {
+        room = RX_LINE_SIZE - rxLineLen;    // The host's room is checked on the way out
+    } else if (rxMode == RX_FRAMES) {
+        room = host.availableForWrite() - RX_FRAME_HEADER;
+    } else if (rxMode == RX_COBS) {
+        room = host.availableForWrite() - RX_COBS_OVERHEAD;
+    }
+    // A frame for each block, as it arrived, once the host has room for all of
+    // it. Only a block that the host's ring can't take in one, or blocks run
+    // together past RX_ARRIVALS, go in more than one.
+    bool block = rxMode >= RX_FRAMES;
+    int most = RECV_BUF_SIZE;
+    if (block) {
+        most = toHost.capacity() - RX_COBS_OVERHEAD;
+        most = most < SPP_MAX_BLOCK ? most : SPP_MAX_BLOCK;
+        int left = btSPP.blockLeft();
+        room = room < (left > 0 && left < most ? left : most) ? 0 : room;
+    }
+    if (transfer.receiving()) {
+        room = most = RECV_BUF_SIZE;    // It all goes to the file
+        block = false;
+    } else if (ota.receiving()) {
+        room = ota.room();      // Nothing while both blocks are being flashed
+        most = RECV_BUF_SIZE;
+        block = false;
+    }
+    bool more = false;
+    int len = 0;
+    if (reliable.enabled()) {
+        // Always drained, so acknowledgements get through. The window holds
+        // the peer back instead.
+        int n = linkRead(recvBuf, RECV_BUF_SIZE);
+        reliable.receive(recvBuf, n);
+        busy |= n > 0;
+        len = room > 0 ? reliable.read(recvBuf, room < RECV_BUF_SIZE ? room : RECV_BUF_SIZE) : 0;
+    } else if (room > 0) {
+        len = linkRead(recvBuf, room < most ? room : most, block ? &more : nullptr);
+    }
+    if (len > 0 && transfer.receiving()) {
+        transfer.receive(recvBuf, len);
+        busy = true;
+    } else if (len > 0 && ota.receiving()) {
+        ota.receive(recvBuf, len);
+        busy = true;
+    } else if (len > 0) {
+        deliver(recvBuf, len, btSPP.arrivalUs(), more);
+        Trace::record(Trace::SERVER_RX, len);
+        busy = true;
+    }
+    if (rxLineLen > 0) {
+        busy |= deliverLines();
+    }
+
+    // The file has the link to itself until it is done. Host data waits.
+    if (transfer.sending() && connectionStatus == CONNECTED) {
+        busy |= sendFileChunk();
+    }
+    reportTransfer();
+    reportOta();
+
+    bool urgentWaiting = urgentLen > 0 || urgent.size() > 0;
+    if (urgentWaiting) {
+        busy |= sendUrgent();
+    }
+
+    if (connectionStatus == CONNECTED && !urgentWaiting && !transfer.sending() && (replayLen > 0 || !spool.empty())) {
+        busy |= replay();
+    }
+
+    if (connectionStatus == CONNECTED && reliable.enabled()) {
+        busy |= reliablePump();
+    }
+
+    if (connectionStatus == CONNECTED && tuner.due()) {
+        // From how the last period went. The RSSI asked for now is there by the next one.
+        int rssiDelta = 0;
+        bool rssiKnown = btGAP.rssiDelta(rssiDelta);
+        tuner.update(rssiKnown, rssiDelta);
+        btGAP.readRssi(btSPP.peerAddress());
+        reliable.setWindowLimit(tuner.depth());
+    }
+
+    switch (idle.update(btGAP.pollInterval(), btGAP.powerMode())) {
+    case IdlePolicy::SLOW_DOWN:
+        btGAP.setPollInterval(btSPP.peerAddress(), IDLE_POLL_SLOTS);
+        break;
+    case IdlePolicy::SPEED_UP:
+        btGAP.setPollInterval(btSPP.peerAddress(), ESP_BT_GAP_TPOLL_DFT);
+        break;
+    case IdlePolicy::DISCONNECT:
+        // Host data brings it back, see sendData()
+        ESP_LOGI(SPP_SERVER_TAG, "Idle, disconnecting");
+        btSPP.endConnection();
+        if (!btSPP.isError()) {
+            setState(DISCONNECTING);
         }
+        break;
+    default:
+        break;
+    }
+
+    const uint8_t *control;
+    if (connectionStatus == CONNECTED && codec.control(&control) > 0) {
+        linkWrite(nullptr, 0);	// Compression negotiation, even with nothing to send
     }
 
     if (connectionStatus == CONNECTED) {
@@ -141,17 +429,13 @@ void BTSPPServer::loop() {
         digitalWrite(connectedPin, LOW);
     }
 
-    if (connectionStatus == NOT_INITIALIZED) {
-        initSPP();	// Will move to NOT_CONNECTED if it succeeds
-    }
-
     if ((connectionStatus == NOT_CONNECTED) && canConnect) {
         initiateConnection();	// Will move to CONNECTING or SEARCHING
     }
 
     if (connectionStatus == SEARCHING) {
         if (btGAP.inquiryDone()) {
-            uint8_t *address = btGAP.getAddress(clientName.c_str());
+            uint8_t *address = btGAP.getAddress(clientName);
             if (address) {
                 clientAddress =  ((uint64_t)address[0]) |
                             ((uint64_t)address[1]) << 8 |
@@ -162,49 +446,511 @@ void BTSPPServer::loop() {
                             ;
                 clientAddressCallback(clientAddress);
             }
-            connectionStatus = NOT_CONNECTED;	// Try connecting or searching again
+            setState(NOT_CONNECTED);	// Try connecting or searching again
         }
     }
 
     if (connectionStatus == CONNECTING) {
         // Connecting might fail - re-initiate the connection attempt
         if (btSPP.isError()) {
-            ESP_LOGI(SPP_SERVER_TAG, "%s", btSPP.getErrMessage().c_str());
-            connectionStatus == NOT_CONNECTED;
+            ESP_LOGI(SPP_SERVER_TAG, "%s", btSPP.getErrMessage());
+            notifier.post(Notifier::ERROR, "+ERROR:CONNECT");
+            setState(NOT_CONNECTED);
         } else if (btSPP.connectionDone()) {
             ESP_LOGI(SPP_SERVER_TAG, "Connected");
-            connectionStatus = CONNECTED;
+            BootProfiler::mark(BootProfiler::CONNECTED);
+            BridgeStats::add(BridgeStats::CONNECTS);
+            setState(CONNECTED);
         }
     }
 
+    if (connectionStatus == CONNECTED && !btSPP.connectionDone()) {
+        // Dropped by the remote end, or out of range. Keep trying to get it back.
+        ESP_LOGI(SPP_SERVER_TAG, "Link lost");
+        setState(NOT_CONNECTED);
+        canConnect = true;
+    }
+
     if (connectionStatus == DISCONNECTING) {
         if (!btSPP.connectionDone()) {
             ESP_LOGI(SPP_SERVER_TAG, "Disconnected");
-            connectionStatus = NOT_CONNECTED;
+            setState(NOT_CONNECTED);
         }
     }
+
+    // Between whole responses and whole blocks of received data
+    notifier.flush(host);
+    host.flush();
+
+    if (!busy) {
+        // Until the UART stage passes on more from the host, or the next tick
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
 }
 
 bool BTSPPServer::sendData(uint8_t *pData, int len) {
-	if (connectionStatus == CONNECTED) {
-		bool ret = btSPP.write(pData, len);
+	// Wakes the link, or brings it back if it was dropped for being idle
+	idle.traffic();
+	if (idle.dropped() && connectionStatus == NOT_CONNECTED) {
+		canConnect = true;
+	}
+
+	Lane lane = dataLane;
+	if (laneFlag >= 0 && len > 0 && pData[0] == laneFlag) {
+		lane = LANE_URGENT;
+		pData++;
+		len--;
+	}
+
+	if (lane == LANE_URGENT) {
+		uint8_t header[URGENT_HEADER];
+		uint32_t nowUs = micros();
+		if (urgent.space() < (size_t)(URGENT_HEADER + len)) {
+			BridgeStats::add(BridgeStats::URGENT_DROPPED_BYTES, len);
+		} else if (len > 0) {
+			header[0] = len;
+			memcpy(&header[1], &nowUs, sizeof(nowUs));
+			urgent.write(header, URGENT_HEADER);
+			urgent.write(pData, len);
+			BridgeStats::add(BridgeStats::URGENT_BYTES, len);
+		}
+		sendUrgent();
+		return true;
+	}
+
+	// AT+TUNE may have it wait for more to go with it, or go out in smaller writes
+	bool whole = len <= writeSize() && tuner.coalesceMs() == 0;
+	if (!whole && connectionStatus == CONNECTED) {
+		bool ret = coalesce(pData, len);
+		// Without AT+RELIABLE, waits for room as the direct path below does
+		unsigned long startMs = millis();
+		while (!ret && !reliable.enabled() && spool.empty() && !transfer.sending() &&
+			millis() - startMs < SEND_WAIT_MS && btSPP.connectionDone()) {
+			if (sendUrgent() || !replay(true)) {
+				btSPP.waitWritable(1);
+			}
+			ret = coalesce(pData, len);
+		}
+		if (ret) {
+			return true;
+		}
+	}
+
+	if (reliable.enabled()) {
+		// Into the window while it has room, else the spool keeps it until then
+		if (whole && replayLen == 0 && spool.empty() && !transfer.sending() && reliable.queue(pData, len)) {
+			Trace::record(Trace::SERVER_TX, len, true);
+			if (connectionStatus == CONNECTED) {
+				reliablePump();
+			}
+		} else {
+			spool.store(pData, len);
+		}
+		return true;
+	}
+
+	// Straight to the link, unless earlier data is still waiting in the spool
+	if (whole && connectionStatus == CONNECTED && replayLen == 0 && spool.empty() && !transfer.sending()) {
+		// The urgent lane gets each free write first
+		bool ret = !sendUrgent() && linkWrite(pData, len);
+		// The previous write is still going. Waiting here only holds up the
+		// radio stage; the UART stage goes on buffering behind it.
+		unsigned long startMs = millis();
+		while (!ret && millis() - startMs < SEND_WAIT_MS && btSPP.connectionDone()) {
+			btSPP.waitWritable(1);
+			ret = !sendUrgent() && linkWrite(pData, len);
+		}
+		Trace::record(Trace::SERVER_TX, len, ret);
+		if (btSPP.isError()) {
+			ESP_LOGI(SPP_SERVER_TAG, "Error writing message: %s", btSPP.getErrMessage());
+			notifier.post(Notifier::ERROR, "+ERROR:WRITE");
+		}
+		if (ret) {
+			return true;
+		}
+	}
+
+	// Kept until the link is back, or dropped if the spool is off or full
+	spool.store(pData, len);
+
+	return true;
+}
+
+int BTSPPServer::writeSize() {
+	// As much as AT+TUNE lets go in one write, less the packet header with AT+RELIABLE
+	int size = tuner.chunkSize();
+
+	if (reliable.enabled()) {
+		size -= RELIABLE_HEADER;
+		return size < RELIABLE_MAX_PAYLOAD ? size : RELIABLE_MAX_PAYLOAD;
+	}
+
+	return size < LINK_CODEC_MAX_BLOCK ? size : LINK_CODEC_MAX_BLOCK;
+}
+
+bool BTSPPServer::coalesce(const uint8_t *pData, int len) {
+	// Behind what is waiting to go out already, if nothing older is in the spool
+	if (!spool.empty() || transfer.sending() || replayLen + len > (int)sizeof(replayBuf)) {
+		return false;
+	}
+	if (replayLen == 0) {
+		replaySinceMs = millis();
+	}
+	memcpy(&replayBuf[replayLen], pData, len);
+	replayLen += len;
+
+	return true;
+}
+
+bool BTSPPServer::replay(bool now) {
+	const uint8_t *data;
+	int len;
+	int size = writeSize();
+
+	// Records go out together in writes as large as BTSPP takes (less the
+	// frame header in case the link is compressed by the time it goes), or
+	// the window takes as one packet, or AT+TUNE allows. One longer than that
+	// is split.
+	while ((len = spool.front(&data)) > 0 && (replayLen == 0 || replayLen + len <= size)) {
+		if (replayLen == 0) {
+			replaySinceMs = millis();
+		}
+		memcpy(&replayBuf[replayLen], data, len);
+		replayLen += len;
+		spool.pop();
+	}
+	if (replayLen == 0) {
+		return false;
+	}
+	if (!now && replayLen < size && spool.empty() && millis() - replaySinceMs < (uint32_t)tuner.coalesceMs()) {
+		return false;	// For more to go with it
+	}
+
+	int n = replayLen < size ? replayLen : size;
+	if (reliable.enabled()) {
+		if (!reliable.queue(replayBuf, n)) {
+			return false;
+		}
+	} else if (!linkWrite(replayBuf, n)) {
+		btSPP.waitWritable(1);	// The previous write is still going
+		return true;
+	} else if (btSPP.isError()) {
+		// Kept, to try again or to wait for the next connection
+		ESP_LOGI(SPP_SERVER_TAG, "Error replaying: %s", btSPP.getErrMessage());
+		notifier.post(Notifier::ERROR, "+ERROR:WRITE");
+		return false;
+	}
+	Trace::record(Trace::SERVER_TX, n, true);
+	replayLen -= n;
+	memmove(replayBuf, &replayBuf[n], replayLen);
+	replaySinceMs = millis();
+
+	return true;
+}
+
+bool BTSPPServer::sendUrgent() {
+	// A record at a time, each as a write of its own, so that urgent data only
+	// ever waits for the one write in front of it
+	bool wrote = false;
+
+	if (transfer.sending()) {
+		return false;
+	}
+
+	while (true) {
+		if (urgentLen == 0) {
+			uint8_t header[URGENT_HEADER];
+			if (urgent.read(header, URGENT_HEADER) != URGENT_HEADER) {
+				break;
+			}
+			memcpy(&urgentQueuedUs, &header[1], sizeof(urgentQueuedUs));
+			urgentLen = urgent.read(urgentBuf, header[0]);
+		}
+
+		if (reliable.enabled()) {
+			if (!reliable.queue(urgentBuf, urgentLen)) {
+				break;
+			}
+		} else {
+			if (connectionStatus != CONNECTED || !linkWrite(urgentBuf, urgentLen)) {
+				break;
+			}
+			if (btSPP.isError()) {
+				ESP_LOGI(SPP_SERVER_TAG, "Error writing urgent data: %s", btSPP.getErrMessage());
+				notifier.post(Notifier::ERROR, "+ERROR:WRITE");
+			}
+		}
+		Trace::record(Trace::SERVER_TX, urgentLen, true);
+		BridgeStats::max(BridgeStats::URGENT_MAX_WAIT_US, micros() - urgentQueuedUs);
+		urgentLen = 0;
+		wrote = true;
+	}
+
+	if (wrote && reliable.enabled() && connectionStatus == CONNECTED) {
+		reliablePump();
+	}
+
+	return wrote;
+}
+
+bool BTSPPServer::sendFileChunk() {
+	const uint8_t *chunk;
+	int len = transfer.next(&chunk);
+
+	if (len == 0) {
+		return false;
+	} else if (reliable.enabled()) {
+		if (!reliable.queue(chunk, len)) {
+			return false;
+		}
+	} else {
+		if (!linkWrite(chunk, len)) {
+			btSPP.waitWritable(1);	// The previous chunk is still going
+			return true;
+		}
 		if (btSPP.isError()) {
-			ESP_LOGI(SPP_SERVER_TAG, "Error writing message: %s", btSPP.getErrMessage().c_str());
+			ESP_LOGI(SPP_SERVER_TAG, "Error sending file: %s", btSPP.getErrMessage());
+			notifier.post(Notifier::ERROR, "+ERROR:WRITE");
+			transfer.fail("Write failed");
+			return false;
+		}
+	}
+	transfer.setChunkSize(writeSize());
+	transfer.sent();	// Reads the next one while this one is on the air
+
+	return true;
+}
+
+void BTSPPServer::reportTransfer() {
+	transfer.poll();
+
+	int percent = transfer.progress();
+	if (percent >= 0) {
+		notifier.post(Notifier::FILE, "+FILE:%d", percent);
+	}
+	if (transfer.ended()) {
+		if (transfer.getState() == FileTransfer::DONE) {
+			notifier.post(Notifier::FILE, "+FILE:DONE,%u,%u", transfer.bytes(), transfer.bytesPerSec());
+		} else {
+			notifier.post(Notifier::FILE, "+FILE:FAILED");
+		}
+	}
+}
+
+void BTSPPServer::reportOta() {
+	ota.poll();
+
+	int percent = ota.progress();
+	if (percent >= 0) {
+		notifier.post(Notifier::OTA, "+OTA:%d", percent);
+	}
+	if (ota.ended()) {
+		if (ota.getState() == OtaUpdate::DONE) {
+			notifier.post(Notifier::OTA, "+OTA:DONE,%u,%u", ota.bytes(), ota.bytesPerSec());
+		} else {
+			notifier.post(Notifier::OTA, "+OTA:FAILED");
+		}
+	}
+}
+
+bool BTSPPServer::reliablePump() {
+	const uint8_t *packet;
+	int len;
+	bool wrote = false;
+
+	while ((len = reliable.next(&packet)) > 0) {
+		if (!linkWrite(packet, len)) {
+			break;	// The previous write is still going
+		}
+		if (btSPP.isError()) {
+			// Counts as sent. It goes again if it isn't acknowledged.
+			ESP_LOGI(SPP_SERVER_TAG, "Error writing packet: %s", btSPP.getErrMessage());
+		}
+		reliable.sent();
+		wrote = true;
+	}
+
+	return wrote;
+}
+
+bool BTSPPServer::linkWrite(const uint8_t *pData, int len) {
+	// Same contract as BTSPP::write. Negotiation goes first, and what is
+	// written after START goes through the codec.
+	const uint8_t *control;
+	int controlLen = codec.control(&control);
+	if (controlLen > 0) {
+		if (!btSPP.write((uint8_t*)control, controlLen)) {
+			return false;
+		}
+		if (btSPP.isError()) {
+			return true;
+		}
+		codec.controlSent();
+	}
+
+	if (len == 0) {
+		return true;
+	} else if (!codec.txFramed()) {
+		return btSPP.write((uint8_t*)pData, len);
+	}
+
+	int frameLen = codec.encode(pData, len, frameBuf);
+	if (!btSPP.write(frameBuf, frameLen)) {
+		return false;
+	}
+	if (!btSPP.isError()) {
+		codec.commit();
+	}
+
+	return true;
+}
+
+int BTSPPServer::linkRead(uint8_t *buf, int len, bool *more) {
+	if (!codec.active() && linkInLen > 0) {
+		// Left over from when it was on
+		len = len < linkInLen ? len : linkInLen;
+		memcpy(buf, &linkIn[linkInHead], len);
+		linkInHead += len;
+		linkInLen -= len;
+		return len;
+	} else if (!codec.active()) {
+		return more ? btSPP.readBlock(buf, len, *more) : btSPP.read(buf, len, 0);
+	}
+
+	// Through the codec, which only takes what it has room to decode
+	if (linkInLen == 0) {
+		linkInHead = 0;
+		linkInLen = btSPP.read(linkIn, sizeof(linkIn), 0);
+		linkInLen = linkInLen > 0 ? linkInLen : 0;
+	}
+	int used = codec.receive(&linkIn[linkInHead], linkInLen);
+	linkInHead += used;
+	linkInLen -= used;
+
+	return codec.read(buf, len);
+}
+
+// No 00 in what it gives, so a 00 can end each frame. Gives at most one byte
+// more than it takes per 254 bytes, plus one.
+static int cobsEncode(const uint8_t *in, int len, uint8_t *out) {
+	int code = 0;
+	int o = 1;
+	uint8_t run = 1;
+
+	for (int i = 0; i < len; i++) {
+		if (in[i] != 0) {
+			out[o++] = in[i];
+			run++;
+		}
+		if (in[i] == 0 || run == 0xff) {
+			out[code] = run;
+			code = o++;
+			run = 1;
 		}
+	}
+	out[code] = run;
 
-		return ret;
+	return o;
+}
+
+void BTSPPServer::deliver(const uint8_t *data, int len, uint32_t arrivedUs, bool more) {
+	switch (rxMode) {
+	case RX_LINES:
+		host.write(data, len);
+		host.write("\r\n");
+		BridgeStats::add(BridgeStats::UART_TX_BYTES, len + 2);
+		return;
+	case RX_RAW:
+		host.write(data, len);
+		BridgeStats::add(BridgeStats::UART_TX_BYTES, len);
+		return;
+	case RX_WHOLE_LINES:
+		// Room was only made for what fits
+		if (rxLineLen == 0) {
+			rxLineSinceMs = millis();
+		}
+		memcpy(&rxLine[rxLineLen], data, len);
+		rxLineLen += len;
+		return;
+	case RX_FRAMES:
+	case RX_COBS:
+		break;
+	default:
+		return;
 	}
 
-	return true;	// Can't send but let handler clear data as we aren't connected
+	writeFrame(data, len, arrivedUs, more ? RX_FRAME_MORE : 0);
+	BridgeStats::add(BridgeStats::HOST_FRAMES);
+	BridgeStats::max(BridgeStats::FRAME_DELAY_MAX_US, (uint32_t)micros() - arrivedUs);
 }
 
-bool BTSPPServer::setRname(std::string cmd, std::string name) {
-	ESP_LOGI(SPP_SERVER_TAG, "Setting client name to %s", name.c_str());
+void BTSPPServer::writeFrame(const uint8_t *data, int len, uint32_t us, uint16_t flags) {
+	static uint8_t frame[RX_FRAME_HEADER + SPP_MAX_BLOCK];
+	static uint8_t encoded[SPP_MAX_BLOCK + RX_COBS_OVERHEAD];
+	int n = 0;
+	uint16_t length = len | flags;
 
-	if (name.size() <= MAX_NAME_LEN) {
-		if (strcmp(clientName.c_str(), name.c_str()) != 0) {
-			clientName = name;
-			clientNameCallback(clientName.c_str());
+	frame[n++] = length;
+	frame[n++] = length >> 8;
+	frame[n++] = us;
+	frame[n++] = us >> 8;
+	frame[n++] = us >> 16;
+	frame[n++] = us >> 24;
+	if (rxMode == RX_FRAMES) {
+		host.writeThrough(frame, n);
+		host.writeThrough(data, len);
+		n += len;
+	} else {
+		memcpy(&frame[n], data, len);
+		n = cobsEncode(frame, n + len, encoded);
+		encoded[n++] = 0;
+		host.writeThrough(encoded, n);
+	}
+	BridgeStats::add(BridgeStats::UART_TX_BYTES, n);
+}
+
+bool BTSPPServer::deliverLines() {
+	int end = 0;
+	int lines = 0;
+
+	if (rxMode == RX_DISCARD) {
+		rxLineLen = 0;
+		return false;
+	} else if (rxMode == RX_WHOLE_LINES) {
+		for (int i = 0; i < rxLineLen; i++) {
+			if (rxLine[i] == '\n') {
+				end = i + 1;
+				lines++;
+			}
+		}
+	}
+	// The start of a line goes on its own once it has waited long enough,
+	// fills the buffer, or is all that is left after AT+SENDRX changed
+	if (end == 0 && rxMode == RX_WHOLE_LINES && rxLineLen < RX_LINE_SIZE && millis() - rxLineSinceMs < RX_LINE_FLUSH_MS) {
+		return false;
+	}
+	end = end > 0 ? end : rxLineLen;
+	if (host.availableForWrite() < end) {
+		return false;
+	}
+
+	host.write(rxLine, end);
+	BridgeStats::add(BridgeStats::UART_TX_BYTES, end);
+	BridgeStats::add(BridgeStats::HOST_FRAMES, lines);
+	rxLineLen -= end;
+	memmove(rxLine, &rxLine[end], rxLineLen);
+	rxLineSinceMs = millis();
+
+	return true;
+}
+
+bool BTSPPServer::setRname(const char *cmd, const char *name) {
+	ESP_LOGI(SPP_SERVER_TAG, "Setting client name to %s", name);
+
+	if (strlen(name) <= MAX_NAME_LEN) {
+		if (strcmp(clientName, name) != 0) {
+			setClientName(name);
+			clientNameCallback(clientName);
 
 			clientAddress = 0;
             clientAddressCallback(clientAddress);
@@ -216,11 +962,36 @@ bool BTSPPServer::setRname(std::string cmd, std::string name) {
 	return false;
 }
 
-bool BTSPPServer::setSendRx(std::string cmd, std::string arg) {
+bool BTSPPServer::setSendRx(const char *cmd, const char *arg) {
 	ESP_LOGI(SPP_SERVER_TAG, "setSendRx %s", arg);
 
-	if (arg.size() == 1) {
-        sendRx = arg != "0";
+	if (strlen(arg) == 1 && arg[0] >= '0' && arg[0] <= '5') {
+        RxMode mode = (RxMode)(arg[0] - '0');
+        // Anything held goes in the old mode, and its own OK in the new one
+        host.setFraming(mode >= RX_FRAMES);
+        rxMode = mode;
+
+		return true;
+	}
+
+	return false;
+}
+
+bool BTSPPServer::setLoopback(const char *cmd, const char *arg) {
+	ESP_LOGI(SPP_SERVER_TAG, "setLoopback %s", arg);
+
+	if (arg[0] == 0) {
+		// A soak test should see what didn't make it back
+		host.printf("ON=%d\r\n", btSPP.loopback() ? 1 : 0);
+		host.printf("BYTES=%u\r\n", BridgeStats::get(BridgeStats::LOOPBACK_BYTES));
+		host.printf("DROPPED=%u\r\n", BridgeStats::get(BridgeStats::LOOPBACK_DROPS));
+
+		return true;
+	} else if (strlen(arg) == 1) {
+		if (!btSPP.setLoopback(strcmp(arg, "0") != 0)) {
+			ESP_LOGI(SPP_SERVER_TAG, "%s", btSPP.getErrMessage());
+			return false;
+		}
 
 		return true;
 	}
@@ -228,50 +999,395 @@ bool BTSPPServer::setSendRx(std::string cmd, std::string arg) {
 	return false;
 }
 
-bool BTSPPServer::connect(std::string cmd, std::string name) {
-	if (name.size() > 0) {
+bool BTSPPServer::setSpool(const char *cmd, const char *arg) {
+	// AT+SPOOL, AT+SPOOL=CLEAR or AT+SPOOL=<on>[,<flash KB>[,OLDEST|NEWEST]]
+	int on;
+	int flashKB = -1;
+	char policy[8] = "";
+
+	if (arg[0] == 0) {
+		spool.report(host);
+	} else if (strcmp(arg, "CLEAR") == 0) {
+		spool.clear();
+		replayLen = 0;
+	} else if (sscanf(arg, "%d,%d,%7s", &on, &flashKB, policy) >= 1) {
+		if (policy[0] != 0 && strcmp(policy, "OLDEST") != 0 && strcmp(policy, "NEWEST") != 0) {
+			return false;
+		}
+		spool.setEnabled(on != 0);
+		if (flashKB >= 0) {
+			spool.setFlashLimit((uint32_t)flashKB * 1024);
+		}
+		if (policy[0] != 0) {
+			spool.setPolicy(strcmp(policy, "OLDEST") == 0 ? Spool::DROP_OLDEST : Spool::DROP_NEWEST);
+		}
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setUrc(const char *cmd, const char *arg) {
+	// AT+URC or AT+URC=<category>,<0|1>
+	char name[8];
+	int on;
+	Notifier::Category category;
+
+	if (arg[0] == 0) {
+		notifier.report(host);
+	} else if (sscanf(arg, "%7[A-Z],%d", name, &on) == 2 && Notifier::lookup(name, category)) {
+		notifier.setEnabled(category, on != 0);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setRxFlow(const char *cmd, const char *arg) {
+	// AT+RXFLOW or AT+RXFLOW=<high %>,<low %>
+	int high;
+	int low;
+
+	if (arg[0] == 0) {
+		host.printf("HIGH=%d\r\n", btSPP.rxHighWater());
+		host.printf("LOW=%d\r\n", btSPP.rxLowWater());
+		host.printf("BUFFERED=%u\r\n", (uint32_t)btSPP.rxBuffered());
+		host.printf("CAPACITY=%u\r\n", (uint32_t)btSPP.rxCapacity());
+		host.printf("THROTTLED=%d\r\n", btSPP.rxThrottled() ? 1 : 0);
+	} else if (sscanf(arg, "%d,%d", &high, &low) == 2) {
+		return btSPP.setRxWatermarks(high, low);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setCompress(const char *cmd, const char *arg) {
+	// AT+COMPRESS or AT+COMPRESS=<0|1>
+	if (arg[0] == 0) {
+		codec.report(host);
+	} else if (strcmp(arg, "0") == 0 || strcmp(arg, "1") == 0) {
+		codec.setEnabled(arg[0] == '1');
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setReliable(const char *cmd, const char *arg) {
+	// AT+RELIABLE or AT+RELIABLE=<0|1>
+	if (arg[0] == 0) {
+		reliable.report(host);
+	} else if (strcmp(arg, "0") == 0 || strcmp(arg, "1") == 0) {
+		reliable.setEnabled(arg[0] == '1');
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setLane(const char *cmd, const char *arg) {
+	// AT+LANE or AT+LANE=<0|1>[,<flag byte in hex>]
+	int lane;
+	unsigned int flag;
+
+	if (arg[0] == 0) {
+		host.printf("LANE=%d\r\n", dataLane);
+		if (laneFlag >= 0) {
+			host.printf("FLAG=%02X\r\n", laneFlag);
+		} else {
+			host.printf("FLAG=NONE\r\n");
+		}
+		host.printf("URGENT_QUEUED=%u\r\n", (uint32_t)urgent.size() + urgentLen);
+		return true;
+	}
+
+	int n = sscanf(arg, "%d,%x", &lane, &flag);
+	if (n < 1 || lane < LANE_BULK || lane > LANE_URGENT || (n == 2 && flag > 0xff)) {
+		return false;
+	}
+	dataLane = (Lane)lane;
+	laneFlag = n == 2 ? (int)flag : -1;
+
+	return true;
+}
+
+bool BTSPPServer::sendFile(const char *cmd, const char *arg) {
+	// AT+SENDFILE, AT+SENDFILE=<path> or AT+SENDFILE=STOP
+	if (arg[0] == 0) {
+		transfer.report(host);
+	} else if (strcmp(arg, "STOP") == 0) {
+		transfer.fail("Stopped");
+	} else if (connectionStatus != CONNECTED) {
+		return false;
+	} else if (!transfer.startSend(arg, writeSize())) {
+		ESP_LOGI(SPP_SERVER_TAG, "Can't send %s: %s", arg, transfer.getErrMessage());
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::receiveFile(const char *cmd, const char *arg) {
+	// AT+RECVFILE, AT+RECVFILE=<path> or AT+RECVFILE=STOP
+	if (arg[0] == 0) {
+		transfer.report(host);
+	} else if (strcmp(arg, "STOP") == 0) {
+		transfer.fail("Stopped");
+	} else if (ota.active()) {
+		return false;
+	} else if (!transfer.startReceive(arg)) {
+		ESP_LOGI(SPP_SERVER_TAG, "Can't receive %s: %s", arg, transfer.getErrMessage());
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::update(const char *cmd, const char *arg) {
+	// AT+OTA, AT+OTA=START, AT+OTA=STOP or AT+OTA=RESTART
+	if (arg[0] == 0) {
+		ota.report(host);
+	} else if (strcmp(arg, "START") == 0) {
+		if (transfer.receiving()) {
+			return false;
+		} else if (!ota.start()) {
+			ESP_LOGI(SPP_SERVER_TAG, "Can't update: %s", ota.getErrMessage());
+			return false;
+		}
+	} else if (strcmp(arg, "STOP") == 0) {
+		ota.fail("Stopped");
+	} else if (strcmp(arg, "RESTART") == 0) {
+		if (ota.active()) {
+			return false;
+		}
+		restartDue = true;	// Once the OK has gone out
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setTuning(const char *cmd, const char *arg) {
+	// AT+TUNE or AT+TUNE=<0|1>
+	if (arg[0] == 0) {
+		tuner.report(host);
+	} else if (strcmp(arg, "0") == 0 || strcmp(arg, "1") == 0) {
+		tuner.setEnabled(arg[0] == '1');
+		reliable.setWindowLimit(tuner.depth());
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::bond(const char *cmd, const char *arg) {
+	// AT+BOND, AT+BOND=REMOVE,<address> or AT+BOND=CLEAR
+	esp_bd_addr_t bonds[BTGAP_MAX_PEERS];
+	char address[BTGAP_ADDRESS_LEN + 1];
+	int n = btGAP.getBonds(bonds, BTGAP_MAX_PEERS);
+
+	if (arg[0] == 0) {
+		host.printf("BONDS=%d\r\n", n);
+		for (int i = 0; i < n; i++) {
+			host.printf("BOND=%s\r\n", BTGAP::formatAddress(bonds[i], address));
+		}
+	} else if (strcmp(arg, "CLEAR") == 0) {
+		for (int i = 0; i < n; i++) {
+			if (!btGAP.removeBond(bonds[i])) {
+				return false;
+			}
+		}
+	} else if (strncmp(arg, "REMOVE,", 7) == 0) {
+		esp_bd_addr_t peer;
+		if (!BTGAP::parseAddress(&arg[7], peer) || !btGAP.removeBond(peer)) {
+			return false;
+		}
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::setPin(const char *cmd, const char *arg) {
+	// AT+PIN, AT+PIN=<pin> for any peer or AT+PIN=<address>,[<pin>] for one
+	const char *comma = strchr(arg, ',');
+	char address[BTGAP_ADDRESS_LEN + 1];
+	esp_bd_addr_t peer;
+
+	if (arg[0] == 0) {
+		btGAP.reportPins(host);
+		return true;
+	}
+
+	if (comma == nullptr) {
+		if (!btGAP.setPin(nullptr, arg)) {
+			return false;
+		}
+	} else if (comma - arg > BTGAP_ADDRESS_LEN) {
+		return false;
+	} else {
+		memcpy(address, arg, comma - arg);
+		address[comma - arg] = 0;
+		if (!BTGAP::parseAddress(address, peer) || !btGAP.setPin(peer, comma + 1)) {
+			return false;
+		}
+	}
+
+	char pins[BTGAP_PINS_STRING_LEN];
+	btGAP.pinsToString(pins, sizeof(pins));
+	pinsCallback(pins);
+
+	return true;
+}
+
+bool BTSPPServer::setIdle(const char *cmd, const char *arg) {
+	// AT+IDLE or AT+IDLE=<slow poll after ms>[,<disconnect after ms>]
+	unsigned int slowPollMs;
+	unsigned int disconnectMs = 0;
+
+	if (arg[0] == 0) {
+		idle.report(host);
+	} else if (sscanf(arg, "%u,%u", &slowPollMs, &disconnectMs) >= 1) {
+		return idle.set(slowPollMs, disconnectMs);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::connect(const char *cmd, const char *name) {
+	if (name[0] != 0) {
 		setRname(cmd, name);
 	}
 
-	ESP_LOGI(SPP_SERVER_TAG, "Connecting to %s", clientName.c_str());
+	ESP_LOGI(SPP_SERVER_TAG, "Connecting to %s", clientName);
 
 	canConnect = true;
 
 	return true;
 }
 
-bool BTSPPServer::disconnect(std::string cmd, std::string name) {
+bool BTSPPServer::disconnect(const char *cmd, const char *name) {
 	ESP_LOGI(SPP_SERVER_TAG, "Disconnecting");
+	idle.stayDown();
 	btSPP.endConnection();
 	if (btSPP.isError()) {
 		return false;
 	}
 
-	connectionStatus = DISCONNECTING;
+	setState(DISCONNECTING);
 
 	return true;
 }
 
-bool BTSPPServer::setName(std::string cmd, std::string name) {
-	if (name.size() <= MAX_NAME_LEN) {
-		serverName = name;
-        serverNameCallback(serverName.c_str());
-		return btGAP.setName(name.c_str());
+bool BTSPPServer::setName(const char *cmd, const char *name) {
+	if (strlen(name) <= MAX_NAME_LEN) {
+		setServerName(name);
+        serverNameCallback(serverName);
+		return btGAP.setName(name);
 	}
 
 	return false;
 }
 
-bool BTSPPServer::reportState(std::string cmd, std::string name) {
-    // ESP_LOGI(SPP_SERVER_TAG, "Sending state %d", connectionStatus);
+bool BTSPPServer::reportState(const char *cmd, const char *format) {
+	// The number by default, for hosts that parse it; AT+STATE=NAME as in +STATE:
+	if (format[0] == 0) {
+		host.printf("%d\r\n", connectionStatus);
+	} else if (strcmp(format, "NAME") == 0) {
+		host.printf("%s\r\n", stateNames[connectionStatus]);
+	} else {
+		return false;
+	}
 
-	serial.println(connectionStatus);
-    serial.flush();
+	return true;
+}
+
+bool BTSPPServer::reportBoot(const char *cmd, const char *unused) {
+	BootProfiler::report(host);
+
+	return true;
+}
+
+bool BTSPPServer::reportStats(const char *cmd, const char *format) {
+	if (format[0] == 0 || strcmp(format, "TEXT") == 0) {
+		BridgeStats::reportText(host);
+	} else if (strcmp(format, "BIN") == 0) {
+		BridgeStats::reportBinary(host);
+	} else if (strcmp(format, "RESET") == 0) {
+		BridgeStats::reset();
+	} else {
+		return false;
+	}
 
 	return true;
 }
 
+bool BTSPPServer::trace(const char *cmd, const char *arg) {
+	if (arg[0] == 0) {
+		Trace::dump(host);
+	} else if (strcmp(arg, "CLEAR") == 0) {
+		Trace::clear();
+	} else if (strcmp(arg, "ON") == 0 || strcmp(arg, "OFF") == 0) {
+		Trace::setEnabled(strcmp(arg, "ON") == 0);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::reportConnStats(const char *cmd, const char *arg) {
+	if (arg[0] == 0 || strcmp(arg, "HIST") == 0) {
+		ConnStats::report(host, strcmp(arg, "HIST") == 0);
+	} else if (strcmp(arg, "RESET") == 0) {
+		ConnStats::reset();
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool BTSPPServer::bench(const char *cmd, const char *arg) {
+	// AT+BENCH=<size>[,<seconds>[,<window>]]
+	int size = 64;
+	int seconds = 10;
+	int window = 4;
+
+	if (arg[0] != 0 && sscanf(arg, "%d,%d,%d", &size, &seconds, &window) < 1) {
+		return false;
+	}
+	if (size < LinkBench::MIN_SIZE || size > LinkBench::MAX_SIZE ||
+		seconds < 1 || seconds > LinkBench::MAX_SECONDS ||
+		window < 1 || window > LINK_BENCH_MAX_WINDOW ||
+		size * window > RECV_QUEUE_SIZE) {
+		return false;
+	}
+	if (connectionStatus != CONNECTED) {
+		return false;
+	}
+
+	// Runs here, in the SPP task, so nothing else touches the link meanwhile
+	LinkBench linkBench(btSPP);
+	bool ok = linkBench.run(size, seconds, window);
+	linkBench.report(host);
+
+	return ok;
+}
+
 void BTSPPServer::start(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin) {
+  	serial.setTxBufferSize(UART_TX_BUFFER_SIZE);
   	serial.begin(baud, config, rxPin, txPin);
 
     /* Initialize NVS — it is used to store PHY calibration data */
@@ -281,13 +1397,35 @@ void BTSPPServer::start(unsigned long baud, uint32_t config, int8_t rxPin, int8_
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+    BootProfiler::mark(BootProfiler::NVS_INITED);
+
+    spool.begin();
 
-	commandHandler.setCommandCallback("SENDRX", [this](std::string cmd, std::string arg) { return setSendRx(cmd, arg);});
-	commandHandler.setCommandCallback("RNAME", [this](std::string cmd, std::string name) { return setRname(cmd, name);});
-	commandHandler.setCommandCallback("NAME", [this](std::string cmd, std::string name) { return setName(cmd, name);});
-	commandHandler.setCommandCallback("CONNECT", [this](std::string cmd, std::string name) { return connect(cmd, name);});
-	commandHandler.setCommandCallback("DISCONNECT", [this](std::string cmd, std::string args) { return disconnect(cmd, args);});
-	commandHandler.setCommandCallback("STATE", [this](std::string cmd, std::string name) { return reportState(cmd, name);});
+	commandHandler.setCommandCallback("SENDRX", [this](const char *cmd, const char *arg) { return setSendRx(cmd, arg);});
+	commandHandler.setCommandCallback("RNAME", [this](const char *cmd, const char *name) { return setRname(cmd, name);});
+	commandHandler.setCommandCallback("NAME", [this](const char *cmd, const char *name) { return setName(cmd, name);});
+	commandHandler.setCommandCallback("CONNECT", [this](const char *cmd, const char *name) { return connect(cmd, name);});
+	commandHandler.setCommandCallback("DISCONNECT", [this](const char *cmd, const char *args) { return disconnect(cmd, args);});
+	commandHandler.setCommandCallback("STATE", [this](const char *cmd, const char *name) { return reportState(cmd, name);});
+	commandHandler.setCommandCallback("STATS", [this](const char *cmd, const char *format) { return reportStats(cmd, format);});
+	commandHandler.setCommandCallback("CONNSTATS", [this](const char *cmd, const char *arg) { return reportConnStats(cmd, arg);});
+	commandHandler.setCommandCallback("TRACE", [this](const char *cmd, const char *arg) { return trace(cmd, arg);});
+	commandHandler.setCommandCallback("BOOT", [this](const char *cmd, const char *unused) { return reportBoot(cmd, unused);});
+	commandHandler.setCommandCallback("LOOPBACK", [this](const char *cmd, const char *arg) { return setLoopback(cmd, arg);});
+	commandHandler.setCommandCallback("BENCH", [this](const char *cmd, const char *arg) { return bench(cmd, arg);});
+	commandHandler.setCommandCallback("SPOOL", [this](const char *cmd, const char *arg) { return setSpool(cmd, arg);});
+	commandHandler.setCommandCallback("URC", [this](const char *cmd, const char *arg) { return setUrc(cmd, arg);});
+	commandHandler.setCommandCallback("RXFLOW", [this](const char *cmd, const char *arg) { return setRxFlow(cmd, arg);});
+	commandHandler.setCommandCallback("COMPRESS", [this](const char *cmd, const char *arg) { return setCompress(cmd, arg);});
+	commandHandler.setCommandCallback("RELIABLE", [this](const char *cmd, const char *arg) { return setReliable(cmd, arg);});
+	commandHandler.setCommandCallback("LANE", [this](const char *cmd, const char *arg) { return setLane(cmd, arg);});
+	commandHandler.setCommandCallback("SENDFILE", [this](const char *cmd, const char *arg) { return sendFile(cmd, arg);});
+	commandHandler.setCommandCallback("RECVFILE", [this](const char *cmd, const char *arg) { return receiveFile(cmd, arg);});
+	commandHandler.setCommandCallback("OTA", [this](const char *cmd, const char *arg) { return update(cmd, arg);});
+	commandHandler.setCommandCallback("TUNE", [this](const char *cmd, const char *arg) { return setTuning(cmd, arg);});
+	commandHandler.setCommandCallback("BOND", [this](const char *cmd, const char *arg) { return bond(cmd, arg);});
+	commandHandler.setCommandCallback("PIN", [this](const char *cmd, const char *arg) { return setPin(cmd, arg);});
+	commandHandler.setCommandCallback("IDLE", [this](const char *cmd, const char *arg) { return setIdle(cmd, arg);});
 	commandHandler.setSendCallback([this](uint8_t *pData, int len) { return sendData(pData, len);});
 	
 	pinMode(commandPin, INPUT_PULLUP);
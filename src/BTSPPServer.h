@@ -1,12 +1,32 @@
 #ifndef _BT_SPP_SERVER_H
 #define _BT_SPP_SERVER_H
 
-#include <unordered_map>
 #include <string>
+#include <atomic>
 
 #include <CommandHandler.h>
 #include <BTSPP.h>
 #include <BTGAP.h>
+#include <SPSCRing.h>
+#include <HostStream.h>
+#include <Spool.h>
+#include <Notifier.h>
+#include <LinkCodec.h>
+#include <ReliableLink.h>
+#include <FileTransfer.h>
+#include <OtaUpdate.h>
+#include <LinkTuner.h>
+#include <IdlePolicy.h>
+
+#define MAX_NAME_LEN 63
+// Longest line AT+SENDRX=3 puts back together. Longer ones go in pieces.
+#ifndef RX_LINE_SIZE
+#define RX_LINE_SIZE 256
+#endif
+// How long the start of a line waits for the rest before it goes anyway
+#ifndef RX_LINE_FLUSH_MS
+#define RX_LINE_FLUSH_MS 100
+#endif
 
 class BTSPPServer {
 public:
@@ -24,46 +44,140 @@ public:
     void setClientAddressCallback(std::function<void(unsigned long address)> callback);
     void setServerNameCallback(std::function<void(const char *name)> callback);
     void setClientNameCallback(std::function<void(const char *name)> callback);
+    // PINs as BTGAP::pinsToString() has them, each time AT+PIN changes them
+    void setPinsCallback(std::function<void(const char *pins)> callback);
     
     void setClientAddress(unsigned long address);
     void setServerName(const char* name);
     void setClientName(const char * name);
+    void setPins(const char *pins);
 
     void setCommandPin(uint8_t pin);
     void setConnectedPin(uint8_t pin);
 
+    // Lets loop() bring the stack up while the application is still loading its
+    // configuration. Until setConfigured(true), names and callbacks aren't used.
+    void setConfigured(bool configured);
+
+    // What happens to data from the client, see AT+SENDRX
+    typedef enum {
+        RX_DISCARD = 0,
+        RX_LINES,           // Each block as it arrived, followed by \r\n
+        RX_RAW,             // Byte for byte
+        RX_WHOLE_LINES,     // Byte for byte, but only whole lines at a time
+        RX_FRAMES,          // <length: 2> <arrived at, us: 4> <data>, a block each, and text in frames too
+        RX_COBS             // The same in COBS, then 00
+    } RxMode;
+
+    // Which queue data from the host goes to, see AT+LANE
+    typedef enum {
+        LANE_BULK = 0,      // Straight to the link, or the spool
+        LANE_URGENT         // Ahead of anything bulk, a write at a time
+    } Lane;
+
     void start(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin);
+
+    // The bridge runs as two stages, each called over and over from its own
+    // task, which may be on a different core. uartLoop() only moves bytes
+    // between the UART and two rings. loop() does everything else: commands,
+    // the link and the connection state.
+    void uartLoop();
     void loop();
 
 private:
+    SPSCRing fromHost;      // UART stage to radio stage
+    SPSCRing toHost;        // Radio stage to UART stage
+    HostStream host;        // The radio stage's end of both
+    TaskHandle_t radioTask = nullptr;
     BTSPP btSPP;
     BTGAP btGAP;
     CommandHandler commandHandler;
+    Spool spool;            // Host data while the link is down
+    uint8_t replayBuf[MAX_STRING_LENGTH];
+    int replayLen = 0;      // Taken from the spool, or held back by AT+TUNE, not written yet
+    uint32_t replaySinceMs = 0;
+    Notifier notifier;
+    LinkCodec codec;        // AT+COMPRESS
+    uint8_t frameBuf[MAX_STRING_LENGTH];
+    uint8_t linkIn[MAX_STRING_LENGTH];  // Read from the link, not taken by the codec yet
+    int linkInHead = 0;
+    int linkInLen = 0;
+    ReliableLink reliable;  // AT+RELIABLE
+    SPSCRing urgent;        // Urgent lane: <length> <queued at, us: 4> <data> records
+    uint8_t urgentBuf[MAX_STRING_LENGTH];
+    int urgentLen = 0;      // Taken from the urgent lane, not written yet
+    uint32_t urgentQueuedUs = 0;
+    Lane dataLane = LANE_BULK;
+    int laneFlag = -1;      // Data starting with this byte goes to the urgent lane, without it
+    FileTransfer transfer;  // AT+SENDFILE, AT+RECVFILE
+    OtaUpdate ota;          // AT+OTA
+    bool restartDue = false;
+    LinkTuner tuner;        // AT+TUNE
+    IdlePolicy idle;        // AT+IDLE
     State connectionStatus = NOT_INITIALIZED;
     HardwareSerial &serial;
     bool canConnect = false;
-    bool sendRx = false;
+    RxMode rxMode = RX_DISCARD;
+    uint8_t rxLine[RX_LINE_SIZE];   // AT+SENDRX=3, up to the end of a line
+    int rxLineLen = 0;
+    uint32_t rxLineSinceMs = 0;
+    std::atomic<bool> configured{true};
+    bool nameApplied = false;
     unsigned long clientAddress = 0;
-    std::string serverName;
-    std::string clientName;
+    char serverName[MAX_NAME_LEN + 1];
+    char clientName[MAX_NAME_LEN + 1];
     uint8_t commandPin = 15;
     uint8_t connectedPin = 13;
     
+    void setState(State state);
     void initSPP();
     void initiateConnection();
 
-    bool setSendRx(std::string cmd, std::string name);
-    bool setRname(std::string cmd, std::string name);
-    bool setName(std::string cmd, std::string name);
-    bool connect(std::string cmd, std::string name);
-    bool disconnect(std::string cmd, std::string args);
-    bool reportState(std::string cmd, std::string unused);
+    bool setSendRx(const char *cmd, const char *name);
+    bool setRname(const char *cmd, const char *name);
+    bool setName(const char *cmd, const char *name);
+    bool connect(const char *cmd, const char *name);
+    bool disconnect(const char *cmd, const char *args);
+    bool reportState(const char *cmd, const char *format);
+    bool reportBoot(const char *cmd, const char *unused);
+    bool reportStats(const char *cmd, const char *format);
+    bool trace(const char *cmd, const char *arg);
+    bool reportConnStats(const char *cmd, const char *arg);
+    bool bench(const char *cmd, const char *arg);
+    bool setLoopback(const char *cmd, const char *arg);
+    bool setSpool(const char *cmd, const char *arg);
+    bool setUrc(const char *cmd, const char *arg);
+    bool setRxFlow(const char *cmd, const char *arg);
+    bool setCompress(const char *cmd, const char *arg);
+    bool setReliable(const char *cmd, const char *arg);
+    bool setLane(const char *cmd, const char *arg);
+    bool sendFile(const char *cmd, const char *arg);
+    bool receiveFile(const char *cmd, const char *arg);
+    bool update(const char *cmd, const char *arg);
+    bool setTuning(const char *cmd, const char *arg);
+    bool bond(const char *cmd, const char *arg);
+    bool setPin(const char *cmd, const char *arg);
+    bool setIdle(const char *cmd, const char *arg);
     bool sendData(uint8_t *pData, int len);
+    bool linkWrite(const uint8_t *pData, int len);
+    int linkRead(uint8_t *buf, int len, bool *more = nullptr);     // more: a block at a time
+    void deliver(const uint8_t *data, int len, uint32_t arrivedUs, bool more);
+    void writeFrame(const uint8_t *data, int len, uint32_t us, uint16_t flags);
+    bool deliverLines();
+    int writeSize();
+    bool coalesce(const uint8_t *pData, int len);
+    bool replay(bool now = false);     // now: without waiting for more to go with it
+    bool reliablePump();
+    bool sendUrgent();
+    bool sendFileChunk();
+    void reportTransfer();
+    void reportOta();
 
     std::function<void(unsigned long address)> clientAddressCallback;
     std::function<void(const char *name)> serverNameCallback;
     std::function<void(const char *name)> clientNameCallback;
+    std::function<void(const char *pins)> pinsCallback;
 
-    static std::unordered_map<State, std::string> state2string;
+    static const char *stateNames[];
 };
 #endif
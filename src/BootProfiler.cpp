@@ -0,0 +1,37 @@
+#include <BootProfiler.h>
+#include <esp_timer.h>
+
+int64_t BootProfiler::marks[NUM_PHASES] = {0};
+
+const char *BootProfiler::names[NUM_PHASES] = {
+    "SETUP_START",
+    "NVS_INITED",
+    "CONFIG_LOADED",
+    "CONTROLLER_STARTED",
+    "BLUEDROID_INITED",
+    "BLUEDROID_ENABLED",
+    "SPP_INITED",
+    "GAP_INITED",
+    "CONNECT_STARTED",
+    "SDP_DONE",
+    "CONNECTED"
+};
+
+void BootProfiler::mark(Phase phase) {
+    // Only the first occurrence counts - later reconnects aren't part of boot
+    if (marks[phase] == 0) {
+        marks[phase] = esp_timer_get_time();
+    }
+}
+
+void BootProfiler::report(Print &out) {
+    // <phase>,<us since boot>,<us since setup() started>
+    // Phases can overlap, so they are not necessarily in chronological order.
+    for (int i = 0; i < NUM_PHASES; i++) {
+        if (marks[i] != 0) {
+            out.printf("%s,%lld,%lld\r\n", names[i], (long long)marks[i], (long long)(marks[i] - marks[SETUP_START]));
+        } else {
+            out.printf("%s,-,-\r\n", names[i]);
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef BOOT_PROFILER_H
+#define BOOT_PROFILER_H
+
+#include <Arduino.h>
+
+/*
+ * Records when each stage of the power-on to connected sequence first completes,
+ * using the microsecond esp_timer clock (which counts from boot).
+ */
+class BootProfiler {
+public:
+    typedef enum {
+        SETUP_START = 0,
+        NVS_INITED,
+        CONFIG_LOADED,
+        CONTROLLER_STARTED,
+        BLUEDROID_INITED,
+        BLUEDROID_ENABLED,
+        SPP_INITED,
+        GAP_INITED,
+        CONNECT_STARTED,
+        SDP_DONE,
+        CONNECTED,
+        NUM_PHASES
+    } Phase;
+
+    static void mark(Phase phase);
+    static int64_t get(Phase phase) { return marks[phase]; }
+    static void report(Print &out);
+
+private:
+    static int64_t marks[NUM_PHASES];
+    static const char *names[NUM_PHASES];
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include <BridgeStats.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_system.h>
+
+#define STATS_BINARY_VERSION 1
+
+std::atomic<uint32_t> BridgeStats::counters[NUM_COUNTERS];
+
+const char *BridgeStats::names[NUM_COUNTERS] = {
+    "TX_BYTES",
+    "TX_PACKETS",
+    "TX_REJECTS",
+    "TX_ERRORS",
+    "RX_BYTES",
+    "RX_PACKETS",
+    "RX_DROPS",
+    "RX_QUEUE_HIGH_WATER",
+    "CONGESTION_EVENTS",
+    "UART_RX_BYTES",
+    "UART_TX_BYTES",
+    "UART_OVERFLOWS",
+    "COMMANDS",
+    "COMMAND_ERRORS",
+    "CONNECTS",
+    "DISCONNECTS",
+    "CONFIG_COMMITS",
+    "CONFIG_ITEMS_WRITTEN",
+    "CONFIG_WRITES_SKIPPED",
+    "CONFIG_COMMIT_MAX_US",
+    "FREE_HEAP",
+    "MIN_FREE_HEAP",
+    "STACK_HIGH_WATER",
+    "LOOPBACK_BYTES",
+    "SPP_CPU_US",
+    "SPOOLED_BYTES",
+    "SPOOL_REPLAYED_BYTES",
+    "SPOOL_DROPPED_BYTES",
+    "SPOOL_FLASH_BYTES",
+    "RX_THROTTLES",
+    "RX_THROTTLED_MS",
+    "RX_OVERFLOW_BYTES",
+    "RX_OVERFLOW_HIGH_WATER",
+    "COMPRESS_IN_BYTES",
+    "COMPRESS_OUT_BYTES",
+    "COMPRESS_CPU_US",
+    "DECOMPRESS_IN_BYTES",
+    "DECOMPRESS_OUT_BYTES",
+    "DECOMPRESS_CPU_US",
+    "DECOMPRESS_ERRORS",
+    "COMPRESS_PERMILLE",
+    "COMPRESS_US_PER_KB",
+    "DECOMPRESS_US_PER_KB",
+    "RELIABLE_PACKETS",
+    "RELIABLE_RETRANSMITS",
+    "RELIABLE_DUPLICATES",
+    "RELIABLE_OUT_OF_ORDER",
+    "URGENT_BYTES",
+    "URGENT_DROPPED_BYTES",
+    "URGENT_MAX_WAIT_US",
+    "FILE_TX_BYTES",
+    "FILE_RX_BYTES",
+    "FILE_CRC_ERRORS",
+    "TX_CHUNK_SIZE",
+    "TX_COALESCE_MS",
+    "TX_IN_FLIGHT_LIMIT",
+    "TUNING_STEPS",
+    "PAIRINGS",
+    "BONDED_AUTHS",
+    "LINK_SLOW_POLL_MS",
+    "LINK_SNIFF_MS",
+    "LINK_WAKES",
+    "LINK_WAKE_MAX_US",
+    "IDLE_DISCONNECTS",
+    "HOST_FRAMES",
+    "FRAME_DELAY_MAX_US",
+    "LOOPBACK_DROPS"
+};
+
+void BridgeStats::reset() {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        counters[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void BridgeStats::sample() {
+    set(FREE_HEAP, esp_get_free_heap_size());
+    set(MIN_FREE_HEAP, esp_get_minimum_free_heap_size());
+    set(STACK_HIGH_WATER, uxTaskGetStackHighWaterMark(NULL));
+
+    uint64_t in = get(COMPRESS_IN_BYTES);
+    uint64_t decoded = get(DECOMPRESS_OUT_BYTES);
+    set(COMPRESS_PERMILLE, in > 0 ? (uint64_t)get(COMPRESS_OUT_BYTES) * 1000 / in : 0);
+    set(COMPRESS_US_PER_KB, in > 0 ? (uint64_t)get(COMPRESS_CPU_US) * 1024 / in : 0);
+    set(DECOMPRESS_US_PER_KB, decoded > 0 ? (uint64_t)get(DECOMPRESS_CPU_US) * 1024 / decoded : 0);
+}
+
+void BridgeStats::reportText(Print &out) {
+    sample();
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        out.printf("%s=%u\r\n", names[i], get((Counter)i));
+    }
+}
+
+void BridgeStats::reportBinary(Print &out) {
+    uint8_t buf[3 + NUM_COUNTERS * sizeof(uint32_t)];
+    uint8_t *p = buf;
+
+    sample();
+    *p++ = 'S';
+    *p++ = STATS_BINARY_VERSION;
+    *p++ = NUM_COUNTERS;
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        uint32_t value = get((Counter)i);
+        *p++ = value & 0xff;
+        *p++ = (value >> 8) & 0xff;
+        *p++ = (value >> 16) & 0xff;
+        *p++ = (value >> 24) & 0xff;
+    }
+
+    out.write(buf, sizeof(buf));
+    out.print("\r\n");
+}
@@ -0,0 +1,117 @@
+#ifndef BRIDGE_STATS_H
+#define BRIDGE_STATS_H
+
+#include <Arduino.h>
+#include <atomic>
+
+/*
+ * Throughput and health counters. Updated from the SPP task and the Bluetooth
+ * callbacks with relaxed atomics, so they cost a few cycles on the data path.
+ */
+class BridgeStats {
+public:
+    typedef enum {
+        TX_BYTES = 0,           // Bytes handed to esp_spp_write
+        TX_PACKETS,
+        TX_REJECTS,             // Writes refused because one was in progress or too long
+        TX_ERRORS,              // ESP_SPP_WRITE_EVT with a failure status
+        RX_BYTES,               // Bytes received in ESP_SPP_DATA_IND_EVT
+        RX_PACKETS,
+        RX_DROPS,               // Bytes dropped because the receive buffer was full
+        RX_QUEUE_HIGH_WATER,    // Most bytes ever waiting in the receive buffer
+        CONGESTION_EVENTS,      // Times the lower layers reported congestion
+        UART_RX_BYTES,
+        UART_TX_BYTES,
+        UART_OVERFLOWS,         // Lines too long for the command buffer
+        COMMANDS,
+        COMMAND_ERRORS,
+        CONNECTS,
+        DISCONNECTS,            // Includes links dropped by the remote end
+        CONFIG_COMMITS,         // Flash commits, i.e. erase/write cycles
+        CONFIG_ITEMS_WRITTEN,
+        CONFIG_WRITES_SKIPPED,
+        CONFIG_COMMIT_MAX_US,
+        FREE_HEAP,              // Sampled when reported
+        MIN_FREE_HEAP,          // Sampled when reported
+        STACK_HIGH_WATER,       // Unused stack of the reporting task, sampled when reported
+        LOOPBACK_BYTES,         // Bytes reflected back to the peer in loopback mode
+        SPP_CPU_US,             // Time spent in the SPP data path, not counting waits
+        SPOOLED_BYTES,          // Host data kept while the link was down
+        SPOOL_REPLAYED_BYTES,   // Of that, sent once it came back
+        SPOOL_DROPPED_BYTES,    // Of that, dropped by the spool policy
+        SPOOL_FLASH_BYTES,      // Written to flash, including record headers
+        RX_THROTTLES,           // Times received data reached the high watermark
+        RX_THROTTLED_MS,        // Time spent above it, until below the low watermark
+        RX_OVERFLOW_BYTES,      // Received bytes that went to the overflow pool
+        RX_OVERFLOW_HIGH_WATER, // Most bytes ever waiting in the overflow pool
+        COMPRESS_IN_BYTES,      // Data written to the link while compressing
+        COMPRESS_OUT_BYTES,     // The frames it went out as
+        COMPRESS_CPU_US,
+        DECOMPRESS_IN_BYTES,    // Frames received from the peer
+        DECOMPRESS_OUT_BYTES,   // The data they held
+        DECOMPRESS_CPU_US,
+        DECOMPRESS_ERRORS,      // Frames that didn't decode
+        COMPRESS_PERMILLE,      // COMPRESS_OUT_BYTES per 1000 in, sampled when reported
+        COMPRESS_US_PER_KB,     // Sampled when reported
+        DECOMPRESS_US_PER_KB,   // Per KB decoded, sampled when reported
+        RELIABLE_PACKETS,       // Data packets sent for the first time, see AT+RELIABLE
+        RELIABLE_RETRANSMITS,   // And sent again
+        RELIABLE_DUPLICATES,    // Received again, and dropped
+        RELIABLE_OUT_OF_ORDER,  // Received after a gap, and held until it was filled
+        URGENT_BYTES,           // Host data sent on the urgent lane, see AT+LANE
+        URGENT_DROPPED_BYTES,   // Of that, dropped because the lane was full
+        URGENT_MAX_WAIT_US,     // Longest any of it waited for the link
+        FILE_TX_BYTES,          // AT+SENDFILE, including the header and CRC
+        FILE_RX_BYTES,          // AT+RECVFILE, everything received while waiting for the file
+        FILE_CRC_ERRORS,        // Files or firmware images received that didn't match their CRC
+        TX_CHUNK_SIZE,          // Most data in one link write, see AT+TUNE
+        TX_COALESCE_MS,         // Longest data short of a chunk waits for more
+        TX_IN_FLIGHT_LIMIT,     // AT+RELIABLE packets allowed in flight
+        TUNING_STEPS,           // Times AT+TUNE changed any of them
+        PAIRINGS,               // Authentications that paired with a PIN, and bonded the peer
+        BONDED_AUTHS,           // Authentications with a stored link key, see AT+BOND
+        LINK_SLOW_POLL_MS,      // Time the link spent polling the peer less often, see AT+IDLE
+        LINK_SNIFF_MS,          // Time the stack had the link in sniff mode
+        LINK_WAKES,             // Times data had either of them go back to full speed
+        LINK_WAKE_MAX_US,       // Longest that took
+        IDLE_DISCONNECTS,       // Links dropped for being idle
+        HOST_FRAMES,            // Whole lines or frames to the host, AT+SENDRX=3 to 5
+        FRAME_DELAY_MAX_US,     // Longest from arrival to the UART stage's ring, not counting the UART
+        LOOPBACK_DROPS,         // Bytes received in loopback mode that couldn't be reflected
+        NUM_COUNTERS
+    } Counter;
+
+    static void add(Counter counter, uint32_t n = 1) {
+        counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void set(Counter counter, uint32_t value) {
+        counters[counter].store(value, std::memory_order_relaxed);
+    }
+
+    static void max(Counter counter, uint32_t value) {
+        uint32_t current = counters[counter].load(std::memory_order_relaxed);
+        while (value > current && !counters[counter].compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    static uint32_t get(Counter counter) {
+        return counters[counter].load(std::memory_order_relaxed);
+    }
+
+    static void reset();
+
+    // One <NAME>=<value> line per counter
+    static void reportText(Print &out);
+
+    // 'S', version, counter count, then each counter as a little-endian uint32
+    static void reportBinary(Print &out);
+
+private:
+    static void sample();
+
+    static std::atomic<uint32_t> counters[NUM_COUNTERS];
+    static const char *names[NUM_COUNTERS];
+};
+
+#endif
@@ -1,8 +1,9 @@
 #include <CommandHandler.h>
 #include "esp_log.h"
+#include <BridgeStats.h>
 
 #define COMMAND_TAG "COMMAND_HANDLER"
-CommandHandler::CommandHandler(HardwareSerial& _serial) :
+CommandHandler::CommandHandler(Stream& _serial) :
     serial(_serial),
     infoCallback([](const char *msg) { ESP_LOGI(COMMAND_TAG, "%s", msg); }),
     debugCallback([](const char *msg) { ESP_LOGD(COMMAND_TAG, "%s", msg); }),
@@ -27,9 +28,34 @@ void CommandHandler::setSendCallback(std::function<bool(uint8_t*, int)> callback
   sendCallback = callback;
 }
 
-void CommandHandler::setCommandCallback(std::string command, std::function<bool(std::string command, std::string arguments)> commandCallback)
+bool CommandHandler::setCommandCallback(const char *command, CommandCallback commandCallback)
 {
-    commandCallbacks.insert_or_assign(command, commandCallback);
+    Command *existing = findCommand(command);
+
+    if (existing != NULL) {
+        existing->callback = commandCallback;
+        return true;
+    }
+    if (commandCount >= COMMAND_HANDLER_MAX_COMMANDS) {
+        ESP_LOGE(COMMAND_TAG, "No room for AT+%s", command);
+        return false;
+    }
+    commands[commandCount].name = command;
+    commands[commandCount].callback = commandCallback;
+    commandCount++;
+
+    return true;
+}
+
+CommandHandler::Command *CommandHandler::findCommand(const char *name)
+{
+    for (int i = 0; i < commandCount; i++) {
+        if (strcmp(commands[i].name, name) == 0) {
+            return &commands[i];
+        }
+    }
+
+    return NULL;
 }
 
 void CommandHandler::setErrorCallback(std::function<void(Error)> callback) {
@@ -40,7 +66,7 @@ void CommandHandler::loop() {
     while (serial.available() > 0) {
         int c = serial.read();
         if (c > 0) {
-            delay(1);
+            BridgeStats::add(BridgeStats::UART_RX_BYTES);
             if (x_position < sizeof(x_buffer)) {
                 if (c == '\n') {
                     if (x_position >= 1 && x_buffer[x_position-1] == '\r') {
@@ -62,6 +88,7 @@ void CommandHandler::loop() {
                 }
             } else {
                 if (c == '\n') {
+                    BridgeStats::add(BridgeStats::UART_OVERFLOWS);
                     errorCallback(Error::ERROR_BUFFER_OVERFLOW);
                     x_position = 0;
                 }
@@ -77,7 +104,7 @@ void CommandHandler::parseCommand()
         return;
     }
 
-    const char *cmdPtr = (const char*)(&x_buffer[3]);
+    char *cmdPtr = (char*)(&x_buffer[3]);
     char *eqPtr = strchr(cmdPtr, '=');
     char *argPtr = NULL;
 
@@ -86,18 +113,17 @@ void CommandHandler::parseCommand()
         argPtr = eqPtr + 1;
     }
 
-    cmd = cmdPtr;
+    BridgeStats::add(BridgeStats::COMMANDS);
 
-    if (commandCallbacks.count(cmd) == 0) {
+    Command *command = findCommand(cmdPtr);
+    if (command == NULL) {
+        BridgeStats::add(BridgeStats::COMMAND_ERRORS);
         errorCallback(Error::ERROR_UNKNOWN_COMMAND);
+        return;
     }
 
-    std::string args = "";
-    if (argPtr != NULL) {
-        args = argPtr;
-    }
-
-    if (!commandCallbacks[cmd](cmd, args)) {
+    if (!command->callback(cmdPtr, argPtr != NULL ? argPtr : "")) {
+        BridgeStats::add(BridgeStats::COMMAND_ERRORS);
         errorCallback(Error::ERROR_COMMAND_FAILED);
     } else {
         serial.println("OK");
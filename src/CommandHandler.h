@@ -3,8 +3,10 @@
 
 #include <Arduino.h>
 #include <functional>
-#include <string>
-#include <map>
+
+#ifndef COMMAND_HANDLER_MAX_COMMANDS
+#define COMMAND_HANDLER_MAX_COMMANDS 32
+#endif
 
 class CommandHandler {
 public:
@@ -23,14 +25,20 @@ public:
         PASSTHROUGH = 0x1,
     };
 
-    CommandHandler(HardwareSerial& serial);
+    // The command's name and whatever followed '=', "" if nothing did. Both
+    // point into the line buffer and are only valid during the call.
+    typedef std::function<bool(const char *command, const char *arguments)> CommandCallback;
+
+    CommandHandler(Stream& serial);
 
     void loop();
     void setMode(Mode mode);
     void setInfoCallback(std::function<void(const char*)> callback);
     void setDebugCallback(std::function<void(const char*)> callback);
     void setSendCallback(std::function<bool(uint8_t*, int)> callback);
-    void setCommandCallback(std::string command, std::function<bool(std::string command, std::string arguments)> commandCallback);
+    // command must outlive the handler, normally a literal. Returns false when
+    // all COMMAND_HANDLER_MAX_COMMANDS slots are taken.
+    bool setCommandCallback(const char *command, CommandCallback commandCallback);
     void setErrorCallback(std::function<void(Error)> errorCallback);
     
 private:
@@ -39,18 +47,23 @@ private:
     uint8_t x_position = 0;
     uint8_t end_position = 0;
     bool foundEquals = false;
-    std::string cmd;
     Mode mode = COMMAND;
 
-    HardwareSerial& serial;
+    Stream& serial;
 
     std::function<void(const char*)> infoCallback;
     std::function<void(const char*)> debugCallback;
     std::function<void(Error)> errorCallback;
 
-    std::unordered_map<std::string, std::function<bool(std::string command, std::string arguments)>> commandCallbacks;
+    struct Command {
+        const char *name;
+        CommandCallback callback;
+    };
+    Command commands[COMMAND_HANDLER_MAX_COMMANDS];
+    int commandCount = 0;
     std::function<bool(uint8_t*, int)> sendCallback;
 
     void parseCommand();
+    Command *findCommand(const char *name);
 };
 #endif
\ No newline at end of file
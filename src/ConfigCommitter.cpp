@@ -0,0 +1,98 @@
+#include <ConfigCommitter.h>
+#include "freertos/task.h"
+#include "esp_log.h"
+#include <BridgeStats.h>
+
+#define COMMITTER_TAG "CONFIG_COMMIT"
+
+ConfigCommitter::ConfigCommitter(EEPROMConfig &_config, unsigned long _quietMs) :
+    config(_config),
+    quietMs(_quietMs),
+    mutex(xSemaphoreCreateMutex()),
+    dirtySem(xSemaphoreCreateBinary())
+{
+}
+
+void ConfigCommitter::track(BaseConfigItem &item) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (numTracked < MAX_COMMIT_ITEMS) {
+        tracked[numTracked].item = &item;
+        tracked[numTracked].committed = item.toString();
+        tracked[numTracked].dirty = false;
+        numTracked++;
+    } else {
+        ESP_LOGE(COMMITTER_TAG, "Too many config items");
+    }
+    xSemaphoreGive(mutex);
+}
+
+void ConfigCommitter::markDirty(BaseConfigItem *item) {
+    for (int i = 0; i < numTracked; i++) {
+        if (tracked[i].item == item) {
+            tracked[i].dirty = true;
+            return;
+        }
+    }
+
+    ESP_LOGE(COMMITTER_TAG, "Untracked config item");
+}
+
+void ConfigCommitter::commitDirty() {
+    int written = 0;
+
+    // put() only copies into the EEPROM RAM image, so it is cheap to do under the lock
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < numTracked; i++) {
+        if (tracked[i].dirty) {
+            tracked[i].dirty = false;
+            String value = tracked[i].item->toString();
+            if (value == tracked[i].committed) {
+                BridgeStats::add(BridgeStats::CONFIG_WRITES_SKIPPED);
+            } else {
+                tracked[i].item->put();
+                tracked[i].committed = value;
+                written++;
+            }
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (written > 0) {
+        unsigned long start = micros();
+        config.commit();
+        uint32_t elapsed = micros() - start;
+
+        BridgeStats::add(BridgeStats::CONFIG_COMMITS);
+        BridgeStats::add(BridgeStats::CONFIG_ITEMS_WRITTEN, written);
+        BridgeStats::max(BridgeStats::CONFIG_COMMIT_MAX_US, elapsed);
+
+        ESP_LOGI(COMMITTER_TAG, "Committed %d item(s) in %u us (commits=%u, written=%u, skipped=%u)",
+            written, elapsed,
+            BridgeStats::get(BridgeStats::CONFIG_COMMITS),
+            BridgeStats::get(BridgeStats::CONFIG_ITEMS_WRITTEN),
+            BridgeStats::get(BridgeStats::CONFIG_WRITES_SKIPPED));
+    }
+}
+
+void ConfigCommitter::taskFn(void *pArg) {
+    ConfigCommitter *self = (ConfigCommitter*)pArg;
+
+    TickType_t quiet = pdMS_TO_TICKS(self->quietMs);
+    TickType_t most = quiet * CONFIG_COMMIT_MAX_QUIETS;
+
+    while (true) {
+        xSemaphoreTake(self->dirtySem, portMAX_DELAY);
+        TickType_t first = xTaskGetTickCount();
+
+        // Coalesce: keep waiting until nothing has changed for quietMs, but
+        // not past most after the first change
+        while (true) {
+            TickType_t waited = xTaskGetTickCount() - first;
+            if (waited >= most || xSemaphoreTake(self->dirtySem, quiet < most - waited ? quiet : most - waited) != pdTRUE) {
+                break;
+            }
+        }
+
+        self->commitDirty();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef CONFIG_COMMITTER_H
+#define CONFIG_COMMITTER_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <ConfigItem.h>
+#include <EEPROMConfig.h>
+
+#define MAX_COMMIT_ITEMS 8
+
+// How many quiet times the first pending change waits at most, if updates keep coming
+#ifndef CONFIG_COMMIT_MAX_QUIETS
+#define CONFIG_COMMIT_MAX_QUIETS 5
+#endif
+
+/*
+ * Write-behind persistence for config items. Callers update values with set(),
+ * which only touches RAM. A background task waits until updates have stopped
+ * for quietMs, writes the items whose value actually changed, and commits once.
+ * Updates that never stop are committed anyway once the first of them is
+ * CONFIG_COMMIT_MAX_QUIETS times quietMs old, so they aren't held in RAM for
+ * ever. Commit counts and latency go to BridgeStats.
+ */
+class ConfigCommitter {
+public:
+    ConfigCommitter(EEPROMConfig &config, unsigned long quietMs = 2000);
+
+    // Register an item and remember its current (stored) value
+    void track(BaseConfigItem &item);
+
+    template <class I, class V>
+    void set(I &item, const V &value) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        item = value;
+        markDirty(&item);
+        xSemaphoreGive(mutex);
+        xSemaphoreGive(dirtySem);
+    }
+
+    static void taskFn(void *pArg);
+
+private:
+    typedef struct {
+        BaseConfigItem *item;
+        String committed;
+        bool dirty;
+    } Tracked;
+
+    EEPROMConfig &config;
+    unsigned long quietMs;
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t dirtySem;
+    Tracked tracked[MAX_COMMIT_ITEMS];
+    int numTracked = 0;
+
+    void markDirty(BaseConfigItem *item);
+    void commitDirty();
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include <ConnStats.h>
+#include <esp_timer.h>
+
+ConnStats::Histogram ConnStats::histograms[NUM_PHASES];
+
+const char *ConnStats::names[NUM_PHASES] = {
+    "INQUIRY",
+    "SDP",
+    "AUTH",
+    "RFCOMM_OPEN",
+    "CONNECT",
+    "DISCONNECT"
+};
+
+// Upper bound of each bucket, in ms. The last one catches everything else.
+const uint32_t ConnStats::bucketLimitMs[CONN_STATS_BUCKETS] = {
+    10, 20, 50, 100, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 10000, 20000, UINT32_MAX
+};
+
+portMUX_TYPE ConnStats::mux = portMUX_INITIALIZER_UNLOCKED;
+
+void ConnStats::start(Phase phase) {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&mux);
+    histograms[phase].startUs = now;
+    portEXIT_CRITICAL(&mux);
+}
+
+void ConnStats::end(Phase phase) {
+    int64_t now = esp_timer_get_time();
+    Histogram &h = histograms[phase];
+
+    portENTER_CRITICAL(&mux);
+    if (h.startUs != 0) {
+        uint32_t ms = (now - h.startUs) / 1000;
+        int bucket = 0;
+        while (ms > bucketLimitMs[bucket]) {
+            bucket++;
+        }
+        h.buckets[bucket]++;
+        if (h.count == 0 || ms < h.minMs) {
+            h.minMs = ms;
+        }
+        if (ms > h.maxMs) {
+            h.maxMs = ms;
+        }
+        h.count++;
+        h.startUs = 0;
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+void ConnStats::fail(Phase phase) {
+    portENTER_CRITICAL(&mux);
+    if (histograms[phase].startUs != 0) {
+        histograms[phase].failures++;
+        histograms[phase].startUs = 0;
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+void ConnStats::reset() {
+    portENTER_CRITICAL(&mux);
+    memset(histograms, 0, sizeof(histograms));
+    portEXIT_CRITICAL(&mux);
+}
+
+uint32_t ConnStats::percentile(const Histogram &h, int pct) {
+    // Smallest bucket holding at least pct% of the samples, reported as the
+    // bucket's upper bound but never more than the largest value seen.
+    uint32_t target = (h.count * pct + 99) / 100;
+    uint32_t seen = 0;
+
+    for (int i = 0; i < CONN_STATS_BUCKETS; i++) {
+        seen += h.buckets[i];
+        if (seen >= target) {
+            return bucketLimitMs[i] < h.maxMs ? bucketLimitMs[i] : h.maxMs;
+        }
+    }
+
+    return h.maxMs;
+}
+
+void ConnStats::report(Print &out, bool histogram) {
+    Histogram copy[NUM_PHASES];
+
+    portENTER_CRITICAL(&mux);
+    memcpy(copy, histograms, sizeof(copy));
+    portEXIT_CRITICAL(&mux);
+
+    for (int i = 0; i < NUM_PHASES; i++) {
+        const Histogram &h = copy[i];
+        // In two, each short enough for printf's buffer on the stack
+        out.printf("%s,count=%u,fail=%u,min=%u,", names[i], h.count, h.failures, h.minMs);
+        out.printf("p50=%u,p90=%u,p99=%u,max=%u\r\n", percentile(h, 50), percentile(h, 90), percentile(h, 99), h.maxMs);
+        if (histogram) {
+            for (int b = 0; b < CONN_STATS_BUCKETS; b++) {
+                out.printf(b == 0 ? "%u" : ",%u", h.buckets[b]);
+            }
+            out.print("\r\n");
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef CONN_STATS_H
+#define CONN_STATS_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+
+#define CONN_STATS_BUCKETS 16
+
+/*
+ * Connection setup latency. Each phase is started and ended from wherever the
+ * transition is seen (server state machine, SPP or GAP callback) and its
+ * duration goes into a fixed-bucket histogram, so thousands of reconnects
+ * cost no more memory than one.
+ */
+class ConnStats {
+public:
+    typedef enum {
+        INQUIRY = 0,    // SEARCHING until the inquiry finishes
+        SDP,            // esp_spp_start_discovery until ESP_SPP_DISCOVERY_COMP_EVT
+        AUTH,           // ESP_SPP_DISCOVERY_COMP_EVT until ESP_BT_GAP_AUTH_CMPL_EVT
+        RFCOMM_OPEN,    // ESP_SPP_DISCOVERY_COMP_EVT until ESP_SPP_OPEN_EVT, includes AUTH
+        CONNECT,        // CONNECTING until CONNECTED
+        DISCONNECT,     // DISCONNECTING until NOT_CONNECTED
+        NUM_PHASES
+    } Phase;
+
+    static void start(Phase phase);
+    static void end(Phase phase);   // Records the duration if the phase was started
+    static void fail(Phase phase);  // Counts a failure and forgets the start time
+
+    static void reset();
+
+    // One line per phase with count, failures, min, p50, p90, p99 and max in ms.
+    // With histogram set, each line is followed by the bucket counts.
+    static void report(Print &out, bool histogram);
+
+private:
+    typedef struct {
+        int64_t startUs;
+        uint32_t count;
+        uint32_t failures;
+        uint32_t minMs;
+        uint32_t maxMs;
+        uint32_t buckets[CONN_STATS_BUCKETS];
+    } Histogram;
+
+    static uint32_t percentile(const Histogram &h, int pct);
+
+    static Histogram histograms[NUM_PHASES];
+    static const char *names[NUM_PHASES];
+    static const uint32_t bucketLimitMs[CONN_STATS_BUCKETS];
+    static portMUX_TYPE mux;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include <FileTransfer.h>
+#include <BridgeStats.h>
+#include <esp_rom_crc.h>
+#include "esp_log.h"
+
+#define FILE_TRANSFER_TAG "FILE_TRANSFER"
+
+static const uint8_t magic[4] = {0x00, 0xc5, 'F', 'T'};
+
+const char *FileTransfer::stateNames[] = {
+    "IDLE",
+    "SENDING",
+    "RECEIVING",
+    "DONE",
+    "FAILED"
+};
+
+FileTransfer::FileTransfer() {
+}
+
+bool FileTransfer::setPath(const char *path) {
+    if (active()) {
+        errMsg = "A transfer is already going";
+        return false;
+    }
+    if (path[0] != '/' || strlen(path) > FILE_TRANSFER_PATH_LEN) {
+        errMsg = "Path has to start with / and be at most 31 characters";
+        return false;
+    }
+
+    strlcpy(this->path, path, sizeof(this->path));
+    snprintf(partPath, sizeof(partPath), "%s.part", path);
+    size = done = crc = 0;
+    progressReported = 0;
+    endPending = false;
+    errMsg = "";
+    startMs = lastRxMs = millis();
+
+    return true;
+}
+
+bool FileTransfer::startSend(const char *path, int chunkSize) {
+    if (!setPath(path)) {
+        return false;
+    }
+
+    file = LittleFS.open(path, FILE_READ);
+    if (!file || file.isDirectory()) {
+        file.close();
+        errMsg = "No such file";
+        return false;
+    }
+
+    size = file.size();
+    this->chunkSize = chunkSize < FILE_TRANSFER_MAX_CHUNK ? chunkSize : FILE_TRANSFER_MAX_CHUNK;
+    crcSent = 0;
+    memcpy(chunk, magic, sizeof(magic));
+    for (int i = 0; i < 4; i++) {
+        chunk[sizeof(magic) + i] = size >> (8 * i);
+    }
+    chunkLen = HEADER_LEN;
+    state = SENDING;
+    ESP_LOGI(FILE_TRANSFER_TAG, "Sending %s, %u bytes", path, size);
+    readChunk();
+
+    return state == SENDING;
+}
+
+void FileTransfer::readChunk() {
+    if (done < size) {
+        int want = size - done < (uint32_t)(chunkSize - chunkLen) ? size - done : chunkSize - chunkLen;
+        int n = file.read(&chunk[chunkLen], want);
+        if (n <= 0) {
+            fail("Read failed");
+            return;
+        }
+        crc = esp_rom_crc32_le(crc, &chunk[chunkLen], n);
+        done += n;
+        chunkLen += n;
+    }
+
+    // The CRC follows the data, in whatever room is left
+    while (done == size && crcSent < CRC_LEN && chunkLen < chunkSize) {
+        chunk[chunkLen++] = crc >> (8 * crcSent++);
+    }
+}
+
+void FileTransfer::setChunkSize(int chunkSize) {
+    this->chunkSize = chunkSize < FILE_TRANSFER_MAX_CHUNK ? chunkSize : FILE_TRANSFER_MAX_CHUNK;
+}
+
+int FileTransfer::next(const uint8_t **data) {
+    *data = chunk;
+
+    return state == SENDING ? chunkLen : 0;
+}
+
+void FileTransfer::sent() {
+    BridgeStats::add(BridgeStats::FILE_TX_BYTES, chunkLen);
+    chunkLen = 0;
+    if (done == size && crcSent == CRC_LEN) {
+        file.close();
+        finish(DONE);
+    } else {
+        readChunk();
+    }
+}
+
+bool FileTransfer::startReceive(const char *path) {
+    if (!setPath(path)) {
+        return false;
+    }
+
+    file = LittleFS.open(partPath, FILE_WRITE);
+    if (!file) {
+        errMsg = "Can't create the file";
+        return false;
+    }
+
+    headerLen = blockLen = trailerLen = 0;
+    state = RECEIVING;
+    ESP_LOGI(FILE_TRANSFER_TAG, "Waiting for %s", path);
+
+    return true;
+}
+
+void FileTransfer::receive(const uint8_t *in, int len) {
+    int i = 0;
+
+    if (state != RECEIVING) {
+        return;
+    }
+    lastRxMs = millis();
+    BridgeStats::add(BridgeStats::FILE_RX_BYTES, len);
+
+    while (i < len && state == RECEIVING) {
+        if (headerLen < HEADER_LEN) {
+            uint8_t c = in[i++];
+            if (headerLen < (int)sizeof(magic) && c != magic[headerLen]) {
+                headerLen = c == magic[0] ? 1 : 0;
+                continue;
+            }
+            header[headerLen++] = c;
+            if (headerLen == HEADER_LEN) {
+                size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+                startMs = millis();
+                ESP_LOGI(FILE_TRANSFER_TAG, "Receiving %s, %u bytes", path, size);
+            }
+        } else if (done < size) {
+            // As much as is left of the data, of the input and of the block
+            int n = len - i;
+            n = (uint32_t)n < size - done ? n : size - done;
+            n = n < FILE_TRANSFER_BLOCK - blockLen ? n : FILE_TRANSFER_BLOCK - blockLen;
+            memcpy(&block[blockLen], &in[i], n);
+            crc = esp_rom_crc32_le(crc, &in[i], n);
+            blockLen += n;
+            done += n;
+            i += n;
+            if (blockLen == FILE_TRANSFER_BLOCK) {
+                flushBlock();
+            }
+        } else {
+            trailer[trailerLen++] = in[i++];
+            if (trailerLen == CRC_LEN) {
+                received();
+            }
+        }
+    }
+}
+
+bool FileTransfer::flushBlock() {
+    if (blockLen > 0 && file.write(block, blockLen) != (size_t)blockLen) {
+        fail("Write failed");
+        return false;
+    }
+    blockLen = 0;
+
+    return true;
+}
+
+void FileTransfer::received() {
+    uint32_t sent = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+
+    if (!flushBlock()) {
+        return;
+    }
+    file.close();
+    if (sent != crc) {
+        ESP_LOGE(FILE_TRANSFER_TAG, "CRC %08x, expected %08x", crc, sent);
+        BridgeStats::add(BridgeStats::FILE_CRC_ERRORS);
+        fail("CRC mismatch");
+        return;
+    }
+
+    // Only now does it replace the old one
+    LittleFS.remove(path);
+    if (!LittleFS.rename(partPath, path)) {
+        fail("Rename failed");
+        return;
+    }
+    finish(DONE);
+}
+
+void FileTransfer::poll() {
+    if (state == RECEIVING && millis() - lastRxMs > FILE_TRANSFER_TIMEOUT_MS) {
+        fail("Timed out");
+    }
+}
+
+void FileTransfer::fail(const char *why) {
+    if (!active()) {
+        return;
+    }
+
+    ESP_LOGE(FILE_TRANSFER_TAG, "%s: %s", path, why);
+    file.close();
+    if (state == RECEIVING) {
+        LittleFS.remove(partPath);
+    }
+    errMsg = why;
+    finish(FAILED);
+}
+
+void FileTransfer::finish(State state) {
+    endMs = millis();
+    this->state = state;
+    endPending = true;
+    if (state == DONE) {
+        ESP_LOGI(FILE_TRANSFER_TAG, "%s: %u bytes in %u ms", path, done, endMs - startMs);
+    }
+}
+
+int FileTransfer::progress() {
+    if (!active() || size == 0) {
+        return -1;
+    }
+
+    int step = (uint64_t)done * 10 / size * 10;
+    if (step <= progressReported || step >= 100) {
+        return -1;
+    }
+    progressReported = step;
+
+    return step;
+}
+
+bool FileTransfer::ended() {
+    bool pending = endPending;
+    endPending = false;
+
+    return pending;
+}
+
+uint32_t FileTransfer::bytesPerSec() {
+    uint32_t ms = (active() ? millis() : endMs) - startMs;
+
+    return ms > 0 ? (uint64_t)done * 1000 / ms : 0;
+}
+
+void FileTransfer::report(Print &out) {
+    out.printf("STATE=%s\r\n", stateNames[state]);
+    out.printf("PATH=%s\r\n", path);
+    out.printf("SIZE=%u\r\n", size);
+    out.printf("BYTES=%u\r\n", done);
+    out.printf("CRC=%08X\r\n", crc);
+    out.printf("MS=%u\r\n", (uint32_t)((active() ? millis() : endMs) - startMs));
+    out.printf("BPS=%u\r\n", bytesPerSec());
+    if (state == FAILED) {
+        out.printf("ERROR=%s\r\n", errMsg);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef FILE_TRANSFER_H
+#define FILE_TRANSFER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <LinkCodec.h>
+
+#define FILE_TRANSFER_PATH_LEN 31
+#define FILE_TRANSFER_MAX_CHUNK LINK_CODEC_MAX_BLOCK
+#ifndef FILE_TRANSFER_BLOCK
+#define FILE_TRANSFER_BLOCK 512         // Received data goes to flash in blocks this size
+#endif
+#ifndef FILE_TRANSFER_TIMEOUT_MS
+#define FILE_TRANSFER_TIMEOUT_MS 30000  // Receiving gives up after this long without data
+#endif
+
+/*
+ * Files between LittleFS and the peer, for AT+SENDFILE and AT+RECVFILE. On
+ * the link a file is
+ *
+ *   00 c5 'F' 'T' <size: 4> <data> <CRC-32 of the data: 4>
+ *
+ * (numbers little-endian), so the receiving end knows where it ends and
+ * whether it arrived intact. Anything received before the header is skipped.
+ *
+ * Sending goes a chunk at a time, each as large as one link write. The next
+ * chunk is read from flash as soon as the link has taken one, while that one
+ * is still on the air; the transport's copy of it is the other half of the
+ * double buffer. Received data is collected into FILE_TRANSFER_BLOCK byte
+ * blocks for flash while the stack goes on receiving into the transport's
+ * queue, and written to <path>.part, which only replaces <path> once the CRC
+ * matches.
+ *
+ * Only the radio stage uses it, and LittleFS has to be mounted already.
+ */
+class FileTransfer {
+public:
+    typedef enum {
+        IDLE = 0,
+        SENDING,
+        RECEIVING,
+        DONE,
+        FAILED
+    } State;
+
+    FileTransfer();
+
+    // False, with getErrMessage(), if it can't start. chunkSize is at most
+    // FILE_TRANSFER_MAX_CHUNK.
+    bool startSend(const char *path, int chunkSize);
+    // From the chunk after the one read ahead
+    void setChunkSize(int chunkSize);
+    bool startReceive(const char *path);
+    void fail(const char *why);
+
+    State getState() { return state; }
+    bool sending() { return state == SENDING; }
+    bool receiving() { return state == RECEIVING; }
+    bool active() { return sending() || receiving(); }
+
+    // Sending. The chunk to write next; once the link has taken it, sent().
+    int next(const uint8_t **data);
+    void sent();
+
+    // Receiving. Everything that came from the link, and poll() for the timeout.
+    void receive(const uint8_t *in, int len);
+    void poll();
+
+    // The next 10% step since the last call, or -1
+    int progress();
+    // True once when it has finished or failed
+    bool ended();
+
+    uint32_t bytes() { return done; }
+    uint32_t bytesPerSec();
+    const char *getErrMessage() { return errMsg; }
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    static const int HEADER_LEN = 8;
+    static const int CRC_LEN = 4;
+
+    State state = IDLE;
+    char path[FILE_TRANSFER_PATH_LEN + 1] = "";
+    char partPath[FILE_TRANSFER_PATH_LEN + 6] = "";
+    File file;
+    uint32_t size = 0;
+    uint32_t done = 0;              // Read from flash, or received
+    uint32_t crc = 0;
+    uint32_t startMs = 0;
+    uint32_t endMs = 0;
+    uint32_t lastRxMs = 0;
+    int progressReported = 0;
+    bool endPending = false;
+    const char *errMsg = "";
+
+    // Sending
+    uint8_t chunk[FILE_TRANSFER_MAX_CHUNK];
+    int chunkLen = 0;
+    int chunkSize = 0;
+    int crcSent = 0;                // Bytes of the CRC in chunks so far
+
+    // Receiving
+    uint8_t header[HEADER_LEN];
+    int headerLen = 0;
+    uint8_t block[FILE_TRANSFER_BLOCK];
+    int blockLen = 0;
+    uint8_t trailer[CRC_LEN];
+    int trailerLen = 0;
+
+    bool setPath(const char *path);
+    void readChunk();
+    bool flushBlock();
+    void received();
+    void finish(State state);
+
+    static const char *stateNames[];
+};
+
+#endif
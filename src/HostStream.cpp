@@ -0,0 +1,74 @@
+#include <HostStream.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+HostStream::HostStream(SPSCRing &_fromHost, SPSCRing &_toHost) :
+    fromHost(_fromHost),
+    toHost(_toHost)
+{
+}
+
+int HostStream::available() {
+    return fromHost.size();
+}
+
+int HostStream::read() {
+    uint8_t c;
+
+    return fromHost.read(&c, 1) == 1 ? c : -1;
+}
+
+int HostStream::peek() {
+    const uint8_t *data;
+
+    return fromHost.peek(&data) > 0 ? *data : -1;
+}
+
+size_t HostStream::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HostStream::write(const uint8_t *buffer, size_t size) {
+    if (!framing) {
+        return writeThrough(buffer, size);
+    }
+
+    for (size_t i = 0; i < size; ) {
+        size_t n = size - i < HOST_TEXT_SIZE - textLen ? size - i : HOST_TEXT_SIZE - textLen;
+        memcpy(&text[textLen], &buffer[i], n);
+        textLen += n;
+        i += n;
+        if (textLen == HOST_TEXT_SIZE) {
+            flush();
+        }
+    }
+
+    return size;
+}
+
+size_t HostStream::writeThrough(const uint8_t *buffer, size_t size) {
+    size_t written = toHost.write(buffer, size);
+
+    while (written < size) {
+        vTaskDelay(1);      // Let the UART stage make room
+        written += toHost.write(&buffer[written], size - written);
+    }
+
+    return size;
+}
+
+int HostStream::availableForWrite() {
+    return toHost.space();
+}
+
+void HostStream::setFraming(bool on) {
+    flush();
+    framing = on && framer;
+}
+
+void HostStream::flush() {
+    if (textLen > 0) {
+        framer(text, textLen);
+        textLen = 0;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <Arduino.h>
+#include <SPSCRing.h>
+#include <functional>
+
+#ifndef HOST_TEXT_SIZE
+#define HOST_TEXT_SIZE 128
+#endif
+
+/*
+ * The host UART as the radio stage sees it. Reads come out of the ring the
+ * UART stage fills, and writes go into the ring it empties, so the radio
+ * stage never waits on the UART itself. Writes only block if the outgoing
+ * ring is full, which keeps command responses whole.
+ *
+ * While framing is on, text written here (command responses and URCs) is
+ * held and handed to the framer by flush(), or whenever HOST_TEXT_SIZE of it
+ * is waiting, so that it can go to the host in frames of its own.
+ */
+class HostStream : public Stream {
+public:
+    typedef std::function<void(const uint8_t *text, size_t len)> Framer;
+
+    HostStream(SPSCRing &fromHost, SPSCRing &toHost);
+
+    // Set once; setFraming() turns it on and off, after a flush()
+    void setFramer(Framer framer) { this->framer = framer; }
+    void setFraming(bool on);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int availableForWrite() override;
+
+    // Straight to the ring, even while framing: for the framer and data frames
+    size_t writeThrough(const uint8_t *buffer, size_t size);
+
+    // Hands held text to the framer. The UART stage sends the rest; there is
+    // nothing to wait for here.
+    void flush() override;
+
+private:
+    SPSCRing &fromHost;
+    SPSCRing &toHost;
+    Framer framer;
+    bool framing = false;
+    uint8_t text[HOST_TEXT_SIZE];
+    size_t textLen = 0;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <IdlePolicy.h>
+#include <BridgeStats.h>
+#include "esp_log.h"
+
+#define IDLE_POLICY_TAG "IDLE"
+
+IdlePolicy::IdlePolicy() {
+#ifdef DISCONNECT_BT_ON_IDLE
+    set(IDLE_SLOW_POLL_MS, IDLE_DISCONNECT_MS);
+#else
+    set(IDLE_SLOW_POLL_MS, 0);
+#endif
+}
+
+bool IdlePolicy::set(uint32_t slowPollMs, uint32_t disconnectMs) {
+    if (slowPollMs > IDLE_MAX_MS || disconnectMs > IDLE_MAX_MS) {
+        return false;
+    }
+    this->slowPollMs = slowPollMs;
+    this->disconnectMs = disconnectMs;
+
+    return true;
+}
+
+void IdlePolicy::linkUp() {
+    if (reconnecting) {
+        reconnectMs = (micros() - reconnectStartUs) / 1000;
+        ESP_LOGD(IDLE_POLICY_TAG, "Back after %u ms", reconnectMs);
+    }
+    connected = true;
+    wantSlow = false;
+    idleDropped = false;
+    reconnecting = false;
+    waking = false;
+    lastTrafficUs = micros();
+}
+
+void IdlePolicy::linkDown() {
+    connected = false;
+    waking = false;
+}
+
+void IdlePolicy::traffic() {
+    traffic(micros());
+}
+
+void IdlePolicy::traffic(uint32_t nowUs) {
+    lastTrafficUs = nowUs;
+    if (connected && !waking && (wantSlow || slow || sniff)) {
+        waking = true;
+        wakeStartUs = nowUs;
+    } else if (!connected && idleDropped && !reconnecting) {
+        reconnecting = true;
+        reconnectStartUs = nowUs;
+    }
+}
+
+void IdlePolicy::account(uint32_t nowUs) {
+    uint32_t elapsed = nowUs - lastUs;
+
+    lastUs = nowUs;
+    if (!connected) {
+        downUs += elapsed;
+    } else if (sniff) {
+        sniffUs += elapsed;
+    } else if (slow) {
+        slowUs += elapsed;
+    } else {
+        activeUs += elapsed;
+    }
+
+    // Added rather than set, so that they survive AT+STATS=RESET as counts from then on
+    uint32_t slowMs = slowUs / 1000;
+    uint32_t sniffMs = sniffUs / 1000;
+    BridgeStats::add(BridgeStats::LINK_SLOW_POLL_MS, slowMs - slowMsPublished);
+    BridgeStats::add(BridgeStats::LINK_SNIFF_MS, sniffMs - sniffMsPublished);
+    slowMsPublished = slowMs;
+    sniffMsPublished = sniffMs;
+}
+
+IdlePolicy::Action IdlePolicy::update(uint32_t pollSlots, esp_bt_pm_mode_t mode) {
+    uint32_t nowUs = micros();
+
+    account(nowUs);
+    slow = connected && pollSlots > ESP_BT_GAP_TPOLL_DFT;
+    sniff = connected && mode == ESP_BT_PM_MD_SNIFF;
+
+    uint32_t bytes = BridgeStats::get(BridgeStats::TX_BYTES) + BridgeStats::get(BridgeStats::RX_BYTES) +
+        BridgeStats::get(BridgeStats::LOOPBACK_BYTES);
+    if (bytes != moved) {
+        moved = bytes;
+        traffic(nowUs);
+    }
+    if (!connected) {
+        return STAY;
+    }
+
+    if (waking && !wantSlow && !slow && !sniff) {
+        wakeUs = nowUs - wakeStartUs;
+        wakeMaxUs = wakeUs > wakeMaxUs ? wakeUs : wakeMaxUs;
+        wakes++;
+        waking = false;
+        BridgeStats::add(BridgeStats::LINK_WAKES);
+        BridgeStats::max(BridgeStats::LINK_WAKE_MAX_US, wakeUs);
+        ESP_LOGD(IDLE_POLICY_TAG, "Awake after %u us", wakeUs);
+    }
+
+    uint32_t idleMs = (nowUs - lastTrafficUs) / 1000;
+    if (wantSlow && (slowPollMs == 0 || idleMs < slowPollMs)) {
+        wantSlow = false;
+        return SPEED_UP;
+    }
+    if (disconnectMs > 0 && idleMs >= disconnectMs) {
+        ESP_LOGD(IDLE_POLICY_TAG, "Idle for %u ms", idleMs);
+        idleDropped = true;
+        lastTrafficUs = nowUs;      // Not again straight away, should it not go down
+        BridgeStats::add(BridgeStats::IDLE_DISCONNECTS);
+        return DISCONNECT;
+    }
+    if (!wantSlow && !slow && slowPollMs > 0 && idleMs >= slowPollMs) {
+        wantSlow = true;
+        return SLOW_DOWN;
+    }
+
+    return STAY;
+}
+
+void IdlePolicy::report(Print &out) {
+    const char *mode = !connected ? "DOWN" : sniff ? "SNIFF" : slow ? "SLOW_POLL" : "ACTIVE";
+
+    out.printf("SLOW_POLL_AFTER_MS=%u\r\n", slowPollMs);
+    out.printf("DISCONNECT_AFTER_MS=%u\r\n", disconnectMs);
+    out.printf("MODE=%s\r\n", mode);
+    out.printf("IDLE_MS=%u\r\n", connected ? (uint32_t)(micros() - lastTrafficUs) / 1000 : 0);
+    out.printf("ACTIVE_MS=%u\r\n", (uint32_t)(activeUs / 1000));
+    out.printf("SLOW_POLL_MS=%u\r\n", (uint32_t)(slowUs / 1000));
+    out.printf("SNIFF_MS=%u\r\n", (uint32_t)(sniffUs / 1000));
+    out.printf("DOWN_MS=%u\r\n", (uint32_t)(downUs / 1000));
+    out.printf("WAKES=%u\r\n", wakes);
+    out.printf("WAKE_US=%u\r\n", wakeUs);
+    out.printf("WAKE_MAX_US=%u\r\n", wakeMaxUs);
+    out.printf("RECONNECT_MS=%u\r\n", reconnectMs);
+}
@@ -0,0 +1,97 @@
+#ifndef IDLE_POLICY_H
+#define IDLE_POLICY_H
+
+#include <Arduino.h>
+#include <esp_gap_bt_api.h>
+
+// Time without traffic before the link polls the peer less often, 0 for never.
+// Also AT+IDLE. Off by default, as it delays data from the peer after a pause.
+#ifndef IDLE_SLOW_POLL_MS
+#define IDLE_SLOW_POLL_MS 0
+#endif
+#ifndef IDLE_POLL_SLOTS
+#define IDLE_POLL_SLOTS 800             // 0.5 s in 0.625 ms slots, at most ESP_BT_GAP_TPOLL_MAX
+#endif
+// With DISCONNECT_BT_ON_IDLE, the link is also dropped after this long without
+// traffic. Also AT+IDLE.
+#ifndef IDLE_DISCONNECT_MS
+#define IDLE_DISCONNECT_MS 60000
+#endif
+#define IDLE_MAX_MS 3600000             // Well short of micros() wrapping
+
+/*
+ * What the link does while no data goes either way, for AT+IDLE. Each step
+ * is taken only if it has been given a time:
+ *
+ * - After a while it polls the peer every IDLE_POLL_SLOTS instead of the
+ *   stack's default. As the master, the radio is then off between polls, at
+ *   the cost of data from the peer waiting for the next one. Any data, from
+ *   either side, sets the default back: a wake. How long that takes is
+ *   measured, as is the stack's own way out of sniff mode, which its power
+ *   manager goes into by itself on an idle link.
+ * - Later, the link is dropped. Host data brings it back, and
+ *   waits in the spool meanwhile. How long that takes is measured too.
+ *
+ * Time spent in each mode is counted. Only the radio stage uses it.
+ */
+class IdlePolicy {
+public:
+    typedef enum {
+        STAY = 0,
+        SLOW_DOWN,          // Set the poll interval to IDLE_POLL_SLOTS
+        SPEED_UP,           // Back to ESP_BT_GAP_TPOLL_DFT
+        DISCONNECT
+    } Action;
+
+    IdlePolicy();
+
+    // Either 0 for never. False if either is over IDLE_MAX_MS.
+    bool set(uint32_t slowPollMs, uint32_t disconnectMs);
+
+    void linkUp();
+    void linkDown();
+    // Host data is on its way to the link. What moves over the link is seen
+    // in update() anyway.
+    void traffic();
+    // Dropped for being idle, and not back yet. Host data should bring it back.
+    bool dropped() { return idleDropped; }
+    // Dropped by the host, so data shouldn't bring it back
+    void stayDown() { idleDropped = false; reconnecting = false; }
+
+    // From the radio stage, with what the stack last reported
+    Action update(uint32_t pollSlots, esp_bt_pm_mode_t mode);
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    uint32_t slowPollMs;
+    uint32_t disconnectMs;
+    bool connected = false;
+    bool wantSlow = false;          // SLOW_DOWN asked for, and no SPEED_UP since
+    bool slow = false;              // As the controller last confirmed
+    bool sniff = false;
+    bool idleDropped = false;
+    bool waking = false;
+    bool reconnecting = false;
+    uint32_t lastTrafficUs = 0;     // Good for IDLE_MAX_MS
+    uint32_t moved = 0;             // Link bytes either way, as last seen in BridgeStats
+    uint32_t lastUs = 0;
+    uint32_t wakeStartUs = 0;
+    uint32_t reconnectStartUs = 0;
+    uint64_t activeUs = 0;
+    uint64_t slowUs = 0;
+    uint64_t sniffUs = 0;
+    uint64_t downUs = 0;
+    uint32_t slowMsPublished = 0;
+    uint32_t sniffMsPublished = 0;
+    uint32_t wakes = 0;
+    uint32_t wakeUs = 0;
+    uint32_t wakeMaxUs = 0;
+    uint32_t reconnectMs = 0;
+
+    void traffic(uint32_t nowUs);
+    void account(uint32_t nowUs);
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include <LinkBench.h>
+#include <BridgeStats.h>
+#include <esp_timer.h>
+#include "esp_log.h"
+
+#define LINK_BENCH_TAG "LINK_BENCH"
+
+#define HEADER_LEN 9        // '#' and 8 hex digits
+#define UNIT_SHIFT 5        // Histogram unit is 32us
+
+static const char hexDigits[] = "0123456789abcdef";
+
+LinkBench::LinkBench(BTSPP &_spp) : spp(_spp) {
+}
+
+void LinkBench::makePayload(uint32_t seq, uint8_t *buf) {
+    buf[0] = '#';
+    for (int i = 0; i < 8; i++) {
+        buf[1 + i] = hexDigits[(seq >> (28 - 4 * i)) & 0xf];
+    }
+    for (int i = HEADER_LEN; i < size; i++) {
+        buf[i] = 'a' + (seq + i) % 26;
+    }
+}
+
+bool LinkBench::checkPayload(const uint8_t *buf, uint32_t &seq) {
+    seq = 0;
+    for (int i = 1; i < HEADER_LEN; i++) {
+        const char *digit = strchr(hexDigits, buf[i]);
+        if (digit == NULL || *digit == 0) {
+            return false;
+        }
+        seq = (seq << 4) | (digit - hexDigits);
+    }
+    for (int i = HEADER_LEN; i < size; i++) {
+        if (buf[i] != 'a' + (seq + i) % 26) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void LinkBench::receive(const uint8_t *data, int len) {
+    for (int i = 0; i < len; i++) {
+        if (rxLen == 0 && data[i] != '#') {
+            continue;   // Lost sync, wait for the start of a payload
+        }
+        rxPacket[rxLen++] = data[i];
+        if (rxLen < size) {
+            continue;
+        }
+
+        uint32_t seq;
+        if (checkPayload(rxPacket, seq)) {
+            echo(seq);
+            rxLen = 0;
+        } else {
+            // Part of a payload went missing. Start again from the next '#'.
+            corrupt++;
+            int next = 1;
+            while (next < rxLen && rxPacket[next] != '#') {
+                next++;
+            }
+            rxLen -= next;
+            memmove(rxPacket, &rxPacket[next], rxLen);
+        }
+    }
+}
+
+void LinkBench::echo(uint32_t seq) {
+    int64_t now = esp_timer_get_time();
+
+    if (seq < base || seq >= nextSeq || echoed[seq % window]) {
+        late++;
+        return;
+    }
+
+    received++;
+    echoed[seq % window] = true;
+    recordRtt(now - sentUs[seq % window]);
+    while (base < nextSeq && echoed[base % window]) {
+        base++;
+    }
+}
+
+void LinkBench::expire(int64_t now) {
+    while (base < nextSeq && (echoed[base % window] || now - sentUs[base % window] > LOSS_TIMEOUT_US)) {
+        if (!echoed[base % window]) {
+            lost++;
+        }
+        base++;
+    }
+}
+
+bool LinkBench::run(int size, int seconds, int window) {
+    uint8_t txPacket[MAX_STRING_LENGTH];
+    uint8_t rxBuf[256];
+    uint32_t rxDropsBefore = BridgeStats::get(BridgeStats::RX_DROPS);
+    uint32_t congestionBefore = BridgeStats::get(BridgeStats::CONGESTION_EVENTS);
+    uint32_t cpuBefore = BridgeStats::get(BridgeStats::SPP_CPU_US);
+    bool ok = true;
+
+    this->size = size;
+    this->seconds = seconds;
+    this->window = window;
+    nextSeq = base = 0;
+    rxLen = 0;
+    sent = received = lost = corrupt = late = 0;
+    rttCount = rttMinUs = rttMaxUs = 0;
+    memset(echoed, 0, sizeof(echoed));
+    memset(buckets, 0, sizeof(buckets));
+
+    ESP_LOGI(LINK_BENCH_TAG, "%d byte payloads for %ds, %d in flight", size, seconds, window);
+
+    // Throw away anything left over from before
+    while (spp.read(rxBuf, sizeof(rxBuf), 0) > 0) {
+    }
+
+    startUs = esp_timer_get_time();
+    int64_t stopSendingUs = startUs + (int64_t)seconds * 1000000;
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        bool sending = now < stopSendingUs;
+
+        if (!spp.connectionDone()) {
+            ESP_LOGI(LINK_BENCH_TAG, "Link went down");
+            ok = false;
+            break;
+        }
+        if (!sending && base == nextSeq) {
+            break;
+        }
+
+        if (sending && nextSeq - base < (uint32_t)window) {
+            makePayload(nextSeq, txPacket);
+            if (spp.write(txPacket, size)) {
+                if (spp.isError()) {
+                    ESP_LOGI(LINK_BENCH_TAG, "Write failed: %s", spp.getErrMessage());
+                    ok = false;
+                    break;
+                }
+                sentUs[nextSeq % window] = now;
+                echoed[nextSeq % window] = false;
+                nextSeq++;
+                sent++;
+            }
+        }
+
+        // Block for at most a tick waiting for the first byte, then take whatever is there
+        int len = spp.read(rxBuf, 1, 1);
+        if (len > 0) {
+            len += spp.read(&rxBuf[1], sizeof(rxBuf) - 1, 0);
+            receive(rxBuf, len);
+        }
+        expire(esp_timer_get_time());
+    }
+    endUs = esp_timer_get_time();
+
+    rxDrops = BridgeStats::get(BridgeStats::RX_DROPS) - rxDropsBefore;
+    congestion = BridgeStats::get(BridgeStats::CONGESTION_EVENTS) - congestionBefore;
+    cpuUs = BridgeStats::get(BridgeStats::SPP_CPU_US) - cpuBefore;
+
+    return ok;
+}
+
+int LinkBench::bucketOf(uint32_t us) {
+    uint32_t units = us >> UNIT_SHIFT;
+
+    if (units < 8) {
+        return units;
+    }
+
+    int msb = 31 - __builtin_clz(units);
+    int bucket = (msb - 2) * 8 + ((units >> (msb - 3)) & 7);
+
+    return bucket < LINK_BENCH_BUCKETS ? bucket : LINK_BENCH_BUCKETS - 1;
+}
+
+uint32_t LinkBench::bucketLimit(int bucket) {
+    if (bucket >= LINK_BENCH_BUCKETS - 1) {
+        return UINT32_MAX;
+    }
+    if (bucket < 8) {
+        return ((bucket + 1) << UNIT_SHIFT) - 1;
+    }
+
+    int msb = bucket / 8 + 2;
+    uint32_t units = (uint32_t)(8 + bucket % 8 + 1) << (msb - 3);
+
+    return (units << UNIT_SHIFT) - 1;
+}
+
+void LinkBench::recordRtt(uint32_t us) {
+    buckets[bucketOf(us)]++;
+    if (rttCount == 0 || us < rttMinUs) {
+        rttMinUs = us;
+    }
+    if (us > rttMaxUs) {
+        rttMaxUs = us;
+    }
+    rttCount++;
+}
+
+uint32_t LinkBench::percentile(int pct) {
+    // As ConnStats: the upper bound of the bucket holding the pct'th sample,
+    // but never more than the largest value seen.
+    uint32_t target = (rttCount * pct + 99) / 100;
+    uint32_t seen = 0;
+
+    for (int i = 0; i < LINK_BENCH_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return bucketLimit(i) < rttMaxUs ? bucketLimit(i) : rttMaxUs;
+        }
+    }
+
+    return rttMaxUs;
+}
+
+void LinkBench::report(Print &out) {
+    int64_t elapsedUs = endUs - startUs;
+
+    out.printf("TRANSPORT=%s\r\n", spp.transportName());
+    out.printf("SIZE=%d\r\n", size);
+    out.printf("SECONDS=%d\r\n", seconds);
+    out.printf("WINDOW=%d\r\n", window);
+    out.printf("SENT=%u\r\n", sent);
+    out.printf("ECHOED=%u\r\n", received);
+    out.printf("LOST=%u\r\n", lost);
+    out.printf("CORRUPT=%u\r\n", corrupt);
+    out.printf("LATE=%u\r\n", late);
+    out.printf("RX_DROPS=%u\r\n", rxDrops);
+    out.printf("CONGESTION_EVENTS=%u\r\n", congestion);
+    out.printf("ELAPSED_MS=%u\r\n", (uint32_t)(elapsedUs / 1000));
+    out.printf("THROUGHPUT_BPS=%u\r\n", elapsedUs > 0 ? (uint32_t)((uint64_t)received * size * 1000000 / elapsedUs) : 0);
+    out.printf("CPU_US=%u\r\n", cpuUs);
+    out.printf("CPU_PERMILLE=%u\r\n", elapsedUs > 0 ? (uint32_t)((uint64_t)cpuUs * 1000 / elapsedUs) : 0);
+    out.printf("RTT_MIN_US=%u\r\n", rttMinUs);
+    out.printf("RTT_P50_US=%u\r\n", percentile(50));
+    out.printf("RTT_P99_US=%u\r\n", percentile(99));
+    out.printf("RTT_MAX_US=%u\r\n", rttMaxUs);
+}
@@ -0,0 +1,80 @@
+#ifndef LINK_BENCH_H
+#define LINK_BENCH_H
+
+#include <Arduino.h>
+#include <BTSPP.h>
+
+#define LINK_BENCH_MAX_WINDOW 16
+#define LINK_BENCH_BUCKETS 128
+
+/*
+ * On-device link test. Sends numbered payloads through BTSPP::write to a peer
+ * that echoes everything back, and times each round trip. Payloads are text:
+ *
+ *   '#' <seq: 8 hex digits> <fill: lower case letters derived from seq>
+ *
+ * A payload that doesn't come back within LOSS_TIMEOUT_US counts as lost, one
+ * that comes back damaged as corrupt. RTTs go into a log-linear histogram of
+ * 32us units with 8 buckets per power of two, so percentiles are within 12.5%
+ * up to about 8s while memory stays fixed.
+ */
+class LinkBench {
+public:
+    static const int MIN_SIZE = 16;
+    static const int MAX_SIZE = MAX_STRING_LENGTH - 1;
+    static const int MAX_SECONDS = 300;
+    static const int64_t LOSS_TIMEOUT_US = 2000000;
+
+    LinkBench(BTSPP &spp);
+
+    // Runs for seconds, then waits for the payloads still in flight.
+    // Returns false if the link went down or a write failed.
+    bool run(int size, int seconds, int window);
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    BTSPP &spp;
+
+    int size = 0;
+    int seconds = 0;
+    int window = 0;
+
+    uint32_t nextSeq = 0;           // Next payload to send
+    uint32_t base = 0;              // Oldest payload not yet echoed or lost
+    int64_t sentUs[LINK_BENCH_MAX_WINDOW];
+    bool echoed[LINK_BENCH_MAX_WINDOW];
+
+    uint8_t rxPacket[MAX_STRING_LENGTH];
+    int rxLen = 0;
+
+    int64_t startUs = 0;
+    int64_t endUs = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t lost = 0;
+    uint32_t corrupt = 0;
+    uint32_t late = 0;              // Echoes that came back after being counted as lost
+    uint32_t rxDrops = 0;
+    uint32_t congestion = 0;
+    uint32_t cpuUs = 0;             // SPP_CPU_US over the run
+
+    uint32_t rttCount = 0;
+    uint32_t rttMinUs = 0;
+    uint32_t rttMaxUs = 0;
+    uint32_t buckets[LINK_BENCH_BUCKETS];
+
+    void makePayload(uint32_t seq, uint8_t *buf);
+    bool checkPayload(const uint8_t *buf, uint32_t &seq);
+    void receive(const uint8_t *data, int len);
+    void echo(uint32_t seq);
+    void expire(int64_t now);
+
+    void recordRtt(uint32_t us);
+    static int bucketOf(uint32_t us);
+    static uint32_t bucketLimit(int bucket);
+    uint32_t percentile(int pct);
+};
+
+#endif
@@ -0,0 +1,396 @@
+#include <LinkCodec.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <esp_timer.h>
+#include "esp_log.h"
+
+#define LINK_CODEC_TAG "LINK_CODEC"
+
+#define MAGIC_PREFIX_LEN 4
+#define MAGIC_PARAMS ((LINK_CODEC_WINDOW_BITS << 4) | LINK_CODEC_LENGTH_BITS)
+
+static const uint8_t magicPrefix[MAGIC_PREFIX_LEN] = {0x00, 0xc5, 'L', 'Z'};
+
+LinkCodec::LinkCodec() {
+}
+
+void LinkCodec::setEnabled(bool on) {
+    if (on == this->on) {
+        return;
+    }
+
+    this->on = on;
+    if (!linkIsUp) {
+        return;
+    }
+
+    // What the peer sends goes on being decoded as it was
+    if (on && stopQueued) {
+        ctrlLen = 0;            // It never went, so the peer never stopped
+        stopQueued = false;
+    } else if (on && !txStarted) {
+        queueControl('H');
+    } else if (!on) {
+        // Nothing negotiated that hasn't gone yet, and STOP after the last frame
+        ctrlLen = 0;
+        startQueued = false;
+        draining = true;
+        if (txStarted) {
+            queueStop();
+        }
+    }
+}
+
+void LinkCodec::linkUp() {
+    linkDown();
+    linkIsUp = true;
+    if (on) {
+        queueControl('H');
+    }
+}
+
+void LinkCodec::linkDown() {
+    linkIsUp = false;
+    ctrlLen = 0;
+    startQueued = false;
+    stopQueued = false;
+    txStarted = false;
+    draining = false;
+    peerStopped = false;
+    encHistLen = 0;
+    encPending = 0;
+    rxStarted = false;
+    magicMatched = 0;
+    frameLen = 0;
+    decPos = 0;
+    rxOutHead = rxOutLen = 0;
+}
+
+void LinkCodec::queueControl(uint8_t type) {
+    if (ctrlLen + MAGIC_LEN > (int)sizeof(ctrl)) {
+        return;
+    }
+
+    memcpy(&ctrl[ctrlLen], magicPrefix, MAGIC_PREFIX_LEN);
+    ctrl[ctrlLen + MAGIC_PREFIX_LEN] = type;
+    ctrl[ctrlLen + MAGIC_PREFIX_LEN + 1] = MAGIC_PARAMS;
+    ctrlLen += MAGIC_LEN;
+}
+
+void LinkCodec::queueStop() {
+    ctrl[ctrlLen++] = FRAME_STOP;
+    ctrl[ctrlLen++] = 0;
+    stopQueued = true;
+}
+
+int LinkCodec::control(const uint8_t **data) {
+    *data = ctrl;
+
+    return linkIsUp ? ctrlLen : 0;
+}
+
+void LinkCodec::controlSent() {
+    Trace::record(Trace::LINK_CODEC_CONTROL, ctrl[ctrlLen - 2], 0);
+    ctrlLen = 0;
+    if (startQueued && !txStarted) {
+        // Everything from here on is framed
+        ESP_LOGI(LINK_CODEC_TAG, "Compressing");
+        txStarted = true;
+    } else if (stopQueued) {
+        // Everything from here on is plain, and a later START begins a new window
+        ESP_LOGI(LINK_CODEC_TAG, "Not compressing");
+        stopQueued = false;
+        txStarted = false;
+        encHistLen = 0;
+    }
+}
+
+int LinkCodec::encode(const uint8_t *in, int len, uint8_t *out) {
+    int64_t startUs = esp_timer_get_time();
+
+    if (len > LINK_CODEC_MAX_BLOCK) {
+        ESP_LOGE(LINK_CODEC_TAG, "%d bytes is too much for one frame", len);
+        len = LINK_CODEC_MAX_BLOCK;
+    }
+
+    // Behind the window, so matches can reach back into earlier writes.
+    // Only commit() makes it part of the window.
+    memcpy(&encHist[encHistLen], in, len);
+    int n = compress(encHistLen, encHistLen + len, &out[LINK_CODEC_FRAME_HEADER], len - 1);
+    if (n > 0) {
+        out[0] = FRAME_LZ;
+    } else {
+        out[0] = FRAME_RAW;
+        memcpy(&out[LINK_CODEC_FRAME_HEADER], in, len);
+        n = len;
+    }
+    out[1] = n;
+
+    encPending = len;
+    encPendingOut = LINK_CODEC_FRAME_HEADER + n;
+    BridgeStats::add(BridgeStats::COMPRESS_CPU_US, esp_timer_get_time() - startUs);
+
+    return encPendingOut;
+}
+
+void LinkCodec::commit() {
+    int total = encHistLen + encPending;
+    int keep = total < WINDOW ? total : WINDOW;
+
+    memmove(encHist, &encHist[total - keep], keep);
+    encHistLen = keep;
+    BridgeStats::add(BridgeStats::COMPRESS_IN_BYTES, encPending);
+    BridgeStats::add(BridgeStats::COMPRESS_OUT_BYTES, encPendingOut);
+    encPending = 0;
+}
+
+int LinkCodec::compress(int start, int end, uint8_t *out, int outSize) {
+    uint32_t bits = 0;
+    int bitCount = 0;
+    int n = 0;
+
+    // MSB first. False once out is full, i.e. it didn't get any smaller.
+    auto put = [&](uint32_t value, int count) {
+        bits = (bits << count) | value;
+        bitCount += count;
+        while (bitCount >= 8) {
+            if (n >= outSize) {
+                return false;
+            }
+            bitCount -= 8;
+            out[n++] = bits >> bitCount;
+        }
+        bits &= (1 << bitCount) - 1;
+        return true;
+    };
+
+    int pos = start;
+    while (pos < end) {
+        int maxLen = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+        int lowest = pos - WINDOW > 0 ? pos - WINDOW : 0;
+        int best = 0;
+        int bestOffset = 0;
+
+        for (int cand = pos - 1; cand >= lowest && maxLen >= MIN_MATCH; cand--) {
+            if (encHist[cand] != encHist[pos] || encHist[cand + best] != encHist[pos + best]) {
+                continue;
+            }
+            int len = 0;
+            while (len < maxLen && encHist[cand + len] == encHist[pos + len]) {
+                len++;
+            }
+            if (len > best) {
+                best = len;
+                bestOffset = pos - cand;
+                if (best == maxLen) {
+                    break;
+                }
+            }
+        }
+
+        if (best >= MIN_MATCH) {
+            if (!put(0, 1) || !put(bestOffset - 1, LINK_CODEC_WINDOW_BITS) || !put(best - MIN_MATCH, LINK_CODEC_LENGTH_BITS)) {
+                return 0;
+            }
+            pos += best;
+        } else {
+            if (!put(1, 1) || !put(encHist[pos], 8)) {
+                return 0;
+            }
+            pos++;
+        }
+    }
+
+    if (bitCount > 0) {
+        // Fewer than 8 bits of padding, too short for a token
+        if (n >= outSize) {
+            return 0;
+        }
+        out[n++] = bits << (8 - bitCount);
+    }
+
+    return n;
+}
+
+int LinkCodec::receive(const uint8_t *in, int len) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        int room = RX_OUT_SIZE - rxOutLen;
+        if (!rxStarted) {
+            // Held back bytes of what looked like HELLO or START come out at once
+            if (room < MAGIC_LEN) {
+                break;
+            }
+            plainByte(in[i]);
+        } else {
+            int frameEnd = LINK_CODEC_FRAME_HEADER + (frameLen == 1 ? in[i] : frame[1]);
+            if (frameLen >= 1 && frameLen + 1 == frameEnd && room < LINK_CODEC_MAX_BLOCK) {
+                break;
+            }
+            frameByte(in[i]);
+        }
+    }
+
+    return i;
+}
+
+void LinkCodec::plainByte(uint8_t c) {
+    if (magicMatched < MAGIC_PREFIX_LEN && c == magicPrefix[magicMatched]) {
+        magicMatched++;
+        return;
+    }
+    if (magicMatched == MAGIC_PREFIX_LEN && (c == 'H' || c == 'S')) {
+        magicType = c;
+        magicMatched++;
+        return;
+    }
+    if (magicMatched == MAGIC_PREFIX_LEN + 1) {
+        magicMatched = 0;
+        magicReceived(magicType, c);
+        return;
+    }
+
+    // Not one after all, so it was data
+    int held = magicMatched;
+    magicMatched = 0;
+    for (int i = 0; i < held; i++) {
+        output(magicPrefix[i]);
+    }
+    if (c == magicPrefix[0]) {
+        magicMatched = 1;
+    } else {
+        output(c);
+    }
+}
+
+void LinkCodec::magicReceived(uint8_t type, uint8_t params) {
+    Trace::record(Trace::LINK_CODEC_CONTROL, type, 1);
+    if (params != MAGIC_PARAMS) {
+        ESP_LOGW(LINK_CODEC_TAG, "Peer has window/length bits %02x, not %02x", params, MAGIC_PARAMS);
+        return;
+    }
+
+    if (type == 'H') {
+        peerStopped = false;
+        // Our HELLO again, in case the peer only turned it on after ours went
+        if (on && !startQueued) {
+            queueControl('H');
+            queueControl('S');
+            startQueued = true;
+        }
+    } else {
+        ESP_LOGI(LINK_CODEC_TAG, "Peer is compressing");
+        rxStarted = true;
+        frameLen = 0;
+        decPos = 0;
+    }
+}
+
+void LinkCodec::stopReceived() {
+    ESP_LOGI(LINK_CODEC_TAG, "Peer stopped compressing");
+    rxStarted = false;
+    peerStopped = true;
+    if (txStarted && !stopQueued) {
+        queueStop();
+    } else if (!txStarted) {
+        ctrlLen = 0;            // No START after all
+        startQueued = false;
+    }
+}
+
+void LinkCodec::frameByte(uint8_t c) {
+    frame[frameLen++] = c;
+    if (frameLen >= LINK_CODEC_FRAME_HEADER && frameLen == LINK_CODEC_FRAME_HEADER + frame[1]) {
+        decodeFrame();
+        frameLen = 0;
+    }
+}
+
+void LinkCodec::decodeFrame() {
+    int64_t startUs = esp_timer_get_time();
+    const uint8_t *payload = &frame[LINK_CODEC_FRAME_HEADER];
+    int len = frame[1];
+    int produced = 0;
+
+    if (frame[0] == FRAME_STOP && len == 0) {
+        stopReceived();
+        return;
+    } else if (frame[0] == FRAME_RAW && len <= LINK_CODEC_MAX_BLOCK) {
+        for (int i = 0; i < len; i++) {
+            output(payload[i]);
+        }
+        produced = len;
+    } else if (frame[0] == FRAME_LZ) {
+        int bitsLeft = len * 8;
+        int bitPos = 0;
+        auto get = [&](int count) {
+            uint32_t value = 0;
+            for (int i = 0; i < count; i++, bitPos++) {
+                value = (value << 1) | ((payload[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+            }
+            bitsLeft -= count;
+            return value;
+        };
+
+        // Anything shorter than a literal is padding
+        while (bitsLeft >= 9) {
+            if (get(1)) {
+                if (produced >= LINK_CODEC_MAX_BLOCK) {
+                    break;
+                }
+                output(get(8));
+                produced++;
+            } else {
+                if (bitsLeft < LINK_CODEC_WINDOW_BITS + LINK_CODEC_LENGTH_BITS) {
+                    break;
+                }
+                int offset = get(LINK_CODEC_WINDOW_BITS) + 1;
+                int count = get(LINK_CODEC_LENGTH_BITS) + MIN_MATCH;
+                if (produced + count > LINK_CODEC_MAX_BLOCK) {
+                    break;
+                }
+                for (int i = 0; i < count; i++) {
+                    output(decWindow[(decPos - offset) & (WINDOW - 1)]);
+                }
+                produced += count;
+            }
+        }
+        if (bitsLeft >= 9) {
+            BridgeStats::add(BridgeStats::DECOMPRESS_ERRORS);
+            Trace::record(Trace::LINK_CODEC_ERROR, frame[0], len);
+        }
+    } else {
+        BridgeStats::add(BridgeStats::DECOMPRESS_ERRORS);
+        Trace::record(Trace::LINK_CODEC_ERROR, frame[0], len);
+    }
+
+    BridgeStats::add(BridgeStats::DECOMPRESS_IN_BYTES, LINK_CODEC_FRAME_HEADER + len);
+    BridgeStats::add(BridgeStats::DECOMPRESS_OUT_BYTES, produced);
+    BridgeStats::add(BridgeStats::DECOMPRESS_CPU_US, esp_timer_get_time() - startUs);
+}
+
+void LinkCodec::output(uint8_t c) {
+    rxOut[(rxOutHead + rxOutLen) % RX_OUT_SIZE] = c;
+    rxOutLen++;
+    decWindow[decPos] = c;
+    decPos = (decPos + 1) & (WINDOW - 1);
+}
+
+int LinkCodec::read(uint8_t *out, int len) {
+    int n = len < rxOutLen ? len : rxOutLen;
+
+    for (int i = 0; i < n; i++) {
+        out[i] = rxOut[rxOutHead];
+        rxOutHead = (rxOutHead + 1) % RX_OUT_SIZE;
+    }
+    rxOutLen -= n;
+
+    return n;
+}
+
+void LinkCodec::report(Print &out) {
+    out.printf("ENABLED=%d\r\n", on ? 1 : 0);
+    out.printf("TX=%s\r\n", txStarted ? "COMPRESSED" : (on && linkIsUp && !peerStopped ? "NEGOTIATING" : "PLAIN"));
+    out.printf("RX=%s\r\n", rxStarted ? "COMPRESSED" : "PLAIN");
+}
@@ -0,0 +1,135 @@
+#ifndef LINK_CODEC_H
+#define LINK_CODEC_H
+
+#include <Arduino.h>
+#include <SPPTransport.h>
+
+// Whether AT+COMPRESS starts out on
+#ifndef LINK_COMPRESSION
+#define LINK_COMPRESSION 0
+#endif
+
+#define LINK_CODEC_WINDOW_BITS 8        // 256 byte window
+#define LINK_CODEC_LENGTH_BITS 4        // Matches of 2 to 17 bytes
+#define LINK_CODEC_FRAME_HEADER 2       // Type and length
+#define LINK_CODEC_MAX_BLOCK (MAX_STRING_LENGTH - 1 - LINK_CODEC_FRAME_HEADER)
+
+/*
+ * Optional compression of the link between two units of this firmware. It
+ * is LZSS as heatshrink does it: a bit stream of literals (1, then 8 bits)
+ * and back references into the last 256 bytes (0, then 8 bits of offset and
+ * 4 of length), so repetitive telemetry shrinks to a fraction while RAM stays
+ * at about 1.2KB. The window runs on across writes, which is where
+ * line-by-line telemetry gains most.
+ *
+ * Each write goes out as one frame, compressed or, if that doesn't make it
+ * smaller, as it is:
+ *
+ *   <type: 0 raw, 1 compressed, 2 STOP> <length> <payload>
+ *
+ * Both sides have to agree, so it is negotiated in band each time the link
+ * comes up. A side with compression on sends HELLO; one that gets HELLO while
+ * on answers with HELLO and START and frames everything it sends after START.
+ * Until the peer's START, what it sends is taken as plain data. A peer that
+ * doesn't run this only ever sees the 6 byte HELLO.
+ *
+ *   HELLO  00 c5 'L' 'Z' 'H' <window bits << 4 | length bits>
+ *   START  00 c5 'L' 'Z' 'S' <the same>
+ *
+ * Turned off on a live link, a side that frames sends STOP, 02 00, as its
+ * last frame. The peer takes what follows as plain data and, if it frames
+ * too, answers with STOP of its own, so both go back to plain together. The
+ * side that turned it off decodes whatever the peer frames until then, and
+ * either side's HELLO starts it all over again.
+ *
+ * Only the radio stage uses it. Writes that the link refuses are encoded
+ * again on the next attempt, so commit() only after one has been taken.
+ */
+class LinkCodec {
+public:
+    LinkCodec();
+
+    void setEnabled(bool on);
+    bool enabled() { return on; }
+    // Whether what comes from the link has to go through receive(): while
+    // enabled, and once turned off, until the link drops
+    bool active() { return on || draining; }
+
+    // Starts negotiating if enabled. Anything from an earlier link is forgotten.
+    void linkUp();
+    void linkDown();
+
+    // Negotiation to send ahead of anything else. 0 if there is none.
+    int control(const uint8_t **data);
+    void controlSent();
+
+    // Sending side. Once framed, encode() turns up to LINK_CODEC_MAX_BLOCK
+    // bytes into a frame of at most MAX_STRING_LENGTH - 1 in out.
+    bool txFramed() { return txStarted; }
+    int encode(const uint8_t *in, int len, uint8_t *out);
+    void commit();
+
+    // Receiving side. receive() takes bytes from the link for as long as
+    // what they decode to is sure to fit, and returns how many it took. The
+    // rest has to be offered again once read() has made room.
+    int receive(const uint8_t *in, int len);
+    int read(uint8_t *out, int len);
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    static const int WINDOW = 1 << LINK_CODEC_WINDOW_BITS;
+    static const int MIN_MATCH = 2;
+    static const int MAX_MATCH = MIN_MATCH + (1 << LINK_CODEC_LENGTH_BITS) - 1;
+    static const int MAGIC_LEN = 6;
+    static const int RX_OUT_SIZE = 256;
+
+    typedef enum {
+        FRAME_RAW = 0,
+        FRAME_LZ = 1,
+        FRAME_STOP = 2
+    } FrameType;
+
+    bool on = LINK_COMPRESSION;
+    bool linkIsUp = false;
+
+    uint8_t ctrl[2 * MAGIC_LEN];
+    int ctrlLen = 0;
+    bool startQueued = false;
+    bool stopQueued = false;
+    bool txStarted = false;
+    bool draining = false;          // Turned off on this link
+    bool peerStopped = false;       // And the peer sent STOP since its last HELLO
+
+    // The window, then the block being encoded
+    uint8_t encHist[WINDOW + LINK_CODEC_MAX_BLOCK];
+    int encHistLen = 0;
+    int encPending = 0;             // Encoded but not committed
+    int encPendingOut = 0;          // And the size of its frame
+
+    bool rxStarted = false;
+    int magicMatched = 0;           // Plain data held back while it looks like HELLO or START
+    uint8_t magicType = 0;
+
+    uint8_t frame[LINK_CODEC_FRAME_HEADER + 255];
+    int frameLen = 0;               // Of frame, received so far
+    uint8_t decWindow[WINDOW];
+    int decPos = 0;
+
+    uint8_t rxOut[RX_OUT_SIZE];
+    int rxOutHead = 0;
+    int rxOutLen = 0;
+
+    void queueControl(uint8_t type);
+    void queueStop();
+    void plainByte(uint8_t c);
+    void magicReceived(uint8_t type, uint8_t params);
+    void stopReceived();
+    void frameByte(uint8_t c);
+    void decodeFrame();
+    void output(uint8_t c);
+    int compress(int start, int end, uint8_t *out, int outSize);
+};
+
+#endif
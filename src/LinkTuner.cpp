@@ -0,0 +1,112 @@
+#include <LinkTuner.h>
+#include <BridgeStats.h>
+#include "esp_log.h"
+
+#define LINK_TUNER_TAG "TUNER"
+
+LinkTuner::LinkTuner(int maxDepth) : maxDepth(maxDepth), inFlight(maxDepth) {
+    publish();
+}
+
+void LinkTuner::setEnabled(bool on) {
+    this->on = on;
+    if (!on) {
+        chunk = LINK_TUNER_MAX_CHUNK;
+        coalesce = 0;
+        inFlight = maxDepth;
+        direction = -1;
+        lastBps = 0;
+        publish();
+    }
+    linkUp();
+}
+
+void LinkTuner::linkUp() {
+    periodStartMs = millis();
+    txBytesBase = BridgeStats::get(BridgeStats::TX_BYTES);
+    congestionBase = BridgeStats::get(BridgeStats::CONGESTION_EVENTS);
+    retransmitBase = BridgeStats::get(BridgeStats::RELIABLE_RETRANSMITS);
+    lastBps = 0;
+    bps = 0;
+    rssiKnown = false;
+}
+
+bool LinkTuner::due() {
+    return millis() - periodStartMs >= LINK_TUNER_PERIOD_MS;
+}
+
+void LinkTuner::update(bool rssiKnown, int rssiDelta) {
+    uint32_t nowMs = millis();
+    uint32_t ms = nowMs - periodStartMs;
+    uint32_t txBytes = BridgeStats::get(BridgeStats::TX_BYTES);
+    uint32_t congestions = BridgeStats::get(BridgeStats::CONGESTION_EVENTS) - congestionBase;
+    uint32_t retransmits = BridgeStats::get(BridgeStats::RELIABLE_RETRANSMITS) - retransmitBase;
+
+    bps = ms > 0 ? (uint64_t)(txBytes - txBytesBase) * 1000 / ms : 0;
+    this->rssiKnown = rssiKnown;
+    rssi = rssiDelta;
+    periodStartMs = nowMs;
+    txBytesBase = txBytes;
+    congestionBase += congestions;
+    retransmitBase += retransmits;
+    if (!on) {
+        publish();      // In case AT+STATS=RESET cleared them
+        return;
+    }
+
+    int lastChunk = chunk, lastCoalesce = coalesce, lastInFlight = inFlight;
+    bool saturated = congestions > 0;
+    bool weak = rssiKnown && rssiDelta <= LINK_TUNER_WEAK_RSSI;
+
+    if (saturated) {
+        coalesce = coalesce + 2 < LINK_TUNER_MAX_COALESCE_MS ? coalesce + 2 : LINK_TUNER_MAX_COALESCE_MS;
+    } else {
+        coalesce /= 2;
+    }
+
+    if (!weak) {
+        chunk = LINK_TUNER_MAX_CHUNK;
+        direction = -1;
+        lastBps = 0;
+    } else if (saturated) {
+        // What the link moves is all it can, so more of it means a better size
+        if (lastBps > 0 && bps < lastBps - lastBps / 20) {
+            direction = -direction;
+        }
+        lastBps = bps;
+        chunk = direction < 0 ? chunk * 3 / 4 : chunk * 4 / 3;
+        chunk = chunk < LINK_TUNER_MIN_CHUNK ? LINK_TUNER_MIN_CHUNK : chunk > LINK_TUNER_MAX_CHUNK ? LINK_TUNER_MAX_CHUNK : chunk;
+    }
+
+    if (weak && retransmits > 0) {
+        inFlight = inFlight / 2 > 1 ? inFlight / 2 : 1;
+    } else if (inFlight < maxDepth) {
+        inFlight++;
+    }
+
+    if (chunk != lastChunk || coalesce != lastCoalesce || inFlight != lastInFlight) {
+        ESP_LOGD(LINK_TUNER_TAG, "RSSI %d, %u B/s: chunk %d, coalesce %d ms, depth %d",
+            rssiDelta, bps, chunk, coalesce, inFlight);
+        BridgeStats::add(BridgeStats::TUNING_STEPS);
+    }
+    publish();
+}
+
+void LinkTuner::publish() {
+    BridgeStats::set(BridgeStats::TX_CHUNK_SIZE, chunk);
+    BridgeStats::set(BridgeStats::TX_COALESCE_MS, coalesce);
+    BridgeStats::set(BridgeStats::TX_IN_FLIGHT_LIMIT, inFlight);
+}
+
+void LinkTuner::report(Print &out) {
+    out.printf("ENABLED=%d\r\n", on ? 1 : 0);
+    if (rssiKnown) {
+        out.printf("RSSI_DELTA=%d\r\n", rssi);
+    } else {
+        out.printf("RSSI_DELTA=NONE\r\n");
+    }
+    out.printf("CHUNK=%d\r\n", chunk);
+    out.printf("COALESCE_MS=%d\r\n", coalesce);
+    out.printf("DEPTH=%d\r\n", inFlight);
+    out.printf("BPS=%u\r\n", bps);
+}
@@ -0,0 +1,81 @@
+#ifndef LINK_TUNER_H
+#define LINK_TUNER_H
+
+#include <Arduino.h>
+#include <LinkCodec.h>
+
+#ifndef LINK_TUNING
+#define LINK_TUNING 1                   // AT+TUNE at power on
+#endif
+#ifndef LINK_TUNER_PERIOD_MS
+#define LINK_TUNER_PERIOD_MS 500
+#endif
+#ifndef LINK_TUNER_WEAK_RSSI
+#define LINK_TUNER_WEAK_RSSI -5         // dB from the golden receive range, at or below which the link is marginal
+#endif
+#ifndef LINK_TUNER_MAX_COALESCE_MS
+#define LINK_TUNER_MAX_COALESCE_MS 10
+#endif
+#define LINK_TUNER_MIN_CHUNK 32
+#define LINK_TUNER_MAX_CHUNK LINK_CODEC_MAX_BLOCK
+
+/*
+ * Adapts how data goes to the link to how well the link is doing, for
+ * AT+TUNE. Each period it looks at the RSSI and at whether the link reported
+ * congestion, i.e. had more to send than it could:
+ *
+ * - Chunk size, the most data in one write. With the RSSI in range, nothing
+ *   is lost on the air and the largest writes cost least. Below it, a lost
+ *   baseband packet takes the whole write with it, so while the link is
+ *   congested (and what it moves is all it can) the size climbs towards
+ *   whatever moved the most data in the last period, starting smaller.
+ * - Coalescing delay, how long data short of a chunk waits for more. It grows
+ *   while the link is congested, when writes wait anyway, and shrinks back to
+ *   none when it isn't, so that a quiet link keeps its latency.
+ * - In-flight depth, the AT+RELIABLE window. Halved when packets had to be
+ *   sent again on a marginal link, otherwise opened a packet at a time.
+ *
+ * Off, it stays at the largest chunks, no delay and the whole window. Only the
+ * radio stage uses it.
+ */
+class LinkTuner {
+public:
+    LinkTuner(int maxDepth);
+
+    void setEnabled(bool on);
+    bool enabled() { return on; }
+
+    // Starts measuring afresh, from the last values
+    void linkUp();
+    // A period has gone by since the last update()
+    bool due();
+    // rssiKnown is false until the controller has answered
+    void update(bool rssiKnown, int rssiDelta);
+
+    int chunkSize() { return chunk; }
+    int coalesceMs() { return coalesce; }
+    int depth() { return inFlight; }
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    bool on = LINK_TUNING;
+    int maxDepth;
+    int chunk = LINK_TUNER_MAX_CHUNK;
+    int coalesce = 0;
+    int inFlight;
+    int direction = -1;             // Of the next chunk size step on a marginal link
+    uint32_t periodStartMs = 0;
+    uint32_t txBytesBase = 0;
+    uint32_t congestionBase = 0;
+    uint32_t retransmitBase = 0;
+    uint32_t lastBps = 0;           // Of the last marginal, congested period, or 0
+    uint32_t bps = 0;
+    bool rssiKnown = false;
+    int rssi = 0;
+
+    void publish();
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <Notifier.h>
+#include <BridgeStats.h>
+#include <stdarg.h>
+
+const char *Notifier::names[NUM_CATEGORIES] = {
+    "STATE",
+    "DROP",
+    "ERROR",
+    "FILE",
+    "OTA"
+};
+
+Notifier::Notifier(size_t queueBytes) : queue(queueBytes) {
+}
+
+void Notifier::setEnabled(Category category, bool on) {
+    if (on && !enabled(category) && category == DROP) {
+        // Only what is lost from now on
+        rxDropsSeen = BridgeStats::get(BridgeStats::RX_DROPS);
+        spoolDropsSeen = BridgeStats::get(BridgeStats::SPOOL_DROPPED_BYTES);
+        urgentDropsSeen = BridgeStats::get(BridgeStats::URGENT_DROPPED_BYTES);
+    }
+    if (on) {
+        mask |= 1 << category;
+    } else {
+        mask &= ~(1 << category);
+    }
+}
+
+bool Notifier::lookup(const char *name, Category &category) {
+    for (int i = 0; i < NUM_CATEGORIES; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            category = (Category)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Notifier::post(Category category, const char *format, ...) {
+    char line[NOTIFIER_LINE_LENGTH];
+    va_list args;
+
+    if (!enabled(category)) {
+        return;
+    }
+
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line) - 2, format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    len = len < (int)sizeof(line) - 3 ? len : sizeof(line) - 3;
+    line[len++] = '\r';
+    line[len++] = '\n';
+
+    // All or nothing, so the host never sees half a line
+    if (queue.space() >= (size_t)len) {
+        queue.write((uint8_t*)line, len);
+    }
+}
+
+void Notifier::flush(Print &out) {
+    if (enabled(DROP)) {
+        uint32_t rxDrops = BridgeStats::get(BridgeStats::RX_DROPS);
+        uint32_t spoolDrops = BridgeStats::get(BridgeStats::SPOOL_DROPPED_BYTES);
+        uint32_t urgentDrops = BridgeStats::get(BridgeStats::URGENT_DROPPED_BYTES);
+        // Less than before means AT+STATS=RESET
+        if (rxDrops > rxDropsSeen) {
+            post(DROP, "+DROP:%u", rxDrops - rxDropsSeen);
+        }
+        if (spoolDrops > spoolDropsSeen) {
+            post(DROP, "+DROP:%u,SPOOL", spoolDrops - spoolDropsSeen);
+        }
+        if (urgentDrops > urgentDropsSeen) {
+            post(DROP, "+DROP:%u,URGENT", urgentDrops - urgentDropsSeen);
+        }
+        rxDropsSeen = rxDrops;
+        spoolDropsSeen = spoolDrops;
+        urgentDropsSeen = urgentDrops;
+    }
+
+    const uint8_t *data;
+    size_t len;
+    while ((len = queue.peek(&data)) > 0) {
+        out.write(data, len);
+        queue.consume(len);
+    }
+}
+
+void Notifier::report(Print &out) {
+    for (int i = 0; i < NUM_CATEGORIES; i++) {
+        out.printf("%s=%d\r\n", names[i], enabled((Category)i) ? 1 : 0);
+    }
+}
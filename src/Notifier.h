@@ -0,0 +1,66 @@
+#ifndef NOTIFIER_H
+#define NOTIFIER_H
+
+#include <Arduino.h>
+#include <SPSCRing.h>
+
+#define NOTIFIER_LINE_LENGTH 48
+
+/*
+ * Unsolicited result codes for the host, so that it doesn't have to poll
+ * AT+STATE. Each category is off until the host turns it on:
+ *
+ *   STATE   +STATE:<name> on every change of connection state
+ *   DROP    +DROP:<n> when n bytes from the peer were lost before reaching
+ *           the host, +DROP:<n>,SPOOL when the spool dropped host data,
+ *           +DROP:<n>,URGENT when the urgent lane did
+ *   ERROR   +ERROR:<what> when connecting, searching or a write fails
+ *   FILE    +FILE:<percent> every 10% of AT+SENDFILE or AT+RECVFILE, then
+ *           +FILE:DONE,<bytes>,<bytes per second> or +FILE:FAILED
+ *   OTA     +OTA:<percent> every 10% of a firmware update, then
+ *           +OTA:DONE,<bytes>,<bytes per second> or +OTA:FAILED
+ *
+ * Codes are queued as whole lines and only written out by flush(), which the
+ * radio stage calls between command responses and received data, so they
+ * never end up in the middle of either. With AT+SENDRX=4 or 5 the host
+ * stream puts them in text frames. When the queue is full new codes are
+ * dropped; the state can still be read with AT+STATE.
+ */
+class Notifier {
+public:
+    typedef enum {
+        STATE = 0,
+        DROP,
+        ERROR,
+        FILE,
+        OTA,
+        NUM_CATEGORIES
+    } Category;
+
+    Notifier(size_t queueBytes);
+
+    void setEnabled(Category category, bool on);
+    bool enabled(Category category) { return (mask & (1 << category)) != 0; }
+
+    // Category by name, false if there is none
+    static bool lookup(const char *name, Category &category);
+
+    void post(Category category, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    // Writes out what is queued, after checking the drop counters
+    void flush(Print &out);
+
+    // <CATEGORY>=<0|1> lines
+    void report(Print &out);
+
+private:
+    SPSCRing queue;
+    uint32_t mask = 0;
+    uint32_t rxDropsSeen = 0;
+    uint32_t spoolDropsSeen = 0;
+    uint32_t urgentDropsSeen = 0;
+
+    static const char *names[NUM_CATEGORIES];
+};
+
+#endif
@@ -0,0 +1,330 @@
+#include <OtaUpdate.h>
+#include <BridgeStats.h>
+#include <esp_rom_crc.h>
+#include "esp_log.h"
+
+#define OTA_TAG "OTA"
+
+static const uint8_t magic[4] = {0x00, 0xc5, 'F', 'T'};
+
+const char *OtaUpdate::stateNames[] = {
+    "IDLE",
+    "RECEIVING",
+    "FINISHING",
+    "DONE",
+    "FAILED"
+};
+
+static const char *imageStateName(const esp_partition_t *partition) {
+    static const char *names[] = {"NEW", "PENDING_VERIFY", "VALID", "INVALID", "ABORTED"};
+    esp_ota_img_states_t imageState;
+
+    if (partition == nullptr || esp_ota_get_state_partition(partition, &imageState) != ESP_OK ||
+        imageState > ESP_OTA_IMG_ABORTED) {
+        return "UNDEFINED";
+    }
+
+    return names[imageState];
+}
+
+OtaUpdate::OtaUpdate() {
+    for (Block &block : blocks) {
+        block.len = 0;
+        block.full.store(false);
+    }
+}
+
+bool OtaUpdate::start() {
+    if (active()) {
+        errMsg = "An update is already going";
+        return false;
+    }
+    if (request.load(std::memory_order_acquire) != NONE ||
+        blocks[0].full.load(std::memory_order_acquire) || blocks[1].full.load(std::memory_order_acquire)) {
+        errMsg = "Still stopping the last one";
+        return false;
+    }
+
+    partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == nullptr) {
+        errMsg = "No OTA partition";
+        return false;
+    }
+    if (writerTask == nullptr && xTaskCreate(writerTaskFn, "OTA writer", 4096, this, OTA_WRITER_PRIORITY, &writerTask) != pdPASS) {
+        writerTask = nullptr;
+        errMsg = "Can't start the writer";
+        return false;
+    }
+
+    size = done = crc = 0;
+    headerLen = trailerLen = 0;
+    fillBlock = 0;
+    fillLen = 0;
+    progressReported = 0;
+    endPending = false;
+    errMsg = "";
+    writeErr = ESP_OK;
+    outcome.store(PENDING, std::memory_order_release);
+    startMs = lastRxMs = millis();
+    state = RECEIVING;
+    ESP_LOGI(OTA_TAG, "Waiting for firmware for %s", partition->label);
+
+    return true;
+}
+
+int OtaUpdate::room() {
+    if (state != RECEIVING || blocks[fillBlock].full.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    return OTA_BLOCK - fillLen;
+}
+
+void OtaUpdate::receive(const uint8_t *in, int len) {
+    int i = 0;
+
+    if (state != RECEIVING) {
+        return;
+    }
+    lastRxMs = millis();
+
+    while (i < len && state == RECEIVING) {
+        if (headerLen < HEADER_LEN) {
+            uint8_t c = in[i++];
+            if (headerLen < (int)sizeof(magic) && c != magic[headerLen]) {
+                headerLen = c == magic[0] ? 1 : 0;
+                continue;
+            }
+            header[headerLen++] = c;
+            if (headerLen == HEADER_LEN) {
+                size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+                if (size == 0 || size > partition->size) {
+                    ESP_LOGE(OTA_TAG, "%u bytes won't fit %s", size, partition->label);
+                    fail("Doesn't fit the partition");
+                    return;
+                }
+                startMs = millis();
+                ESP_LOGI(OTA_TAG, "Receiving %u bytes for %s", size, partition->label);
+            }
+        } else if (done < size) {
+            Block &block = blocks[fillBlock];
+            if (block.full.load(std::memory_order_acquire)) {
+                fail("More than there was room for");
+                return;
+            }
+            // As much as is left of the image, of the input and of the block
+            int n = len - i;
+            n = (uint32_t)n < size - done ? n : size - done;
+            n = n < OTA_BLOCK - fillLen ? n : OTA_BLOCK - fillLen;
+            memcpy(&block.data[fillLen], &in[i], n);
+            crc = esp_rom_crc32_le(crc, &in[i], n);
+            fillLen += n;
+            done += n;
+            i += n;
+            if (fillLen == OTA_BLOCK || done == size) {
+                handOver();
+            }
+        } else {
+            trailer[trailerLen++] = in[i++];
+            if (trailerLen == CRC_LEN) {
+                received();
+            }
+        }
+    }
+}
+
+void OtaUpdate::handOver() {
+    Block &block = blocks[fillBlock];
+
+    block.len = fillLen;
+    block.full.store(true, std::memory_order_release);
+    xTaskNotifyGive(writerTask);
+    fillBlock ^= 1;
+    fillLen = 0;
+}
+
+void OtaUpdate::received() {
+    uint32_t sent = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+
+    if (sent != crc) {
+        ESP_LOGE(OTA_TAG, "CRC %08x, expected %08x", crc, sent);
+        BridgeStats::add(BridgeStats::FILE_CRC_ERRORS);
+        fail("CRC mismatch");
+        return;
+    }
+
+    // The writer checks the image once it has written the rest
+    state = FINISHING;
+    request.store(FINISH, std::memory_order_release);
+    xTaskNotifyGive(writerTask);
+}
+
+void OtaUpdate::poll() {
+    int result = outcome.load(std::memory_order_acquire);
+
+    if (active() && result == WRITE_FAILED) {
+        fail(esp_err_to_name(writeErr));
+    } else if (state == FINISHING && result == SUCCEEDED) {
+        finish(DONE);
+    } else if (state == RECEIVING && millis() - lastRxMs > OTA_TIMEOUT_MS) {
+        fail("Timed out");
+    }
+}
+
+void OtaUpdate::fail(const char *why) {
+    if (!active() || (state == FINISHING && outcome.load(std::memory_order_acquire) != WRITE_FAILED)) {
+        return;     // Once it has all arrived, only the writer can fail it
+    }
+
+    ESP_LOGE(OTA_TAG, "%s", why);
+    request.store(ABORT, std::memory_order_release);
+    xTaskNotifyGive(writerTask);
+    errMsg = why;
+    finish(FAILED);
+}
+
+void OtaUpdate::finish(State state) {
+    endMs = millis();
+    this->state = state;
+    endPending = true;
+    if (state == DONE) {
+        ESP_LOGI(OTA_TAG, "%u bytes in %u ms, %s boots next", done, endMs - startMs, partition->label);
+    }
+}
+
+int OtaUpdate::progress() {
+    if (!active() || size == 0) {
+        return -1;
+    }
+
+    int step = (uint64_t)done * 10 / size * 10;
+    if (step <= progressReported || step >= 100) {
+        return -1;
+    }
+    progressReported = step;
+
+    return step;
+}
+
+bool OtaUpdate::ended() {
+    bool pending = endPending;
+    endPending = false;
+
+    return pending;
+}
+
+uint32_t OtaUpdate::bytesPerSec() {
+    uint32_t ms = (active() ? millis() : endMs) - startMs;
+
+    return ms > 0 ? (uint64_t)done * 1000 / ms : 0;
+}
+
+void OtaUpdate::report(Print &out) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+
+    out.printf("STATE=%s\r\n", stateNames[state]);
+    out.printf("RUNNING=%s\r\n", running ? running->label : "NONE");
+    out.printf("RUNNING_STATE=%s\r\n", imageStateName(running));
+    out.printf("BOOT=%s\r\n", boot ? boot->label : "NONE");
+    out.printf("SIZE=%u\r\n", size);
+    out.printf("BYTES=%u\r\n", done);
+    out.printf("MS=%u\r\n", (uint32_t)((active() ? millis() : endMs) - startMs));
+    out.printf("BPS=%u\r\n", bytesPerSec());
+    if (state == FAILED) {
+        out.printf("ERROR=%s\r\n", errMsg);
+    }
+}
+
+void OtaUpdate::confirm() {
+#ifdef CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    esp_ota_img_states_t imageState;
+
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &imageState) == ESP_OK &&
+        imageState == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGI(OTA_TAG, "New firmware is up, keeping it");
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+#endif
+}
+
+void OtaUpdate::writer() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        writeBlocks();
+    }
+}
+
+void OtaUpdate::writeBlocks() {
+    while (true) {
+        int req = request.load(std::memory_order_acquire);
+        Block &block = blocks[writeBlock];
+
+        if (req == ABORT) {
+            if (handle != 0) {
+                esp_ota_abort(handle);
+                handle = 0;
+            }
+            blocks[0].full.store(false, std::memory_order_release);
+            blocks[1].full.store(false, std::memory_order_release);
+            writeBlock = 0;
+            request.store(NONE, std::memory_order_release);
+            return;
+        } else if (block.full.load(std::memory_order_acquire)) {
+            // Once it has failed the rest is only thrown away
+            if (outcome.load(std::memory_order_relaxed) == PENDING) {
+                esp_err_t err = ESP_OK;
+                const esp_partition_t *boot = esp_ota_get_boot_partition();
+                if (handle == 0 && boot != nullptr && boot->address == partition->address) {
+                    // An earlier update nothing has restarted into yet, about to be overwritten
+                    err = esp_ota_set_boot_partition(esp_ota_get_running_partition());
+                }
+                if (handle == 0 && err == ESP_OK) {
+                    // Erases each sector as it gets to it, not the whole partition up front
+                    err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+                }
+                if (err == ESP_OK) {
+                    err = esp_ota_write(handle, block.data, block.len);
+                }
+                if (err != ESP_OK) {
+                    ESP_LOGE(OTA_TAG, "Writing %s: %s", partition->label, esp_err_to_name(err));
+                    if (handle != 0) {
+                        esp_ota_abort(handle);
+                        handle = 0;
+                    }
+                    writeErr = err;
+                    outcome.store(WRITE_FAILED, std::memory_order_release);
+                }
+            }
+            block.full.store(false, std::memory_order_release);
+            writeBlock ^= 1;
+        } else if (req == FINISH) {
+            esp_err_t err = ESP_OK;
+            bool finishing = outcome.load(std::memory_order_relaxed) == PENDING;
+            if (finishing) {
+                // Checks the image, its checksum and hash, before it can boot
+                err = esp_ota_end(handle);
+                handle = 0;
+                if (err == ESP_OK) {
+                    err = esp_ota_set_boot_partition(partition);
+                }
+                if (err != ESP_OK) {
+                    ESP_LOGE(OTA_TAG, "Finishing %s: %s", partition->label, esp_err_to_name(err));
+                    writeErr = err;
+                }
+            }
+            writeBlock = 0;
+            request.store(NONE, std::memory_order_release);
+            if (finishing) {
+                outcome.store(err == ESP_OK ? SUCCEEDED : WRITE_FAILED, std::memory_order_release);
+            }
+            return;
+        } else {
+            return;
+        }
+    }
+}
+
+void OtaUpdate::writerTaskFn(void *self) {
+    ((OtaUpdate*)self)->writer();
+}
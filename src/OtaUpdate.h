@@ -0,0 +1,139 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_ota_ops.h"
+#include <atomic>
+
+#ifndef OTA_BLOCK
+#define OTA_BLOCK 4096              // A flash sector. Two of them take turns.
+#endif
+#ifndef OTA_TIMEOUT_MS
+#define OTA_TIMEOUT_MS 30000        // Gives up after this long without data
+#endif
+#ifndef OTA_WRITER_PRIORITY
+#define OTA_WRITER_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+
+/*
+ * Firmware updates from the client, for AT+OTA. The image is framed as for
+ * AT+RECVFILE (see FileTransfer.h), so a bridge that has it in LittleFS can
+ * send it with AT+SENDFILE.
+ *
+ * Receiving and flashing overlap. The radio stage fills one OTA_BLOCK buffer
+ * while a writer task passes the other to esp_ota_write(), which erases each
+ * sector of the inactive app partition as it gets to it. While both are full
+ * the radio stage reads nothing more, so the client is held back as by any
+ * slow receiver. Once the CRC matches, esp_ota_end() checks the image itself
+ * and it is made the one to boot. Anything short of that leaves the running
+ * firmware as it is.
+ *
+ * A new firmware boots on probation: confirm() keeps it, and the bootloader
+ * goes back to the old one if it resets before that.
+ */
+class OtaUpdate {
+public:
+    typedef enum {
+        IDLE = 0,
+        RECEIVING,
+        FINISHING,      // All there, the writer is checking the image
+        DONE,           // Boots next time
+        FAILED
+    } State;
+
+    OtaUpdate();
+
+    // False, with getErrMessage(), if it can't start
+    bool start();
+    void fail(const char *why);
+
+    State getState() { return state; }
+    bool receiving() { return state == RECEIVING; }
+    bool active() { return state == RECEIVING || state == FINISHING; }
+
+    // How much receive() can take now, none while both blocks are full
+    int room();
+    void receive(const uint8_t *in, int len);
+    // Picks up what the writer has done, and times out
+    void poll();
+
+    // The next 10% step since the last call, or -1
+    int progress();
+    // True once when it has finished or failed
+    bool ended();
+
+    uint32_t bytes() { return done; }
+    uint32_t bytesPerSec();
+    const char *getErrMessage() { return errMsg; }
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+    // Call once the firmware is known to work. Ends its probation if it is
+    // new from an update.
+    static void confirm();
+
+private:
+    static const int HEADER_LEN = 8;
+    static const int CRC_LEN = 4;
+
+    typedef enum {
+        NONE = 0,
+        FINISH,         // Write what's left, then check the image and boot it
+        ABORT
+    } Request;
+
+    typedef enum {
+        PENDING = 0,
+        SUCCEEDED,
+        WRITE_FAILED
+    } Outcome;
+
+    typedef struct {
+        uint8_t data[OTA_BLOCK];
+        int len;
+        std::atomic<bool> full;     // The writer's until it clears this
+    } Block;
+
+    State state = IDLE;
+    const esp_partition_t *partition = nullptr;
+    uint32_t size = 0;
+    uint32_t done = 0;
+    uint32_t crc = 0;
+    uint32_t startMs = 0;
+    uint32_t endMs = 0;
+    uint32_t lastRxMs = 0;
+    int progressReported = 0;
+    bool endPending = false;
+    const char *errMsg = "";
+
+    uint8_t header[HEADER_LEN];
+    int headerLen = 0;
+    uint8_t trailer[CRC_LEN];
+    int trailerLen = 0;
+
+    // The radio stage fills blocks[fillBlock], the writer empties blocks[writeBlock]
+    Block blocks[2];
+    int fillBlock = 0;
+    int fillLen = 0;
+    int writeBlock = 0;
+    std::atomic<int> request{NONE};
+    std::atomic<int> outcome{PENDING};
+    esp_err_t writeErr = ESP_OK;        // Set before outcome
+    esp_ota_handle_t handle = 0;        // Only the writer's
+    TaskHandle_t writerTask = nullptr;
+
+    void handOver();
+    void received();
+    void finish(State state);
+
+    void writer();
+    void writeBlocks();
+    static void writerTaskFn(void *self);
+
+    static const char *stateNames[];
+};
+
+#endif
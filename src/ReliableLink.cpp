@@ -0,0 +1,372 @@
+#include <ReliableLink.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <esp_system.h>
+#include "esp_log.h"
+
+#define RELIABLE_TAG "RELIABLE"
+
+#define SYNC 0xa5
+#define HELLO_LEN 6
+#define ACK_LEN 8
+
+static_assert(RELIABLE_WINDOW <= 16 && (RELIABLE_WINDOW & (RELIABLE_WINDOW - 1)) == 0,
+    "RELIABLE_WINDOW has to be a power of 2, up to 16");
+
+#define SLOT(seq) ((seq) & (RELIABLE_WINDOW - 1))
+
+// How far a is after b, across the wrap
+static inline int16_t seqDiff(uint16_t a, uint16_t b) {
+    return (int16_t)(uint16_t)(a - b);
+}
+
+static inline void put16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+ReliableLink::ReliableLink() {
+    reset();
+}
+
+void ReliableLink::setEnabled(bool on) {
+    this->on = on;
+    reset();
+    helloDue = on && linkIsUp;
+}
+
+void ReliableLink::reset() {
+    // A new session, so the peer doesn't take what follows for more of the old one
+    session = esp_random();
+    txBase = txNext = 0;
+    txKind = NOTHING;
+    helloDue = false;
+    rxKnown = false;
+    rxNext = 0;
+    ackDue = ackNow = false;
+    unackedPackets = 0;
+    rxPacketLen = 0;
+    for (int i = 0; i < RELIABLE_WINDOW; i++) {
+        txSlots[i].held = false;
+        rxSlots[i].held = false;
+    }
+}
+
+void ReliableLink::linkUp() {
+    linkIsUp = true;
+    rxPacketLen = 0;
+    if (!on) {
+        return;
+    }
+
+    // Whatever the peer hasn't got is sent again, after HELLO
+    helloDue = true;
+    for (uint16_t seq = txBase; seq != txNext; seq++) {
+        Slot &slot = txSlots[SLOT(seq)];
+        if (!slot.held) {
+            slot.due = true;
+            slot.fastResent = false;
+        }
+    }
+    if (rxKnown) {
+        scheduleAck(true);
+    }
+}
+
+void ReliableLink::linkDown() {
+    linkIsUp = false;
+    rxPacketLen = 0;
+}
+
+bool ReliableLink::queue(const uint8_t *data, int len) {
+    if (!on || seqDiff(txNext, txBase) >= txLimit) {
+        return false;
+    }
+    if (len > RELIABLE_MAX_PAYLOAD) {
+        ESP_LOGE(RELIABLE_TAG, "%d bytes is too much for one packet", len);
+        return false;
+    }
+
+    Slot &slot = txSlots[SLOT(txNext)];
+    memcpy(slot.data, data, len);
+    slot.len = len;
+    slot.held = false;
+    slot.due = true;
+    slot.fastResent = false;
+    slot.sends = 0;
+    txNext++;
+
+    return true;
+}
+
+int ReliableLink::next(const uint8_t **packet) {
+    uint32_t nowMs = millis();
+
+    *packet = txPacket;
+    txKind = NOTHING;
+    if (!on || !linkIsUp) {
+        return 0;
+    }
+
+    txPacket[0] = SYNC;
+    if (helloDue) {
+        txKind = HELLO;
+        txPacket[1] = 'H';
+        put16(&txPacket[2], session);
+        put16(&txPacket[4], txBase);
+        return HELLO_LEN;
+    }
+
+    if (ackDue && (ackNow || unackedPackets >= RELIABLE_WINDOW / 2 || nowMs - ackDueSinceMs >= RELIABLE_ACK_DELAY_MS)) {
+        txKind = ACK;
+        return buildAck();
+    }
+
+    for (uint16_t seq = txBase; seq != txNext; seq++) {
+        Slot &slot = txSlots[SLOT(seq)];
+        if (slot.held || !(slot.due || nowMs - slot.sentMs >= RELIABLE_RTO_MS)) {
+            continue;
+        }
+        txKind = DATA;
+        txSeq = seq;
+        txPacket[1] = 'D';
+        put16(&txPacket[2], seq);
+        txPacket[4] = slot.len;
+        memcpy(&txPacket[RELIABLE_HEADER], slot.data, slot.len);
+        return RELIABLE_HEADER + slot.len;
+    }
+
+    return 0;
+}
+
+int ReliableLink::buildAck() {
+    uint16_t sack = 0;
+
+    for (int i = 0; i < RELIABLE_WINDOW; i++) {
+        if (rxSlots[SLOT(rxNext + i)].held) {
+            sack |= 1 << i;
+        }
+    }
+    txPacket[1] = 'A';
+    put16(&txPacket[2], rxSession);
+    put16(&txPacket[4], rxNext);
+    put16(&txPacket[6], sack);
+
+    return ACK_LEN;
+}
+
+void ReliableLink::sent() {
+    switch (txKind) {
+    case HELLO:
+        helloDue = false;
+        break;
+    case ACK:
+        ackDue = ackNow = false;
+        unackedPackets = 0;
+        break;
+    case DATA: {
+        Slot &slot = txSlots[SLOT(txSeq)];
+        if (slot.sends == 0) {
+            BridgeStats::add(BridgeStats::RELIABLE_PACKETS);
+        } else {
+            // b is 1 for a gap or a reconnect, 0 for a timeout
+            BridgeStats::add(BridgeStats::RELIABLE_RETRANSMITS);
+            Trace::record(Trace::RELIABLE_RETRANSMIT, txSeq, slot.due);
+        }
+        slot.sends = slot.sends < 255 ? slot.sends + 1 : 255;
+        slot.due = false;
+        slot.sentMs = millis();
+        break;
+    }
+    default:
+        break;
+    }
+    txKind = NOTHING;
+}
+
+void ReliableLink::scheduleAck(bool now) {
+    if (!ackDue) {
+        ackDue = true;
+        ackDueSinceMs = millis();
+    }
+    ackNow |= now;
+}
+
+void ReliableLink::receive(const uint8_t *in, int len) {
+    for (int i = 0; i < len; i++) {
+        uint8_t c = in[i];
+        if (rxPacketLen == 0 && c != SYNC) {
+            continue;   // Not in step, or the peer isn't running this
+        }
+        rxPacket[rxPacketLen++] = c;
+
+        int need = packetLength();
+        if (need == 0) {
+            rxPacketLen = 0;
+        } else if (rxPacketLen == need) {
+            packetReceived();
+            rxPacketLen = 0;
+        }
+    }
+}
+
+int ReliableLink::packetLength() {
+    if (rxPacketLen < 2) {
+        return RELIABLE_HEADER;
+    }
+
+    switch (rxPacket[1]) {
+    case 'H':
+        return HELLO_LEN;
+    case 'A':
+        return ACK_LEN;
+    case 'D':
+        if (rxPacketLen < RELIABLE_HEADER) {
+            return RELIABLE_HEADER;
+        }
+        return rxPacket[4] <= RELIABLE_MAX_PAYLOAD ? RELIABLE_HEADER + rxPacket[4] : 0;
+    default:
+        return 0;
+    }
+}
+
+void ReliableLink::packetReceived() {
+    switch (rxPacket[1]) {
+    case 'H':
+        helloReceived(get16(&rxPacket[2]), get16(&rxPacket[4]));
+        break;
+    case 'A':
+        ackReceived(get16(&rxPacket[2]), get16(&rxPacket[4]), get16(&rxPacket[6]));
+        break;
+    default:
+        dataReceived(get16(&rxPacket[2]), &rxPacket[RELIABLE_HEADER], rxPacket[4]);
+        break;
+    }
+}
+
+void ReliableLink::helloReceived(uint16_t peerSession, uint16_t base) {
+    if (!rxKnown || peerSession != rxSession) {
+        if (rxKnown) {
+            // The peer started again and lost what it held of ours
+            ESP_LOGI(RELIABLE_TAG, "Peer session %04x, was %04x", peerSession, rxSession);
+            for (uint16_t seq = txBase; seq != txNext; seq++) {
+                txSlots[SLOT(seq)].held = false;
+                txSlots[SLOT(seq)].due = true;
+            }
+        }
+        Trace::record(Trace::RELIABLE_SESSION, peerSession, base);
+        rxKnown = true;
+        rxSession = peerSession;
+        rxNext = base;
+        for (int i = 0; i < RELIABLE_WINDOW; i++) {
+            rxSlots[i].held = false;
+        }
+    }
+    scheduleAck(true);
+}
+
+void ReliableLink::ackReceived(uint16_t ackSession, uint16_t next, uint16_t sack) {
+    if (ackSession != session || seqDiff(next, txBase) < 0 || seqDiff(next, txNext) > 0) {
+        return;     // For an earlier session, or older than one already had
+    }
+
+    txBase = next;
+    int highest = -1;
+    for (int i = 0; i < RELIABLE_WINDOW && seqDiff(next + i, txNext) < 0; i++) {
+        if (sack & (1 << i)) {
+            txSlots[SLOT(next + i)].held = true;
+            highest = i;
+        }
+    }
+
+    // The link keeps order, so anything sent before one that arrived is lost
+    for (int i = 0; i < highest; i++) {
+        Slot &slot = txSlots[SLOT(next + i)];
+        if (!slot.held && slot.sends > 0 && !slot.due && !slot.fastResent) {
+            slot.due = true;
+            slot.fastResent = true;
+        }
+    }
+}
+
+void ReliableLink::dataReceived(uint16_t seq, const uint8_t *data, int len) {
+    if (!rxKnown) {
+        return;     // Nothing to go by until HELLO
+    }
+
+    int16_t ahead = seqDiff(seq, rxNext);
+    Slot &slot = rxSlots[SLOT(seq)];
+    if (ahead < 0 || (ahead < RELIABLE_WINDOW && slot.held)) {
+        // Our acknowledgement got lost
+        BridgeStats::add(BridgeStats::RELIABLE_DUPLICATES);
+        scheduleAck(true);
+        return;
+    } else if (ahead >= RELIABLE_WINDOW) {
+        scheduleAck(true);
+        return;
+    }
+
+    memcpy(slot.data, data, len);
+    slot.len = len;
+    slot.readOffset = 0;
+    slot.held = true;
+    unackedPackets++;
+    if (ahead > 0 && !rxSlots[SLOT(rxNext)].held) {
+        BridgeStats::add(BridgeStats::RELIABLE_OUT_OF_ORDER);
+        scheduleAck(true);
+    } else {
+        scheduleAck(false);
+    }
+}
+
+int ReliableLink::read(uint8_t *out, int len) {
+    int n = 0;
+
+    while (n < len && rxKnown) {
+        Slot &slot = rxSlots[SLOT(rxNext)];
+        if (!slot.held) {
+            break;
+        }
+        int take = slot.len - slot.readOffset < len - n ? slot.len - slot.readOffset : len - n;
+        memcpy(&out[n], &slot.data[slot.readOffset], take);
+        slot.readOffset += take;
+        n += take;
+        if (slot.readOffset == slot.len) {
+            // Delivered, which is what moves the peer's window on
+            slot.held = false;
+            rxNext++;
+            scheduleAck(false);
+        }
+    }
+
+    return n;
+}
+
+void ReliableLink::setWindowLimit(int packets) {
+    // Whatever is already in flight stays there
+    txLimit = packets < 1 ? 1 : packets > RELIABLE_WINDOW ? RELIABLE_WINDOW : packets;
+}
+
+void ReliableLink::report(Print &out) {
+    int held = 0;
+
+    for (int i = 0; i < RELIABLE_WINDOW; i++) {
+        held += rxSlots[i].held ? 1 : 0;
+    }
+    out.printf("ENABLED=%d\r\n", on ? 1 : 0);
+    out.printf("SESSION=%04X\r\n", session);
+    out.printf("IN_FLIGHT=%d\r\n", seqDiff(txNext, txBase));
+    out.printf("WINDOW=%d\r\n", txLimit);
+    out.printf("TX_NEXT=%u\r\n", txNext);
+    if (rxKnown) {
+        out.printf("PEER_SESSION=%04X\r\n", rxSession);
+    } else {
+        out.printf("PEER_SESSION=NONE\r\n");
+    }
+    out.printf("RX_NEXT=%u\r\n", rxNext);
+    out.printf("RX_HELD=%d\r\n", held);
+}
@@ -0,0 +1,133 @@
+#ifndef RELIABLE_LINK_H
+#define RELIABLE_LINK_H
+
+#include <Arduino.h>
+#include <LinkCodec.h>
+
+// Whether AT+RELIABLE starts out on
+#ifndef RELIABLE_LINK
+#define RELIABLE_LINK 0
+#endif
+
+// Packets in flight each way, at most 16. Each costs two packet buffers.
+#ifndef RELIABLE_WINDOW
+#define RELIABLE_WINDOW 8
+#endif
+#ifndef RELIABLE_RTO_MS
+#define RELIABLE_RTO_MS 400         // Resend what hasn't been acknowledged by then
+#endif
+#ifndef RELIABLE_ACK_DELAY_MS
+#define RELIABLE_ACK_DELAY_MS 20    // Longest an acknowledgement waits for company
+#endif
+
+#define RELIABLE_HEADER 5
+#define RELIABLE_MAX_PAYLOAD (LINK_CODEC_MAX_BLOCK - RELIABLE_HEADER)
+
+/*
+ * Exactly once, in order delivery between two units of this firmware, across
+ * failed writes and reconnects. Everything each side sends is a packet:
+ *
+ *   a5 'D' <seq: 2> <length: 1> <payload>      data
+ *   a5 'A' <session: 2> <next: 2> <sack: 2>    acknowledgement
+ *   a5 'H' <session: 2> <base: 2>              hello, each time the link comes up
+ *
+ * (numbers little-endian). Up to RELIABLE_WINDOW data packets are in flight.
+ * The receiver acknowledges with the next sequence number it has yet to
+ * deliver to its host and a bitmap of the packets from there on that it
+ * holds, so the window only moves on as fast as the far host takes data,
+ * and the sender only resends what is missing: at once for a gap below a
+ * packet that did arrive, otherwise after RELIABLE_RTO_MS.
+ *
+ * Unacknowledged packets stay through a reconnect and are sent again after
+ * HELLO. The session in HELLO is picked at power on, so a receiver can tell a
+ * restarted sender (and start again from its base) from a returning one.
+ *
+ * Both ends have to have it on, and it sits above LinkCodec. Only the radio
+ * stage uses it.
+ */
+class ReliableLink {
+public:
+    ReliableLink();
+
+    void setEnabled(bool on);       // Forgets everything either way
+    bool enabled() { return on; }
+
+    void linkUp();
+    void linkDown();
+
+    // Sending side. False if the window is full.
+    bool queue(const uint8_t *data, int len);
+    // Keeps fewer than RELIABLE_WINDOW packets in flight, for AT+TUNE
+    void setWindowLimit(int packets);
+
+    // The next packet to write, 0 if nothing is due yet. Once the link has
+    // taken it, sent().
+    int next(const uint8_t **packet);
+    void sent();
+
+    // Receiving side. Takes everything; what doesn't fit the window is
+    // dropped and sent again.
+    void receive(const uint8_t *in, int len);
+    int read(uint8_t *out, int len);
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    typedef enum {
+        NOTHING = 0,
+        HELLO,
+        ACK,
+        DATA
+    } PacketKind;
+
+    typedef struct {
+        uint8_t data[RELIABLE_MAX_PAYLOAD];
+        uint8_t len;
+        bool held;              // Sending: acknowledged as received. Receiving: received.
+        bool due;               // Sending: to be sent (again) as soon as possible
+        bool fastResent;        // Sending: already resent for a gap
+        uint8_t sends;
+        uint32_t sentMs;
+        uint8_t readOffset;     // Receiving: taken by read() so far
+    } Slot;
+
+    bool on = RELIABLE_LINK;
+    bool linkIsUp = false;
+    uint16_t session;
+
+    uint8_t txPacket[RELIABLE_HEADER + RELIABLE_MAX_PAYLOAD];
+    PacketKind txKind = NOTHING;
+    uint16_t txSeq = 0;         // Of the DATA packet in txPacket
+
+    // Sending: txBase up to txNext are in flight
+    Slot txSlots[RELIABLE_WINDOW];
+    uint16_t txBase = 0;
+    uint16_t txNext = 0;
+    int txLimit = RELIABLE_WINDOW;
+    bool helloDue = false;
+
+    // Receiving: rxNext is the next to deliver
+    Slot rxSlots[RELIABLE_WINDOW];
+    bool rxKnown = false;       // Had a HELLO from the peer
+    uint16_t rxSession = 0;
+    uint16_t rxNext = 0;
+    bool ackDue = false;
+    bool ackNow = false;
+    uint32_t ackDueSinceMs = 0;
+    int unackedPackets = 0;
+
+    uint8_t rxPacket[RELIABLE_HEADER + RELIABLE_MAX_PAYLOAD];
+    int rxPacketLen = 0;
+
+    void reset();
+    void scheduleAck(bool now);
+    int packetLength();
+    void packetReceived();
+    void dataReceived(uint16_t seq, const uint8_t *data, int len);
+    void ackReceived(uint16_t session, uint16_t next, uint16_t sack);
+    void helloReceived(uint16_t session, uint16_t base);
+    int buildAck();
+};
+
+#endif
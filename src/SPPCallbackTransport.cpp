@@ -0,0 +1,245 @@
+#include <SPPCallbackTransport.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <esp_timer.h>
+#include "esp_log.h"
+#include <string.h>
+
+#define BT_SPP_TAG "BT_SPP"
+
+SPPCallbackTransport::SPPCallbackTransport(QueueHandle_t recvQueue, esp_err_t &err, const char *&errMsg) :
+    SPPTransport(recvQueue, err, errMsg)
+{
+    if (RX_OVERFLOW_SIZE > 0) {
+        overflow = new SPSCRing(RX_OVERFLOW_SIZE);
+    }
+}
+
+void SPPCallbackTransport::opened(uint32_t handle, int fd) {
+    peerHandle = handle;
+}
+
+void SPPCallbackTransport::closed() {
+    peerHandle = 0;
+    bufLeft = 0;
+    writeFinished();        // A write in flight is lost with the link
+    loopbackWrite = false;
+    loopbackCongested = false;
+    loopbackHead = loopbackTail = loopbackCount = 0;
+}
+
+void SPPCallbackTransport::writeFinished() {
+    writeDone = true;
+    TaskHandle_t waiting = writer;
+    if (waiting != nullptr) {
+        xTaskNotifyGive(waiting);
+    }
+}
+
+bool SPPCallbackTransport::waitWritable(TickType_t wait) {
+    writer = xTaskGetCurrentTaskHandle();
+    if (!writeDone) {
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+    writer = nullptr;
+
+    return writeDone;
+}
+
+bool SPPCallbackTransport::write(const uint8_t *pBuf, int len) {
+    if (len > 0) {
+        int64_t startUs = esp_timer_get_time();
+        if (rejectWhileLoopback(len)) {
+            return true;
+        } else if (writeDone) {
+            if (len < MAX_STRING_LENGTH) {
+                Trace::record(Trace::SPP_WRITE, len, peerHandle);
+                memcpy(writeBuf, pBuf, len);
+                bufPtr = writeBuf;
+                bufLeft = len;
+                if ((err = esp_spp_write(peerHandle, len, (uint8_t*)pBuf)) != ESP_OK) {
+                    errMsg = esp_err_to_name(err);
+                } else {
+                    writeDone = false;
+                    BridgeStats::add(BridgeStats::TX_PACKETS);
+                    BridgeStats::add(BridgeStats::TX_BYTES, len);
+                }
+            } else {
+                err = -1;
+                errMsg = "data is too long";
+                BridgeStats::add(BridgeStats::TX_REJECTS);
+                Trace::record(Trace::SPP_WRITE_REJECT, len);
+            }
+            cpuTime(startUs);
+
+            return true;
+        } else {
+            err = -1;
+            errMsg = "Still writing previous data";
+            BridgeStats::add(BridgeStats::TX_REJECTS);
+            Trace::record(Trace::SPP_WRITE_REJECT, len);
+
+            return false;
+        }
+    } else {
+        return true;
+    }
+}
+
+bool SPPCallbackTransport::setLoopback(bool on) {
+    if (on == loopback()) {
+        return true;
+    }
+
+    if (on) {
+        if (!writeDone) {
+            err = -1;
+            errMsg = "Still writing previous data";
+            return false;
+        }
+        loopbackHead = loopbackTail = loopbackCount = 0;
+        loopbackCongested = false;
+    }
+
+    // A loopback write still in flight when it goes off finishes from the
+    // write event, which then leaves the rest of the ring
+    loopbackOn.store(on, std::memory_order_release);
+
+    return true;
+}
+
+void SPPCallbackTransport::loopbackReceive(const uint8_t *data, int len) {
+    int n = len < (int)(LOOPBACK_BUF_SIZE - loopbackCount) ? len : LOOPBACK_BUF_SIZE - loopbackCount;
+    int first = n < (int)(LOOPBACK_BUF_SIZE - loopbackHead) ? n : LOOPBACK_BUF_SIZE - loopbackHead;
+
+    memcpy(&loopbackBuf[loopbackHead], data, first);
+    memcpy(loopbackBuf, &data[first], n - first);
+    loopbackHead = (loopbackHead + n) % LOOPBACK_BUF_SIZE;
+    loopbackCount += n;
+
+    if (n < len) {
+        BridgeStats::add(BridgeStats::LOOPBACK_DROPS, len - n);
+        Trace::record(Trace::SPP_LOOPBACK_DROP, len - n);
+    }
+
+    if (writeDone && !loopbackCongested) {
+        loopbackSend();
+    }
+}
+
+void SPPCallbackTransport::loopbackSend() {
+    // The largest contiguous run from the tail, so it goes straight from the ring
+    size_t len = loopbackCount < LOOPBACK_BUF_SIZE - loopbackTail ? loopbackCount : LOOPBACK_BUF_SIZE - loopbackTail;
+    if (len > ESP_SPP_MAX_MTU) {
+        len = ESP_SPP_MAX_MTU;
+    }
+
+    if (len == 0 || !loopback()) {
+        loopbackWrite = false;
+        writeFinished();
+        return;
+    }
+
+    Trace::record(Trace::SPP_LOOPBACK_WRITE, len, loopbackCount);
+    writeDone = false;
+    loopbackWrite = true;
+    if ((err = esp_spp_write(peerHandle, len, &loopbackBuf[loopbackTail])) != ESP_OK) {
+        errMsg = esp_err_to_name(err);
+        BridgeStats::add(BridgeStats::TX_ERRORS);
+        loopbackWrite = false;
+        writeFinished();
+    }
+}
+
+void SPPCallbackTransport::loopbackWritten(int len, bool cong) {
+    loopbackTail = (loopbackTail + len) % LOOPBACK_BUF_SIZE;
+    loopbackCount -= len;
+    BridgeStats::add(BridgeStats::LOOPBACK_BYTES, len);
+
+    if (cong) {
+        // Carry on from ESP_SPP_CONG_EVT
+        loopbackCongested = true;
+        BridgeStats::add(BridgeStats::CONGESTION_EVENTS);
+        loopbackWrite = false;
+        writeFinished();
+    } else {
+        loopbackSend();
+    }
+}
+
+void SPPCallbackTransport::event(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
+    int64_t startUs = esp_timer_get_time();
+
+    switch (event) {
+    case ESP_SPP_DATA_IND_EVT:
+        if (param->data_ind.status == ESP_SPP_SUCCESS) {
+            if (loopbackOn.load(std::memory_order_acquire)) {
+                BridgeStats::add(BridgeStats::RX_PACKETS);
+                BridgeStats::add(BridgeStats::RX_BYTES, param->data_ind.len);
+                loopbackReceive(param->data_ind.data, param->data_ind.len);
+            } else {
+                received(param->data_ind.data, param->data_ind.len, startUs);
+            }
+        }
+        break;
+    case ESP_SPP_WRITE_EVT:
+        if (param->write.status == ESP_SPP_SUCCESS) {
+            Trace::record(Trace::SPP_WRITE_EVT, param->write.len, param->write.cong);
+            if (loopbackWrite) {
+                loopbackWritten(param->write.len, param->write.cong);
+            } else if (param->write.len >= bufLeft) {
+                bufLeft = 0;
+                writeFinished();
+            } else {
+                /*
+                 * Means the previous data packet only sent partially due to lower layer congestion, resend the
+                 * remainning data.
+                 */
+                bufPtr += param->write.len;
+                bufLeft -= param->write.len;
+                if (param->write.cong) {
+                    BridgeStats::add(BridgeStats::CONGESTION_EVENTS);
+                } else {
+                    /* The lower layer is not congested, you can send the next data packet now. */
+                    Trace::record(Trace::SPP_WRITE_REMAINDER, bufLeft);
+                    esp_spp_write(peerHandle, bufLeft, bufPtr);
+                }
+            }
+        } else {
+            /* Means the prevous data packet is not sent at all. It is dropped, which AT+RELIABLE makes up for. */
+            err = param->write.status;
+            errMsg = "Write failed";
+            BridgeStats::add(BridgeStats::TX_ERRORS);
+            Trace::record(Trace::SPP_WRITE_FAIL, param->write.status);
+            if (loopbackWrite) {
+                // Leave the data in the ring for the next attempt
+                loopbackWrite = false;
+            }
+            bufLeft = 0;
+            writeFinished();
+            ESP_LOGE(BT_SPP_TAG, "ESP_SPP_WRITE_EVT status:%d", param->write.status);
+        }
+        break;
+    case ESP_SPP_CONG_EVT:
+        Trace::record(Trace::SPP_CONG, param->cong.cong);
+        if (param->cong.cong) {
+            BridgeStats::add(BridgeStats::CONGESTION_EVENTS);
+        } else if (loopback()) {
+            loopbackCongested = false;
+            if (writeDone) {
+                loopbackSend();
+            }
+        } else {
+            /* Send the previous (partial) data packet or the next data packet. */
+            if (bufLeft == 0) {
+                writeFinished();
+                break;
+            }
+            esp_spp_write(peerHandle, bufLeft, bufPtr);
+        }
+        break;
+    default:
+        return;
+    }
+    cpuTime(startUs);
+}
@@ -0,0 +1,57 @@
+#ifndef SPP_CALLBACK_TRANSPORT_H
+#define SPP_CALLBACK_TRANSPORT_H
+
+#include <SPPTransport.h>
+#include "freertos/task.h"
+
+// Received data that doesn't fit in the receive queue, see SPPTransport
+#ifndef RX_OVERFLOW_SIZE
+#define RX_OVERFLOW_SIZE 4096
+#endif
+
+/*
+ * ESP_SPP_MODE_CB. Received data is copied out of ESP_SPP_DATA_IND_EVT into
+ * the receive queue. One write is in flight at a time; when the stack only
+ * takes part of it, the rest goes from the write or congestion event.
+ */
+class SPPCallbackTransport : public SPPTransport {
+public:
+    SPPCallbackTransport(QueueHandle_t recvQueue, esp_err_t &err, const char *&errMsg);
+
+    esp_spp_mode_t mode() override { return ESP_SPP_MODE_CB; }
+    const char *name() override { return "CB"; }
+
+    void opened(uint32_t handle, int fd) override;
+    void closed() override;
+    void event(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) override;
+
+    bool write(const uint8_t *pBuf, int len) override;
+    bool waitWritable(TickType_t wait) override;
+    bool setLoopback(bool on) override;
+
+private:
+    uint32_t peerHandle = 0;
+    uint8_t writeBuf[MAX_STRING_LENGTH];
+    uint8_t *bufPtr = writeBuf;
+    int bufLeft = 0;                // Of the write in flight, not yet taken by the stack
+    volatile bool writeDone = true;
+    TaskHandle_t volatile writer = nullptr;     // Waiting in waitWritable()
+
+    // Loopback ring. Received data is written back from where it landed, so
+    // reflecting costs one copy out of the stack's buffer and no more. Only
+    // the Bluetooth task touches it while loopback is on.
+    bool loopbackWrite = false;     // The write in flight came from the ring
+    bool loopbackCongested = false;
+    uint8_t loopbackBuf[LOOPBACK_BUF_SIZE];     // With the transport, so AT+LOOPBACK can't run out of heap
+    size_t loopbackHead = 0;        // Where the next received byte goes
+    size_t loopbackTail = 0;        // Oldest byte not yet accepted by esp_spp_write
+    size_t loopbackCount = 0;
+
+    void writeFinished();
+
+    void loopbackReceive(const uint8_t *data, int len);
+    void loopbackSend();
+    void loopbackWritten(int len, bool cong);
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include <SPPTransport.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <esp_timer.h>
+
+SPPTransport::SPPTransport(QueueHandle_t _recvQueue, esp_err_t &_err, const char *&_errMsg) :
+    recvQueue(_recvQueue),
+    err(_err),
+    errMsg(_errMsg)
+{
+}
+
+void SPPTransport::received(const uint8_t *data, int len, int64_t arrivedUs) {
+    int queued = 0;
+    int pooled = 0;
+    int dropped = 0;
+
+    BridgeStats::add(BridgeStats::RX_PACKETS);
+    BridgeStats::add(BridgeStats::RX_BYTES, len);
+    // Not into the queue while there is older data in the pool
+    if (overflow == nullptr || overflow->size() == 0) {
+        while (queued < len && xQueueSend(recvQueue, &data[queued], 0) == pdTRUE) {
+            queued++;
+        }
+    }
+    if (queued < len) {
+        pooled = overflow ? overflow->write(&data[queued], len - queued) : 0;
+        if (pooled > 0) {
+            BridgeStats::add(BridgeStats::RX_OVERFLOW_BYTES, pooled);
+            BridgeStats::max(BridgeStats::RX_OVERFLOW_HIGH_WATER, overflow->size());
+        }
+        dropped = len - queued - pooled;
+    }
+    if (queued + pooled > 0) {
+        receivedBytes += queued + pooled;
+        uint32_t head = arrivalHead.load(std::memory_order_relaxed);
+        if (head - arrivalTail.load(std::memory_order_acquire) < RX_ARRIVALS) {
+            arrivals[head % RX_ARRIVALS].end.store(receivedBytes, std::memory_order_relaxed);
+            arrivals[head % RX_ARRIVALS].us = (uint32_t)arrivedUs;
+            arrivalHead.store(head + 1, std::memory_order_release);
+        } else {
+            // All taken, so the newest one takes these in too
+            arrivals[(head - 1) % RX_ARRIVALS].end.store(receivedBytes, std::memory_order_release);
+        }
+    }
+    UBaseType_t waiting = uxQueueMessagesWaiting(recvQueue);
+    BridgeStats::max(BridgeStats::RX_QUEUE_HIGH_WATER, waiting);
+    Trace::record(Trace::SPP_DATA_IND, len, waiting);
+    if (dropped) {
+        // Receive buffer and pool are full
+        BridgeStats::add(BridgeStats::RX_DROPS, dropped);
+        Trace::record(Trace::SPP_RX_DROP, dropped);
+    }
+    checkWatermarks();
+}
+
+int SPPTransport::readOverflow(uint8_t *buf, int len) {
+    return overflow ? overflow->read(buf, len) : 0;
+}
+
+int SPPTransport::arrival(uint32_t readBytes, uint32_t &arrivedUs) {
+    uint32_t tail = arrivalTail.load(std::memory_order_relaxed);
+
+    while (tail != arrivalHead.load(std::memory_order_acquire)) {
+        int32_t left = arrivals[tail % RX_ARRIVALS].end.load(std::memory_order_acquire) - readBytes;
+        if (left > 0) {
+            arrivedUs = arrivals[tail % RX_ARRIVALS].us;
+            return left;
+        }
+        // All read
+        arrivalTail.store(++tail, std::memory_order_release);
+    }
+
+    return 0;
+}
+
+bool SPPTransport::setRxWatermarks(int high, int low) {
+    if (high < 1 || high > 100 || low < 0 || low >= high) {
+        return false;
+    }
+    highPercent = high;
+    lowPercent = low;
+    checkWatermarks();
+
+    return true;
+}
+
+size_t SPPTransport::rxBuffered() {
+    return uxQueueMessagesWaiting(recvQueue) + (overflow ? overflow->size() : 0);
+}
+
+size_t SPPTransport::rxCapacity() {
+    return uxQueueMessagesWaiting(recvQueue) + uxQueueSpacesAvailable(recvQueue) + (overflow ? overflow->capacity() : 0);
+}
+
+void SPPTransport::checkWatermarks() {
+    size_t buffered = rxBuffered() * 100;
+    size_t capacity = rxCapacity();
+    bool expected = false;
+
+    if (buffered >= capacity * highPercent) {
+        if (throttled.compare_exchange_strong(expected, true)) {
+            throttledSinceUs = esp_timer_get_time();
+            BridgeStats::add(BridgeStats::RX_THROTTLES);
+            Trace::record(Trace::SPP_RX_THROTTLE, 1, buffered / 100);
+        }
+    } else if (buffered < capacity * lowPercent) {
+        expected = true;
+        if (throttled.compare_exchange_strong(expected, false)) {
+            BridgeStats::add(BridgeStats::RX_THROTTLED_MS, (esp_timer_get_time() - throttledSinceUs) / 1000);
+            Trace::record(Trace::SPP_RX_THROTTLE, 0, buffered / 100);
+        }
+    }
+}
+
+bool SPPTransport::rejectWhileLoopback(int len) {
+    if (!loopback()) {
+        return false;
+    }
+
+    err = -1;
+    errMsg = "Loopback is on";
+    BridgeStats::add(BridgeStats::TX_REJECTS);
+    Trace::record(Trace::SPP_WRITE_REJECT, len);
+
+    return true;
+}
+
+void SPPTransport::cpuTime(int64_t startUs) {
+    BridgeStats::add(BridgeStats::SPP_CPU_US, esp_timer_get_time() - startUs);
+}
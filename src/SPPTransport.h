@@ -0,0 +1,123 @@
+#ifndef SPP_TRANSPORT_H
+#define SPP_TRANSPORT_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include <esp_spp_api.h>
+#include <string>
+#include <atomic>
+#include <SPSCRing.h>
+
+#define MAX_STRING_LENGTH 200       // Longest write, plus one
+#define SPP_MAX_BLOCK 1024          // Longest block received: ESP_SPP_MAX_MTU, or a VFS read
+// What the callback transport holds of received data while reflecting it, see
+// AT+LOOPBACK. What doesn't fit is dropped, and counted as LOOPBACK_DROPS.
+#ifndef LOOPBACK_BUF_SIZE
+#define LOOPBACK_BUF_SIZE 4096
+#endif
+
+// Receive flow control, in percent of what can be buffered. Also AT+RXFLOW.
+#ifndef RX_HIGH_WATER_PERCENT
+#define RX_HIGH_WATER_PERCENT 75
+#endif
+#ifndef RX_LOW_WATER_PERCENT
+#define RX_LOW_WATER_PERCENT 25
+#endif
+// Received blocks waiting to be read that keep their own arrival time. Past
+// this, newer ones share the time of the newest that got one.
+#ifndef RX_ARRIVALS
+#define RX_ARRIVALS 32
+#endif
+
+/*
+ * How SPP data gets in and out. BTSPP does discovery and connection handling
+ * the same way whatever the mode, and hands the data path to one of these:
+ *
+ *   SPPCallbackTransport  ESP_SPP_MODE_CB: data arrives in ESP_SPP_DATA_IND_EVT
+ *                         on the Bluetooth task, writes complete in events.
+ *   SPPVfsTransport       ESP_SPP_MODE_VFS: a reader task does blocking reads
+ *                         on the connection's file descriptor.
+ *
+ * Which one is built is chosen at compile time with SPP_TRANSPORT_VFS. Errors
+ * go into BTSPP's err and errMsg, so callers see no difference.
+ *
+ * Received data waits in the receive queue and, if the transport has one, an
+ * overflow pool behind it. Once what waits there reaches the high watermark
+ * the receive side is throttled until it falls below the low watermark.
+ * Throttled, the VFS transport stops reading, so the stack stops giving the
+ * peer RFCOMM credits. The callback transport can't hold the peer back, so it
+ * has the pool to ride it out.
+ *
+ * Each block also leaves a record of where it ends and when it arrived: in
+ * ESP_SPP_DATA_IND_EVT, or when the VFS reader task read it. The reader of
+ * the queue can so stop at block boundaries and tell when data came in.
+ */
+class SPPTransport {
+public:
+    SPPTransport(QueueHandle_t recvQueue, esp_err_t &err, const char *&errMsg);
+    virtual ~SPPTransport() { delete overflow; }
+
+    virtual esp_spp_mode_t mode() = 0;
+    virtual const char *name() = 0;
+
+    // From the SPP callback, on the Bluetooth task
+    virtual bool inited() { return true; }
+    virtual void opened(uint32_t handle, int fd) = 0;
+    virtual void closed() = 0;
+    virtual void event(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {}
+
+    // From the application. Same contract as BTSPP::write.
+    virtual bool write(const uint8_t *pBuf, int len) = 0;
+    virtual bool waitWritable(TickType_t wait) { return true; }
+
+    virtual bool setLoopback(bool on) = 0;
+    bool loopback() { return loopbackOn.load(std::memory_order_relaxed); }
+
+    // From the reader of the receive queue, once it is empty. What is in the
+    // pool always arrived after what is in the queue.
+    int readOverflow(uint8_t *buf, int len);
+    // From the same reader, with how many bytes it has read so far: what is
+    // left of the block that the next byte read is from, and when that block
+    // arrived, in esp_timer_get_time() microseconds. 0 if none is recorded.
+    int arrival(uint32_t readBytes, uint32_t &arrivedUs);
+
+    bool setRxWatermarks(int highPercent, int lowPercent);
+    int rxHighWater() { return highPercent; }
+    int rxLowWater() { return lowPercent; }
+    size_t rxBuffered();
+    size_t rxCapacity();
+    bool rxThrottled() { return throttled.load(std::memory_order_acquire); }
+
+    // Starts or ends throttling. From either side, whenever the amount buffered changes.
+    void checkWatermarks();
+
+protected:
+    QueueHandle_t recvQueue;
+    esp_err_t &err;
+    const char *&errMsg;
+    std::atomic<bool> loopbackOn{false};
+    SPSCRing *overflow = nullptr;       // Set up by transports that need one
+
+    // Into the receive queue, then the pool, counting what doesn't fit
+    void received(const uint8_t *data, int len, int64_t arrivedUs);
+    bool rejectWhileLoopback(int len);
+
+    // Time spent moving data, for SPP_CPU_US
+    static void cpuTime(int64_t startUs);
+
+private:
+    volatile int highPercent = RX_HIGH_WATER_PERCENT;
+    volatile int lowPercent = RX_LOW_WATER_PERCENT;
+    std::atomic<bool> throttled{false};
+    int64_t throttledSinceUs = 0;
+    struct Arrival {
+        std::atomic<uint32_t> end;      // In bytes received, so it wraps with them
+        uint32_t us;
+    };
+    Arrival arrivals[RX_ARRIVALS];
+    std::atomic<uint32_t> arrivalHead{0};   // Counts, only taken modulo RX_ARRIVALS
+    std::atomic<uint32_t> arrivalTail{0};
+    uint32_t receivedBytes = 0;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include <SPPVfsTransport.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include <esp_timer.h>
+#include "esp_log.h"
+#include <sys/select.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#define BT_SPP_TAG "BT_SPP"
+
+SPPVfsTransport::SPPVfsTransport(QueueHandle_t recvQueue, esp_err_t &err, const char *&errMsg) :
+    SPPTransport(recvQueue, err, errMsg)
+{
+}
+
+bool SPPVfsTransport::inited() {
+    if ((err = esp_spp_vfs_register()) != ESP_OK) {
+        errMsg = "Failed to register SPP VFS";
+        ESP_LOGE(BT_SPP_TAG, "%s: %s", errMsg, esp_err_to_name(err));
+        return false;
+    }
+
+    return true;
+}
+
+void SPPVfsTransport::opened(uint32_t handle, int _fd) {
+    fd.store(_fd, std::memory_order_release);
+    if (readerTask == nullptr) {
+        xTaskCreate(readerTaskFn, "SPP VFS reader", 4096, this, tskIDLE_PRIORITY + 2, &readerTask);
+    } else {
+        xTaskNotifyGive(readerTask);
+    }
+}
+
+void SPPVfsTransport::closed() {
+    // The reader sees this the next time select() returns
+    fd.store(-1, std::memory_order_release);
+}
+
+bool SPPVfsTransport::writeAll(int fd, const uint8_t *data, int len) {
+    int64_t giveUpUs = esp_timer_get_time() + VFS_WRITE_TIMEOUT_MS * 1000LL;
+    bool congested = false;
+
+    while (len > 0) {
+        int64_t startUs = esp_timer_get_time();
+        int n = ::write(fd, data, len);
+        cpuTime(startUs);
+        if (n > 0) {
+            data += n;
+            len -= n;
+            congested = false;
+        } else if (n < 0 && errno != EAGAIN) {
+            return false;
+        } else if (esp_timer_get_time() > giveUpUs) {
+            errno = ETIMEDOUT;
+            return false;
+        } else {
+            // The stack's buffer is full. Count it once per wait, as ESP_SPP_CONG_EVT would.
+            if (!congested) {
+                congested = true;
+                BridgeStats::add(BridgeStats::CONGESTION_EVENTS);
+                Trace::record(Trace::SPP_CONG, 1);
+            }
+            vTaskDelay(1);
+        }
+    }
+
+    return true;
+}
+
+bool SPPVfsTransport::write(const uint8_t *pBuf, int len) {
+    if (len > 0) {
+        int current = fd.load(std::memory_order_acquire);
+
+        if (rejectWhileLoopback(len)) {
+            return true;
+        } else if (current < 0) {
+            err = ESP_ERR_INVALID_STATE;
+            errMsg = esp_err_to_name(err);
+        } else {
+            Trace::record(Trace::SPP_WRITE, len, current);
+            if (writeAll(current, pBuf, len)) {
+                err = ESP_OK;
+                BridgeStats::add(BridgeStats::TX_PACKETS);
+                BridgeStats::add(BridgeStats::TX_BYTES, len);
+            } else {
+                err = ESP_FAIL;
+                errMsg = strerror(errno);
+                BridgeStats::add(BridgeStats::TX_ERRORS);
+                Trace::record(Trace::SPP_WRITE_FAIL, errno);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool SPPVfsTransport::setLoopback(bool on) {
+    // Writes are synchronous, so there is never one in flight to wait for
+    loopbackOn.store(on, std::memory_order_release);
+
+    return true;
+}
+
+void SPPVfsTransport::reader() {
+    while (true) {
+        int current = fd.load(std::memory_order_acquire);
+        if (current < 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // Leave it with the stack until the receive queue has drained. The
+        // stack then holds back the peer's credits.
+        checkWatermarks();
+        int room = uxQueueSpacesAvailable(recvQueue);
+        if (!loopbackOn.load(std::memory_order_acquire) && (rxThrottled() || room == 0)) {
+            vTaskDelay(1);
+            continue;
+        }
+
+        fd_set readable;
+        struct timeval timeout = {0, 100000};
+        FD_ZERO(&readable);
+        FD_SET(current, &readable);
+        int ready = select(current + 1, &readable, NULL, NULL, &timeout);
+        if (ready == 0) {
+            continue;
+        } else if (ready < 0) {
+            // Older stacks can't select on SPP, so poll instead
+            vTaskDelay(1);
+        }
+
+        int64_t startUs = esp_timer_get_time();
+        int n = ::read(current, readBuf, loopbackOn.load(std::memory_order_acquire) || room > VFS_READ_SIZE ? VFS_READ_SIZE : room);
+        if (n > 0) {
+            if (!loopbackOn.load(std::memory_order_acquire)) {
+                received(readBuf, n, startUs);
+            } else {
+                BridgeStats::add(BridgeStats::RX_PACKETS);
+                BridgeStats::add(BridgeStats::RX_BYTES, n);
+                Trace::record(Trace::SPP_LOOPBACK_WRITE, n, 0);
+                cpuTime(startUs);
+                if (writeAll(current, readBuf, n)) {
+                    BridgeStats::add(BridgeStats::LOOPBACK_BYTES, n);
+                } else {
+                    BridgeStats::add(BridgeStats::LOOPBACK_DROPS, n);
+                    Trace::record(Trace::SPP_LOOPBACK_DROP, n);
+                }
+                continue;
+            }
+        } else if (n < 0 && errno != EAGAIN) {
+            // The link is going. Wait for ESP_SPP_CLOSE_EVT rather than spin.
+            fd.compare_exchange_strong(current, -1);
+        }
+        cpuTime(startUs);
+    }
+}
+
+void SPPVfsTransport::readerTaskFn(void *self) {
+    ((SPPVfsTransport*)self)->reader();
+}
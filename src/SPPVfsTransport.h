@@ -0,0 +1,42 @@
+#ifndef SPP_VFS_TRANSPORT_H
+#define SPP_VFS_TRANSPORT_H
+
+#include <SPPTransport.h>
+#include "freertos/task.h"
+
+#define VFS_READ_SIZE SPP_MAX_BLOCK
+#define VFS_WRITE_TIMEOUT_MS 2000
+
+/*
+ * ESP_SPP_MODE_VFS. The stack buffers received data behind the connection's
+ * file descriptor and a reader task moves it into the receive queue, so the
+ * Bluetooth task does no copying of its own. Writes block the caller until
+ * the stack has taken all of the data.
+ */
+class SPPVfsTransport : public SPPTransport {
+public:
+    SPPVfsTransport(QueueHandle_t recvQueue, esp_err_t &err, const char *&errMsg);
+
+    esp_spp_mode_t mode() override { return ESP_SPP_MODE_VFS; }
+    const char *name() override { return "VFS"; }
+
+    bool inited() override;
+    void opened(uint32_t handle, int fd) override;
+    void closed() override;
+
+    bool write(const uint8_t *pBuf, int len) override;
+    bool setLoopback(bool on) override;
+
+private:
+    std::atomic<int> fd{-1};
+    TaskHandle_t readerTask = nullptr;
+    uint8_t readBuf[VFS_READ_SIZE];
+
+    // All of it, or false with errno set once the link is gone or stays full
+    static bool writeAll(int fd, const uint8_t *data, int len);
+
+    void reader();
+    static void readerTaskFn(void *self);
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include <SPSCRing.h>
+#include <string.h>
+
+SPSCRing::SPSCRing(size_t capacity) {
+    size_t rounded = 16;
+
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+    buf = new uint8_t[rounded];
+    mask = rounded - 1;
+}
+
+SPSCRing::~SPSCRing() {
+    delete[] buf;
+}
+
+size_t SPSCRing::write(const uint8_t *data, size_t len) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t free = capacity() - (h - tail.load(std::memory_order_acquire));
+    size_t n = len < free ? len : free;
+    size_t offset = h & mask;
+    size_t first = n < capacity() - offset ? n : capacity() - offset;
+
+    memcpy(&buf[offset], data, first);
+    memcpy(buf, &data[first], n - first);
+    head.store(h + n, std::memory_order_release);
+
+    return n;
+}
+
+size_t SPSCRing::read(uint8_t *data, size_t len) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t used = head.load(std::memory_order_acquire) - t;
+    size_t n = len < used ? len : used;
+    size_t offset = t & mask;
+    size_t first = n < capacity() - offset ? n : capacity() - offset;
+
+    memcpy(data, &buf[offset], first);
+    memcpy(&data[first], buf, n - first);
+    tail.store(t + n, std::memory_order_release);
+
+    return n;
+}
+
+size_t SPSCRing::peek(const uint8_t **data) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t used = head.load(std::memory_order_acquire) - t;
+    size_t offset = t & mask;
+
+    *data = &buf[offset];
+
+    return used < capacity() - offset ? used : capacity() - offset;
+}
+
+void SPSCRing::consume(size_t len) {
+    tail.store(tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
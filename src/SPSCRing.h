@@ -0,0 +1,44 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * Byte ring between exactly one producer task and one consumer task, which
+ * may run on different cores. There are no locks: only the producer moves
+ * head and only the consumer moves tail, and each publishes its side with
+ * release ordering after touching the data. Positions run freely and are
+ * masked on use, so the capacity is rounded up to a power of two.
+ */
+class SPSCRing {
+public:
+    SPSCRing(size_t capacity);
+    ~SPSCRing();
+
+    size_t capacity() const { return mask + 1; }
+
+    // Safe from either side, but only a snapshot
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    size_t space() const { return capacity() - size(); }
+
+    // Producer. Takes as much as fits and returns how much that was.
+    size_t write(const uint8_t *data, size_t len);
+
+    // Consumer
+    size_t read(uint8_t *data, size_t len);
+    // The contiguous run at the tail, left in place until consume()
+    size_t peek(const uint8_t **data);
+    void consume(size_t len);
+
+private:
+    uint8_t *buf;
+    size_t mask;
+    std::atomic<size_t> head{0};    // Next byte to write
+    std::atomic<size_t> tail{0};    // Next byte to read
+};
+
+#endif
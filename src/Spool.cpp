@@ -0,0 +1,286 @@
+#include <Spool.h>
+#include <BridgeStats.h>
+#include <Trace.h>
+#include "esp_log.h"
+
+#define SPOOL_TAG "SPOOL"
+
+Spool::Spool(size_t ramBytes, uint32_t _flashLimit) : ram(ramBytes), flashLimit(_flashLimit) {
+    setFlashLimit(_flashLimit);
+}
+
+void Spool::begin() {
+    if (!LittleFS.begin(true)) {
+        ESP_LOGE(SPOOL_TAG, "LittleFS mount failed, spooling to RAM only");
+        return;
+    }
+    mounted = true;
+    LittleFS.mkdir(SPOOL_DIR);
+
+    // Pick up whatever was left from before a restart
+    File dir = LittleFS.open(SPOOL_DIR);
+    bool found = false;
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+        uint32_t segment = strtoul(file.name(), NULL, 16);
+        if (!found || segment < firstSegment) {
+            firstSegment = segment;
+        }
+        if (!found || segment >= nextSegment) {
+            nextSegment = segment + 1;
+        }
+        found = true;
+        flashUsed += file.size();
+        flashBytes += file.size();
+    }
+    if (flashBytes > 0) {
+        ESP_LOGI(SPOOL_TAG, "%u bytes left in %u segments", flashBytes, nextSegment - firstSegment);
+    }
+}
+
+void Spool::setEnabled(bool on) {
+    // Whatever is stored still goes out; only new data is no longer kept
+    this->on = on;
+}
+
+void Spool::setFlashLimit(uint32_t bytes) {
+    // Room for the segment being read and the one being written
+    flashLimit = bytes == 0 || bytes >= 2 * SPOOL_SEGMENT_BYTES ? bytes : 2 * SPOOL_SEGMENT_BYTES;
+}
+
+void Spool::segmentPath(uint32_t segment, char *path) {
+    sprintf(path, SPOOL_DIR "/%08x", segment);
+}
+
+bool Spool::store(const uint8_t *data, int len) {
+    if (!on || len <= 0 || len >= MAX_STRING_LENGTH) {
+        return false;
+    }
+
+    // Only to RAM while nothing is on flash, or it would overtake it
+    if (flashBytes == 0 && ram.space() >= (size_t)len + 1) {
+        return storeInRam(data, len);
+    }
+
+    if (!mounted || flashLimit == 0) {
+        if (policy == DROP_NEWEST) {
+            dropped(len);
+            return false;
+        }
+        while (ram.space() < (size_t)len + 1) {
+            dropRamRecord();
+        }
+        return storeInRam(data, len);
+    }
+
+    return storeInFlash(data, len);
+}
+
+bool Spool::storeInRam(const uint8_t *data, int len) {
+    uint8_t header = len;
+
+    ram.write(&header, 1);
+    ram.write(data, len);
+    BridgeStats::add(BridgeStats::SPOOLED_BYTES, len);
+
+    return true;
+}
+
+bool Spool::storeInFlash(const uint8_t *data, int len) {
+    uint8_t header = len;
+    char path[32];
+
+    while (flashUsed + len + 1 > flashLimit) {
+        if (policy == DROP_NEWEST || firstSegment == nextSegment) {
+            dropped(len);
+            return false;
+        }
+        dropOldestSegment();
+    }
+
+    if (writeFile && writeFile.size() >= SPOOL_SEGMENT_BYTES) {
+        writeFile.close();
+    }
+    if (!writeFile) {
+        segmentPath(nextSegment, path);
+        if (!(writeFile = LittleFS.open(path, FILE_APPEND))) {
+            ESP_LOGE(SPOOL_TAG, "Can't create %s", path);
+            dropped(len);
+            return false;
+        }
+        nextSegment++;
+    }
+
+    size_t written = writeFile.write(&header, 1);
+    written += written == 1 ? writeFile.write(data, len) : 0;
+    if (written != (size_t)len + 1) {
+        // Flash is full. What did get written is counted, and skipped by
+        // readFlash() as a short record at the end of the segment.
+        ESP_LOGE(SPOOL_TAG, "Write failed");
+        writeFile.close();
+        flashUsed += written;
+        flashBytes += written;
+        dropped(len);
+        return false;
+    }
+    flashUsed += len + 1;
+    flashBytes += len + 1;
+    BridgeStats::add(BridgeStats::SPOOLED_BYTES, len);
+    BridgeStats::add(BridgeStats::SPOOL_FLASH_BYTES, len + 1);
+
+    return true;
+}
+
+int Spool::front(const uint8_t **data) {
+    if (recordLen == 0 && !readRam()) {
+        readFlash();
+    }
+    *data = record;
+
+    return recordLen;
+}
+
+void Spool::pop() {
+    BridgeStats::add(BridgeStats::SPOOL_REPLAYED_BYTES, recordLen);
+    recordLen = 0;
+}
+
+bool Spool::readRam() {
+    uint8_t header;
+
+    if (ram.read(&header, 1) != 1) {
+        return false;
+    }
+    recordLen = ram.read(record, header);
+
+    return true;
+}
+
+bool Spool::readFlash() {
+    char path[32];
+
+    while (flashBytes > 0) {
+        if (!readFile) {
+            if (firstSegment + 1 == nextSegment && writeFile) {
+                writeFile.close();      // Finished, so that it can be read; new data starts another one
+            }
+            segmentPath(firstSegment, path);
+            if (!(readFile = LittleFS.open(path, FILE_READ))) {
+                ESP_LOGE(SPOOL_TAG, "Can't open %s", path);
+                dropOldestSegment();
+                continue;
+            }
+        }
+
+        uint8_t header;
+        if (readFile.read(&header, 1) == 1) {
+            recordLen = readFile.read(record, header);
+            uint32_t got = 1 + recordLen;
+            flashBytes -= got < flashBytes ? got : flashBytes;
+            if (recordLen == header) {
+                return true;
+            }
+            recordLen = 0;      // From a write that failed, and was dropped then
+            continue;
+        }
+
+        // All read back
+        uint32_t size = readFile.size();
+        readFile.close();
+        segmentPath(firstSegment, path);
+        LittleFS.remove(path);
+        flashUsed -= size < flashUsed ? size : flashUsed;
+        firstSegment++;
+        if (firstSegment == nextSegment) {
+            flashUsed = flashBytes = 0;     // Any rounding errors go with the last one
+        }
+    }
+
+    return false;
+}
+
+void Spool::dropRamRecord() {
+    uint8_t header;
+    uint8_t skip[MAX_STRING_LENGTH];
+
+    if (ram.read(&header, 1) == 1) {
+        dropped(ram.read(skip, header));
+    }
+}
+
+uint32_t Spool::dataLeftIn(File &file) {
+    // Skips from header to header, so the stats count data and not headers
+    uint32_t data = 0;
+    uint8_t header;
+
+    while (file.read(&header, 1) == 1 && file.position() + header <= file.size() && file.seek(file.position() + header)) {
+        data += header;
+    }
+
+    return data;
+}
+
+void Spool::dropOldestSegment() {
+    char path[32];
+    uint32_t size = 0;
+    uint32_t unread = 0;
+    uint32_t data = 0;
+
+    segmentPath(firstSegment, path);
+    if (readFile) {
+        size = readFile.size();
+        unread = size - readFile.position();
+        data = dataLeftIn(readFile);
+        readFile.close();
+    } else {
+        if (firstSegment + 1 == nextSegment && writeFile) {
+            writeFile.close();
+        }
+        File file = LittleFS.open(path, FILE_READ);
+        if (file) {
+            size = unread = file.size();
+            data = dataLeftIn(file);
+        }
+    }
+    LittleFS.remove(path);
+    firstSegment++;
+
+    flashUsed -= size < flashUsed ? size : flashUsed;
+    flashBytes -= unread < flashBytes ? unread : flashBytes;
+    if (firstSegment == nextSegment) {
+        flashUsed = flashBytes = 0;
+    }
+    dropped(data);
+    Trace::record(Trace::SPOOL_DROP_SEGMENT, firstSegment - 1, data);
+}
+
+void Spool::dropped(int len) {
+    BridgeStats::add(BridgeStats::SPOOL_DROPPED_BYTES, len);
+}
+
+void Spool::clear() {
+    char path[32];
+
+    readFile.close();
+    writeFile.close();
+    for (; firstSegment < nextSegment; firstSegment++) {
+        segmentPath(firstSegment, path);
+        LittleFS.remove(path);
+    }
+    while (ram.size() > 0) {
+        uint8_t skip[64];
+        ram.read(skip, sizeof(skip));
+    }
+    recordLen = 0;
+    flashUsed = flashBytes = 0;
+}
+
+void Spool::report(Print &out) {
+    out.printf("ENABLED=%d\r\n", on ? 1 : 0);
+    out.printf("POLICY=%s\r\n", policy == DROP_OLDEST ? "OLDEST" : "NEWEST");
+    out.printf("RAM_BYTES=%u\r\n", (uint32_t)ram.size());
+    out.printf("RAM_SIZE=%u\r\n", (uint32_t)ram.capacity());
+    out.printf("FLASH_BYTES=%u\r\n", flashBytes);
+    out.printf("FLASH_USED=%u\r\n", flashUsed);
+    out.printf("FLASH_LIMIT=%u\r\n", mounted ? flashLimit : 0);
+    out.printf("SEGMENTS=%u\r\n", nextSegment - firstSegment);
+}
@@ -0,0 +1,86 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <SPSCRing.h>
+#include <SPPTransport.h>
+
+#define SPOOL_DIR "/spool"
+#define SPOOL_SEGMENT_BYTES 16384
+
+/*
+ * Store and forward for data from the host while there is no link. Writes
+ * are kept as records (a length byte, then the data) in a RAM ring, and once
+ * that is full they spill to append-only segment files on LittleFS. They come
+ * back out oldest first: the RAM ring holds the oldest records and, while
+ * anything is on flash, new records go to flash behind them.
+ *
+ * Segments are deleted once read back, or, with DROP_OLDEST, when the flash
+ * limit is reached. Segments left from before a restart are picked up again
+ * by begin() and sent from the start, so a restart during replay sends some
+ * of it twice rather than losing it.
+ *
+ * Only the radio stage uses it.
+ */
+class Spool {
+public:
+    typedef enum {
+        DROP_OLDEST = 0,    // Make room by deleting the oldest segment
+        DROP_NEWEST,        // Refuse new data
+    } Policy;
+
+    Spool(size_t ramBytes, uint32_t flashLimit);
+
+    // Mounts LittleFS. Without it, only the RAM ring is used.
+    void begin();
+
+    void setEnabled(bool on);
+    bool enabled() { return on; }
+    void setFlashLimit(uint32_t bytes);     // 0 keeps everything in RAM
+    void setPolicy(Policy policy) { this->policy = policy; }
+
+    bool empty() { return recordLen == 0 && ram.size() == 0 && flashBytes == 0; }
+
+    // False if the policy dropped it
+    bool store(const uint8_t *data, int len);
+
+    // The oldest record, which stays there until pop(). 0 if there is none.
+    int front(const uint8_t **data);
+    void pop();
+
+    void clear();
+
+    // NAME=value lines, as AT+STATS does
+    void report(Print &out);
+
+private:
+    SPSCRing ram;
+    bool on = true;
+    bool mounted = false;
+    Policy policy = DROP_OLDEST;
+    uint32_t flashLimit;
+
+    // Segments firstSegment up to, but not including, nextSegment exist
+    uint32_t firstSegment = 0;
+    uint32_t nextSegment = 0;
+    File writeFile;                 // Open on nextSegment - 1 while it is being added to
+    File readFile;                  // Open on firstSegment while it is being read back
+    uint32_t flashUsed = 0;         // Size of all segments
+    uint32_t flashBytes = 0;        // Of that, not read back yet
+
+    uint8_t record[MAX_STRING_LENGTH];
+    int recordLen = 0;              // The record front() returned, until pop()
+
+    void segmentPath(uint32_t segment, char *path);
+    bool storeInRam(const uint8_t *data, int len);
+    bool storeInFlash(const uint8_t *data, int len);
+    bool readRam();
+    bool readFlash();
+    void dropRamRecord();
+    uint32_t dataLeftIn(File &file);
+    void dropOldestSegment();
+    void dropped(int len);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include <Trace.h>
+#include <esp_timer.h>
+
+Trace::Entry Trace::entries[TRACE_ENTRIES];
+std::atomic<uint32_t> Trace::head(0);
+volatile bool Trace::enabled = true;
+
+void Trace::record(Event event, uint16_t a, uint32_t b) {
+    if (enabled) {
+        // Claiming a slot is the only shared step, so the callbacks and the
+        // SPP task can record concurrently without a lock.
+        Entry &entry = entries[head.fetch_add(1, std::memory_order_relaxed) & (TRACE_ENTRIES - 1)];
+        entry.timestamp = (uint32_t)esp_timer_get_time();
+        entry.event = event;
+        entry.a = a;
+        entry.b = b;
+    }
+}
+
+void Trace::clear() {
+    memset(entries, 0, sizeof(entries));
+    head.store(0, std::memory_order_relaxed);
+}
+
+void Trace::dump(Print &out) {
+    uint32_t end = head.load(std::memory_order_relaxed);
+    uint32_t start = end > TRACE_ENTRIES ? end - TRACE_ENTRIES : 0;
+
+    for (uint32_t i = start; i < end; i++) {
+        const Entry &entry = entries[i & (TRACE_ENTRIES - 1)];
+        out.printf("%08x%04x%04x%08x\r\n", entry.timestamp, entry.event, entry.a, entry.b);
+    }
+}
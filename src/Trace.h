@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define TRACE_ENTRIES 256   // Must be a power of 2
+
+/*
+ * Binary event trace. Recording an event stores a timestamp, an event id and two
+ * integer arguments in a ring buffer, with no formatting, so it is cheap enough
+ * to leave on in the data path. AT+TRACE dumps the ring, tools/trace_decode.py
+ * turns the dump back into readable text.
+ *
+ * Event ids are part of the dump format - only ever add to the end of this list,
+ * and keep the decoder in step.
+ */
+class Trace {
+public:
+    typedef enum : uint16_t {
+        NONE = 0,
+        SPP_INIT,               // a = status
+        SPP_DISCOVERY_COMP,     // a = status, b = number of SCNs
+        SPP_OPEN,               // a = status, b = handle
+        SPP_CLOSE,              // a = status, b = closed by remote
+        SPP_CL_INIT,            // a = status, b = handle
+        SPP_DATA_IND,           // a = length, b = bytes waiting in the receive buffer
+        SPP_RX_DROP,            // a = bytes dropped
+        SPP_WRITE,              // a = length, b = handle
+        SPP_WRITE_EVT,          // a = length written, b = congested
+        SPP_WRITE_FAIL,         // a = status
+        SPP_WRITE_REJECT,       // a = length
+        SPP_CONG,               // a = congested
+        SPP_WRITE_REMAINDER,    // a = length
+        GAP_DISC_RES,           // a = number of properties
+        GAP_DISC_STATE,         // a = state
+        GAP_AUTH_CMPL,          // a = status
+        GAP_PIN_REQ,            // a = min_16_digit
+        GAP_MODE_CHG,           // a = mode
+        GAP_ACL_CONN,
+        GAP_ACL_DISCONN,
+        SERVER_STATE,           // a = new state, b = old state
+        SERVER_RX,              // a = length
+        SERVER_TX,              // a = length, b = result
+        SPP_LOOPBACK_WRITE,     // a = length, b = bytes waiting to be reflected
+        SPP_LOOPBACK_DROP,      // a = bytes dropped
+        SPOOL_DROP_SEGMENT,     // a = segment, b = bytes in it not sent yet
+        SPP_RX_THROTTLE,        // a = throttled, b = bytes buffered
+        LINK_CODEC_CONTROL,     // a = 'H' (HELLO) or 'S' (START), b = 1 if received
+        LINK_CODEC_ERROR,       // a = frame type, b = frame length
+        RELIABLE_RETRANSMIT,    // a = sequence number, b = 1 for a gap or reconnect, 0 for a timeout
+        RELIABLE_SESSION,       // a = the peer's session, b = its first sequence number
+        GAP_QOS_CMPL,           // a = status, b = poll interval in slots
+        NUM_EVENTS
+    } Event;
+
+    typedef struct {
+        uint32_t timestamp;     // Low 32 bits of esp_timer_get_time()
+        uint16_t event;
+        uint16_t a;
+        uint32_t b;
+    } Entry;
+
+    static void record(Event event, uint16_t a = 0, uint32_t b = 0);
+
+    static void setEnabled(bool enabled) { Trace::enabled = enabled; }
+
+    static void clear();
+
+    // Oldest first, one line of 24 hex digits per entry:
+    // <timestamp:8><event:4><a:4><b:8>
+    static void dump(Print &out);
+
+private:
+    static Entry entries[TRACE_ENTRIES];
+    static std::atomic<uint32_t> head;
+    static volatile bool enabled;
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "BTSPPServer.h"
+#include "ConfigCommitter.h"
+#include "BootProfiler.h"
 #include <ConfigItem.h>
 #include <EEPROMConfig.h>
 
@@ -44,6 +46,12 @@ void ConfigItem<T>::debug(Print *debugPrint) const {
 }
 template void ConfigItem<uint64_t>::debug(Print *debugPrint) const;
 
+// Leave a new firmware on probation instead of having the core accept it at
+// once. The server keeps it when Bluetooth comes up (see OtaUpdate::confirm()).
+bool verifyRollbackLater() {
+	return true;
+}
+
 #define RXD 17
 #define TXD 16
 #define COMMAND_PIN 18
@@ -51,14 +59,32 @@ template void ConfigItem<uint64_t>::debug(Print *debugPrint) const;
 
 #define MAX_NAME_LEN 63
 
+// Where the two stages of the bridge run. The radio stage shares core 0 with
+// the controller and Bluedroid, the UART stage has core 1 to itself. Any of
+// these can be overridden with build flags.
+#ifndef RADIO_TASK_CORE
+#define RADIO_TASK_CORE 0
+#endif
+#ifndef RADIO_TASK_PRIORITY
+#define RADIO_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#endif
+#ifndef UART_TASK_CORE
+#define UART_TASK_CORE 1
+#endif
+#ifndef UART_TASK_PRIORITY
+#define UART_TASK_PRIORITY (tskIDLE_PRIORITY + 2)	/* Keeps up with the UART FIFO */
+#endif
+
 StringConfigItem serverName("server_name", MAX_NAME_LEN, "timefliesbridge");
 StringConfigItem clientName("client_name", MAX_NAME_LEN, "Time Flies");
 LongConfigItem clientAddress("address", 0);
+StringConfigItem pins("pins", BTGAP_PINS_STRING_LEN - 1, "");	// AT+PIN. Link keys are in the stack's own NVS.
 
 BTSPPServer btSPPServer(serverName.toString().c_str(), Serial1);
 
 TaskHandle_t commitEEPROMTask;
 TaskHandle_t sppTask;
+TaskHandle_t uartTask;
 
 QueueHandle_t sppQueue;
 
@@ -67,6 +93,7 @@ BaseConfigItem* configSetGlobal[] = {
 	&serverName,
 	&clientName,
     &clientAddress,
+	&pins,
 	0
 };
 
@@ -81,12 +108,20 @@ CompositeConfigItem rootConfig("root", 0, rootConfigSet);
 
 EEPROMConfig config(rootConfig);
 
+ConfigCommitter committer(config);
+
 void sppTaskFn(void *pArg) {
 	while(true) {
 		btSPPServer.loop();
 	}
 }
 
+void uartTaskFn(void *pArg) {
+	while(true) {
+		btSPPServer.uartLoop();
+	}
+}
+
 void initFromEEPROM() {
 //	config.setDebugPrint(debugPrint);
 	config.init();
@@ -97,32 +132,66 @@ void initFromEEPROM() {
 }
 
 void setup() {
+	BootProfiler::mark(BootProfiler::SETUP_START);
+
     Serial.begin(115200);
     Serial.setDebugOutput(true);
 
-	EEPROM.begin(2048);
-	initFromEEPROM();
-
-	btSPPServer.setClientAddressCallback([](long address) { clientAddress = address; clientAddress.put(); config.commit(); });
-	btSPPServer.setServerNameCallback([](const char *name) { serverName = name; serverName.put(); config.commit(); });
-	btSPPServer.setClientNameCallback([](const char *name) { clientName = name; clientName.put(); config.commit(); });
-	
-	btSPPServer.setClientAddress(clientAddress);
-	btSPPServer.setServerName(serverName.value.c_str());
-	btSPPServer.setClientName(clientName.value.c_str());
-
 	btSPPServer.setCommandPin(COMMAND_PIN);
 	btSPPServer.setConnectedPin(CONNECTED_PIN);
-	
+	btSPPServer.setConfigured(false);
+
 	btSPPServer.start(38400, SERIAL_8N1, RXD, TXD);
 
+	// Start the SPP task first so that the controller and bluedroid come up
+	// while we are reading the config from EEPROM.
     xTaskCreatePinnedToCore(
         sppTaskFn,   /* Function to implement the task */
         "BT SPP task", /* Name of the task */
         8192,                 /* Stack size in words */
         NULL,                 /* Task input parameter */
-        tskIDLE_PRIORITY + 1,     /* More than background tasks */
+        RADIO_TASK_PRIORITY,
         &sppTask,    /* Task handle. */
+        RADIO_TASK_CORE);
+
+    xTaskCreatePinnedToCore(
+        uartTaskFn,
+        "UART task",
+        2048,
+        NULL,
+        UART_TASK_PRIORITY,
+        &uartTask,
+        UART_TASK_CORE);
+
+	EEPROM.begin(2048);
+	initFromEEPROM();
+	BootProfiler::mark(BootProfiler::CONFIG_LOADED);
+
+	committer.track(serverName);
+	committer.track(clientName);
+	committer.track(clientAddress);
+	committer.track(pins);
+
+	// These run on the SPP task, so only update RAM and let the commit task write flash
+	btSPPServer.setClientAddressCallback([](long address) { committer.set(clientAddress, (uint64_t)address); });
+	btSPPServer.setServerNameCallback([](const char *name) { committer.set(serverName, name); });
+	btSPPServer.setClientNameCallback([](const char *name) { committer.set(clientName, name); });
+	btSPPServer.setPinsCallback([](const char *value) { committer.set(pins, value); });
+	
+	btSPPServer.setClientAddress(clientAddress);
+	btSPPServer.setServerName(serverName.value.c_str());
+	btSPPServer.setClientName(clientName.value.c_str());
+	btSPPServer.setPins(pins.value.c_str());
+
+	btSPPServer.setConfigured(true);
+
+    xTaskCreatePinnedToCore(
+        ConfigCommitter::taskFn,
+        "Commit EEPROM task",
+        4096,
+        &committer,
+        RADIO_TASK_PRIORITY, /* Not above the radio stage, whose callbacks give it work */
+        &commitEEPROMTask,
         xPortGetCoreID());
 
     ESP_LOGD(SPP_SERVER_TAG, "setup() running on core %d", xPortGetCoreID());
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Compare two runs of the host benchmarks and flag regressions.
+
+Usage: bench_compare.py [--tolerance PCT] baseline.jsonl current.jsonl
+
+Cases are matched on bench, mix and len, so a run of the CB transport can be
+compared with one of the VFS transport as well as with an older build of
+the same one. sim_us_per_op and allocs_per_op are
+deterministic, so any increase is a regression. ns_per_byte depends on the
+machine and its load, so it only counts when it grows by more than the
+tolerance (default 10%). Exits with 1 if anything regressed.
+"""
+import json
+import sys
+
+EXACT = ["sim_us_per_op", "allocs_per_op", "alloc_bytes_per_op"]
+NOISY = ["ns_per_byte"]
+
+
+def load(path):
+    cases = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith("{"):
+                continue
+            case = json.loads(line)
+            cases[(case["bench"], case["mix"], case["len"])] = case
+    return cases
+
+
+def change(old, new):
+    if old == 0:
+        return 0.0 if new == 0 else float("inf")
+    return (new - old) * 100.0 / old
+
+
+def main(argv):
+    tolerance = 10.0
+    if len(argv) > 1 and argv[1] == "--tolerance":
+        tolerance = float(argv[2])
+        argv = argv[:1] + argv[3:]
+    if len(argv) != 3:
+        print(__doc__)
+        return 2
+
+    baseline = load(argv[1])
+    current = load(argv[2])
+    regressions = 0
+
+    transports = [sorted(set(case.get("transport", "CB") for case in cases.values()))
+                  for cases in (baseline, current)]
+    if transports[0] != transports[1]:
+        print("transport %s -> %s" % ("/".join(transports[0]), "/".join(transports[1])))
+
+    for key in sorted(current):
+        name = "%s/%s/%d" % key
+        if key not in baseline:
+            print("%-32s new" % name)
+            continue
+        old = baseline[key]
+        new = current[key]
+        notes = []
+        for metric in EXACT + NOISY:
+            pct = change(old[metric], new[metric])
+            regressed = new[metric] > old[metric] and (metric in EXACT or pct > tolerance)
+            if regressed:
+                regressions += 1
+            if regressed or abs(pct) > tolerance:
+                notes.append("%s %s -> %s (%+.1f%%)%s" % (metric, old[metric], new[metric], pct,
+                                                          " REGRESSION" if regressed else ""))
+        print("%-32s %s" % (name, "; ".join(notes) if notes else "ok"))
+
+    for key in sorted(set(baseline) - set(current)):
+        print("%-32s missing" % ("%s/%s/%d" % key))
+
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
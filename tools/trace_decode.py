@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Decode the output of AT+TRACE into readable text.
+
+Usage: trace_decode.py [file]    (reads stdin if no file is given)
+
+Each trace line is 24 hex digits: <timestamp:8><event:4><a:4><b:8>.
+Lines that aren't trace entries (e.g. the trailing OK) are ignored.
+The event list must match the Trace::Event enum in src/Trace.h.
+"""
+import re
+import sys
+
+EVENTS = [
+    ("NONE", None, None),
+    ("SPP_INIT", "status", None),
+    ("SPP_DISCOVERY_COMP", "status", "scn_num"),
+    ("SPP_OPEN", "status", "handle"),
+    ("SPP_CLOSE", "status", "by_remote"),
+    ("SPP_CL_INIT", "status", "handle"),
+    ("SPP_DATA_IND", "len", "waiting"),
+    ("SPP_RX_DROP", "dropped", None),
+    ("SPP_WRITE", "len", "handle"),
+    ("SPP_WRITE_EVT", "len", "cong"),
+    ("SPP_WRITE_FAIL", "status", None),
+    ("SPP_WRITE_REJECT", "len", None),
+    ("SPP_CONG", "cong", None),
+    ("SPP_WRITE_REMAINDER", "len", None),
+    ("GAP_DISC_RES", "num_prop", None),
+    ("GAP_DISC_STATE", "state", None),
+    ("GAP_AUTH_CMPL", "status", None),
+    ("GAP_PIN_REQ", "min_16_digit", None),
+    ("GAP_MODE_CHG", "mode", None),
+    ("GAP_ACL_CONN", None, None),
+    ("GAP_ACL_DISCONN", None, None),
+    ("SERVER_STATE", "state", "old"),
+    ("SERVER_RX", "len", None),
+    ("SERVER_TX", "len", "ok"),
+    ("SPP_LOOPBACK_WRITE", "len", "waiting"),
+    ("SPP_LOOPBACK_DROP", "dropped", None),
+    ("SPOOL_DROP_SEGMENT", "segment", "dropped"),
+    ("SPP_RX_THROTTLE", "on", "buffered"),
+    ("LINK_CODEC_CONTROL", "type", "received"),
+    ("LINK_CODEC_ERROR", "type", "len"),
+    ("RELIABLE_RETRANSMIT", "seq", "early"),
+    ("RELIABLE_SESSION", "session", "base"),
+    ("GAP_QOS_CMPL", "status", "t_poll"),
+]
+
+STATES = ["NOT_INITIALIZED", "NOT_CONNECTED", "SEARCHING", "CONNECTING", "CONNECTED", "DISCONNECTING"]
+
+LINE = re.compile(r"^([0-9a-fA-F]{8})([0-9a-fA-F]{4})([0-9a-fA-F]{4})([0-9a-fA-F]{8})$")
+
+
+def describe(event, a, b):
+    if event >= len(EVENTS):
+        return "EVENT_%d a=%d b=%d" % (event, a, b)
+
+    name, a_name, b_name = EVENTS[event]
+    if name == "SERVER_STATE":
+        state = STATES[a] if a < len(STATES) else str(a)
+        old = STATES[b] if b < len(STATES) else str(b)
+        return "%s %s -> %s" % (name, old, state)
+
+    text = name
+    if a_name:
+        text += " %s=%d" % (a_name, a)
+    if b_name:
+        text += " %s=%d" % (b_name, b)
+    return text
+
+
+def main():
+    src = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    first = None
+    prev = None
+    for raw in src:
+        m = LINE.match(raw.strip())
+        if not m:
+            continue
+        ts, event, a, b = (int(g, 16) for g in m.groups())
+        if event == 0:
+            continue
+        if first is None:
+            first = prev = ts
+        # Timestamps are the low 32 bits of a microsecond clock, so allow for wrap
+        delta = (ts - prev) & 0xffffffff
+        offset = (ts - first) & 0xffffffff
+        prev = ts
+        print("%12.6f %+10d us  %s" % (offset / 1e6, delta, describe(event, a, b)))
+
+
+if __name__ == "__main__":
+    main()